@@ -0,0 +1,539 @@
+// Sprite throughput benchmarks. CPU microbenchmarks run everywhere; the GPU
+// half renders headlessly, so it also runs on lavapipe in CI. Results are
+// written as JSON for comparing releases:
+//
+//   RetoccilusBench [--output results.json] [--frames 100]
+//                   [--sprites 10000,100000,1000000] [--cpu-only]
+//                   [--replay capture.rtsc]
+//
+// --replay plays a sprite capture (Rt2DSceneWidget::startCapture) back
+// headlessly at full speed in addition to the synthetic frames.
+//
+// The GPU used follows RETOCCILUS_DEVICE like the engine itself.
+
+#include "Core/SceneWidget/Rt2DSceneWidget/Rt2DSceneWidget.h"
+#include "Core/SceneWidget/Rt2DSceneWidget/SpriteBatch.h"
+#include "Core/SceneWidget/Rt2DSceneWidget/SpriteCapture.h"
+#include "Core/SceneWidget/Rt2DSceneWidget/SpriteRenderer.h"
+#include "Core/SceneWidget/Rt2DSceneWidget/SpriteTransformKernel.h"
+#include "Core/VulkanWrapper/VulkanWrapper.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace Retoccilus::Core;
+
+namespace {
+    using Clock = std::chrono::steady_clock;
+
+    // Fixed so that every run measures the same sprites
+    constexpr uint32_t kSeed = 0x5EED;
+
+    struct Options {
+        std::string         outputPath;
+        uint32_t            frames = 100;
+        std::vector<size_t> spriteCounts{10000, 100000, 1000000};
+        bool                gpu = true;
+        std::string         replayPath;
+        uint32_t            width = 1280;
+        uint32_t            height = 720;
+    };
+
+    struct Result {
+        std::string name;
+        std::string unit;
+        double      median;
+        double      best;
+        size_t      samples;
+        bool        lowerIsBetter;
+    };
+
+    struct Report {
+        std::vector<Result> results;
+        std::string         deviceName;
+        std::string         deviceType;
+        std::string         error;
+    };
+
+    double millisecondsSince(Clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    }
+
+    // Adds median and best of `samples` to the report
+    void addResult(Report &report, const std::string &name, const std::string &unit,
+                   std::vector<double> samples, bool lowerIsBetter = true) {
+        if (samples.empty())
+            return;
+
+        std::sort(samples.begin(), samples.end());
+        double median = samples[samples.size() / 2];
+        double best = lowerIsBetter ? samples.front() : samples.back();
+        report.results.push_back(Result{name, unit, median, best, samples.size(), lowerIsBetter});
+    }
+
+    template <typename Fn>
+    std::vector<double> measure(uint32_t warmup, uint32_t repetitions, Fn &&body) {
+        for (uint32_t i = 0; i < warmup; i++)
+            body();
+
+        std::vector<double> samples;
+        samples.reserve(repetitions);
+        for (uint32_t i = 0; i < repetitions; i++) {
+            auto start = Clock::now();
+            body();
+            samples.push_back(millisecondsSince(start));
+        }
+        return samples;
+    }
+
+    std::vector<double> scaled(std::vector<double> samples, double factor) {
+        for (double &sample : samples)
+            sample *= factor;
+        return samples;
+    }
+
+    struct SpriteSet {
+        std::vector<float> x, y, scaleX, scaleY, rotation, sinRotation, cosRotation;
+
+        SpriteSet(size_t count, uint32_t width, uint32_t height) {
+            std::mt19937                          rng(kSeed);
+            std::uniform_real_distribution<float> px(0.0f, static_cast<float>(width));
+            std::uniform_real_distribution<float> py(0.0f, static_cast<float>(height));
+            std::uniform_real_distribution<float> size(2.0f, 6.0f);
+            std::uniform_real_distribution<float> angle(0.0f, 360.0f);
+
+            for (size_t i = 0; i < count; i++) {
+                x.push_back(px(rng));
+                y.push_back(py(rng));
+                scaleX.push_back(size(rng));
+                scaleY.push_back(size(rng));
+                rotation.push_back(angle(rng));
+            }
+            sinRotation.resize(count);
+            cosRotation.resize(count);
+            computeSinCos(rotation.data(), count, sinRotation.data(), cosRotation.data());
+        }
+
+        SpriteTransformStreams streams(bool precomputed) const {
+            SpriteTransformStreams streams;
+            streams.x = x.data();
+            streams.y = y.data();
+            streams.scaleX = scaleX.data();
+            streams.scaleY = scaleY.data();
+            streams.rotation = rotation.data();
+            if (precomputed) {
+                streams.sinRotation = sinRotation.data();
+                streams.cosRotation = cosRotation.data();
+            }
+            return streams;
+        }
+    };
+
+    const char *simdName(SimdLevel level) {
+        switch (level) {
+        case SimdLevel::AVX2:
+            return "avx2";
+        case SimdLevel::SSE2:
+            return "sse2";
+        default:
+            return "scalar";
+        }
+    }
+
+    const char *deviceTypeName(VkPhysicalDeviceType type) {
+        switch (type) {
+        case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+            return "discrete";
+        case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+            return "integrated";
+        case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+            return "virtual";
+        case VK_PHYSICAL_DEVICE_TYPE_CPU:
+            return "cpu";
+        default:
+            return "other";
+        }
+    }
+
+    // Cost of the transform kernel per sprite, for every SIMD level the CPU
+    // supports
+    void benchTransform(Report &report) {
+        constexpr size_t            count = 1 << 20;
+        SpriteSet                   sprites(count, 1920, 1080);
+        std::vector<SpriteInstance> out(count);
+
+        SimdLevel original = activeSimdLevel();
+        for (SimdLevel level : {SimdLevel::Scalar, SimdLevel::SSE2, SimdLevel::AVX2}) {
+            if (level > supportedSimdLevel())
+                continue;
+            setSimdLevel(level);
+
+            for (bool precomputed : {false, true}) {
+                SpriteTransformStreams streams = sprites.streams(precomputed);
+                auto samples = measure(2, 15, [&]() {
+                    transformSprites(streams, count, 0, 0xFFFFFFFFu, out.data());
+                });
+                addResult(report,
+                          std::string("transform/") + simdName(level) +
+                              (precomputed ? "/sincos" : "/degrees"),
+                          "ns/sprite", scaled(samples, 1e6 / count));
+            }
+        }
+        setSimdLevel(original);
+    }
+
+    // renderSprites() appends and build() writes instances; the latter is
+    // reported as fill rate into ordinary host memory
+    void benchInstanceFill(Report &report) {
+        constexpr size_t            count = 1 << 20;
+        SpriteSet                   sprites(count, 1920, 1080);
+        SpriteTransformStreams      streams = sprites.streams(false);
+        std::vector<SpriteInstance> out(count);
+        SpriteBatcher               batcher;
+
+        std::vector<double> addSamples;
+        std::vector<double> buildSamples;
+        for (uint32_t i = 0; i < 17; i++) {
+            batcher.clear();
+            auto start = Clock::now();
+            batcher.add(streams, count);
+            double addMs = millisecondsSince(start);
+
+            start = Clock::now();
+            batcher.build(out.data());
+            double buildMs = millisecondsSince(start);
+
+            // The first two are warmup
+            if (i >= 2) {
+                addSamples.push_back(addMs * 1e6 / count);
+                buildSamples.push_back(count * sizeof(SpriteInstance) / (buildMs * 1e3));
+            }
+        }
+        batcher.clear();
+
+        addResult(report, "batcher/add", "ns/sprite", addSamples);
+        addResult(report, "batcher/build/host", "MB/s", buildSamples, false);
+    }
+
+    void benchUpload(VulkanWrapper &wrapper, Report &report) {
+        constexpr VkDeviceSize totalSize = 64ull * 1024 * 1024;
+        constexpr VkDeviceSize chunkSize = 4ull * 1024 * 1024;
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = totalSize;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        GpuAllocationCreateInfo allocInfo{};
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        allocInfo.dedicated = true;
+
+        VkBuffer      buffer = VK_NULL_HANDLE;
+        GpuAllocation memory;
+        wrapper.getAllocator().createBuffer(bufferInfo, allocInfo, buffer, memory);
+
+        std::vector<uint8_t> data(chunkSize);
+        for (size_t i = 0; i < data.size(); i++)
+            data[i] = static_cast<uint8_t>(i * 31);
+
+        StagingUploader &uploader = wrapper.getUploader();
+        auto             samples = measure(1, 5, [&]() {
+            for (VkDeviceSize offset = 0; offset < totalSize; offset += chunkSize) {
+                uploader.uploadBuffer(buffer, offset, data.data(), chunkSize);
+            }
+            uploader.wait(uploader.flush());
+        });
+
+        vkDeviceWaitIdle(wrapper.getDevice());
+        wrapper.getAllocator().destroyBuffer(buffer, memory);
+
+        for (double &sample : samples)
+            sample = totalSize / (sample * 1e3);
+        addResult(report, "upload/staging", "MB/s", samples, false);
+    }
+
+    // Instance writes into the per-frame arena, which is host-visible and
+    // often write-combined
+    void benchMappedFill(VulkanWrapper &wrapper, Report &report) {
+        constexpr size_t       count = 100000;
+        SpriteSet              sprites(count, 1920, 1080);
+        SpriteTransformStreams streams = sprites.streams(false);
+        SpriteBatcher          batcher;
+
+        // Safe while nothing is in flight; the next frame rewinds it anyway
+        vkDeviceWaitIdle(wrapper.getDevice());
+        FrameArena &arena = wrapper.getFrameArena();
+
+        std::vector<double> samples;
+        for (uint32_t i = 0; i < 17; i++) {
+            arena.reset(wrapper.getCurrentFrame());
+            FrameArena::Slice slice =
+                arena.allocate(count * sizeof(SpriteInstance), alignof(SpriteInstance));
+
+            batcher.clear();
+            batcher.add(streams, count);
+            auto start = Clock::now();
+            batcher.build(static_cast<SpriteInstance *>(slice.data));
+            double ms = millisecondsSince(start);
+
+            if (i >= 2)
+                samples.push_back(count * sizeof(SpriteInstance) / (ms * 1e3));
+        }
+        batcher.clear();
+        arena.reset(wrapper.getCurrentFrame());
+
+        addResult(report, "batcher/build/mapped", "MB/s", samples, false);
+    }
+
+    void benchFrames(VulkanWrapper &wrapper, SpriteRenderer &spriteRenderer,
+                     const Options &options, Report &report) {
+        SpriteBatcher batcher;
+        wrapper.setRecordCallback(
+            [&](VkCommandBuffer cmd) { spriteRenderer.record(cmd, batcher); });
+
+        FrameProfiler &profiler = wrapper.getProfiler();
+        profiler.setEnabled(true);
+        // Matches the wrapper's frame numbering, which profiles carry
+        uint64_t framesDrawn = 0;
+
+        for (size_t count : options.spriteCounts) {
+            SpriteSet              sprites(count, options.width, options.height);
+            SpriteTransformStreams streams = sprites.streams(false);
+
+            auto frame = [&]() {
+                batcher.add(streams, count);
+                wrapper.drawFrame();
+                framesDrawn++;
+            };
+
+            // Fill the pipeline so every measured frame waits on a real fence
+            for (uint32_t i = 0; i < wrapper.getMaxFramesInFlight() + 2; i++)
+                frame();
+
+            uint64_t            firstFrame = framesDrawn;
+            std::vector<double> cpuSamples;
+            auto                start = Clock::now();
+            for (uint32_t i = 0; i < options.frames; i++) {
+                auto frameStart = Clock::now();
+                frame();
+                cpuSamples.push_back(millisecondsSince(frameStart));
+            }
+            vkDeviceWaitIdle(wrapper.getDevice());
+            double totalMs = millisecondsSince(start);
+
+            std::string prefix = "frame/" + std::to_string(count);
+            addResult(report, prefix + "/fps", "frames/s", {options.frames * 1000.0 / totalMs},
+                      false);
+            addResult(report, prefix + "/cpu", "ms", cpuSamples);
+
+            std::vector<double> gpuSamples;
+            for (const FrameProfile &profile : profiler.getHistory()) {
+                if (profile.frameNumber >= firstFrame && !profile.gpuScopes.empty())
+                    gpuSamples.push_back(profile.gpuMs);
+            }
+            addResult(report, prefix + "/gpu", "ms", gpuSamples);
+        }
+
+        profiler.setEnabled(false);
+        wrapper.setRecordCallback(nullptr);
+    }
+
+    void benchGpu(const Options &options, Report &report) {
+        VulkanWrapper wrapper(options.width, options.height, "RetoccilusBench",
+                              WindowMode::Headless);
+        // Repeatable init: no layers, and no pipeline cache left by a previous run
+        wrapper.setValidationLayers({});
+        wrapper.setPipelineCachePath("");
+
+        auto start = Clock::now();
+        wrapper.initVulkan();
+        addResult(report, "init/total", "ms", {millisecondsSince(start)});
+        for (const auto &timing : wrapper.getInitTimings()) {
+            addResult(report, std::string("init/") + timing.stage, "ms", {timing.milliseconds});
+        }
+
+        const VkPhysicalDeviceProperties &properties =
+            wrapper.getDeviceCapabilities().properties;
+        report.deviceName = properties.deviceName;
+        report.deviceType = deviceTypeName(properties.deviceType);
+
+        {
+            SpriteRenderer spriteRenderer(wrapper);
+            start = Clock::now();
+            spriteRenderer.initialize();
+            addResult(report, "init/spritePipeline", "ms", {millisecondsSince(start)});
+
+            benchUpload(wrapper, report);
+            benchMappedFill(wrapper, report);
+            benchFrames(wrapper, spriteRenderer, options, report);
+
+            vkDeviceWaitIdle(wrapper.getDevice());
+        }
+        wrapper.cleanup();
+    }
+
+    // Replays a capture through a headless widget, one sample per frame
+    void benchReplay(const Options &options, Report &report) {
+        auto context = std::make_shared<RenderContext>(WindowMode::Headless);
+        context->setValidationLayers({});
+        context->setPipelineCachePath("");
+
+        Rt2DSceneWidget widget(context, options.width, options.height, "RetoccilusBench",
+                               WindowMode::Headless);
+        widget.initialize();
+
+        SpriteCaptureReader   reader(options.replayPath);
+        SpriteCaptureReplayer replayer(widget, reader);
+
+        std::vector<double> cpuSamples;
+        auto                start = Clock::now();
+        for (;;) {
+            auto frameStart = Clock::now();
+            if (!replayer.replayFrame())
+                break;
+            cpuSamples.push_back(millisecondsSince(frameStart));
+        }
+        double totalMs = millisecondsSince(start);
+
+        if (cpuSamples.empty())
+            return;
+        addResult(report, "replay/fps", "frames/s", {cpuSamples.size() * 1000.0 / totalMs},
+                  false);
+        addResult(report, "replay/cpu", "ms", cpuSamples);
+    }
+
+    void writeString(std::ostream &out, const std::string &text) {
+        out << '"';
+        for (char c : text) {
+            if (c == '"' || c == '\\')
+                out << '\\' << c;
+            else if (static_cast<unsigned char>(c) >= 0x20)
+                out << c;
+        }
+        out << '"';
+    }
+
+    void writeNumber(std::ostream &out, double value) {
+        if (std::isfinite(value))
+            out << value;
+        else
+            out << "null";
+    }
+
+    void writeReport(std::ostream &out, const Report &report) {
+        out << std::setprecision(6);
+        out << "{\n  \"benchmark\": \"RetoccilusBench\",\n  \"schemaVersion\": 1,\n";
+        out << "  \"simdLevel\": \"" << simdName(activeSimdLevel()) << "\",\n";
+
+        out << "  \"device\": ";
+        if (report.deviceName.empty()) {
+            out << "null";
+        } else {
+            out << "{\"name\": ";
+            writeString(out, report.deviceName);
+            out << ", \"type\": ";
+            writeString(out, report.deviceType);
+            out << "}";
+        }
+        out << ",\n";
+
+        if (!report.error.empty()) {
+            out << "  \"error\": ";
+            writeString(out, report.error);
+            out << ",\n";
+        }
+
+        out << "  \"results\": [";
+        for (size_t i = 0; i < report.results.size(); i++) {
+            const Result &result = report.results[i];
+            out << (i == 0 ? "\n" : ",\n") << "    {\"name\": ";
+            writeString(out, result.name);
+            out << ", \"unit\": ";
+            writeString(out, result.unit);
+            out << ", \"median\": ";
+            writeNumber(out, result.median);
+            out << ", \"best\": ";
+            writeNumber(out, result.best);
+            out << ", \"samples\": " << result.samples << ", \"lowerIsBetter\": "
+                << (result.lowerIsBetter ? "true" : "false") << "}";
+        }
+        out << "\n  ]\n}\n";
+    }
+
+    bool parseOptions(int argc, char **argv, Options &options) {
+        for (int i = 1; i < argc; i++) {
+            std::string arg = argv[i];
+            bool        hasValue = i + 1 < argc;
+
+            if (arg == "--output" && hasValue) {
+                options.outputPath = argv[++i];
+            } else if (arg == "--frames" && hasValue) {
+                options.frames = std::max(1, std::atoi(argv[++i]));
+            } else if (arg == "--sprites" && hasValue) {
+                options.spriteCounts.clear();
+                std::stringstream list(argv[++i]);
+                std::string       item;
+                while (std::getline(list, item, ',')) {
+                    size_t count = std::strtoull(item.c_str(), nullptr, 10);
+                    if (count > 0)
+                        options.spriteCounts.push_back(count);
+                }
+            } else if (arg == "--cpu-only") {
+                options.gpu = false;
+            } else if (arg == "--replay" && hasValue) {
+                options.replayPath = argv[++i];
+            } else {
+                std::cerr << "Usage: " << argv[0]
+                          << " [--output file] [--frames n] [--sprites a,b,...] [--cpu-only]"
+                             " [--replay capture]"
+                          << std::endl;
+                return false;
+            }
+        }
+        return true;
+    }
+} // namespace
+
+int main(int argc, char **argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options))
+        return EXIT_FAILURE;
+
+    Report report;
+    benchTransform(report);
+    benchInstanceFill(report);
+
+    if (options.gpu) {
+        try {
+            benchGpu(options, report);
+            if (!options.replayPath.empty())
+                benchReplay(options, report);
+        } catch (const std::exception &e) {
+            // CPU results are still worth keeping
+            report.error = e.what();
+            std::cerr << "GPU benchmarks failed: " << e.what() << std::endl;
+        }
+    }
+
+    if (options.outputPath.empty()) {
+        writeReport(std::cout, report);
+    } else {
+        std::ofstream file(options.outputPath);
+        if (!file) {
+            std::cerr << "Cannot write " << options.outputPath << std::endl;
+            return EXIT_FAILURE;
+        }
+        writeReport(file, report);
+    }
+
+    return report.error.empty() ? EXIT_SUCCESS : EXIT_FAILURE;
+}
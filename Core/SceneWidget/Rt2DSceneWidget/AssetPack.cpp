@@ -0,0 +1,282 @@
+#include "AssetPack.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr char kMagic[4] = {'R', 'T', 'P', 'K'};
+
+        uint32_t readPixel(const uint8_t *pixel) {
+            uint32_t value;
+            std::memcpy(&value, pixel, 4);
+            return value;
+        }
+
+        // See AssetPack::Encoding::RunLength
+        std::vector<uint8_t> encodeRunLength(const uint8_t *rgba, size_t pixels) {
+            std::vector<uint8_t> out;
+            size_t               i = 0;
+            while (i < pixels) {
+                size_t run = 1;
+                while (i + run < pixels && run < 129 &&
+                       readPixel(rgba + (i + run) * 4) == readPixel(rgba + i * 4))
+                    run++;
+
+                if (run >= 2) {
+                    out.push_back(static_cast<uint8_t>(run + 126));
+                    out.insert(out.end(), rgba + i * 4, rgba + i * 4 + 4);
+                    i += run;
+                    continue;
+                }
+
+                // Literals up to the next run of two
+                size_t literals = 1;
+                while (i + literals < pixels && literals < 128 &&
+                       !(i + literals + 1 < pixels &&
+                         readPixel(rgba + (i + literals) * 4) ==
+                             readPixel(rgba + (i + literals + 1) * 4)))
+                    literals++;
+
+                out.push_back(static_cast<uint8_t>(literals - 1));
+                out.insert(out.end(), rgba + i * 4, rgba + (i + literals) * 4);
+                i += literals;
+            }
+            return out;
+        }
+    } // namespace
+
+    AssetPack::AssetPack(const std::string &path) : path(path) {
+        map();
+
+        Header header;
+        if (size < sizeof(Header)) {
+            unmap();
+            throw std::runtime_error("Not an asset pack: " + path);
+        }
+        std::memcpy(&header, base, sizeof(Header));
+
+        if (std::memcmp(header.magic, kMagic, sizeof(kMagic)) != 0 ||
+            header.version != kVersion ||
+            header.entryCount > (size - sizeof(Header)) / sizeof(Entry)) {
+            unmap();
+            throw std::runtime_error("Not an asset pack: " + path);
+        }
+
+        entries.resize(header.entryCount);
+        std::memcpy(entries.data(), base + sizeof(Header), header.entryCount * sizeof(Entry));
+
+        for (const Entry &entry : entries) {
+            if (entry.offset > size || entry.size > size - entry.offset) {
+                unmap();
+                throw std::runtime_error("Asset pack entry out of bounds: " + path);
+            }
+        }
+    }
+
+    AssetPack::~AssetPack() {
+        unmap();
+    }
+
+    const AssetPack::Entry *AssetPack::find(const std::string &name) const {
+        return find(hashName(name));
+    }
+
+    const AssetPack::Entry *AssetPack::find(uint64_t nameHash) const {
+        auto it = std::lower_bound(
+            entries.begin(), entries.end(), nameHash,
+            [](const Entry &entry, uint64_t hash) { return entry.nameHash < hash; });
+        return it != entries.end() && it->nameHash == nameHash ? &*it : nullptr;
+    }
+
+    void AssetPack::prefetch(const Entry &entry) const {
+#ifdef _WIN32
+        WIN32_MEMORY_RANGE_ENTRY range{const_cast<uint8_t *>(getData(entry)),
+                                       static_cast<SIZE_T>(entry.size)};
+        PrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+#else
+        // madvise wants a page-aligned start
+        uintptr_t page = static_cast<uintptr_t>(sysconf(_SC_PAGESIZE));
+        uintptr_t start = reinterpret_cast<uintptr_t>(getData(entry)) & ~(page - 1);
+        uintptr_t end = reinterpret_cast<uintptr_t>(getData(entry)) + entry.size;
+        madvise(reinterpret_cast<void *>(start), end - start, MADV_WILLNEED);
+#endif
+    }
+
+    bool AssetPack::decode(const Entry &entry, uint8_t *rgba) const {
+        const uint8_t *src = getData(entry);
+        size_t         bytes = static_cast<size_t>(entry.width) * entry.height * 4;
+
+        if (entry.encoding == Encoding::Raw) {
+            if (entry.size != bytes)
+                return false;
+            std::memcpy(rgba, src, bytes);
+            return true;
+        }
+        if (entry.encoding != Encoding::RunLength)
+            return false;
+
+        const uint8_t *end = src + entry.size;
+        uint8_t       *dst = rgba;
+        uint8_t       *dstEnd = rgba + bytes;
+        while (src < end) {
+            uint8_t control = *src++;
+            if (control < 128) {
+                size_t length = (control + 1u) * 4u;
+                if (static_cast<size_t>(end - src) < length ||
+                    static_cast<size_t>(dstEnd - dst) < length)
+                    return false;
+                std::memcpy(dst, src, length);
+                src += length;
+                dst += length;
+            } else {
+                size_t count = control - 126u;
+                if (end - src < 4 || static_cast<size_t>(dstEnd - dst) < count * 4)
+                    return false;
+                for (size_t i = 0; i < count; i++, dst += 4)
+                    std::memcpy(dst, src, 4);
+                src += 4;
+            }
+        }
+        return dst == dstEnd;
+    }
+
+    uint64_t AssetPack::hashName(const std::string &name) {
+        uint64_t hash = 14695981039346656037ull;
+        for (char c : name) {
+            hash ^= static_cast<uint8_t>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    void AssetPack::write(const std::string &path, const std::vector<Image> &images) {
+        std::vector<Entry>                entries(images.size());
+        std::vector<std::vector<uint8_t>> encoded(images.size());
+
+        uint64_t offset = sizeof(Header) + images.size() * sizeof(Entry);
+        for (size_t i = 0; i < images.size(); i++) {
+            const Image   &image = images[i];
+            const uint8_t *rgba = static_cast<const uint8_t *>(image.rgba);
+            size_t         bytes = static_cast<size_t>(image.width) * image.height * 4;
+
+            Entry &entry = entries[i];
+            entry = Entry{hashName(image.name), offset, bytes, image.width, image.height,
+                          Encoding::Raw, 0};
+
+            std::vector<uint8_t> runs =
+                encodeRunLength(rgba, static_cast<size_t>(image.width) * image.height);
+            if (runs.size() < bytes) {
+                entry.encoding = Encoding::RunLength;
+                entry.size = runs.size();
+                encoded[i] = std::move(runs);
+            } else {
+                encoded[i].assign(rgba, rgba + bytes);
+            }
+            offset += entry.size;
+        }
+
+        // The table is sorted for find(); payloads stay in input order
+        std::vector<Entry> table = entries;
+        std::sort(table.begin(), table.end(), [](const Entry &a, const Entry &b) {
+            return a.nameHash < b.nameHash;
+        });
+        for (size_t i = 1; i < table.size(); i++) {
+            if (table[i].nameHash == table[i - 1].nameHash)
+                throw std::runtime_error("Asset pack has two entries of the same name");
+        }
+
+        Header header{};
+        std::memcpy(header.magic, kMagic, sizeof(kMagic));
+        header.version = kVersion;
+        header.entryCount = static_cast<uint32_t>(table.size());
+
+        std::ofstream file(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            throw std::runtime_error("Failed to write asset pack: " + path);
+        }
+        file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+        file.write(reinterpret_cast<const char *>(table.data()), table.size() * sizeof(Entry));
+        for (const std::vector<uint8_t> &payload : encoded)
+            file.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+        if (!file) {
+            throw std::runtime_error("Failed to write asset pack: " + path);
+        }
+    }
+
+    void AssetPack::map() {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE)
+            file = nullptr;
+        LARGE_INTEGER fileSize;
+        if (!file || !GetFileSizeEx(file, &fileSize)) {
+            unmap();
+            throw std::runtime_error("Failed to open asset pack: " + path);
+        }
+        size = static_cast<size_t>(fileSize.QuadPart);
+        mapping = size > 0 ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr)
+                           : nullptr;
+        if (size > 0) {
+            base = mapping ? static_cast<const uint8_t *>(
+                                 MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0))
+                           : nullptr;
+            if (!base) {
+                unmap();
+                throw std::runtime_error("Failed to map asset pack: " + path);
+            }
+        }
+#else
+        file = open(path.c_str(), O_RDONLY);
+        struct stat info;
+        if (file < 0 || fstat(file, &info) != 0) {
+            unmap();
+            throw std::runtime_error("Failed to open asset pack: " + path);
+        }
+        size = static_cast<size_t>(info.st_size);
+        if (size > 0) {
+            void *mapped = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, file, 0);
+            if (mapped == MAP_FAILED) {
+                unmap();
+                throw std::runtime_error("Failed to map asset pack: " + path);
+            }
+            base = static_cast<const uint8_t *>(mapped);
+        }
+#endif
+    }
+
+    void AssetPack::unmap() {
+#ifdef _WIN32
+        if (base)
+            UnmapViewOfFile(base);
+        if (mapping)
+            CloseHandle(mapping);
+        if (file)
+            CloseHandle(file);
+        mapping = nullptr;
+        file = nullptr;
+#else
+        if (base)
+            munmap(const_cast<uint8_t *>(base), size);
+        if (file >= 0)
+            close(file);
+        file = -1;
+#endif
+        base = nullptr;
+        size = 0;
+    }
+
+} // namespace Retoccilus::Core
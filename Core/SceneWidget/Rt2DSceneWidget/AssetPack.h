@@ -0,0 +1,104 @@
+#ifndef ASSETPACK_H
+#define ASSETPACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Read-only pack of images, memory-mapped so that reading an entry
+    // costs no read() call or intermediate buffer: the page cache is the
+    // buffer, and only the pages of entries actually decoded are touched.
+    //
+    // Layout, little-endian:
+    //   Header  { char magic[4] = "RTPK"; uint32 version; uint32 entryCount;
+    //             uint32 reserved }
+    //   Entry   [entryCount], sorted by nameHash
+    //   payloads
+    // Names are looked up by their 64-bit FNV-1a hash. Payloads are RGBA8
+    // texels, either raw or run-length encoded (see decode()).
+    //
+    // Immutable once opened, so any thread may read it.
+    class AssetPack {
+      public:
+        enum class Encoding : uint32_t {
+            Raw = 0,
+            // Runs of pixels: a control byte c < 128 is followed by c + 1
+            // literal pixels, c >= 128 by one pixel repeated c - 126 times
+            RunLength = 1
+        };
+
+        struct Entry {
+            uint64_t nameHash;
+            uint64_t offset; // from the start of the file
+            uint64_t size;
+            uint32_t width;
+            uint32_t height;
+            Encoding encoding;
+            uint32_t reserved;
+        };
+
+        // Input for write(); `rgba` is tightly packed
+        struct Image {
+            std::string name;
+            uint32_t    width;
+            uint32_t    height;
+            const void *rgba;
+        };
+
+        static constexpr uint32_t kVersion = 1;
+
+        // Maps `path`; throws if it cannot be opened or is not a pack
+        explicit AssetPack(const std::string &path);
+        ~AssetPack();
+
+        AssetPack(const AssetPack &) = delete;
+        AssetPack &operator=(const AssetPack &) = delete;
+
+        // Null if the pack has no entry of that name
+        const Entry *find(const std::string &name) const;
+        const Entry *find(uint64_t nameHash) const;
+
+        const uint8_t *getData(const Entry &entry) const { return base + entry.offset; }
+        // Hints the OS to start reading the entry's pages in
+        void prefetch(const Entry &entry) const;
+        // Writes the entry's texels into `rgba`, which must hold
+        // width * height * 4 bytes. False if the payload is corrupt.
+        bool decode(const Entry &entry, uint8_t *rgba) const;
+
+        const std::string        &getPath() const { return path; }
+        const std::vector<Entry> &getEntries() const { return entries; }
+
+        static uint64_t hashName(const std::string &name);
+        // Writes a pack, run-length encoding the images where that is smaller
+        static void write(const std::string &path, const std::vector<Image> &images);
+
+      private:
+        struct Header {
+            char     magic[4];
+            uint32_t version;
+            uint32_t entryCount;
+            uint32_t reserved;
+        };
+
+        void map();
+        void unmap();
+
+        std::string        path;
+        std::vector<Entry> entries;
+
+        const uint8_t *base = nullptr;
+        size_t         size = 0;
+#ifdef _WIN32
+        void *file = nullptr;
+        void *mapping = nullptr;
+#else
+        int file = -1;
+#endif
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // ASSETPACK_H
@@ -0,0 +1,245 @@
+#include "AssetStreamer.h"
+#include <algorithm>
+#include <new>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Sorts the queue worst first, so workers take the best from the back
+        template <typename Request>
+        bool decodesLater(const Request &a, const Request &b) {
+            if (a.tier != b.tier)
+                return a.tier > b.tier;
+            if (a.distance != b.distance)
+                return a.distance > b.distance;
+            return a.sequence > b.sequence;
+        }
+
+        void expand(WorldRect &rect, const WorldRect &other) {
+            rect.minX = std::min(rect.minX, other.minX);
+            rect.minY = std::min(rect.minY, other.minY);
+            rect.maxX = std::max(rect.maxX, other.maxX);
+            rect.maxY = std::max(rect.maxY, other.maxY);
+        }
+    } // namespace
+
+    AssetStreamer::AssetStreamer(SpriteTextures &textures, JobSystem &jobs, const Config &config)
+        : textures(textures), jobs(jobs), config(config),
+          decodeLimit(config.decodeJobs ? config.decodeJobs
+                                        : std::max(jobs.getThreadCount() / 2, 1u)) {}
+
+    AssetStreamer::~AssetStreamer() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        // Jobs still queued return at once
+        jobs.wait(decodes);
+    }
+
+    void AssetStreamer::mount(const std::string &path) {
+        packs.push_back(std::make_unique<AssetPack>(path));
+    }
+
+    AssetStreamer::TextureId AssetStreamer::request(const std::string &name) {
+        return enqueue(name, nullptr);
+    }
+
+    AssetStreamer::TextureId AssetStreamer::request(const std::string &name,
+                                                    const WorldRect   &bounds) {
+        return enqueue(name, &bounds);
+    }
+
+    AssetStreamer::TextureId AssetStreamer::enqueue(const std::string &name,
+                                                    const WorldRect   *bounds) {
+        auto found = byName.find(name);
+        if (found != byName.end()) {
+            if (bounds)
+                hint(found->second, *bounds);
+            return found->second;
+        }
+
+        TextureId texture = textures.reserve();
+        byName.emplace(name, texture);
+
+        uint64_t hash = AssetPack::hashName(name);
+        for (auto pack = packs.rbegin(); pack != packs.rend(); ++pack) {
+            const AssetPack::Entry *entry = (*pack)->find(hash);
+            if (!entry)
+                continue;
+
+            // Start the disk read now; the decode may be a while
+            (*pack)->prefetch(*entry);
+
+            Request request{texture, pack->get(), entry, {}, bounds != nullptr, nextSequence++,
+                            0, 0.0f};
+            if (bounds)
+                request.bounds = *bounds;
+            prioritize(request);
+
+            bool start;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                states[texture] = State::Queued;
+                queue.insert(std::upper_bound(queue.begin(), queue.end(), request,
+                                              decodesLater<Request>),
+                             request);
+                start = scheduled < decodeLimit;
+                if (start)
+                    scheduled++;
+            }
+            if (start)
+                jobs.runBackground([this] { decodeNext(); }, &decodes);
+            return texture;
+        }
+
+        std::lock_guard<std::mutex> lock(mutex);
+        states[texture] = State::Failed;
+        return texture;
+    }
+
+    void AssetStreamer::hint(TextureId texture, const WorldRect &bounds) {
+        auto inserted = hints.emplace(texture, bounds);
+        if (!inserted.second)
+            expand(inserted.first->second, bounds);
+    }
+
+    void AssetStreamer::prioritize(Request &request) const {
+        request.distance = 0.0f;
+        if (!request.hasBounds) {
+            request.tier = 1;
+            return;
+        }
+        if (!hasView || request.bounds.overlaps(view)) {
+            request.tier = 0;
+            return;
+        }
+
+        float dx = std::max({request.bounds.minX - view.maxX, view.minX - request.bounds.maxX,
+                             0.0f});
+        float dy = std::max({request.bounds.minY - view.maxY, view.minY - request.bounds.maxY,
+                             0.0f});
+        request.tier = 2;
+        request.distance = dx * dx + dy * dy;
+    }
+
+    void AssetStreamer::update(const WorldRect &view) {
+        this->view = view;
+        hasView = true;
+
+        std::vector<Decoded> ready;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+
+            for (Request &request : queue) {
+                auto hinted = hints.find(request.texture);
+                if (hinted != hints.end()) {
+                    if (request.hasBounds) {
+                        expand(request.bounds, hinted->second);
+                    } else {
+                        request.bounds = hinted->second;
+                        request.hasBounds = true;
+                    }
+                }
+                prioritize(request);
+            }
+            hints.clear();
+            std::sort(queue.begin(), queue.end(), decodesLater<Request>);
+
+            size_t bytes = 0;
+            while (!decoded.empty() &&
+                   (ready.empty() || bytes + decoded.front().texels.size() <= config.uploadBudget)) {
+                bytes += decoded.front().texels.size();
+                states[decoded.front().texture] = State::Loaded;
+                ready.push_back(std::move(decoded.front()));
+                decoded.pop_front();
+            }
+        }
+
+        for (Decoded &image : ready)
+            textures.provide(image.texture, std::move(image.texels), image.width, image.height);
+    }
+
+    AssetStreamer::State AssetStreamer::getState(TextureId texture) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto found = states.find(texture);
+        // Textures loaded directly count as loaded
+        return found != states.end() ? found->second : State::Loaded;
+    }
+
+    bool AssetStreamer::isIdle() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return queue.empty() && decoding == 0 && decoded.empty();
+    }
+
+    AssetStreamer::Stats AssetStreamer::getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        Stats stats;
+        for (const auto &entry : states) {
+            switch (entry.second) {
+            case State::Queued:
+                stats.queued++;
+                break;
+            case State::Decoding:
+                stats.decoding++;
+                break;
+            case State::Decoded:
+                stats.decoded++;
+                break;
+            case State::Loaded:
+                stats.loaded++;
+                break;
+            case State::Failed:
+                stats.failed++;
+                break;
+            }
+        }
+        return stats;
+    }
+
+    void AssetStreamer::decodeNext() {
+        std::unique_lock<std::mutex> lock(mutex);
+        if (stopping || queue.empty()) {
+            scheduled--;
+            return;
+        }
+
+        Request request = queue.back();
+        queue.pop_back();
+        states[request.texture] = State::Decoding;
+        decoding++;
+        lock.unlock();
+
+        const AssetPack::Entry &entry = *request.entry;
+        Decoded                 image{request.texture, entry.width, entry.height, {}};
+        bool                    ok = entry.width > 0 && entry.height > 0;
+        if (ok) {
+            try {
+                image.texels.resize(static_cast<size_t>(entry.width) * entry.height * 4);
+                ok = request.pack->decode(entry, image.texels.data());
+            } catch (const std::bad_alloc &) {
+                ok = false;
+            }
+        }
+
+        lock.lock();
+        decoding--;
+        if (ok) {
+            states[request.texture] = State::Decoded;
+            decoded.push_back(std::move(image));
+        } else {
+            states[request.texture] = State::Failed;
+        }
+
+        // A fresh job per image, so other background work gets a turn
+        bool more = !stopping && !queue.empty();
+        if (!more)
+            scheduled--;
+        lock.unlock();
+
+        if (more)
+            jobs.runBackground([this] { decodeNext(); }, &decodes);
+    }
+
+} // namespace Retoccilus::Core
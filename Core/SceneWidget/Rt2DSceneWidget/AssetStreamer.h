@@ -0,0 +1,146 @@
+#ifndef ASSETSTREAMER_H
+#define ASSETSTREAMER_H
+
+#include "AssetPack.h"
+#include "Core/VulkanWrapper/JobSystem.h"
+#include "SpatialGrid.h"
+#include "SpriteTextures.h"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Loads sprite textures from asset packs without stalling the render
+    // thread. request() hands back a texture id at once; it samples the
+    // white texture until its image has been decoded by a background job
+    // and uploaded, so sprites can use it straight away.
+    //
+    // Decode jobs read entries straight out of the packs' mappings and decode
+    // into the buffer that SpriteTextures then uploads from, so texels are
+    // copied once on the way to the staging ring. update() hands decoded
+    // images over on the render thread, at most Config::uploadBudget bytes
+    // per frame, so that a level's worth of textures arriving at once is
+    // spread over several frames instead of one long one.
+    //
+    // Queued requests are decoded most visible first: update() orders them
+    // by the distance between the view and the bounds they were hinted
+    // with, and requests without bounds come after those on screen. A
+    // decode job takes the best request when it starts rather than when
+    // it was queued, and queues the next one when done.
+    //
+    // Everything but the decode jobs runs on the render thread.
+    class AssetStreamer {
+      public:
+        enum class State {
+            Queued,
+            Decoding,
+            Decoded, // waiting for update() to hand it over
+            Loaded,  // handed to SpriteTextures; draws once uploaded
+            Failed   // missing or corrupt; keeps drawing white
+        };
+
+        struct Config {
+            // Decode jobs running at once; zero picks half the job system's
+            // threads, leaving the rest for frame work
+            uint32_t decodeJobs = 0;
+            // Decoded bytes handed to SpriteTextures per update(); at least
+            // one image is handed over per update regardless
+            size_t uploadBudget = 8 * 1024 * 1024;
+        };
+
+        struct Stats {
+            uint32_t queued = 0;
+            uint32_t decoding = 0;
+            uint32_t decoded = 0;
+            uint32_t loaded = 0;
+            uint32_t failed = 0;
+        };
+
+        using TextureId = SpriteTextures::TextureId;
+
+        AssetStreamer(SpriteTextures &textures, JobSystem &jobs, const Config &config);
+        ~AssetStreamer();
+
+        AssetStreamer(const AssetStreamer &) = delete;
+        AssetStreamer &operator=(const AssetStreamer &) = delete;
+
+        // Later packs take precedence for equal names. Throws if the pack
+        // cannot be opened.
+        void mount(const std::string &path);
+
+        // Queues the named image; requesting a name again returns the same
+        // id. Names found in no pack fail without throwing.
+        TextureId request(const std::string &name);
+        TextureId request(const std::string &name, const WorldRect &bounds);
+        // Widens the bounds a queued texture is prioritised by from the
+        // next update() on, e.g. when another sprite starts using it.
+        // Ignored for anything not queued by then.
+        void hint(TextureId texture, const WorldRect &bounds);
+
+        // Reprioritises the queue against `view` and hands decoded images
+        // to SpriteTextures. Called once per frame before it commits.
+        void update(const WorldRect &view);
+
+        State getState(TextureId texture) const;
+        // True when nothing is queued, decoding or waiting for update()
+        bool  isIdle() const;
+        Stats getStats() const;
+
+      private:
+        struct Request {
+            TextureId               texture;
+            const AssetPack        *pack;
+            const AssetPack::Entry *entry;
+            WorldRect               bounds;
+            bool                    hasBounds;
+            uint64_t                sequence;
+
+            // Set by update(): 0 on screen, 1 without bounds, 2 off screen
+            // by `distance`
+            uint32_t tier;
+            float    distance;
+        };
+
+        struct Decoded {
+            TextureId            texture;
+            uint32_t             width;
+            uint32_t             height;
+            std::vector<uint8_t> texels;
+        };
+
+        TextureId enqueue(const std::string &name, const WorldRect *bounds);
+        void      prioritize(Request &request) const;
+        void      decodeNext();
+
+        SpriteTextures &textures;
+        JobSystem      &jobs;
+        Config          config;
+        uint32_t        decodeLimit;
+
+        std::vector<std::unique_ptr<AssetPack>>    packs;
+        std::unordered_map<std::string, TextureId> byName;
+        uint64_t                                   nextSequence = 0;
+        std::unordered_map<TextureId, WorldRect>   hints; // until the next update()
+        WorldRect                                  view;  // of the last update()
+        bool                                       hasView = false;
+
+        // Shared with the decode jobs
+        mutable std::mutex                   mutex;
+        std::unordered_map<TextureId, State> states; // streamed textures
+        std::vector<Request>                 queue;  // best last
+        std::deque<Decoded>                  decoded;
+        uint32_t                             decoding = 0;
+        uint32_t                             scheduled = 0; // decode jobs queued or running
+        bool                                 stopping = false;
+
+        JobCounter decodes;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // ASSETSTREAMER_H
@@ -0,0 +1,120 @@
+#include "FontSource.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    BitmapFont::BitmapFont(const uint8_t *coverage, uint32_t width, uint32_t height,
+                           uint32_t cellWidth, uint32_t cellHeight, uint32_t firstCodepoint,
+                           uint32_t baseline)
+        : sheetWidth(width), cellWidth(cellWidth), cellHeight(cellHeight),
+          firstCodepoint(firstCodepoint), baseline(baseline == 0 ? cellHeight : baseline) {
+        if (!coverage || cellWidth == 0 || cellHeight == 0 || cellWidth > width ||
+            cellHeight > height) {
+            throw std::runtime_error("Bitmap font sheet does not hold a single cell");
+        }
+        if (this->baseline > cellHeight) {
+            throw std::runtime_error("Bitmap font baseline lies outside its cells");
+        }
+
+        sheet.assign(coverage, coverage + static_cast<size_t>(width) * height);
+        columns = width / cellWidth;
+        uint32_t cells = columns * (height / cellHeight);
+
+        // Ink bounds of every cell, from the texels that are not empty
+        float em = static_cast<float>(cellHeight);
+        float advance = cellWidth / em;
+        glyphs.reserve(cells + 1);
+        glyphs.push_back(GlyphMetrics{advance, 0.0f, 0.0f, 0.0f, 0.0f});
+        for (uint32_t cell = 0; cell < cells; cell++) {
+            uint32_t cellX = cell % columns * cellWidth;
+            uint32_t cellY = cell / columns * cellHeight;
+            uint32_t minX = cellWidth, minY = cellHeight, maxX = 0, maxY = 0;
+            for (uint32_t y = 0; y < cellHeight; y++) {
+                const uint8_t *row = &sheet[static_cast<size_t>(cellY + y) * width + cellX];
+                for (uint32_t x = 0; x < cellWidth; x++) {
+                    if (row[x] == 0)
+                        continue;
+                    minX = std::min(minX, x);
+                    minY = std::min(minY, y);
+                    maxX = std::max(maxX, x + 1);
+                    maxY = std::max(maxY, y + 1);
+                }
+            }
+
+            GlyphMetrics metrics{advance, 0.0f, 0.0f, 0.0f, 0.0f};
+            if (maxX > minX) {
+                float top = static_cast<float>(this->baseline);
+                metrics.minX = minX / em;
+                metrics.minY = (minY - top) / em;
+                metrics.maxX = maxX / em;
+                metrics.maxY = (maxY - top) / em;
+            }
+            glyphs.push_back(metrics);
+        }
+    }
+
+    FontMetrics BitmapFont::getMetrics() const {
+        float em = static_cast<float>(cellHeight);
+        return FontMetrics{baseline / em, (cellHeight - baseline) / em, 0.0f};
+    }
+
+    uint32_t BitmapFont::getGlyph(uint32_t codepoint) const {
+        if (codepoint < firstCodepoint || codepoint - firstCodepoint >= glyphs.size() - 1)
+            return 0;
+        return codepoint - firstCodepoint + 1;
+    }
+
+    GlyphMetrics BitmapFont::getGlyphMetrics(uint32_t glyph) const {
+        return glyphs[glyph < glyphs.size() ? glyph : 0];
+    }
+
+    float BitmapFont::sample(uint32_t glyph, float x, float y) const {
+        uint32_t cell = glyph - 1;
+        uint32_t cellX = cell % columns * cellWidth;
+        uint32_t cellY = cell / columns * cellHeight;
+
+        auto texel = [&](int32_t tx, int32_t ty) -> float {
+            if (tx < 0 || ty < 0 || tx >= static_cast<int32_t>(cellWidth) ||
+                ty >= static_cast<int32_t>(cellHeight))
+                return 0.0f;
+            return sheet[static_cast<size_t>(cellY + ty) * sheetWidth + cellX + tx];
+        };
+
+        // Texel centres sit at half-integer coordinates
+        float   fx = x - 0.5f;
+        float   fy = y - 0.5f;
+        float   x0 = std::floor(fx);
+        float   y0 = std::floor(fy);
+        float   wx = fx - x0;
+        float   wy = fy - y0;
+        int32_t tx = static_cast<int32_t>(x0);
+        int32_t ty = static_cast<int32_t>(y0);
+
+        float top = texel(tx, ty) + (texel(tx + 1, ty) - texel(tx, ty)) * wx;
+        float bottom = texel(tx, ty + 1) + (texel(tx + 1, ty + 1) - texel(tx, ty + 1)) * wx;
+        return top + (bottom - top) * wy;
+    }
+
+    void BitmapFont::rasterize(uint32_t glyph, float pixelsPerEm, float originX, float originY,
+                               uint32_t width, uint32_t height, uint8_t *coverage) const {
+        if (glyph == 0 || glyph >= glyphs.size()) {
+            std::fill(coverage, coverage + static_cast<size_t>(width) * height, 0);
+            return;
+        }
+
+        // Output pixels to cell texels
+        float scale = cellHeight / pixelsPerEm;
+        for (uint32_t y = 0; y < height; y++) {
+            float cellY = baseline + (y + 0.5f - originY) * scale;
+            for (uint32_t x = 0; x < width; x++) {
+                float cellX = (x + 0.5f - originX) * scale;
+                float value = sample(glyph, cellX, cellY);
+                coverage[static_cast<size_t>(y) * width + x] =
+                    static_cast<uint8_t>(std::clamp(value + 0.5f, 0.0f, 255.0f));
+            }
+        }
+    }
+
+} // namespace Retoccilus::Core
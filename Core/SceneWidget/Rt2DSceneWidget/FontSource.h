@@ -0,0 +1,88 @@
+#ifndef FONTSOURCE_H
+#define FONTSOURCE_H
+
+#include <cstdint>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Line metrics in em units, positive away from the baseline
+    struct FontMetrics {
+        float ascent;
+        float descent;
+        float lineGap;
+    };
+
+    // In em units from the glyph's origin on the baseline, y down. The ink
+    // bounds are empty (max <= min) for glyphs that draw nothing.
+    struct GlyphMetrics {
+        float advance;
+        float minX;
+        float minY;
+        float maxX;
+        float maxY;
+    };
+
+    // Where TextRenderer gets glyphs from. Glyph outlines are only ever
+    // turned into coverage, so a font format is supported by implementing
+    // rasterize() for it, e.g. on top of FreeType or stb_truetype.
+    class FontSource {
+      public:
+        virtual ~FontSource() = default;
+
+        virtual FontMetrics getMetrics() const = 0;
+        // Glyph index of `codepoint`; 0 if the font has none
+        virtual uint32_t     getGlyph(uint32_t codepoint) const = 0;
+        virtual GlyphMetrics getGlyphMetrics(uint32_t glyph) const = 0;
+        // Added to the advance of `left` when `right` follows it
+        virtual float getKerning(uint32_t left, uint32_t right) const {
+            (void)left;
+            (void)right;
+            return 0.0f;
+        }
+
+        // Writes the coverage (0 to 255) of `width` x `height` pixels at
+        // `pixelsPerEm`, row by row. The glyph's origin lies at pixel
+        // coordinates (originX, originY) from the top-left corner of the
+        // first pixel. Called from several threads at once.
+        virtual void rasterize(uint32_t glyph, float pixelsPerEm, float originX, float originY,
+                               uint32_t width, uint32_t height, uint8_t *coverage) const = 0;
+    };
+
+    // A font drawn as a sheet of equally sized cells, like the bitmap fonts
+    // of old, holding consecutive codepoints row by row. Cells are one em
+    // high and every glyph advances by the cell's width. Coverage between
+    // texels is interpolated bilinearly, so glyphs scaled far beyond their
+    // cells turn blobby; they are meant for the smaller size classes.
+    class BitmapFont : public FontSource {
+      public:
+        // Copies a sheet of 8-bit coverage, `width` x `height` texels.
+        // `baseline` is the row of the baseline within a cell, counted from
+        // its top; 0 puts it at the bottom.
+        BitmapFont(const uint8_t *coverage, uint32_t width, uint32_t height, uint32_t cellWidth,
+                   uint32_t cellHeight, uint32_t firstCodepoint = 32, uint32_t baseline = 0);
+
+        FontMetrics  getMetrics() const override;
+        uint32_t     getGlyph(uint32_t codepoint) const override;
+        GlyphMetrics getGlyphMetrics(uint32_t glyph) const override;
+        void         rasterize(uint32_t glyph, float pixelsPerEm, float originX, float originY,
+                               uint32_t width, uint32_t height, uint8_t *coverage) const override;
+
+      private:
+        // Coverage of the sheet at texel coordinates of glyph's cell,
+        // zero outside it
+        float sample(uint32_t glyph, float x, float y) const;
+
+        std::vector<uint8_t>      sheet;
+        uint32_t                  sheetWidth;
+        uint32_t                  cellWidth;
+        uint32_t                  cellHeight;
+        uint32_t                  columns;
+        uint32_t                  firstCodepoint;
+        uint32_t                  baseline;
+        std::vector<GlyphMetrics> glyphs; // [0] is the missing glyph
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // FONTSOURCE_H
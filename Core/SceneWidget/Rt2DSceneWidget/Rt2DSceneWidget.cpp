@@ -1,44 +1,561 @@
 #include "Rt2DSceneWidget.h"
+#include "AssetStreamer.h"
 #include "Core/VulkanWrapper/VulkanWrapper.h"
-#include <glm/glm.hpp>
-#include <glm/gtc/matrix_transform.hpp>
+#include "FontSource.h"
+#include "SpatialGrid.h"
+#include "SpriteCapture.h"
+#include "SpriteRenderer.h"
+#include "TextRenderer.h"
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <stdexcept>
 
 namespace Retoccilus::Core {
 
+    namespace {
+        SpriteTransformStreams offsetStreams(const SpriteTransformStreams &streams,
+                                             size_t offset) {
+            auto advance = [offset](const float *stream) {
+                return stream ? stream + offset : nullptr;
+            };
+
+            SpriteTransformStreams result;
+            result.x = advance(streams.x);
+            result.y = advance(streams.y);
+            result.scaleX = advance(streams.scaleX);
+            result.scaleY = advance(streams.scaleY);
+            result.rotation = advance(streams.rotation);
+            result.sinRotation = advance(streams.sinRotation);
+            result.cosRotation = advance(streams.cosRotation);
+            return result;
+        }
+
+        // Calls add(begin, count) for every run of consecutive visible items
+        template <typename Visible, typename Add>
+        void addVisibleRuns(size_t count, Visible visible, Add add) {
+            size_t begin = 0;
+            for (size_t i = 0; i < count; i++) {
+                if (visible(i))
+                    continue;
+                if (i > begin)
+                    add(begin, i - begin);
+                begin = i + 1;
+            }
+            if (count > begin)
+                add(begin, count - begin);
+        }
+    } // namespace
+
     struct Rt2DSceneWidget::Impl {
-        std::shared_ptr<VulkanWrapper> renderer;
+        struct IndexedSprite {
+            Sprite   transform;
+            uint32_t texture;
+        };
 
-        struct SpriteTransform {
-            glm::vec2 position;
-            glm::vec2 scale;
-            float     rotation;
+        struct LoadedTexture {
+            uint32_t id;
+            uint32_t width;
+            uint32_t height;
         };
 
-        void applyTransform(const SpriteTransform &transform) {
-            // Create transformation matrix
-            glm::mat4 model = glm::mat4(1.0f);
-            model = glm::translate(model, glm::vec3(transform.position, 0.0f));
-            model = glm::rotate(model, glm::radians(transform.rotation), glm::vec3(0.0f, 0.0f, 1.0f));
-            model = glm::scale(model, glm::vec3(transform.scale, 1.0f));
+        std::shared_ptr<VulkanWrapper>  renderer;
+        std::unique_ptr<SpriteRenderer> spriteRenderer;
+        SpriteBatcher                   batcher;
+        uint32_t                        texture = 0;
+        // Created by the first mountAssetPack(); uses spriteRenderer's
+        // textures, so it is declared after it and destroyed first
+        std::unique_ptr<AssetStreamer> streamer;
+        // Created by the first addFont(), on spriteRenderer's textures too
+        std::unique_ptr<TextRenderer> text;
+
+        // State a capture started mid-session opens with
+        std::unique_ptr<SpriteCaptureWriter> capture;
+        std::vector<LoadedTexture>           loadedTextures;
+        SpriteSortMode                       sortMode = SpriteSortMode::Submission;
+        std::optional<WorldRect>             camera;
+
+        // Culling rectangle for the frame being queued; everything passes
+        // until the renderer exists
+        WorldRect view{-std::numeric_limits<float>::infinity(),
+                       -std::numeric_limits<float>::infinity(),
+                       std::numeric_limits<float>::infinity(),
+                       std::numeric_limits<float>::infinity()};
+        // Framebuffer pixels per world unit across the view
+        float pixelsPerUnit = 1.0f;
+
+        std::vector<IndexedSprite> sprites; // indexed by SpriteId
+        std::vector<SpriteId>      freeIds;
+        SpatialGrid                grid;
+        std::vector<uint32_t>      visible; // scratch for queueIndexedSprites
+
+        SceneGraph scene;
+        bool       gpuCulling = false;
+        // Set while GPU culling declared this frame's scene passes
+        std::optional<SpriteRenderer::PreparedScene> culledScene;
+
+        bool isVisible(const Sprite &sprite) const {
+            return WorldRect::fromTransform(sprite).overlaps(view);
+        }
+
+        void refreshView() {
+            if (!spriteRenderer)
+                return;
+
+            view = spriteRenderer->getView();
+            float width = view.maxX - view.minX;
+            if (width > 0.0f)
+                pixelsPerUnit = renderer->getSwapChainExtent().width / width;
+        }
+
+        TextRenderer &getText() {
+            if (!text) {
+                text = std::make_unique<TextRenderer>(*renderer, spriteRenderer->getTextures());
+                updateRenderGraph();
+            }
+            return *text;
+        }
 
-            // TODO: Send transformation matrix to Vulkan renderer
+        // Everything drawFrame() does before recording
+        void beginFrame() {
+            {
+                FrameProfiler::CpuScope scope(renderer->getProfiler(), "SceneGraph::update");
+                scene.update();
+            }
+            if (capture)
+                capture->endFrame();
+            if (streamer) {
+                FrameProfiler::CpuScope scope(renderer->getProfiler(), "AssetStreamer::update");
+                streamer->update(view);
+            }
+            queueIndexedSprites();
+        }
+
+        // Everything drawFrame() does after submitting
+        void endFrame() {
+            if (text)
+                text->endFrame();
+            // The swapchain may have been resized by this frame
+            refreshView();
+        }
+
+        const IndexedSprite &getSprite(SpriteId id) const {
+            if (!grid.contains(id))
+                throw std::runtime_error("Rt2DSceneWidget: unknown sprite id");
+            return sprites[id];
+        }
+
+        // Appends the indexed sprites inside the view to the batcher, in id
+        // order so overlapping sprites keep a stable stacking order.
+        void queueIndexedSprites() {
+            if (grid.size() == 0)
+                return;
+
+            FrameProfiler::CpuScope scope(renderer->getProfiler(), "Rt2DSceneWidget::cull");
+
+            visible.clear();
+            grid.query(view, visible);
+            std::sort(visible.begin(), visible.end());
+
+            uint32_t state = texture;
+            for (uint32_t id : visible) {
+                const IndexedSprite &sprite = sprites[id];
+                if (sprite.texture != state) {
+                    state = sprite.texture;
+                    batcher.setState(state);
+                }
+                batcher.add(sprite.transform);
+            }
+            batcher.setState(texture);
+        }
+
+        // Below this many sprites per task, waking another thread costs
+        // more than it saves
+        static constexpr uint32_t kMinSpritesPerTask = 4096;
+
+        // Records the scene, then writes the queued sprites into the current
+        // frame's instance buffer and records the batched draws, split into
+        // contiguous instance ranges across the recording threads.
+        void flush(ParallelRecorder &recorder) {
+            bool hasSprites = !batcher.empty();
+            if (!hasSprites && scene.getInstances().empty())
+                return;
+
+            FrameProfiler::CpuScope scope(renderer->getProfiler(), "Rt2DSceneWidget::flush");
+
+            SpriteRenderer::PreparedScene prepared =
+                culledScene ? *culledScene : spriteRenderer->prepareScene(scene);
+            culledScene.reset();
+            SpriteRenderer::PreparedFrame frame;
+            if (hasSprites)
+                frame = spriteRenderer->prepare(batcher);
+
+            // Task 0 draws the scene, when there is one; the rest split the
+            // queued sprites
+            uint32_t sceneTasks = prepared.instanceCount > 0 ? 1 : 0;
+            uint32_t total = frame.instanceCount;
+            uint32_t tasks = std::min(
+                recorder.getThreadCount(), (total + kMinSpritesPerTask - 1) / kMinSpritesPerTask);
+
+            recorder.record(sceneTasks + tasks, [&](VkCommandBuffer cmd, uint32_t task) {
+                if (task < sceneTasks) {
+                    spriteRenderer->recordScene(cmd, prepared);
+                    return;
+                }
+
+                task -= sceneTasks;
+                uint32_t first = static_cast<uint32_t>(static_cast<uint64_t>(total) * task / tasks);
+                uint32_t last = static_cast<uint32_t>(static_cast<uint64_t>(total) * (task + 1) / tasks);
+                spriteRenderer->recordRange(cmd, batcher, frame, first, last - first);
+            });
+
+            batcher.clear();
+        }
+
+        // Glyph uploads and culling passes first: the graph runs passes in
+        // declaration order
+        void declarePasses(RenderGraph &graph, RenderGraph::Resource backbuffer) {
+            RenderGraph::Resource atlas;
+            if (text)
+                atlas = text->declarePasses(graph);
+            if (gpuCulling)
+                culledScene = spriteRenderer->prepareCulledScene(graph, scene);
+
+            RenderGraph::PassBuilder pass = renderer->declareScenePass(graph, backbuffer);
+            if (culledScene && culledScene->gpuCulled) {
+                pass.read(culledScene->culledInstances, RenderGraphAccess::VertexBuffer)
+                    .read(culledScene->drawCommands, RenderGraphAccess::IndirectBuffer);
+            }
+            if (!atlas.isNull())
+                pass.read(atlas, RenderGraphAccess::FragmentSampled);
+        }
+
+        // Frames are built as a render graph while they have passes of
+        // their own to declare
+        void updateRenderGraph() {
+            if (!gpuCulling && !text) {
+                renderer->setRenderGraphCallback(nullptr);
+                return;
+            }
+
+            Impl *impl = this;
+            renderer->setRenderGraphCallback(
+                [impl](RenderGraph &graph, RenderGraph::Resource backbuffer) {
+                    impl->declarePasses(graph, backbuffer);
+                });
         }
     };
 
-    Rt2DSceneWidget::Rt2DSceneWidget() : pImpl(std::make_unique<Impl>()) {
-        // Initialize renderer
-        pImpl->renderer = std::make_shared<VulkanWrapper>(800, 600, "2D Scene");
+    Rt2DSceneWidget::Rt2DSceneWidget() : Rt2DSceneWidget(800, 600) {}
+
+    Rt2DSceneWidget::Rt2DSceneWidget(uint32_t width, uint32_t height, const std::string &title)
+        : pImpl(std::make_unique<Impl>()) {
+        pImpl->renderer = std::make_shared<VulkanWrapper>(width, height, title);
+    }
+
+    Rt2DSceneWidget::Rt2DSceneWidget(std::shared_ptr<RenderContext> context, uint32_t width,
+                                     uint32_t height, const std::string &title, WindowMode mode)
+        : pImpl(std::make_unique<Impl>()) {
+        pImpl->renderer =
+            std::make_shared<VulkanWrapper>(std::move(context), width, height, title, mode);
     }
 
     Rt2DSceneWidget::~Rt2DSceneWidget() = default;
 
+    void Rt2DSceneWidget::initialize() {
+        pImpl->renderer->initVulkan();
+
+        pImpl->spriteRenderer = std::make_unique<SpriteRenderer>(*pImpl->renderer);
+        pImpl->spriteRenderer->initialize();
+
+        Impl *impl = pImpl.get();
+        pImpl->renderer->setParallelRecordCallback(
+            [impl](ParallelRecorder &recorder) { impl->flush(recorder); });
+        pImpl->renderer->setUploadCallback([impl](VkCommandBuffer cmd) {
+            impl->spriteRenderer->getTextures().recordUpdates(cmd);
+        });
+        pImpl->refreshView();
+    }
+
+    void Rt2DSceneWidget::drawFrame() {
+        pImpl->renderer->waitForFrameStart();
+        pImpl->beginFrame();
+        pImpl->renderer->drawFrame();
+        pImpl->endFrame();
+    }
+
+    void Rt2DSceneWidget::drawFrames(const std::vector<Rt2DSceneWidget *> &widgets) {
+        std::vector<VulkanWrapper *> views;
+        views.reserve(widgets.size());
+        for (Rt2DSceneWidget *widget : widgets)
+            views.push_back(widget->pImpl->renderer.get());
+
+        VulkanWrapper::waitForFrameStart(views);
+        for (Rt2DSceneWidget *widget : widgets)
+            widget->pImpl->beginFrame();
+
+        VulkanWrapper::drawFrames(views);
+
+        for (Rt2DSceneWidget *widget : widgets)
+            widget->pImpl->endFrame();
+    }
+
+    void Rt2DSceneWidget::waitForFrameStart() {
+        pImpl->renderer->waitForFrameStart();
+    }
+
+    void Rt2DSceneWidget::setPresentPolicy(PresentPolicy policy) {
+        pImpl->renderer->setPresentPolicy(policy);
+    }
+
+    void Rt2DSceneWidget::setLatencyMode(bool enabled) {
+        pImpl->renderer->setLatencyMode(enabled);
+    }
+
+    LatencyStats Rt2DSceneWidget::getLatencyStats() const {
+        return pImpl->renderer->getLatencyStats();
+    }
+
+    void Rt2DSceneWidget::setDynamicResolution(bool enabled, double gpuBudgetMs) {
+        ResolutionScaler::Settings settings;
+        settings.budgetMs = gpuBudgetMs;
+        pImpl->renderer->setDynamicResolutionSettings(settings);
+        pImpl->renderer->setDynamicResolution(enabled);
+    }
+
+    float Rt2DSceneWidget::getResolutionScale() const {
+        return pImpl->renderer->getResolutionScale();
+    }
+
+    uint32_t Rt2DSceneWidget::loadTexture(const void *rgba, uint32_t width, uint32_t height) {
+        uint32_t id = pImpl->spriteRenderer->getTextures().load(rgba, width, height);
+        pImpl->loadedTextures.push_back(Impl::LoadedTexture{id, width, height});
+        if (pImpl->capture)
+            pImpl->capture->loadTexture(id, width, height);
+        return id;
+    }
+
+    void Rt2DSceneWidget::mountAssetPack(const std::string &path) {
+        if (!pImpl->streamer) {
+            pImpl->streamer = std::make_unique<AssetStreamer>(
+                pImpl->spriteRenderer->getTextures(),
+                pImpl->renderer->getContext().getJobSystem(), AssetStreamer::Config{});
+        }
+        pImpl->streamer->mount(path);
+    }
+
+    uint32_t Rt2DSceneWidget::streamTexture(const std::string &name) {
+        if (!pImpl->streamer)
+            throw std::runtime_error("Rt2DSceneWidget: no asset pack mounted");
+        return pImpl->streamer->request(name);
+    }
+
+    uint32_t Rt2DSceneWidget::streamTexture(const std::string &name, float x, float y,
+                                            float width, float height) {
+        if (!pImpl->streamer)
+            throw std::runtime_error("Rt2DSceneWidget: no asset pack mounted");
+        return pImpl->streamer->request(name, WorldRect{x, y, x + width, y + height});
+    }
+
+    bool Rt2DSceneWidget::isStreamingIdle() const {
+        return !pImpl->streamer || pImpl->streamer->isIdle();
+    }
+
+    void Rt2DSceneWidget::setTexture(uint32_t textureId) {
+        pImpl->texture = textureId;
+        pImpl->batcher.setState(textureId);
+        if (pImpl->capture)
+            pImpl->capture->setTexture(textureId);
+    }
+
+    void Rt2DSceneWidget::setSortMode(SpriteSortMode mode) {
+        pImpl->sortMode = mode;
+        pImpl->batcher.setSortMode(mode);
+        if (pImpl->capture)
+            pImpl->capture->setSortMode(mode);
+    }
+
     void Rt2DSceneWidget::renderSprite(float x, float y, float scaleX, float scaleY, float rotation) {
-        Rt2DSceneWidget::Impl::SpriteTransform transform{
-            .position = {x, y},
-            .scale = {scaleX, scaleY},
-            .rotation = rotation};
+        Sprite sprite{x, y, scaleX, scaleY, rotation};
+        if (pImpl->capture)
+            pImpl->capture->sprite(sprite);
+        if (pImpl->isVisible(sprite))
+            pImpl->batcher.add(sprite);
+    }
+
+    void Rt2DSceneWidget::renderSprites(const Sprite *sprites, size_t count) {
+        FrameProfiler::CpuScope scope(pImpl->renderer->getProfiler(), "Rt2DSceneWidget::renderSprites");
+
+        if (pImpl->capture) {
+            for (size_t i = 0; i < count; i++)
+                pImpl->capture->sprite(sprites[i]);
+        }
+
+        // Visible runs are appended in place, so nothing is copied when the
+        // whole array is on screen
+        Impl *impl = pImpl.get();
+        addVisibleRuns(
+            count, [&](size_t i) { return impl->isVisible(sprites[i]); },
+            [&](size_t begin, size_t n) { impl->batcher.add(sprites + begin, n); });
+    }
+
+    void Rt2DSceneWidget::renderSprites(const SpriteTransformStreams &streams, size_t count) {
+        FrameProfiler::CpuScope scope(pImpl->renderer->getProfiler(), "Rt2DSceneWidget::renderSprites");
+
+        if (pImpl->capture) {
+            for (size_t i = 0; i < count; i++) {
+                float rotation = streams.rotation
+                                     ? streams.rotation[i]
+                                     : std::atan2(streams.sinRotation[i], streams.cosRotation[i]) *
+                                           57.29577951308232f;
+                pImpl->capture->sprite(Sprite{streams.x[i], streams.y[i], streams.scaleX[i],
+                                              streams.scaleY[i], rotation});
+            }
+        }
+
+        // Rotation does not affect the culling bounds
+        Impl *impl = pImpl.get();
+        addVisibleRuns(
+            count,
+            [&](size_t i) {
+                return impl->isVisible(
+                    Sprite{streams.x[i], streams.y[i], streams.scaleX[i], streams.scaleY[i], 0.0f});
+            },
+            [&](size_t begin, size_t n) { impl->batcher.add(offsetStreams(streams, begin), n); });
+    }
+
+    Rt2DSceneWidget::FontId Rt2DSceneWidget::addFont(std::shared_ptr<const FontSource> font) {
+        return pImpl->getText().addFont(std::move(font));
+    }
+
+    Rt2DSceneWidget::FontId Rt2DSceneWidget::loadBitmapFont(const uint8_t *coverage, uint32_t width,
+                                                            uint32_t height, uint32_t cellWidth,
+                                                            uint32_t cellHeight,
+                                                            uint32_t firstCodepoint) {
+        return addFont(std::make_shared<BitmapFont>(coverage, width, height, cellWidth, cellHeight,
+                                                    firstCodepoint));
+    }
 
-        pImpl->applyTransform(transform);
+    void Rt2DSceneWidget::renderText(FontId font, std::string_view text, float x, float y,
+                                     float size, uint32_t rgba, float rotation) {
+        pImpl->getText().add(pImpl->batcher, font, text, x, y, size, rotation, rgba,
+                             pImpl->pixelsPerUnit, pImpl->view);
+
+        // Back to the state sprites are queued with
+        pImpl->batcher.setState(pImpl->texture);
+        pImpl->batcher.setColor(0xFFFFFFFFu);
+    }
+
+    void Rt2DSceneWidget::setCamera(float x, float y, float width, float height) {
+        pImpl->camera = WorldRect{x, y, x + width, y + height};
+        pImpl->spriteRenderer->setView(*pImpl->camera);
+        pImpl->refreshView();
+        if (pImpl->capture)
+            pImpl->capture->setCamera(x, y, width, height);
+    }
+
+    void Rt2DSceneWidget::resetCamera() {
+        pImpl->camera.reset();
+        pImpl->spriteRenderer->resetView();
+        pImpl->refreshView();
+        if (pImpl->capture)
+            pImpl->capture->resetCamera();
+    }
+
+    void Rt2DSceneWidget::startCapture(const std::string &path) {
+        auto capture = std::make_unique<SpriteCaptureWriter>(path);
+
+        for (const Impl::LoadedTexture &texture : pImpl->loadedTextures)
+            capture->loadTexture(texture.id, texture.width, texture.height);
+        capture->setSortMode(pImpl->sortMode);
+        if (pImpl->camera) {
+            const WorldRect &camera = *pImpl->camera;
+            capture->setCamera(camera.minX, camera.minY, camera.maxX - camera.minX,
+                               camera.maxY - camera.minY);
+        }
+        capture->setTexture(pImpl->texture);
+
+        pImpl->capture = std::move(capture);
+    }
+
+    void Rt2DSceneWidget::stopCapture() {
+        pImpl->capture.reset();
+    }
+
+    Rt2DSceneWidget::SpriteId Rt2DSceneWidget::addSprite(const Sprite &sprite, uint32_t textureId) {
+        SpriteId id;
+        if (!pImpl->freeIds.empty()) {
+            id = pImpl->freeIds.back();
+            pImpl->freeIds.pop_back();
+            pImpl->sprites[id] = Impl::IndexedSprite{sprite, textureId};
+        } else {
+            id = static_cast<SpriteId>(pImpl->sprites.size());
+            pImpl->sprites.push_back(Impl::IndexedSprite{sprite, textureId});
+        }
+
+        WorldRect bounds = WorldRect::fromTransform(sprite);
+        pImpl->grid.insert(id, bounds);
+        if (pImpl->streamer)
+            pImpl->streamer->hint(textureId, bounds);
+        return id;
+    }
+
+    void Rt2DSceneWidget::updateSprite(SpriteId id, const Sprite &sprite) {
+        pImpl->getSprite(id);
+        pImpl->sprites[id].transform = sprite;
+        WorldRect bounds = WorldRect::fromTransform(sprite);
+        pImpl->grid.update(id, bounds);
+        if (pImpl->streamer)
+            pImpl->streamer->hint(pImpl->sprites[id].texture, bounds);
+    }
+
+    void Rt2DSceneWidget::removeSprite(SpriteId id) {
+        pImpl->getSprite(id);
+        pImpl->grid.remove(id);
+        pImpl->freeIds.push_back(id);
+    }
+
+    SceneGraph &Rt2DSceneWidget::getScene() {
+        return pImpl->scene;
+    }
+
+    void Rt2DSceneWidget::setGpuCulling(bool enabled) {
+        pImpl->gpuCulling = enabled;
+        pImpl->updateRenderGraph();
+    }
+
+    std::vector<Rt2DSceneWidget::SpriteId>
+    Rt2DSceneWidget::querySprites(float minX, float minY, float maxX, float maxY) const {
+        std::vector<SpriteId> result;
+        pImpl->grid.query(WorldRect{minX, minY, maxX, maxY}, result);
+        std::sort(result.begin(), result.end());
+        return result;
+    }
+
+    std::optional<Rt2DSceneWidget::SpriteId> Rt2DSceneWidget::pickSprite(float x, float y) const {
+        std::vector<SpriteId> candidates;
+        pImpl->grid.query(x, y, candidates);
+
+        // Later ids are drawn on top
+        std::sort(candidates.begin(), candidates.end(), std::greater<SpriteId>());
+        for (SpriteId id : candidates) {
+            const Sprite &sprite = pImpl->sprites[id].transform;
+
+            // Undo the sprite's rotation and test against the unit quad
+            float radians = sprite.rotation * 0.017453292519943295f;
+            float s = std::sin(radians);
+            float c = std::cos(radians);
+            float dx = x - sprite.x;
+            float dy = y - sprite.y;
+            float localX = c * dx + s * dy;
+            float localY = c * dy - s * dx;
+
+            if (std::abs(localX) <= 0.5f * std::abs(sprite.scaleX) &&
+                std::abs(localY) <= 0.5f * std::abs(sprite.scaleY))
+                return id;
+        }
+        return std::nullopt;
     }
 
 } // namespace Retoccilus::Core
@@ -1,16 +1,150 @@
 #ifndef RT2DSCENEWIDGET_H
 #define RT2DSCENEWIDGET_H
 
+#include "Core/VulkanWrapper/FramePacer.h"
+#include "Core/VulkanWrapper/RenderContext.h"
+#include "SceneGraph.h"
+#include "SpriteBatch.h"
+#include "SpriteTransformKernel.h"
+#include <cstddef>
 #include <memory>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
 
 namespace Retoccilus::Core {
 
+    class FontSource;
+
     class Rt2DSceneWidget {
       public:
+        using Sprite = SpriteBatcher::Transform;
+        using SpriteId = uint32_t;
+        using FontId = uint32_t;
+
+        // An 800x600 window on a device of its own
         Rt2DSceneWidget();
+        // A window of the given size on a device of its own. The window can
+        // be resized; the swapchain follows at the next frame.
+        Rt2DSceneWidget(uint32_t width, uint32_t height, const std::string &title = "2D Scene");
+        // A window, or an offscreen target when headless, on a shared
+        // device. Widgets of one context share its memory, uploads and
+        // pipeline cache, and can be drawn with one submission.
+        Rt2DSceneWidget(std::shared_ptr<RenderContext> context, uint32_t width, uint32_t height,
+                        const std::string &title, WindowMode mode = WindowMode::Windowed);
         ~Rt2DSceneWidget();
 
+        void initialize();
+        // Records the queued sprites into the next frame and submits it
+        void drawFrame();
+        // Draws a frame of every widget with a single queue submission and
+        // a single present. The widgets must share one context.
+        static void drawFrames(const std::vector<Rt2DSceneWidget *> &widgets);
+
+        // Frame pacing (see VulkanWrapper). Call waitForFrameStart() right
+        // before polling input, so that the pacing delay is spent before
+        // the input sample rather than after it.
+        void         waitForFrameStart();
+        void         setPresentPolicy(PresentPolicy policy);
+        void         setLatencyMode(bool enabled);
+        LatencyStats getLatencyStats() const;
+
+        // Dynamic resolution (see VulkanWrapper): sprites are drawn at a
+        // resolution that adapts to keep the GPU frame time under
+        // `gpuBudgetMs`, between half and full resolution, and upscaled to
+        // the window. World units stay framebuffer pixels at full
+        // resolution. Off by default.
+        void  setDynamicResolution(bool enabled, double gpuBudgetMs = 1000.0 / 60.0);
+        // Per axis, 1 at full resolution
+        float getResolutionScale() const;
+
+        // Copies tightly packed RGBA8 texels and returns the texture's id.
+        // Small images are packed into shared atlases when the next frame
+        // is prepared; until their upload lands they draw as texture 0,
+        // which is plain white.
+        uint32_t loadTexture(const void *rgba, uint32_t width, uint32_t height);
+
+        // Streaming from asset packs (see AssetPack). streamTexture() returns
+        // at once with an id that draws white until the image has been
+        // decoded in the background and uploaded; unknown names stay white.
+        // Images needed by on-screen sprites are decoded first: indexed
+        // sprites report their bounds on their own, and `bounds` does so
+        // for everything else.
+        void     mountAssetPack(const std::string &path);
+        uint32_t streamTexture(const std::string &name);
+        uint32_t streamTexture(const std::string &name, float x, float y, float width,
+                               float height);
+        // True when every streamed image has been handed to the uploader,
+        // e.g. to hold a level transition until it is complete
+        bool isStreamingIdle() const;
+
+        // Sprites are queued into the frame's instance buffer and drawn with
+        // as few instanced draws as the device allows: one for any mix of
+        // textures with descriptor indexing, else one per texture image.
+        void setTexture(uint32_t textureId);
+        void setSortMode(SpriteSortMode mode);
         void renderSprite(float x, float y, float scaleX, float scaleY, float rotation);
+        void renderSprites(const Sprite *sprites, size_t count);
+        void renderSprites(const SpriteTransformStreams &streams, size_t count);
+
+        // World rectangle shown in the window. Without a camera, world units
+        // are framebuffer pixels. Sprites outside the camera are culled
+        // before they are transformed, both those queued with renderSprite()
+        // and the indexed sprites below, so set the camera before queueing
+        // the frame's sprites.
+        void setCamera(float x, float y, float width, float height);
+        void resetCamera();
+
+        // Text, drawn as sprites from a distance field glyph atlas (see
+        // TextRenderer) so it stays sharp at any size and shares draws
+        // with the sprites around it. `size` is the line height in world
+        // units and (x, y) the top-left corner of the first line, which
+        // the text is rotated around; `rgba` packs red in the lowest
+        // byte. Text is queued like renderSprite() and culled the same.
+        FontId addFont(std::shared_ptr<const FontSource> font);
+        // A BitmapFont from a sheet of 8-bit coverage cells holding
+        // consecutive codepoints from `firstCodepoint`
+        FontId loadBitmapFont(const uint8_t *coverage, uint32_t width, uint32_t height,
+                              uint32_t cellWidth, uint32_t cellHeight, uint32_t firstCodepoint = 32);
+        void   renderText(FontId font, std::string_view text, float x, float y, float size,
+                          uint32_t rgba = 0xFFFFFFFFu, float rotation = 0.0f);
+
+        // Sprites that persist across frames, kept in a spatial grid so only
+        // the ones inside the camera cost anything per frame. They are drawn
+        // in id order after the sprites queued with renderSprite(). Ids are
+        // reused after removeSprite().
+        SpriteId addSprite(const Sprite &sprite, uint32_t textureId = 0);
+        void     updateSprite(SpriteId id, const Sprite &sprite);
+        void     removeSprite(SpriteId id);
+
+        // Region selection and picking over the indexed sprites, in world
+        // units. querySprites() tests conservative bounds that ignore
+        // rotation; pickSprite() tests the rotated quad and returns the
+        // topmost sprite under the point.
+        std::vector<SpriteId>   querySprites(float minX, float minY, float maxX, float maxY) const;
+        std::optional<SpriteId> pickSprite(float x, float y) const;
+
+        // Retained node hierarchy, drawn beneath everything above. Changes
+        // are applied by drawFrame(), which re-uploads only the sprite
+        // instances that changed, so a mostly static scene costs next to
+        // nothing per frame. Scene sprites are only culled against the
+        // camera with setGpuCulling(). Texture ids are those returned by
+        // loadTexture().
+        SceneGraph &getScene();
+        // Records every sprite call above, from loadTexture() to
+        // renderSprites(), and each frame boundary into `path` until
+        // stopCapture(). SpriteCaptureReplayer plays it back, e.g. on a
+        // headless widget for benchmarking. Indexed sprites, text and the
+        // scene graph are not captured.
+        void startCapture(const std::string &path);
+        void stopCapture();
+
+        // Keeps the scene resident on the GPU and culls it against the
+        // camera with compute shaders, drawing the visible sprites with
+        // indirect draws. Worth it for large scenes that are mostly off
+        // screen; off by default.
+        void setGpuCulling(bool enabled);
 
       private:
         struct Impl;
@@ -0,0 +1,375 @@
+#include "SceneCuller.h"
+#include "Core/VulkanWrapper/VulkanWrapper.h"
+#include <algorithm>
+#include <cstring>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        const uint32_t kSpriteCullCompSpv[] =
+#include "SpriteCull.comp.inc"
+            ;
+
+        constexpr uint32_t kBindingCount = 6;
+
+        VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+    } // namespace
+
+    SceneCuller::SceneCuller(VulkanWrapper &renderer) : renderer(renderer) {}
+
+    SceneCuller::~SceneCuller() {
+        cleanup();
+    }
+
+    void SceneCuller::initialize() {
+        DescriptorLayoutKey key;
+        for (uint32_t i = 0; i < kBindingCount; i++)
+            key.add(i, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT);
+        setLayout = renderer.getDescriptorLayouts().getLayout(std::move(key));
+
+        slots.resize(renderer.getMaxFramesInFlight());
+        createPipeline();
+    }
+
+    void SceneCuller::cleanup() {
+        VkDevice device = renderer.getDevice();
+
+        for (FrameSlot &slot : slots) {
+            destroyBuffer(slot.culled);
+            destroyBuffer(slot.setup);
+            for (Buffer &buffer : slot.retired)
+                destroyBuffer(buffer);
+        }
+        slots.clear();
+        destroyBuffer(resident);
+        residentScene = nullptr;
+
+        if (pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+            pipeline = VK_NULL_HANDLE;
+        }
+        if (pipelineLayout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+            pipelineLayout = VK_NULL_HANDLE;
+        }
+        setLayout = VK_NULL_HANDLE;
+    }
+
+    SceneCuller::Outputs SceneCuller::declarePasses(RenderGraph &graph, const SceneGraph &scene,
+                                                    const std::vector<DrawRange> &draws,
+                                                    const WorldRect &view) {
+        FrameProfiler::CpuScope scope(renderer.getProfiler(), "SceneCuller::declarePasses");
+
+        currentSlot = renderer.getCurrentFrame();
+        FrameSlot &slot = slots[currentSlot];
+
+        // The slot's previous frame has finished, and with it every frame
+        // that could still read a buffer retired back then
+        for (Buffer &buffer : slot.retired)
+            destroyBuffer(buffer);
+        slot.retired.clear();
+
+        VkBuffer source = VK_NULL_HANDLE;
+        bool     upload = updateResident(slot, scene, source);
+
+        if (slot.culled.capacity < resident.capacity) {
+            destroyBuffer(slot.culled);
+            createBuffer(slot.culled, resident.capacity,
+                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                         false);
+        }
+        if (slot.draws != draws)
+            writeSetup(slot, draws);
+        VkDescriptorSet set = getDescriptorSet(slot);
+
+        uint32_t chunkCount = slot.chunkCount;
+        uint32_t drawCount = static_cast<uint32_t>(draws.size());
+        uint32_t maxGroups =
+            renderer.getDeviceCapabilities().properties.limits.maxComputeWorkGroupCount[0];
+        if (chunkCount > maxGroups || drawCount > maxGroups) {
+            throw std::runtime_error("SceneCuller: scene too large for one dispatch");
+        }
+
+        RenderGraph::ImportedBuffer residentInfo;
+        residentInfo.buffer = resident.buffer;
+        RenderGraph::ImportedBuffer culledInfo;
+        culledInfo.buffer = slot.culled.buffer;
+        RenderGraph::ImportedBuffer setupInfo;
+        setupInfo.buffer = slot.setup.buffer;
+
+        RenderGraph::Resource instances = graph.importBuffer("SceneInstances", residentInfo);
+        RenderGraph::Resource culled = graph.importBuffer("CulledSceneInstances", culledInfo);
+        RenderGraph::Resource setup = graph.importBuffer("SceneCullSetup", setupInfo);
+
+        if (upload) {
+            graph
+                .addPass("SceneUpload",
+                         [this, source](const RenderGraph::PassContext &context) {
+                             // The graph starts every frame from scratch, so
+                             // the previous frame's compute reads of the
+                             // resident buffer are waited for by hand
+                             vkCmdPipelineBarrier(context.cmd,
+                                                  VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT,
+                                                  VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0,
+                                                  nullptr, 0, nullptr, 0, nullptr);
+                             vkCmdCopyBuffer(context.cmd, source, resident.buffer,
+                                             static_cast<uint32_t>(copies.size()),
+                                             copies.data());
+                         })
+                .write(instances, RenderGraphAccess::TransferBufferWrite);
+        }
+
+        PushConstants constants{};
+        constants.view[0] = view.minX;
+        constants.view[1] = view.minY;
+        constants.view[2] = view.maxX;
+        constants.view[3] = view.maxY;
+
+        auto dispatch = [this, set, constants](VkCommandBuffer cmd, Mode mode, uint32_t groups) {
+            PushConstants modeConstants = constants;
+            modeConstants.mode = mode;
+            vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipeline);
+            vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1,
+                                    &set, 0, nullptr);
+            vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0,
+                               sizeof(PushConstants), &modeConstants);
+            vkCmdDispatch(cmd, groups, 1, 1);
+        };
+
+        graph
+            .addPass("SceneCullCount",
+                     [dispatch, chunkCount](const RenderGraph::PassContext &context) {
+                         dispatch(context.cmd, kCount, chunkCount);
+                     })
+            .read(instances, RenderGraphAccess::ComputeBufferRead)
+            .write(setup, RenderGraphAccess::ComputeBufferWrite);
+
+        graph
+            .addPass("SceneCullScan",
+                     [dispatch, drawCount](const RenderGraph::PassContext &context) {
+                         dispatch(context.cmd, kScan, drawCount);
+                     })
+            .read(setup, RenderGraphAccess::ComputeBufferRead)
+            .write(setup, RenderGraphAccess::ComputeBufferWrite);
+
+        graph
+            .addPass("SceneCullCompact",
+                     [dispatch, chunkCount](const RenderGraph::PassContext &context) {
+                         dispatch(context.cmd, kCompact, chunkCount);
+                     })
+            .read(instances, RenderGraphAccess::ComputeBufferRead)
+            .read(setup, RenderGraphAccess::ComputeBufferRead)
+            .write(culled, RenderGraphAccess::ComputeBufferWrite);
+
+        return Outputs{culled, setup};
+    }
+
+    void SceneCuller::recordDraws(VkCommandBuffer cmd) const {
+        const FrameSlot &slot = slots[currentSlot];
+        for (size_t i = 0; i < slot.draws.size(); i++) {
+            VkDeviceSize offset = slot.draws[i].firstInstance * sizeof(SpriteInstance);
+            vkCmdBindVertexBuffers(cmd, 0, 1, &slot.culled.buffer, &offset);
+            vkCmdDrawIndirect(cmd, slot.setup.buffer, i * sizeof(VkDrawIndirectCommand), 1,
+                              sizeof(VkDrawIndirectCommand));
+        }
+    }
+
+    bool SceneCuller::updateResident(FrameSlot &slot, const SceneGraph &scene,
+                                     VkBuffer &source) {
+        const std::vector<SpriteInstance> &instances = scene.getInstances();
+        uint32_t count = static_cast<uint32_t>(instances.size());
+        bool     full = residentScene != &scene;
+
+        if (resident.capacity < count * sizeof(SpriteInstance)) {
+            // Frames in flight may still read the old buffer
+            if (resident.buffer != VK_NULL_HANDLE) {
+                slot.retired.push_back(resident);
+                resident = Buffer{};
+            }
+
+            size_t capacity = std::max<size_t>(count + count / 2, 1024);
+            createBuffer(resident, capacity * sizeof(SpriteInstance),
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                         false);
+            full = true;
+        }
+
+        if (!full && residentVersion == scene.getVersion())
+            return false;
+
+        // Patch just what changed, as SpriteRenderer does for host-visible
+        // scene copies, unless a straight copy is cheaper
+        changes.clear();
+        if (!full)
+            full = !scene.getChangesSince(residentVersion, changes) || changes.size() > count / 2;
+
+        residentScene = &scene;
+        residentVersion = scene.getVersion();
+        residentCount = count;
+        copies.clear();
+
+        if (full) {
+            if (count == 0)
+                return false;
+
+            FrameArena::Slice slice = renderer.getFrameArena().allocate(
+                count * sizeof(SpriteInstance), alignof(SpriteInstance));
+            std::memcpy(slice.data, instances.data(), count * sizeof(SpriteInstance));
+            copies.push_back(VkBufferCopy{slice.offset, 0, count * sizeof(SpriteInstance)});
+            source = slice.buffer;
+            return true;
+        }
+
+        std::sort(changes.begin(), changes.end());
+        changes.erase(std::unique(changes.begin(), changes.end()), changes.end());
+        if (changes.empty())
+            return false;
+
+        FrameArena::Slice slice = renderer.getFrameArena().allocate(
+            changes.size() * sizeof(SpriteInstance), alignof(SpriteInstance));
+        auto *staged = static_cast<SpriteInstance *>(slice.data);
+
+        // One copy region per run of consecutive instances
+        for (size_t i = 0; i < changes.size(); i++) {
+            staged[i] = instances[changes[i]];
+
+            VkDeviceSize srcOffset = slice.offset + i * sizeof(SpriteInstance);
+            VkDeviceSize dstOffset = changes[i] * sizeof(SpriteInstance);
+            if (i > 0 && changes[i] == changes[i - 1] + 1) {
+                copies.back().size += sizeof(SpriteInstance);
+            } else {
+                copies.push_back(VkBufferCopy{srcOffset, dstOffset, sizeof(SpriteInstance)});
+            }
+        }
+        source = slice.buffer;
+        return true;
+    }
+
+    void SceneCuller::writeSetup(FrameSlot &slot, const std::vector<DrawRange> &draws) {
+        uint32_t chunkCount = 0;
+        for (const DrawRange &draw : draws)
+            chunkCount += (draw.instanceCount + kChunkSize - 1) / kChunkSize;
+
+        VkDeviceSize alignment = std::max<VkDeviceSize>(
+            renderer.getDeviceCapabilities().properties.limits.minStorageBufferOffsetAlignment, 4);
+        slot.drawsOffset = alignUp(draws.size() * sizeof(VkDrawIndirectCommand), alignment);
+        slot.chunkDrawsOffset = alignUp(slot.drawsOffset + draws.size() * sizeof(GpuDraw), alignment);
+        slot.chunkCountsOffset =
+            alignUp(slot.chunkDrawsOffset + chunkCount * sizeof(uint32_t), alignment);
+        VkDeviceSize size = slot.chunkCountsOffset + std::max(chunkCount, 1u) * sizeof(uint32_t);
+
+        // The slot's frame has finished, so the buffer is free to rewrite
+        if (slot.setup.capacity < size) {
+            destroyBuffer(slot.setup);
+            createBuffer(slot.setup, size + size / 2,
+                         VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT,
+                         true);
+        }
+
+        auto *base = static_cast<uint8_t *>(slot.setup.memory.mapped);
+        auto *commands = reinterpret_cast<VkDrawIndirectCommand *>(base);
+        auto *gpuDraws = reinterpret_cast<GpuDraw *>(base + slot.drawsOffset);
+        auto *chunkDraws = reinterpret_cast<uint32_t *>(base + slot.chunkDrawsOffset);
+
+        uint32_t chunk = 0;
+        for (uint32_t i = 0; i < draws.size(); i++) {
+            uint32_t chunks = (draws[i].instanceCount + kChunkSize - 1) / kChunkSize;
+
+            // The scan pass fills in instanceCount
+            commands[i] = VkDrawIndirectCommand{4, 0, 0, 0};
+            gpuDraws[i] = GpuDraw{draws[i].firstInstance, draws[i].instanceCount, chunk, chunks};
+            for (uint32_t c = 0; c < chunks; c++)
+                chunkDraws[chunk++] = i;
+        }
+
+        slot.draws = draws;
+        slot.chunkCount = chunkCount;
+    }
+
+    VkDescriptorSet SceneCuller::getDescriptorSet(const FrameSlot &slot) {
+        VkDeviceSize     chunkCountsSize = std::max(slot.chunkCount, 1u) * sizeof(uint32_t);
+        VkDescriptorType type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+
+        writes.clear();
+        writes.buffer(0, type, resident.buffer, 0, VK_WHOLE_SIZE)
+            .buffer(1, type, slot.culled.buffer, 0, VK_WHOLE_SIZE)
+            .buffer(2, type, slot.setup.buffer, slot.drawsOffset,
+                    slot.chunkDrawsOffset - slot.drawsOffset)
+            .buffer(3, type, slot.setup.buffer, slot.chunkDrawsOffset,
+                    slot.chunkCountsOffset - slot.chunkDrawsOffset)
+            .buffer(4, type, slot.setup.buffer, slot.chunkCountsOffset, chunkCountsSize)
+            .buffer(5, type, slot.setup.buffer, 0, slot.drawsOffset);
+        return renderer.getDescriptorAllocator().getSet(setLayout, writes);
+    }
+
+    void SceneCuller::createBuffer(Buffer &buffer, VkDeviceSize size, VkBufferUsageFlags usage,
+                                   bool hostVisible) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = size;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        GpuAllocationCreateInfo allocInfo{};
+        if (hostVisible) {
+            allocInfo.requiredFlags =
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            allocInfo.mapped = true;
+        } else {
+            allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        }
+
+        renderer.getAllocator().createBuffer(bufferInfo, allocInfo, buffer.buffer, buffer.memory);
+        buffer.capacity = size;
+    }
+
+    void SceneCuller::destroyBuffer(Buffer &buffer) {
+        if (buffer.buffer != VK_NULL_HANDLE)
+            renderer.getAllocator().destroyBuffer(buffer.buffer, buffer.memory);
+        buffer = Buffer{};
+    }
+
+    void SceneCuller::createPipeline() {
+        VkDevice device = renderer.getDevice();
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_COMPUTE_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PushConstants);
+
+        VkPipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstantRange;
+        VK_CHECK_RESULT(vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout));
+
+        VkShaderModuleCreateInfo moduleInfo{};
+        moduleInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        moduleInfo.codeSize = sizeof(kSpriteCullCompSpv);
+        moduleInfo.pCode = kSpriteCullCompSpv;
+
+        VkShaderModule module;
+        VK_CHECK_RESULT(vkCreateShaderModule(device, &moduleInfo, nullptr, &module));
+
+        VkComputePipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+        pipelineInfo.stage.sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        pipelineInfo.stage.stage = VK_SHADER_STAGE_COMPUTE_BIT;
+        pipelineInfo.stage.module = module;
+        pipelineInfo.stage.pName = "main";
+        pipelineInfo.layout = pipelineLayout;
+
+        try {
+            pipeline = renderer.getPipelineCache().createComputePipeline(pipelineInfo);
+        } catch (...) {
+            vkDestroyShaderModule(device, module, nullptr);
+            throw;
+        }
+        vkDestroyShaderModule(device, module, nullptr);
+    }
+
+} // namespace Retoccilus::Core
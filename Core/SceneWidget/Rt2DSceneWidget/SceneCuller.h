@@ -0,0 +1,146 @@
+#ifndef SCENECULLER_H
+#define SCENECULLER_H
+
+#include "Core/VulkanWrapper/DescriptorAllocator.h"
+#include "Core/VulkanWrapper/GpuMemoryAllocator.h"
+#include "Core/VulkanWrapper/RenderGraph.h"
+#include "SceneGraph.h"
+#include "SpatialGrid.h"
+#include <cstdint>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    class VulkanWrapper;
+
+    // GPU-driven drawing of a SceneGraph. The scene's instances stay
+    // resident in one device-local buffer, patched on the graphics queue
+    // with only the instances that changed. Every frame compute passes cull
+    // them against the view and compact the visible ones into a per-frame
+    // buffer, and write a VkDrawIndirectCommand per draw range, so drawing
+    // an unchanged scene costs the CPU nothing per sprite.
+    //
+    // Compaction keeps the instances' order, which blending depends on:
+    // instances are counted per chunk of 256, the chunk counts of each draw
+    // range are scanned into offsets, then the visible instances are
+    // scattered. Every range compacts to the start of its own range, so a
+    // draw binds the compacted buffer at its range's first instance and
+    // needs neither drawIndirectFirstInstance nor an indirect count.
+    class SceneCuller {
+      public:
+        // Instances [firstInstance, firstInstance + instanceCount) of the
+        // scene, drawn with one pipeline and descriptor set
+        struct DrawRange {
+            uint32_t firstInstance;
+            uint32_t instanceCount;
+
+            bool operator==(const DrawRange &other) const {
+                return firstInstance == other.firstInstance &&
+                       instanceCount == other.instanceCount;
+            }
+        };
+
+        // Outputs of the current frame's passes. The pass that calls
+        // recordDraws() must read `instances` as VertexBuffer and `commands`
+        // as IndirectBuffer.
+        struct Outputs {
+            RenderGraph::Resource instances;
+            RenderGraph::Resource commands;
+        };
+
+        explicit SceneCuller(VulkanWrapper &renderer);
+        ~SceneCuller();
+
+        SceneCuller(const SceneCuller &) = delete;
+        SceneCuller &operator=(const SceneCuller &) = delete;
+
+        void initialize();
+        void cleanup();
+
+        // Declares the passes that update the resident copy of `scene` and
+        // cull it against `view`. `draws` must cover every instance, in order.
+        Outputs declarePasses(RenderGraph &graph, const SceneGraph &scene,
+                              const std::vector<DrawRange> &draws, const WorldRect &view);
+        // Draws the ranges of the last declarePasses() with the bound
+        // pipeline. May run on a recording thread.
+        void recordDraws(VkCommandBuffer cmd) const;
+
+        // The current frame's compacted instances
+        VkBuffer getCulledInstances() const { return slots[currentSlot].culled.buffer; }
+
+      private:
+        static constexpr uint32_t kChunkSize = 256;
+
+        enum Mode : uint32_t { kCount = 0, kScan = 1, kCompact = 2 };
+
+        // Matches PushConstants in SpriteCull.comp
+        struct PushConstants {
+            float    view[4];
+            uint32_t mode;
+        };
+
+        // Matches Draw in SpriteCull.comp
+        struct GpuDraw {
+            uint32_t firstInstance;
+            uint32_t instanceCount;
+            uint32_t firstChunk;
+            uint32_t chunkCount;
+        };
+
+        struct Buffer {
+            VkBuffer      buffer = VK_NULL_HANDLE;
+            GpuAllocation memory;
+            VkDeviceSize  capacity = 0;
+        };
+
+        // Per frame slot. The setup buffer holds the indirect commands, the
+        // draw and chunk tables and the chunk counts, each at an offset
+        // aligned for storage buffer binding.
+        struct FrameSlot {
+            Buffer culled;
+            Buffer setup;
+
+            std::vector<DrawRange> draws; // what setup was written for
+            uint32_t               chunkCount = 0;
+            VkDeviceSize           drawsOffset = 0;
+            VkDeviceSize           chunkDrawsOffset = 0;
+            VkDeviceSize           chunkCountsOffset = 0;
+
+            // Resident buffers replaced while this slot's frame was recorded
+            std::vector<Buffer> retired;
+        };
+
+        void createBuffer(Buffer &buffer, VkDeviceSize size, VkBufferUsageFlags usage,
+                          bool hostVisible);
+        void destroyBuffer(Buffer &buffer);
+        // Fills `copies` from a frame arena slice; false if nothing changed
+        bool updateResident(FrameSlot &slot, const SceneGraph &scene, VkBuffer &source);
+        void writeSetup(FrameSlot &slot, const std::vector<DrawRange> &draws);
+        // The frame's set, from the wrapper's DescriptorAllocator
+        VkDescriptorSet getDescriptorSet(const FrameSlot &slot);
+        void createPipeline();
+
+        VulkanWrapper &renderer;
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE; // owned by the layout cache
+        VkPipelineLayout      pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline            pipeline = VK_NULL_HANDLE;
+
+        Buffer            resident;
+        const SceneGraph *residentScene = nullptr;
+        uint64_t          residentVersion = 0;
+        uint32_t          residentCount = 0;
+
+        std::vector<FrameSlot> slots;
+        uint32_t               currentSlot = 0;
+
+        // Scratch for updateResident and getDescriptorSet
+        std::vector<uint32_t>     changes;
+        std::vector<VkBufferCopy> copies;
+        DescriptorSetWrites       writes;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SCENECULLER_H
@@ -0,0 +1,406 @@
+#include "SceneGraph.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr float kDegreesToRadians = 0.017453292519943295f;
+
+        // Instances of destroyed sprites are left empty until at least this
+        // many have piled up and they outnumber the live ones
+        constexpr size_t kCompactThreshold = 1024;
+    } // namespace
+
+    uint32_t SceneGraph::resolve(NodeHandle handle) const {
+        if (!isAlive(handle)) {
+            throw std::runtime_error("SceneGraph: stale or null node handle");
+        }
+        return handle.index;
+    }
+
+    bool SceneGraph::isAlive(NodeHandle handle) const {
+        return handle.index < nodes.size() && nodes[handle.index].generation == handle.generation &&
+               (nodes[handle.index].flags & kAlive);
+    }
+
+    uint32_t SceneGraph::allocateNode() {
+        uint32_t index;
+        if (!freeNodes.empty()) {
+            index = freeNodes.back();
+            freeNodes.pop_back();
+        } else {
+            index = static_cast<uint32_t>(nodes.size());
+            nodes.emplace_back();
+            locals.emplace_back();
+            worlds.emplace_back();
+            sprites.emplace_back();
+        }
+
+        uint32_t generation = nodes[index].generation;
+        nodes[index] = Node{};
+        nodes[index].generation = generation;
+        nodes[index].flags = kAlive | kVisible;
+        locals[index] = NodeTransform{};
+        sprites[index] = Sprite{};
+        return index;
+    }
+
+    void SceneGraph::link(uint32_t node, uint32_t parent) {
+        Node &child = nodes[node];
+        child.parent = parent;
+        if (parent == kNone) {
+            child.depth = 0;
+            return;
+        }
+
+        Node &owner = nodes[parent];
+        child.depth = owner.depth + 1;
+        child.nextSibling = owner.firstChild;
+        if (owner.firstChild != kNone)
+            nodes[owner.firstChild].prevSibling = node;
+        owner.firstChild = node;
+    }
+
+    void SceneGraph::unlink(uint32_t node) {
+        Node &child = nodes[node];
+        if (child.parent == kNone)
+            return;
+
+        if (child.prevSibling != kNone) {
+            nodes[child.prevSibling].nextSibling = child.nextSibling;
+        } else {
+            nodes[child.parent].firstChild = child.nextSibling;
+        }
+        if (child.nextSibling != kNone)
+            nodes[child.nextSibling].prevSibling = child.prevSibling;
+
+        child.parent = kNone;
+        child.prevSibling = kNone;
+        child.nextSibling = kNone;
+    }
+
+    void SceneGraph::markTransformDirty(uint32_t node) {
+        if (nodes[node].flags & kTransformDirty)
+            return;
+        nodes[node].flags |= kTransformDirty;
+        dirtyTransforms.push_back(node);
+    }
+
+    void SceneGraph::markSpriteDirty(uint32_t node) {
+        if (nodes[node].flags & kSpriteDirty)
+            return;
+        nodes[node].flags |= kSpriteDirty;
+        dirtySprites.push_back(node);
+    }
+
+    NodeHandle SceneGraph::createNode(NodeHandle parent) {
+        uint32_t parentIndex = parent.isNull() ? kNone : resolve(parent);
+        uint32_t index = allocateNode();
+        link(index, parentIndex);
+        markTransformDirty(index);
+        return NodeHandle{index, nodes[index].generation};
+    }
+
+    NodeHandle SceneGraph::createSprite(NodeHandle parent, float width, float height,
+                                        uint32_t texture, uint32_t color) {
+        NodeHandle handle = createNode(parent);
+
+        Node &node = nodes[handle.index];
+        node.instance = static_cast<uint32_t>(instances.size());
+        instances.push_back(SpriteInstance{});
+        instanceOwners.push_back(handle.index);
+        sprites[handle.index] = Sprite{width, height, texture, color};
+        textureVersion++;
+        return handle;
+    }
+
+    void SceneGraph::destroyNode(NodeHandle handle) {
+        uint32_t root = resolve(handle);
+        unlink(root);
+
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            stack.pop_back();
+
+            Node &node = nodes[index];
+            for (uint32_t child = node.firstChild; child != kNone;
+                 child = nodes[child].nextSibling) {
+                stack.push_back(child);
+            }
+
+            if (node.instance != kNone) {
+                instances[node.instance] = SpriteInstance{};
+                instanceOwners[node.instance] = kNone;
+                pendingChanges.push_back(node.instance);
+                freedInstances++;
+            }
+
+            uint32_t generation = node.generation + 1;
+            node = Node{};
+            node.generation = generation;
+            freeNodes.push_back(index);
+        }
+    }
+
+    void SceneGraph::setParent(NodeHandle handle, NodeHandle parent) {
+        uint32_t index = resolve(handle);
+        uint32_t parentIndex = parent.isNull() ? kNone : resolve(parent);
+
+        for (uint32_t ancestor = parentIndex; ancestor != kNone;
+             ancestor = nodes[ancestor].parent) {
+            if (ancestor == index)
+                throw std::runtime_error("SceneGraph: node cannot become its own descendant");
+        }
+
+        unlink(index);
+        link(index, parentIndex);
+
+        // Depths order the dirty list, so they must be right before update()
+        stack.clear();
+        for (uint32_t child = nodes[index].firstChild; child != kNone;
+             child = nodes[child].nextSibling) {
+            stack.push_back(child);
+        }
+        while (!stack.empty()) {
+            uint32_t node = stack.back();
+            stack.pop_back();
+            nodes[node].depth = nodes[nodes[node].parent].depth + 1;
+            for (uint32_t child = nodes[node].firstChild; child != kNone;
+                 child = nodes[child].nextSibling) {
+                stack.push_back(child);
+            }
+        }
+
+        markTransformDirty(index);
+    }
+
+    NodeHandle SceneGraph::getParent(NodeHandle handle) const {
+        uint32_t parent = nodes[resolve(handle)].parent;
+        if (parent == kNone)
+            return NodeHandle{};
+        return NodeHandle{parent, nodes[parent].generation};
+    }
+
+    void SceneGraph::setTransform(NodeHandle handle, const NodeTransform &transform) {
+        uint32_t index = resolve(handle);
+        locals[index] = transform;
+        markTransformDirty(index);
+    }
+
+    void SceneGraph::setPosition(NodeHandle handle, float x, float y) {
+        uint32_t index = resolve(handle);
+        locals[index].x = x;
+        locals[index].y = y;
+        markTransformDirty(index);
+    }
+
+    void SceneGraph::setRotation(NodeHandle handle, float degrees) {
+        uint32_t index = resolve(handle);
+        locals[index].rotation = degrees;
+        markTransformDirty(index);
+    }
+
+    void SceneGraph::setScale(NodeHandle handle, float scaleX, float scaleY) {
+        uint32_t index = resolve(handle);
+        locals[index].scaleX = scaleX;
+        locals[index].scaleY = scaleY;
+        markTransformDirty(index);
+    }
+
+    const NodeTransform &SceneGraph::getTransform(NodeHandle handle) const {
+        return locals[resolve(handle)];
+    }
+
+    void SceneGraph::setVisible(NodeHandle handle, bool visible) {
+        uint32_t index = resolve(handle);
+        if (static_cast<bool>(nodes[index].flags & kVisible) == visible)
+            return;
+
+        nodes[index].flags ^= kVisible;
+        markTransformDirty(index);
+    }
+
+    void SceneGraph::setSpriteSize(NodeHandle handle, float width, float height) {
+        uint32_t index = resolve(handle);
+        if (nodes[index].instance == kNone)
+            throw std::runtime_error("SceneGraph: node has no sprite");
+
+        sprites[index].width = width;
+        sprites[index].height = height;
+        markSpriteDirty(index);
+    }
+
+    void SceneGraph::setTexture(NodeHandle handle, uint32_t texture) {
+        uint32_t index = resolve(handle);
+        if (nodes[index].instance == kNone)
+            throw std::runtime_error("SceneGraph: node has no sprite");
+
+        sprites[index].texture = texture;
+        textureVersion++;
+        markSpriteDirty(index);
+    }
+
+    void SceneGraph::setColor(NodeHandle handle, uint32_t rgba) {
+        uint32_t index = resolve(handle);
+        if (nodes[index].instance == kNone)
+            throw std::runtime_error("SceneGraph: node has no sprite");
+
+        sprites[index].color = rgba;
+        markSpriteDirty(index);
+    }
+
+    void SceneGraph::updateSubtree(uint32_t root) {
+        static const Affine kIdentity{{1.0f, 0.0f, 0.0f, 0.0f, 1.0f, 0.0f}};
+
+        stack.clear();
+        stack.push_back(root);
+        while (!stack.empty()) {
+            uint32_t index = stack.back();
+            stack.pop_back();
+
+            Node &node = nodes[index];
+            bool  hasParent = node.parent != kNone;
+
+            // Parents are always current here: either untouched since the
+            // last update, or processed before their children
+            const Affine        &parent = hasParent ? worlds[node.parent] : kIdentity;
+            const NodeTransform &local = locals[index];
+
+            float radians = local.rotation * kDegreesToRadians;
+            float s = std::sin(radians);
+            float c = std::cos(radians);
+            float la = c * local.scaleX;
+            float lb = -s * local.scaleY;
+            float lc = s * local.scaleX;
+            float ld = c * local.scaleY;
+
+            const float *p = parent.m;
+            Affine      &world = worlds[index];
+            world.m[0] = p[0] * la + p[1] * lc;
+            world.m[1] = p[0] * lb + p[1] * ld;
+            world.m[2] = p[0] * local.x + p[1] * local.y + p[2];
+            world.m[3] = p[3] * la + p[4] * lc;
+            world.m[4] = p[3] * lb + p[4] * ld;
+            world.m[5] = p[3] * local.x + p[4] * local.y + p[5];
+
+            bool shown = (node.flags & kVisible) && (!hasParent || (nodes[node.parent].flags & kShown));
+            node.flags = static_cast<uint8_t>((node.flags & ~(kTransformDirty | kShown)) |
+                                              (shown ? kShown : 0));
+
+            if (node.instance != kNone)
+                writeInstance(index);
+            updatedNodes++;
+
+            for (uint32_t child = node.firstChild; child != kNone;
+                 child = nodes[child].nextSibling) {
+                stack.push_back(child);
+            }
+        }
+    }
+
+    void SceneGraph::writeInstance(uint32_t index) {
+        Node           &node = nodes[index];
+        SpriteInstance &instance = instances[node.instance];
+
+        if (node.flags & kShown) {
+            const Sprite &sprite = sprites[index];
+            const float  *m = worlds[index].m;
+
+            instance.row0[0] = m[0] * sprite.width;
+            instance.row0[1] = m[1] * sprite.height;
+            instance.row0[2] = m[2];
+            instance.row1[0] = m[3] * sprite.width;
+            instance.row1[1] = m[4] * sprite.height;
+            instance.row1[2] = m[5];
+            instance.texture = sprite.texture;
+            instance.color = sprite.color;
+        } else {
+            // Zero area: the quad is culled before rasterization. The texture
+            // stays so that showing the node again leaves draws unchanged.
+            instance = SpriteInstance{};
+            instance.texture = sprites[index].texture;
+        }
+
+        node.flags &= ~kSpriteDirty;
+        pendingChanges.push_back(node.instance);
+        writtenInstances++;
+    }
+
+    void SceneGraph::compact() {
+        size_t live = 0;
+        for (size_t i = 0; i < instances.size(); i++) {
+            uint32_t owner = instanceOwners[i];
+            if (owner == kNone)
+                continue;
+
+            instances[live] = instances[i];
+            instanceOwners[live] = owner;
+            nodes[owner].instance = static_cast<uint32_t>(live);
+            live++;
+        }
+
+        instances.resize(live);
+        instanceOwners.resize(live);
+        freedInstances = 0;
+        textureVersion++;
+    }
+
+    void SceneGraph::update() {
+        updatedNodes = 0;
+        writtenInstances = 0;
+
+        // Shallowest first, so a dirty ancestor clears its dirty
+        // descendants before they are reached
+        std::sort(dirtyTransforms.begin(), dirtyTransforms.end(),
+                  [this](uint32_t a, uint32_t b) { return nodes[a].depth < nodes[b].depth; });
+        for (uint32_t index : dirtyTransforms) {
+            if ((nodes[index].flags & kAlive) && (nodes[index].flags & kTransformDirty))
+                updateSubtree(index);
+        }
+        dirtyTransforms.clear();
+
+        for (uint32_t index : dirtySprites) {
+            if ((nodes[index].flags & kAlive) && (nodes[index].flags & kSpriteDirty))
+                writeInstance(index);
+        }
+        dirtySprites.clear();
+
+        bool compacted = freedInstances >= kCompactThreshold && freedInstances * 2 > instances.size();
+        if (compacted)
+            compact();
+
+        if (pendingChanges.empty() && !compacted)
+            return;
+
+        version++;
+        if (compacted) {
+            history.clear();
+            pendingChanges.clear();
+            fullCopyBefore = version;
+            return;
+        }
+
+        history.push_back(ChangeList{version, std::move(pendingChanges)});
+        pendingChanges.clear();
+        if (history.size() > kHistoryLength)
+            history.pop_front();
+    }
+
+    bool SceneGraph::getChangesSince(uint64_t since, std::vector<uint32_t> &out) const {
+        if (since >= version)
+            return true;
+        if (since < fullCopyBefore || history.empty() || history.front().version > since + 1)
+            return false;
+
+        for (const ChangeList &changes : history) {
+            if (changes.version > since)
+                out.insert(out.end(), changes.instances.begin(), changes.instances.end());
+        }
+        return true;
+    }
+
+} // namespace Retoccilus::Core
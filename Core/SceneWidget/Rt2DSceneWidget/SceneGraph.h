@@ -0,0 +1,176 @@
+#ifndef SCENEGRAPH_H
+#define SCENEGRAPH_H
+
+#include "SpriteBatch.h"
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Stable reference to a scene node. The generation detects handles to
+    // destroyed nodes whose slot has been reused.
+    struct NodeHandle {
+        uint32_t index = UINT32_MAX;
+        uint32_t generation = 0;
+
+        bool isNull() const { return index == UINT32_MAX; }
+        bool operator==(const NodeHandle &other) const {
+            return index == other.index && generation == other.generation;
+        }
+        bool operator!=(const NodeHandle &other) const { return !(*this == other); }
+    };
+
+    // Transform of a node relative to its parent. Children inherit it; the
+    // sprite size of a node does not propagate.
+    struct NodeTransform {
+        float x = 0.0f;
+        float y = 0.0f;
+        float rotation = 0.0f; // degrees
+        float scaleX = 1.0f;
+        float scaleY = 1.0f;
+    };
+
+    // Retained 2D scene: a hierarchy of nodes, some of which draw a sprite.
+    // Nodes live in contiguous pools and are recycled through a free list.
+    //
+    // Setters only flag the node. update() recomputes world transforms for
+    // the flagged subtrees alone, shallowest first, and rewrites just the
+    // sprite instances that changed; everything else keeps last frame's
+    // instance data. Each update() that changed something gets a new
+    // version, and getChangesSince() tells a consumer holding an older copy
+    // of the instances which ones to patch.
+    //
+    // Sprites draw in the order they were created. Destroyed sprites leave
+    // an empty instance behind until enough have piled up, at which point
+    // update() compacts the instances and consumers copy them in full.
+    //
+    // Not thread-safe.
+    class SceneGraph {
+      public:
+        NodeHandle createNode(NodeHandle parent = {});
+        // A node drawing a `width` x `height` sprite centred on its origin
+        NodeHandle createSprite(NodeHandle parent, float width, float height,
+                                uint32_t texture = 0, uint32_t color = 0xFFFFFFFFu);
+        // Destroys the node and its whole subtree
+        void destroyNode(NodeHandle node);
+        bool isAlive(NodeHandle node) const;
+
+        // Null `parent` makes the node a root. Throws if it would create a cycle.
+        void       setParent(NodeHandle node, NodeHandle parent);
+        NodeHandle getParent(NodeHandle node) const;
+
+        void                 setTransform(NodeHandle node, const NodeTransform &transform);
+        void                 setPosition(NodeHandle node, float x, float y);
+        void                 setRotation(NodeHandle node, float degrees);
+        void                 setScale(NodeHandle node, float scaleX, float scaleY);
+        const NodeTransform &getTransform(NodeHandle node) const;
+        // Hidden nodes hide their subtree
+        void setVisible(NodeHandle node, bool visible);
+
+        // Sprite properties of a node created with createSprite()
+        void setSpriteSize(NodeHandle node, float width, float height);
+        void setTexture(NodeHandle node, uint32_t texture);
+        void setColor(NodeHandle node, uint32_t rgba);
+
+        // Recomputes what changed since the last call
+        void update();
+
+        const std::vector<SpriteInstance> &getInstances() const { return instances; }
+        uint64_t                           getVersion() const { return version; }
+        // Bumped whenever an instance's texture may have changed, including
+        // when instances are added or compacted
+        uint64_t getTextureVersion() const { return textureVersion; }
+        // Appends the instances changed after `since` to `out`. Returns
+        // false when that is no longer known, and everything must be copied.
+        bool getChangesSince(uint64_t since, std::vector<uint32_t> &out) const;
+
+        size_t getNodeCount() const { return nodes.size() - freeNodes.size(); }
+        // Nodes recomputed and instances written by the last update()
+        size_t getUpdatedNodeCount() const { return updatedNodes; }
+        size_t getWrittenInstanceCount() const { return writtenInstances; }
+
+      private:
+        static constexpr uint32_t kNone = UINT32_MAX;
+        // Update versions whose change lists are kept
+        static constexpr size_t kHistoryLength = 8;
+
+        enum : uint8_t {
+            kAlive = 1 << 0,
+            kVisible = 1 << 1,
+            // World transform and visibility of the subtree are stale
+            kTransformDirty = 1 << 2,
+            // Only the node's own instance is stale (size, texture, colour)
+            kSpriteDirty = 1 << 3,
+            // Effective visibility after the last update
+            kShown = 1 << 4
+        };
+
+        // 2x3 affine, rows as in SpriteInstance
+        struct Affine {
+            float m[6];
+        };
+
+        struct Node {
+            uint32_t parent = kNone;
+            uint32_t firstChild = kNone;
+            uint32_t nextSibling = kNone;
+            uint32_t prevSibling = kNone;
+            uint32_t depth = 0;
+            uint32_t generation = 0;
+            uint32_t instance = kNone;
+            uint8_t  flags = 0;
+        };
+
+        struct Sprite {
+            float    width = 0.0f;
+            float    height = 0.0f;
+            uint32_t texture = 0;
+            uint32_t color = 0xFFFFFFFFu;
+        };
+
+        struct ChangeList {
+            uint64_t              version;
+            std::vector<uint32_t> instances;
+        };
+
+        uint32_t resolve(NodeHandle node) const;
+        uint32_t allocateNode();
+        void     link(uint32_t node, uint32_t parent);
+        void     unlink(uint32_t node);
+        void     markTransformDirty(uint32_t node);
+        void     markSpriteDirty(uint32_t node);
+        void     updateSubtree(uint32_t root);
+        void     writeInstance(uint32_t node);
+        void     compact();
+
+        // Node pools, indexed by node
+        std::vector<Node>          nodes;
+        std::vector<NodeTransform> locals;
+        std::vector<Affine>        worlds;
+        std::vector<Sprite>        sprites;
+        std::vector<uint32_t>      freeNodes;
+
+        std::vector<SpriteInstance> instances;
+        std::vector<uint32_t>       instanceOwners; // node per instance, kNone if freed
+        size_t                      freedInstances = 0;
+
+        std::vector<uint32_t> dirtyTransforms;
+        std::vector<uint32_t> dirtySprites;
+        std::vector<uint32_t> stack; // scratch for updateSubtree
+
+        uint64_t               version = 0;
+        uint64_t               textureVersion = 0;
+        std::vector<uint32_t>  pendingChanges;
+        std::deque<ChangeList> history;
+        // Versions at or before this need a full copy
+        uint64_t fullCopyBefore = 0;
+
+        size_t updatedNodes = 0;
+        size_t writtenInstances = 0;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SCENEGRAPH_H
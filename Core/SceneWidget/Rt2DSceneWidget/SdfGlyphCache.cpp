@@ -0,0 +1,418 @@
+#include "SdfGlyphCache.h"
+#include "Core/VulkanWrapper/VulkanWrapper.h"
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        struct SizeClassInfo {
+            uint32_t emPixels;
+            uint32_t cellSize;
+        };
+
+        // Cells leave room for glyphs a little over an em plus the spread
+        constexpr SizeClassInfo kSizeClasses[SdfGlyphCache::kSizeClassCount] = {
+            {16, 24}, {32, 48}, {64, 96}};
+        // A multiple of every cell size
+        constexpr uint32_t kBlockSize = 96;
+        // Coverage is rasterised this many times finer per axis than the
+        // field, whose texels average the distances of their samples
+        constexpr uint32_t kSupersampling = 4;
+        constexpr float    kFar = 1e20f;
+
+        // Distance, in field texels, over which the field goes from 0 to 1
+        float spreadOf(const SizeClassInfo &info) {
+            return info.emPixels / 8.0f;
+        }
+
+        uint64_t makeKey(SdfGlyphCache::FontId font, uint32_t glyph, uint32_t sizeClass) {
+            // Never 0, which marks free cells
+            return (static_cast<uint64_t>(font) + 1) << 40 |
+                   static_cast<uint64_t>(sizeClass) << 32 | glyph;
+        }
+
+        uint32_t alignUp(uint32_t value, uint32_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        // Squared Euclidean distance transform of one row or column, in
+        // place (Felzenszwalb and Huttenlocher, "Distance Transforms of
+        // Sampled Functions"). Entries of kFar are no seeds; the lower
+        // envelope is built from the others only, which keeps the
+        // arithmetic exact in floats.
+        void distanceTransform(float *values, uint32_t count, uint32_t stride, float *f,
+                               uint32_t *v, float *z) {
+            uint32_t k = 0;
+            bool     seeded = false;
+            for (uint32_t q = 0; q < count; q++) {
+                f[q] = values[static_cast<size_t>(q) * stride];
+                if (f[q] >= kFar)
+                    continue;
+                if (!seeded) {
+                    v[0] = q;
+                    z[0] = -kFar;
+                    z[1] = kFar;
+                    seeded = true;
+                    continue;
+                }
+
+                float s;
+                for (;;) {
+                    float r = static_cast<float>(v[k]);
+                    s = ((f[q] + static_cast<float>(q) * q) - (f[v[k]] + r * r)) /
+                        (2.0f * (static_cast<float>(q) - r));
+                    if (s > z[k] || k == 0)
+                        break;
+                    k--;
+                }
+                k++;
+                v[k] = q;
+                z[k] = s;
+                z[k + 1] = kFar;
+            }
+            if (!seeded)
+                return;
+
+            k = 0;
+            for (uint32_t q = 0; q < count; q++) {
+                while (z[k + 1] < static_cast<float>(q))
+                    k++;
+                float d = static_cast<float>(q) - static_cast<float>(v[k]);
+                values[static_cast<size_t>(q) * stride] = d * d + f[v[k]];
+            }
+        }
+
+        void distanceTransform(std::vector<float> &grid, uint32_t size, std::vector<float> &f,
+                               std::vector<uint32_t> &v, std::vector<float> &z) {
+            for (uint32_t x = 0; x < size; x++)
+                distanceTransform(grid.data() + x, size, size, f.data(), v.data(), z.data());
+            for (uint32_t y = 0; y < size; y++) {
+                distanceTransform(grid.data() + static_cast<size_t>(y) * size, size, 1, f.data(),
+                                  v.data(), z.data());
+            }
+        }
+    } // namespace
+
+    SdfGlyphCache::SdfGlyphCache(VulkanWrapper &renderer, SpriteTextures &textures,
+                                 const Config &config)
+        : renderer(renderer), textures(textures) {
+        uint32_t limit = renderer.getDeviceCapabilities().properties.limits.maxImageDimension2D;
+        atlasSize = std::min(config.atlasSize, limit) / kBlockSize * kBlockSize;
+        if (atlasSize == 0) {
+            throw std::runtime_error("Glyph atlas smaller than one block");
+        }
+        blocksPerRow = atlasSize / kBlockSize;
+
+        atlasImage = textures.createDistanceFieldImage(atlasSize, atlasSize);
+        stateKey = textures.reserve();
+        textures.setRegion(stateKey, atlasImage, 0, 0, atlasSize, atlasSize);
+    }
+
+    SdfGlyphCache::FontId SdfGlyphCache::addFont(std::shared_ptr<const FontSource> font) {
+        if (!font) {
+            throw std::runtime_error("Glyph cache font is null");
+        }
+        fonts.push_back(std::move(font));
+        return static_cast<FontId>(fonts.size() - 1);
+    }
+
+    uint32_t SdfGlyphCache::sizeClassFor(float pixelsPerEm) {
+        // A field reads well from about half to twice its size; the
+        // thresholds keep every class within that
+        if (pixelsPerEm <= 20.0f)
+            return 0;
+        if (pixelsPerEm <= 40.0f)
+            return 1;
+        return 2;
+    }
+
+    SdfGlyphCache::EntryId SdfGlyphCache::acquire(FontId font, uint32_t glyph, uint32_t sizeClass) {
+        uint64_t key = makeKey(font, glyph, sizeClass);
+        auto     found = lookup.find(key);
+        if (found != lookup.end()) {
+            touch(found->second);
+            return found->second;
+        }
+
+        EntryId id = findCell(sizeClass);
+        if (id == kNoEntry) {
+            dropped++;
+            return kNoEntry;
+        }
+
+        // Glyphs whose ink does not fit a cell at the class's em size are
+        // rasterised smaller; the quad stays the same size in ems
+        const SizeClassInfo &info = kSizeClasses[sizeClass];
+        GlyphMetrics         metrics = fonts[font]->getGlyphMetrics(glyph);
+        float                inkWidth = std::max(metrics.maxX - metrics.minX, 0.0f);
+        float                inkHeight = std::max(metrics.maxY - metrics.minY, 0.0f);
+        float                spread = spreadOf(info);
+        float                room = info.cellSize - 2.0f * spread;
+        float                pixelsPerEm = static_cast<float>(info.emPixels);
+        float                largest = std::max(inkWidth, inkHeight) * pixelsPerEm;
+        if (largest > room)
+            pixelsPerEm *= room / largest;
+
+        Entry &entry = entries[id];
+        entry.key = key;
+        entry.font = font;
+        entry.index = glyph;
+        entry.pixelsPerEm = pixelsPerEm;
+        entry.originX = spread - metrics.minX * pixelsPerEm;
+        entry.originY = spread - metrics.minY * pixelsPerEm;
+
+        // The quad covers only the used part of the cell
+        uint32_t width = std::min(
+            static_cast<uint32_t>(std::ceil(inkWidth * pixelsPerEm + 2.0f * spread)), info.cellSize);
+        uint32_t height = std::min(
+            static_cast<uint32_t>(std::ceil(inkHeight * pixelsPerEm + 2.0f * spread)), info.cellSize);
+        entry.glyph.minX = -entry.originX / pixelsPerEm;
+        entry.glyph.minY = -entry.originY / pixelsPerEm;
+        entry.glyph.maxX = (width - entry.originX) / pixelsPerEm;
+        entry.glyph.maxY = (height - entry.originY) / pixelsPerEm;
+        textures.setRegion(entry.glyph.texture, atlasImage, entry.x, entry.y, width, height);
+
+        lookup.emplace(key, id);
+        entry.lastUsed = frame;
+        linkNewest(id);
+        if (!entry.queued) {
+            entry.queued = true;
+            pending.push_back(id);
+        }
+        return id;
+    }
+
+    void SdfGlyphCache::touch(EntryId id) {
+        Entry &entry = entries[id];
+        entry.lastUsed = frame;
+        if (classes[entry.sizeClass].newest != id) {
+            unlink(id);
+            linkNewest(id);
+        }
+    }
+
+    bool SdfGlyphCache::allocateBlock(uint32_t sizeClass) {
+        if (nextBlock >= blocksPerRow * blocksPerRow)
+            return false;
+
+        uint32_t blockX = nextBlock % blocksPerRow * kBlockSize;
+        uint32_t blockY = nextBlock / blocksPerRow * kBlockSize;
+        nextBlock++;
+
+        // Pushed in reverse, so cells are handed out in order
+        uint32_t cellSize = kSizeClasses[sizeClass].cellSize;
+        uint32_t cells = kBlockSize / cellSize;
+        for (uint32_t i = cells * cells; i-- > 0;) {
+            Entry entry;
+            entry.x = blockX + i % cells * cellSize;
+            entry.y = blockY + i / cells * cellSize;
+            entry.sizeClass = sizeClass;
+            entry.glyph.texture = textures.reserve();
+
+            entries.push_back(entry);
+            classes[sizeClass].free.push_back(static_cast<EntryId>(entries.size() - 1));
+        }
+        return true;
+    }
+
+    SdfGlyphCache::EntryId SdfGlyphCache::findCell(uint32_t sizeClass) {
+        SizeClass &cells = classes[sizeClass];
+        if (cells.free.empty())
+            allocateBlock(sizeClass);
+        if (!cells.free.empty()) {
+            EntryId id = cells.free.back();
+            cells.free.pop_back();
+            return id;
+        }
+
+        // Evict the least recently used glyph, unless the frame needs it
+        EntryId oldest = cells.oldest;
+        if (oldest == kNoEntry || entries[oldest].lastUsed >= frame)
+            return kNoEntry;
+
+        lookup.erase(entries[oldest].key);
+        entries[oldest].key = 0;
+        unlink(oldest);
+        epoch++;
+        evicted++;
+        return oldest;
+    }
+
+    void SdfGlyphCache::unlink(EntryId id) {
+        Entry     &entry = entries[id];
+        SizeClass &cells = classes[entry.sizeClass];
+        if (entry.newer != kNoEntry) {
+            entries[entry.newer].older = entry.older;
+        } else {
+            cells.newest = entry.older;
+        }
+        if (entry.older != kNoEntry) {
+            entries[entry.older].newer = entry.newer;
+        } else {
+            cells.oldest = entry.newer;
+        }
+        entry.newer = kNoEntry;
+        entry.older = kNoEntry;
+    }
+
+    void SdfGlyphCache::linkNewest(EntryId id) {
+        Entry     &entry = entries[id];
+        SizeClass &cells = classes[entry.sizeClass];
+        entry.newer = kNoEntry;
+        entry.older = cells.newest;
+        if (cells.newest != kNoEntry) {
+            entries[cells.newest].newer = id;
+        } else {
+            cells.oldest = id;
+        }
+        cells.newest = id;
+    }
+
+    void SdfGlyphCache::rasterize(const Entry &entry, uint8_t *out) const {
+        const SizeClassInfo &info = kSizeClasses[entry.sizeClass];
+        uint32_t             cellSize = info.cellSize;
+        uint32_t             size = cellSize * kSupersampling;
+        size_t               samples = static_cast<size_t>(size) * size;
+
+        std::vector<uint8_t> coverage(samples);
+        fonts[entry.font]->rasterize(entry.index, entry.pixelsPerEm * kSupersampling,
+                                     entry.originX * kSupersampling,
+                                     entry.originY * kSupersampling, size, size, coverage.data());
+
+        // Squared distances of every sample to the nearest sample inside
+        // the glyph, and to the nearest one outside it
+        std::vector<float> toInside(samples);
+        std::vector<float> toOutside(samples);
+        for (size_t i = 0; i < samples; i++) {
+            bool inside = coverage[i] >= 128;
+            toInside[i] = inside ? 0.0f : kFar;
+            toOutside[i] = inside ? kFar : 0.0f;
+        }
+
+        std::vector<float>    f(size);
+        std::vector<uint32_t> v(size);
+        std::vector<float>    z(size + 1);
+        distanceTransform(toInside, size, f, v, z);
+        distanceTransform(toOutside, size, f, v, z);
+
+        // Each texel averages the signed distances of its samples, which
+        // are measured to the boundary halfway between samples
+        float spread = spreadOf(info);
+        float scale = 1.0f / (kSupersampling * kSupersampling * kSupersampling);
+        for (uint32_t y = 0; y < cellSize; y++) {
+            for (uint32_t x = 0; x < cellSize; x++) {
+                float sum = 0.0f;
+                for (uint32_t sy = 0; sy < kSupersampling; sy++) {
+                    size_t row = static_cast<size_t>(y * kSupersampling + sy) * size;
+                    for (uint32_t sx = 0; sx < kSupersampling; sx++) {
+                        size_t i = row + x * kSupersampling + sx;
+                        sum += toInside[i] == 0.0f ? std::sqrt(toOutside[i]) - 0.5f
+                                                   : 0.5f - std::sqrt(toInside[i]);
+                    }
+                }
+
+                // Samples to field texels
+                float distance = sum * scale;
+                float value = 0.5f + distance / (2.0f * spread);
+                out[static_cast<size_t>(y) * cellSize + x] =
+                    static_cast<uint8_t>(std::clamp(value, 0.0f, 1.0f) * 255.0f + 0.5f);
+            }
+        }
+    }
+
+    RenderGraph::Resource SdfGlyphCache::declarePasses(RenderGraph &graph) {
+        if (pending.empty())
+            return {};
+
+        FrameProfiler::CpuScope scope(renderer.getProfiler(), "SdfGlyphCache::rasterize");
+
+        // Whole cells are uploaded, so nothing of an evicted glyph remains
+        // around a smaller one. Buffer offsets of copies are multiples of 4.
+        offsets.resize(pending.size());
+        VkDeviceSize total = 0;
+        for (size_t i = 0; i < pending.size(); i++) {
+            uint32_t cellSize = kSizeClasses[entries[pending[i]].sizeClass].cellSize;
+            offsets[i] = total;
+            total += alignUp(cellSize * cellSize, 4);
+        }
+
+        FrameArena::Slice staging = renderer.getFrameArena().allocate(total, 4);
+        uint8_t          *texels = static_cast<uint8_t *>(staging.data);
+        renderer.getContext().getJobSystem().parallelFor(
+            static_cast<uint32_t>(pending.size()), 4, [&](uint32_t begin, uint32_t end) {
+                for (uint32_t i = begin; i < end; i++)
+                    rasterize(entries[pending[i]], texels + offsets[i]);
+            });
+
+        copies.clear();
+        for (size_t i = 0; i < pending.size(); i++) {
+            Entry   &entry = entries[pending[i]];
+            uint32_t cellSize = kSizeClasses[entry.sizeClass].cellSize;
+
+            VkBufferImageCopy copy{};
+            copy.bufferOffset = staging.offset + offsets[i];
+            copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+            copy.imageOffset = {static_cast<int32_t>(entry.x), static_cast<int32_t>(entry.y), 0};
+            copy.imageExtent = {cellSize, cellSize, 1};
+            copies.push_back(copy);
+
+            entry.queued = false;
+        }
+        rasterized += static_cast<uint32_t>(pending.size());
+        pending.clear();
+
+        // Earlier frames leave the atlas in SHADER_READ_ONLY_OPTIMAL; the
+        // graph waits for their fragment reads before the copy
+        RenderGraph::ImportedImage atlas;
+        atlas.image = textures.getImage(atlasImage);
+        atlas.view = textures.getImageView(atlasImage);
+        atlas.format = VK_FORMAT_R8_UNORM;
+        atlas.extent = {atlasSize, atlasSize};
+        if (atlasWritten) {
+            atlas.initialLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            atlas.initialStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        }
+        atlas.finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        atlas.finalStage = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT;
+        atlas.finalAccess = VK_ACCESS_SHADER_READ_BIT;
+
+        RenderGraph::Resource resource = graph.importImage("GlyphAtlas", atlas);
+
+        VkBuffer buffer = staging.buffer;
+        VkImage  image = atlas.image;
+        auto pass = graph.addPass("GlyphUpload", [this, buffer, image](const RenderGraph::PassContext &context) {
+            vkCmdCopyBufferToImage(context.cmd, buffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   static_cast<uint32_t>(copies.size()), copies.data());
+        });
+        // Kept when no pass draws glyphs, so the atlas still ends the frame
+        // in the layout later frames expect
+        pass.write(resource, RenderGraphAccess::TransferWrite).sideEffects();
+
+        // The copy is recorded ahead of every draw of the frame
+        if (!atlasWritten) {
+            textures.setImageReady(atlasImage);
+            atlasWritten = true;
+        }
+        return resource;
+    }
+
+    void SdfGlyphCache::endFrame() {
+        frame++;
+        rasterized = 0;
+        dropped = 0;
+    }
+
+    SdfGlyphCache::Stats SdfGlyphCache::getStats() const {
+        Stats stats;
+        stats.glyphs = static_cast<uint32_t>(lookup.size());
+        stats.blocksUsed = nextBlock;
+        stats.blocks = blocksPerRow * blocksPerRow;
+        stats.rasterized = rasterized;
+        stats.dropped = dropped;
+        stats.evicted = evicted;
+        return stats;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,167 @@
+#ifndef SDFGLYPHCACHE_H
+#define SDFGLYPHCACHE_H
+
+#include "Core/VulkanWrapper/RenderGraph.h"
+#include "FontSource.h"
+#include "SpriteTextures.h"
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    class VulkanWrapper;
+
+    // Glyphs rasterised on demand into a signed distance field atlas, one
+    // R8 image of SpriteTextures. A distance field keeps outlines sharp
+    // when it is magnified or minified by a factor of a few, so a glyph is
+    // rasterised at one of kSizeClassCount em sizes and drawn from there
+    // at any scale; the size class is picked from the on-screen size only
+    // so that small text does not sample a field far larger than needed.
+    //
+    // The atlas is split into square blocks, each handed to one size class
+    // when it needs room and cut into cells of that class. Every cell is a
+    // sprite texture of its own whose region is the glyph it holds, so
+    // glyphs are drawn as ordinary sprite instances. When a class runs out
+    // of blocks, the least recently used glyph of the class is evicted;
+    // glyphs used in the current frame never are, and a glyph that finds
+    // no cell is dropped for the frame.
+    //
+    // Glyphs are rasterised when the frame's passes are declared, across
+    // the job system, into the frame arena, and copied into the atlas by a
+    // transfer pass ahead of the frame's draws.
+    class SdfGlyphCache {
+      public:
+        using FontId = uint32_t;
+        using EntryId = uint32_t;
+
+        static constexpr EntryId  kNoEntry = UINT32_MAX;
+        static constexpr uint32_t kSizeClassCount = 3;
+
+        struct Config {
+            // Rounded down to whole blocks, clamped to the device limit
+            uint32_t atlasSize = 2048;
+        };
+
+        // Quad of a cached glyph, in em units from its origin on the
+        // baseline, y down; covers the ink plus the field's spread
+        struct Glyph {
+            SpriteTextures::TextureId texture;
+            float                     minX;
+            float                     minY;
+            float                     maxX;
+            float                     maxY;
+        };
+
+        struct Stats {
+            uint32_t glyphs = 0;
+            uint32_t blocksUsed = 0;
+            uint32_t blocks = 0;
+            // Of the current frame
+            uint32_t rasterized = 0;
+            uint32_t dropped = 0;
+            // Since creation
+            uint64_t evicted = 0;
+        };
+
+        SdfGlyphCache(VulkanWrapper &renderer, SpriteTextures &textures, const Config &config);
+
+        SdfGlyphCache(const SdfGlyphCache &) = delete;
+        SdfGlyphCache &operator=(const SdfGlyphCache &) = delete;
+
+        FontId            addFont(std::shared_ptr<const FontSource> font);
+        const FontSource &getFont(FontId font) const { return *fonts[font]; }
+        uint32_t          getFontCount() const { return static_cast<uint32_t>(fonts.size()); }
+
+        // Size class for glyphs drawn `pixelsPerEm` pixels high
+        static uint32_t sizeClassFor(float pixelsPerEm);
+
+        // The cached glyph, rasterised by the next declarePasses() if it is
+        // new; kNoEntry if the class has no cell to spare this frame.
+        // Marks the glyph used in the current frame.
+        EntryId acquire(FontId font, uint32_t glyph, uint32_t sizeClass);
+        // Marks a glyph returned by acquire() used in the current frame.
+        // Only valid while getEpoch() has not changed since.
+        void         touch(EntryId entry);
+        const Glyph &getGlyph(EntryId entry) const { return entries[entry].glyph; }
+        // Changes whenever a glyph is evicted and its entry reused
+        uint64_t getEpoch() const { return epoch; }
+
+        // Batcher state key for glyph sprites: a texture on the atlas
+        // image, so it shares a draw with every glyph
+        SpriteTextures::TextureId getStateKey() const { return stateKey; }
+
+        // Rasterises the new glyphs and declares the pass that copies them
+        // into the atlas. Returns the atlas, which the passes that draw
+        // glyphs must read as FragmentSampled, or a null resource if
+        // nothing was uploaded this frame.
+        RenderGraph::Resource declarePasses(RenderGraph &graph);
+        // Starts the next frame's use tracking
+        void endFrame();
+
+        Stats getStats() const;
+
+      private:
+        struct Entry {
+            uint64_t key = 0; // 0 while the cell is free
+            FontId   font = 0;
+            uint32_t index = 0; // glyph index in the font
+            Glyph    glyph{};   // texture is the cell's, whatever it holds
+            uint32_t x = 0;     // cell origin in the atlas
+            uint32_t y = 0;
+            uint32_t sizeClass = 0;
+            // Rasterisation, in cell pixels
+            float    pixelsPerEm = 0.0f;
+            float    originX = 0.0f;
+            float    originY = 0.0f;
+            uint64_t lastUsed = 0;
+            bool     queued = false; // in pending
+            // Least recently used list of the size class, newest first
+            EntryId  newer = kNoEntry;
+            EntryId  older = kNoEntry;
+        };
+
+        struct SizeClass {
+            EntryId              newest = kNoEntry;
+            EntryId              oldest = kNoEntry;
+            std::vector<EntryId> free;
+        };
+
+        bool    allocateBlock(uint32_t sizeClass);
+        EntryId findCell(uint32_t sizeClass);
+        void    unlink(EntryId entry);
+        void    linkNewest(EntryId entry);
+        void    rasterize(const Entry &entry, uint8_t *out) const;
+
+        VulkanWrapper  &renderer;
+        SpriteTextures &textures;
+
+        uint32_t                  atlasImage;
+        uint32_t                  atlasSize;
+        SpriteTextures::TextureId stateKey;
+        bool                      atlasWritten = false;
+        uint32_t                  blocksPerRow;
+        uint32_t                  nextBlock = 0;
+
+        std::vector<std::shared_ptr<const FontSource>> fonts;
+        std::vector<Entry>                             entries;
+        std::unordered_map<uint64_t, EntryId>          lookup;
+        SizeClass                                      classes[kSizeClassCount];
+        std::vector<EntryId>                           pending;
+
+        uint64_t frame = 1;
+        uint64_t epoch = 1;
+        uint32_t rasterized = 0;
+        uint32_t dropped = 0;
+        uint64_t evicted = 0;
+
+        // Scratch for declarePasses()
+        std::vector<VkDeviceSize>      offsets;
+        std::vector<VkBufferImageCopy> copies;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SDFGLYPHCACHE_H
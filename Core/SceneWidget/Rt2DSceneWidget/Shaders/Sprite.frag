@@ -0,0 +1,27 @@
+#version 450
+
+// Without descriptor indexing the array may only be indexed with a value
+// that is uniform across the draw; SpriteRenderer splits draws wherever
+// the image changes. Size matches SpriteTextures::kFallbackImageCount.
+layout(set = 0, binding = 1) uniform sampler2D textures[16];
+
+layout(location = 0) in vec2 fragUV;
+layout(location = 1) in vec4 fragColor;
+layout(location = 2) flat in uint fragImage;
+layout(location = 3) flat in uint fragFlags;
+
+layout(location = 0) out vec4 outColor;
+
+// Texels of distance-field images hold 0.5 on the glyph outline; the
+// edge is smoothed over one screen pixel at any scale
+vec4 shade(vec4 texel, uint flags) {
+    float width = 0.5 * fwidth(texel.r);
+    if ((flags & 1u) == 0u)
+        return texel * fragColor;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, texel.r);
+    return vec4(fragColor.rgb, fragColor.a * alpha);
+}
+
+void main() {
+    outColor = shade(texture(textures[fragImage], fragUV), fragFlags);
+}
@@ -0,0 +1,49 @@
+#version 450
+
+// Per-instance 2x3 affine transform, see SpriteInstance in SpriteBatch.h
+layout(location = 0) in vec3 inRow0;
+layout(location = 1) in uint inTexture;
+layout(location = 2) in vec3 inRow1;
+layout(location = 3) in uint inColor;
+
+layout(push_constant) uniform PushConstants {
+    vec2 scale;
+    vec2 offset;
+} pc;
+
+// Where each texture lives, see SpriteTextures
+struct TextureRegion {
+    vec4 uv; // u0, v0, u1, v1
+    uint image;
+    uint flags; // SpriteTextures::kDistanceField
+};
+
+layout(std430, set = 0, binding = 0) readonly buffer TextureRegions {
+    TextureRegion regions[];
+};
+
+layout(location = 0) out vec2 fragUV;
+layout(location = 1) out vec4 fragColor;
+layout(location = 2) flat out uint fragImage;
+layout(location = 3) flat out uint fragFlags;
+
+const vec2 corners[4] = vec2[](
+    vec2(-0.5, -0.5),
+    vec2( 0.5, -0.5),
+    vec2(-0.5,  0.5),
+    vec2( 0.5,  0.5));
+
+void main() {
+    vec3 corner = vec3(corners[gl_VertexIndex], 1.0);
+    vec2 world = vec2(dot(inRow0, corner), dot(inRow1, corner));
+
+    // Unknown texture indices fall back to texture 0 (white)
+    uint texture = inTexture < uint(regions.length()) ? inTexture : 0u;
+    TextureRegion region = regions[texture];
+
+    gl_Position = vec4(world * pc.scale + pc.offset, 0.0, 1.0);
+    fragUV = mix(region.uv.xy, region.uv.zw, corner.xy + 0.5);
+    fragColor = unpackUnorm4x8(inColor);
+    fragImage = region.image;
+    fragFlags = region.flags;
+}
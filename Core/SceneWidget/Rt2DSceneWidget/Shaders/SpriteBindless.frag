@@ -0,0 +1,26 @@
+#version 450
+#extension GL_EXT_nonuniform_qualifier : require
+
+// Every sprite texture image, indexed per fragment (descriptor indexing)
+layout(set = 0, binding = 1) uniform sampler2D textures[];
+
+layout(location = 0) in vec2 fragUV;
+layout(location = 1) in vec4 fragColor;
+layout(location = 2) flat in uint fragImage;
+layout(location = 3) flat in uint fragFlags;
+
+layout(location = 0) out vec4 outColor;
+
+// Texels of distance-field images hold 0.5 on the glyph outline; the
+// edge is smoothed over one screen pixel at any scale
+vec4 shade(vec4 texel, uint flags) {
+    float width = 0.5 * fwidth(texel.r);
+    if ((flags & 1u) == 0u)
+        return texel * fragColor;
+    float alpha = smoothstep(0.5 - width, 0.5 + width, texel.r);
+    return vec4(fragColor.rgb, fragColor.a * alpha);
+}
+
+void main() {
+    outColor = shade(texture(textures[nonuniformEXT(fragImage)], fragUV), fragFlags);
+}
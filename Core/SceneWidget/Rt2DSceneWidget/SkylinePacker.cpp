@@ -0,0 +1,100 @@
+#include "SkylinePacker.h"
+#include <algorithm>
+
+namespace Retoccilus::Core {
+
+    SkylinePacker::SkylinePacker(uint32_t width, uint32_t height)
+        : pageWidth(width), pageHeight(height) {
+        clear();
+    }
+
+    void SkylinePacker::clear() {
+        skyline.assign(1, Segment{0, 0, pageWidth});
+        usedArea = 0;
+    }
+
+    float SkylinePacker::occupancy() const {
+        return static_cast<float>(usedArea) /
+               (static_cast<float>(pageWidth) * static_cast<float>(pageHeight));
+    }
+
+    bool SkylinePacker::fitAt(size_t index, uint32_t width, uint32_t height,
+                              uint32_t &y) const {
+        if (skyline[index].x + width > pageWidth)
+            return false;
+
+        // The rectangle rests on the highest segment it spans
+        y = 0;
+        uint32_t remaining = width;
+        for (size_t i = index; remaining > 0; i++) {
+            y = std::max(y, skyline[i].y);
+            if (y + height > pageHeight)
+                return false;
+            remaining -= std::min(remaining, skyline[i].width);
+        }
+        return true;
+    }
+
+    bool SkylinePacker::pack(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y) {
+        if (width == 0 || height == 0 || width > pageWidth || height > pageHeight)
+            return false;
+
+        size_t   bestIndex = skyline.size();
+        uint32_t bestTop = UINT32_MAX;
+        uint32_t bestWidth = UINT32_MAX;
+
+        for (size_t i = 0; i < skyline.size(); i++) {
+            uint32_t top;
+            if (!fitAt(i, width, height, top))
+                continue;
+
+            // Lowest top edge first, then the narrowest resting segment so
+            // wide gaps are left for wide rectangles
+            top += height;
+            if (top < bestTop || (top == bestTop && skyline[i].width < bestWidth)) {
+                bestIndex = i;
+                bestTop = top;
+                bestWidth = skyline[i].width;
+            }
+        }
+
+        if (bestIndex == skyline.size())
+            return false;
+
+        x = skyline[bestIndex].x;
+        y = bestTop - height;
+        place(bestIndex, x, y, width, height);
+        usedArea += static_cast<uint64_t>(width) * height;
+        return true;
+    }
+
+    void SkylinePacker::place(size_t index, uint32_t x, uint32_t y, uint32_t width,
+                              uint32_t height) {
+        skyline.insert(skyline.begin() + index, Segment{x, y + height, width});
+
+        // Trim or drop the segments now hidden under the new one
+        uint32_t right = x + width;
+        size_t   i = index + 1;
+        while (i < skyline.size() && skyline[i].x < right) {
+            uint32_t segmentRight = skyline[i].x + skyline[i].width;
+            if (segmentRight <= right) {
+                skyline.erase(skyline.begin() + i);
+                continue;
+            }
+            skyline[i].width = segmentRight - right;
+            skyline[i].x = right;
+            break;
+        }
+
+        // Merge neighbours at the same height
+        for (size_t j = 0; j + 1 < skyline.size();) {
+            if (skyline[j].y == skyline[j + 1].y) {
+                skyline[j].width += skyline[j + 1].width;
+                skyline.erase(skyline.begin() + j + 1);
+            } else {
+                j++;
+            }
+        }
+    }
+
+} // namespace Retoccilus::Core
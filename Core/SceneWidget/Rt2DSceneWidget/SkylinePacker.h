@@ -0,0 +1,48 @@
+#ifndef SKYLINEPACKER_H
+#define SKYLINEPACKER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Packs rectangles into a fixed-size page with the skyline bottom-left
+    // heuristic: the top edge of the packed area is kept as a list of
+    // horizontal segments, and each rectangle goes where its top edge ends
+    // up lowest. Fast and tight for sprite-sized images, especially when
+    // they are packed tallest first.
+    class SkylinePacker {
+      public:
+        SkylinePacker(uint32_t width, uint32_t height);
+
+        // Finds room for a `width` x `height` rectangle and returns its
+        // top-left corner; false when the page is full.
+        bool pack(uint32_t width, uint32_t height, uint32_t &x, uint32_t &y);
+        void clear();
+
+        uint32_t getWidth() const { return pageWidth; }
+        uint32_t getHeight() const { return pageHeight; }
+        // Fraction of the page covered by packed rectangles
+        float occupancy() const;
+
+      private:
+        struct Segment {
+            uint32_t x;
+            uint32_t y;
+            uint32_t width;
+        };
+
+        // Lowest y at which a rectangle starting at segment `index` fits
+        bool fitAt(size_t index, uint32_t width, uint32_t height, uint32_t &y) const;
+        void place(size_t index, uint32_t x, uint32_t y, uint32_t width, uint32_t height);
+
+        uint32_t             pageWidth;
+        uint32_t             pageHeight;
+        uint64_t             usedArea = 0;
+        std::vector<Segment> skyline;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SKYLINEPACKER_H
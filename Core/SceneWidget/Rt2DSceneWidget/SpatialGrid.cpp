@@ -0,0 +1,175 @@
+#include "SpatialGrid.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        void eraseId(std::vector<uint32_t> &items, uint32_t id) {
+            auto it = std::find(items.begin(), items.end(), id);
+            if (it != items.end()) {
+                *it = items.back();
+                items.pop_back();
+            }
+        }
+    } // namespace
+
+    WorldRect WorldRect::fromTransform(const SpriteBatcher::Transform &transform) {
+        float radius = 0.5f * std::hypot(transform.scaleX, transform.scaleY);
+        return WorldRect{transform.x - radius, transform.y - radius, transform.x + radius,
+                         transform.y + radius};
+    }
+
+    SpatialGrid::SpatialGrid(float cellSize)
+        : cellSize(cellSize), inverseCellSize(1.0f / cellSize) {}
+
+    int32_t SpatialGrid::cellCoord(float value) const {
+        // Clamped so far-away or non-finite bounds still map to a cell
+        constexpr float kLimit = static_cast<float>(1 << 30);
+        float           cell = std::floor(value * inverseCellSize);
+        if (!(cell > -kLimit))
+            return -(1 << 30);
+        if (!(cell < kLimit))
+            return 1 << 30;
+        return static_cast<int32_t>(cell);
+    }
+
+    SpatialGrid::CellRange SpatialGrid::cellsFor(const WorldRect &bounds) const {
+        return CellRange{cellCoord(bounds.minX), cellCoord(bounds.minY), cellCoord(bounds.maxX),
+                         cellCoord(bounds.maxY)};
+    }
+
+    void SpatialGrid::link(uint32_t id, const Entry &entry) {
+        if (entry.oversized) {
+            oversized.push_back(id);
+            return;
+        }
+        for (int32_t y = entry.cells.minY; y <= entry.cells.maxY; y++) {
+            for (int32_t x = entry.cells.minX; x <= entry.cells.maxX; x++) {
+                cells[cellKey(x, y)].push_back(id);
+            }
+        }
+    }
+
+    void SpatialGrid::unlink(uint32_t id, const Entry &entry) {
+        if (entry.oversized) {
+            eraseId(oversized, id);
+            return;
+        }
+        for (int32_t y = entry.cells.minY; y <= entry.cells.maxY; y++) {
+            for (int32_t x = entry.cells.minX; x <= entry.cells.maxX; x++) {
+                auto it = cells.find(cellKey(x, y));
+                if (it == cells.end())
+                    continue;
+
+                eraseId(it->second, id);
+                if (it->second.empty())
+                    cells.erase(it);
+            }
+        }
+    }
+
+    void SpatialGrid::insert(uint32_t id, const WorldRect &bounds) {
+        if (id >= entries.size())
+            entries.resize(static_cast<size_t>(id) + 1);
+
+        Entry &entry = entries[id];
+        if (entry.live) {
+            update(id, bounds);
+            return;
+        }
+
+        entry.bounds = bounds;
+        entry.cells = cellsFor(bounds);
+        entry.oversized = entry.cells.area() > kMaxCellsPerItem;
+        entry.live = true;
+        link(id, entry);
+        count++;
+    }
+
+    void SpatialGrid::update(uint32_t id, const WorldRect &bounds) {
+        if (!contains(id)) {
+            insert(id, bounds);
+            return;
+        }
+
+        Entry    &entry = entries[id];
+        CellRange range = cellsFor(bounds);
+        entry.bounds = bounds;
+        if (range == entry.cells)
+            return;
+
+        unlink(id, entry);
+        entry.cells = range;
+        entry.oversized = range.area() > kMaxCellsPerItem;
+        link(id, entry);
+    }
+
+    void SpatialGrid::remove(uint32_t id) {
+        if (!contains(id))
+            return;
+
+        Entry &entry = entries[id];
+        unlink(id, entry);
+        entry.live = false;
+        count--;
+    }
+
+    void SpatialGrid::clear() {
+        entries.clear();
+        cells.clear();
+        oversized.clear();
+        count = 0;
+    }
+
+    void SpatialGrid::visitCell(const std::vector<uint32_t> &items, int32_t x, int32_t y,
+                                const CellRange &range, const WorldRect &region,
+                                std::vector<uint32_t> &out) const {
+        for (uint32_t id : items) {
+            const Entry &entry = entries[id];
+
+            // An item spanning several cells of the query is reported only
+            // from the first of them, so the result needs no deduplication.
+            if (x != std::max(entry.cells.minX, range.minX) ||
+                y != std::max(entry.cells.minY, range.minY))
+                continue;
+
+            if (entry.bounds.overlaps(region))
+                out.push_back(id);
+        }
+    }
+
+    void SpatialGrid::query(const WorldRect &region, std::vector<uint32_t> &out) const {
+        for (uint32_t id : oversized) {
+            if (entries[id].bounds.overlaps(region))
+                out.push_back(id);
+        }
+
+        CellRange range = cellsFor(region);
+        if (range.area() <= cells.size()) {
+            for (int32_t y = range.minY; y <= range.maxY; y++) {
+                for (int32_t x = range.minX; x <= range.maxX; x++) {
+                    auto it = cells.find(cellKey(x, y));
+                    if (it != cells.end())
+                        visitCell(it->second, x, y, range, region, out);
+                }
+            }
+            return;
+        }
+
+        // Zoomed far out: walking the occupied cells is cheaper than probing
+        // every cell of the region
+        for (const auto &[key, items] : cells) {
+            int32_t x = static_cast<int32_t>(static_cast<uint32_t>(key >> 32));
+            int32_t y = static_cast<int32_t>(static_cast<uint32_t>(key));
+            if (x < range.minX || x > range.maxX || y < range.minY || y > range.maxY)
+                continue;
+            visitCell(items, x, y, range, region, out);
+        }
+    }
+
+    void SpatialGrid::query(float x, float y, std::vector<uint32_t> &out) const {
+        query(WorldRect{x, y, x, y}, out);
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,108 @@
+#ifndef SPATIALGRID_H
+#define SPATIALGRID_H
+
+#include "SpriteBatch.h"
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    // Axis-aligned rectangle in world units, min inclusive.
+    struct WorldRect {
+        float minX = 0.0f;
+        float minY = 0.0f;
+        float maxX = 0.0f;
+        float maxY = 0.0f;
+
+        bool overlaps(const WorldRect &other) const {
+            return minX <= other.maxX && other.minX <= maxX && minY <= other.maxY &&
+                   other.minY <= maxY;
+        }
+        bool contains(float x, float y) const {
+            return x >= minX && x <= maxX && y >= minY && y <= maxY;
+        }
+
+        // Bounds of the unit quad drawn for `transform`. They are taken from
+        // the quad's circumscribed circle, so rotating a sprite never moves
+        // it between grid cells.
+        static WorldRect fromTransform(const SpriteBatcher::Transform &transform);
+    };
+
+    // Uniform grid over an unbounded world, with cells kept in a hash map so
+    // only occupied cells cost memory. Items are identified by small dense
+    // ids chosen by the caller; an item is listed in every cell its bounds
+    // touch, and update() only touches the cell lists when that set of
+    // cells changes, which makes small per-frame moves cheap. Items that
+    // would span more than kMaxCellsPerItem cells are kept on a separate
+    // list that every query scans instead.
+    //
+    // Queries are read-only and may run concurrently with each other, but
+    // not with insert/update/remove.
+    class SpatialGrid {
+      public:
+        static constexpr uint64_t kMaxCellsPerItem = 64;
+
+        explicit SpatialGrid(float cellSize = 256.0f);
+
+        void insert(uint32_t id, const WorldRect &bounds);
+        void update(uint32_t id, const WorldRect &bounds);
+        void remove(uint32_t id);
+        void clear();
+
+        bool   contains(uint32_t id) const { return id < entries.size() && entries[id].live; }
+        size_t size() const { return count; }
+        float  getCellSize() const { return cellSize; }
+
+        // Appends the id of every item whose bounds overlap `region` to
+        // `out`, each exactly once and in no particular order.
+        void query(const WorldRect &region, std::vector<uint32_t> &out) const;
+        // Appends the ids of items whose bounds contain the point
+        void query(float x, float y, std::vector<uint32_t> &out) const;
+
+      private:
+        struct CellRange {
+            int32_t minX, minY, maxX, maxY;
+
+            uint64_t area() const {
+                return static_cast<uint64_t>(static_cast<int64_t>(maxX) - minX + 1) *
+                       static_cast<uint64_t>(static_cast<int64_t>(maxY) - minY + 1);
+            }
+            bool operator==(const CellRange &other) const {
+                return minX == other.minX && minY == other.minY && maxX == other.maxX &&
+                       maxY == other.maxY;
+            }
+            bool operator!=(const CellRange &other) const { return !(*this == other); }
+        };
+
+        struct Entry {
+            WorldRect bounds;
+            CellRange cells;
+            bool      live = false;
+            bool      oversized = false;
+        };
+
+        static uint64_t cellKey(int32_t x, int32_t y) {
+            return (static_cast<uint64_t>(static_cast<uint32_t>(x)) << 32) |
+                   static_cast<uint32_t>(y);
+        }
+
+        int32_t   cellCoord(float value) const;
+        CellRange cellsFor(const WorldRect &bounds) const;
+        void      link(uint32_t id, const Entry &entry);
+        void      unlink(uint32_t id, const Entry &entry);
+        void      visitCell(const std::vector<uint32_t> &items, int32_t x, int32_t y,
+                            const CellRange &range, const WorldRect &region,
+                            std::vector<uint32_t> &out) const;
+
+        float                                               cellSize;
+        float                                               inverseCellSize;
+        std::vector<Entry>                                  entries; // indexed by id
+        std::unordered_map<uint64_t, std::vector<uint32_t>> cells;
+        std::vector<uint32_t>                               oversized;
+        size_t                                              count = 0;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SPATIALGRID_H
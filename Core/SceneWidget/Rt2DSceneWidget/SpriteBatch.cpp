@@ -0,0 +1,188 @@
+#include "SpriteBatch.h"
+#include "SpriteTransformKernel.h"
+#include <algorithm>
+
+namespace Retoccilus::Core {
+
+    void SpriteBatcher::openRun(uint32_t count, bool precomputed, bool textured) {
+        if (!runs.empty()) {
+            Run &last = runs.back();
+            if (last.stateKey == currentState && last.color == currentColor &&
+                (last.sinCosFirst != kNoSinCos) == precomputed &&
+                (last.texturesFirst != kNoTextures) == textured) {
+                last.count += count;
+                return;
+            }
+        }
+
+        uint32_t sinCosFirst =
+            precomputed ? static_cast<uint32_t>(sinRotation.size()) : kNoSinCos;
+        uint32_t texturesFirst = textured ? static_cast<uint32_t>(textures.size()) : kNoTextures;
+        runs.push_back(Run{currentState, currentColor, static_cast<uint32_t>(x.size()), count,
+                           sinCosFirst, texturesFirst});
+    }
+
+    void SpriteBatcher::add(const Transform &transform) {
+        openRun(1, false);
+        x.push_back(transform.x);
+        y.push_back(transform.y);
+        scaleX.push_back(transform.scaleX);
+        scaleY.push_back(transform.scaleY);
+        rotation.push_back(transform.rotation);
+    }
+
+    void SpriteBatcher::add(const Transform *sprites, size_t count) {
+        if (count == 0)
+            return;
+
+        openRun(static_cast<uint32_t>(count), false);
+
+        size_t base = x.size();
+        x.resize(base + count);
+        y.resize(base + count);
+        scaleX.resize(base + count);
+        scaleY.resize(base + count);
+        rotation.resize(base + count);
+
+        for (size_t i = 0; i < count; i++) {
+            x[base + i] = sprites[i].x;
+            y[base + i] = sprites[i].y;
+            scaleX[base + i] = sprites[i].scaleX;
+            scaleY[base + i] = sprites[i].scaleY;
+            rotation[base + i] = sprites[i].rotation;
+        }
+    }
+
+    void SpriteBatcher::add(const SpriteTransformStreams &streams, size_t count) {
+        if (count == 0)
+            return;
+
+        openRun(static_cast<uint32_t>(count), streams.sinRotation != nullptr);
+        appendStreams(streams, count);
+    }
+
+    void SpriteBatcher::add(const SpriteTransformStreams &streams, const uint32_t *spriteTextures,
+                            size_t count) {
+        if (count == 0)
+            return;
+
+        // Runs are only merged with the previous one, whose textures are
+        // the last ones appended, so a run's textures stay contiguous
+        openRun(static_cast<uint32_t>(count), streams.sinRotation != nullptr, true);
+        textures.insert(textures.end(), spriteTextures, spriteTextures + count);
+        appendStreams(streams, count);
+    }
+
+    void SpriteBatcher::appendStreams(const SpriteTransformStreams &streams, size_t count) {
+        x.insert(x.end(), streams.x, streams.x + count);
+        y.insert(y.end(), streams.y, streams.y + count);
+        scaleX.insert(scaleX.end(), streams.scaleX, streams.scaleX + count);
+        scaleY.insert(scaleY.end(), streams.scaleY, streams.scaleY + count);
+
+        if (streams.sinRotation) {
+            // Keep `rotation` index-aligned with the other streams
+            rotation.resize(rotation.size() + count);
+            sinRotation.insert(sinRotation.end(), streams.sinRotation,
+                               streams.sinRotation + count);
+            cosRotation.insert(cosRotation.end(), streams.cosRotation,
+                               streams.cosRotation + count);
+        } else {
+            rotation.insert(rotation.end(), streams.rotation, streams.rotation + count);
+        }
+    }
+
+    void SpriteBatcher::clear() {
+        x.clear();
+        y.clear();
+        scaleX.clear();
+        scaleY.clear();
+        rotation.clear();
+        sinRotation.clear();
+        cosRotation.clear();
+        textures.clear();
+        runs.clear();
+    }
+
+    void SpriteBatcher::writeRun(const Run &run, uint32_t offset, uint32_t count,
+                                 SpriteInstance *out) const {
+        uint32_t first = run.first + offset;
+
+        SpriteTransformStreams streams;
+        streams.x = x.data() + first;
+        streams.y = y.data() + first;
+        streams.scaleX = scaleX.data() + first;
+        streams.scaleY = scaleY.data() + first;
+        streams.rotation = rotation.data() + first;
+        if (run.sinCosFirst != kNoSinCos) {
+            streams.sinRotation = sinRotation.data() + run.sinCosFirst + offset;
+            streams.cosRotation = cosRotation.data() + run.sinCosFirst + offset;
+        }
+
+        transformSprites(streams, count, run.stateKey, run.color, out);
+
+        if (run.texturesFirst != kNoTextures) {
+            const uint32_t *runTextures = textures.data() + run.texturesFirst + offset;
+            for (uint32_t i = 0; i < count; i++)
+                out[i].texture = runTextures[i];
+        }
+    }
+
+    const std::vector<SpriteDrawBatch> &SpriteBatcher::build(SpriteInstance *out) {
+        plan();
+        writeInstances(out, 0, static_cast<uint32_t>(size()));
+        return batches;
+    }
+
+    const std::vector<SpriteDrawBatch> &SpriteBatcher::plan() {
+        batches.clear();
+
+        plannedRuns.resize(runs.size());
+        for (uint32_t i = 0; i < plannedRuns.size(); i++) {
+            plannedRuns[i] = PlannedRun{i, 0};
+        }
+
+        if (sortMode == SpriteSortMode::State) {
+            std::stable_sort(plannedRuns.begin(), plannedRuns.end(),
+                             [this](const PlannedRun &a, const PlannedRun &b) {
+                                 return runs[a.run].stateKey < runs[b.run].stateKey;
+                             });
+        }
+
+        uint32_t dst = 0;
+        for (PlannedRun &planned : plannedRuns) {
+            const Run &run = runs[planned.run];
+            planned.dst = dst;
+
+            if (!batches.empty() && batches.back().stateKey == run.stateKey) {
+                batches.back().instanceCount += run.count;
+            } else {
+                batches.push_back(SpriteDrawBatch{run.stateKey, dst, run.count});
+            }
+            dst += run.count;
+        }
+
+        return batches;
+    }
+
+    void SpriteBatcher::writeInstances(SpriteInstance *out, uint32_t first,
+                                       uint32_t count) const {
+        uint32_t end = first + count;
+
+        // Last run starting at or before `first`
+        auto it = std::upper_bound(
+            plannedRuns.begin(), plannedRuns.end(), first,
+            [](uint32_t value, const PlannedRun &planned) { return value < planned.dst; });
+        if (it != plannedRuns.begin())
+            --it;
+
+        for (; it != plannedRuns.end() && it->dst < end; ++it) {
+            const Run &run = runs[it->run];
+            uint32_t   from = std::max(first, it->dst);
+            uint32_t   to = std::min(end, it->dst + run.count);
+            if (from < to) {
+                writeRun(run, from - it->dst, to - from, out + from);
+            }
+        }
+    }
+
+} // namespace Retoccilus::Core
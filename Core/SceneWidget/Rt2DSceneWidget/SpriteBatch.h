@@ -0,0 +1,121 @@
+#ifndef SPRITEBATCH_H
+#define SPRITEBATCH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    struct SpriteTransformStreams;
+
+    // Per-instance data consumed by Sprite.vert. The 2x3 affine transform is
+    // stored as two rows; the texture index and packed RGBA8 colour ride in
+    // the fourth lane of each row so an instance is exactly two vec4s.
+    struct SpriteInstance {
+        float    row0[3];
+        uint32_t texture;
+        float    row1[3];
+        uint32_t color;
+    };
+    static_assert(sizeof(SpriteInstance) == 32, "SpriteInstance must stay 32 bytes");
+
+    // A contiguous range of instances drawn with one vkCmdDraw.
+    struct SpriteDrawBatch {
+        uint32_t stateKey;
+        uint32_t firstInstance;
+        uint32_t instanceCount;
+    };
+
+    enum class SpriteSortMode {
+        // Keep submission order; consecutive sprites sharing a state are merged.
+        Submission,
+        // Group all sprites by state so every state is exactly one draw.
+        // Only correct when sprites of different states do not overlap.
+        State
+    };
+
+    // Collects sprites for one frame and turns them into instance data plus a
+    // list of instanced draws. Sprites are kept as structure-of-arrays
+    // transforms until build(), so the per-sprite cost of renderSprite() is an
+    // append and build() can run the SIMD transform kernel over each run.
+    class SpriteBatcher {
+      public:
+        struct Transform {
+            float x;
+            float y;
+            float scaleX;
+            float scaleY;
+            float rotation; // degrees
+        };
+
+        void setSortMode(SpriteSortMode mode) { sortMode = mode; }
+        void setState(uint32_t stateKey) { currentState = stateKey; }
+        void setColor(uint32_t rgba) { currentColor = rgba; }
+
+        void add(const Transform &transform);
+        void add(const Transform *transforms, size_t count);
+        void add(const SpriteTransformStreams &streams, size_t count);
+        // Sprites with a texture each instead of the current state, such as
+        // the glyphs of a string. They are batched under the current state,
+        // so every texture must have its draw key.
+        void add(const SpriteTransformStreams &streams, const uint32_t *textures, size_t count);
+        void clear();
+
+        size_t size() const { return x.size(); }
+        bool   empty() const { return x.empty(); }
+
+        // Writes size() instances to `out` and returns the draw list. `out`
+        // is typically the mapped per-frame instance buffer.
+        const std::vector<SpriteDrawBatch> &build(SpriteInstance *out);
+
+        // build() in two steps, for filling the instance buffer from several
+        // threads: plan() orders the runs and returns the draw list, then
+        // writeInstances() fills instances [first, first + count) of `out`.
+        // Disjoint ranges may be written concurrently.
+        const std::vector<SpriteDrawBatch> &plan();
+        void writeInstances(SpriteInstance *out, uint32_t first, uint32_t count) const;
+
+      private:
+        static constexpr uint32_t kNoSinCos = UINT32_MAX;
+        static constexpr uint32_t kNoTextures = UINT32_MAX;
+
+        struct Run {
+            uint32_t stateKey;
+            uint32_t color;
+            uint32_t first;
+            uint32_t count;
+            uint32_t sinCosFirst;   // kNoSinCos unless sin/cos were supplied
+            uint32_t texturesFirst; // kNoTextures unless textures were supplied
+        };
+
+        // A run in draw order and where its instances start
+        struct PlannedRun {
+            uint32_t run;
+            uint32_t dst;
+        };
+
+        void openRun(uint32_t count, bool precomputed, bool textured = false);
+        void appendStreams(const SpriteTransformStreams &streams, size_t count);
+        void writeRun(const Run &run, uint32_t offset, uint32_t count,
+                      SpriteInstance *out) const;
+
+        SpriteSortMode               sortMode = SpriteSortMode::Submission;
+        uint32_t                     currentState = 0;
+        uint32_t                     currentColor = 0xFFFFFFFFu;
+        std::vector<float>           x;
+        std::vector<float>           y;
+        std::vector<float>           scaleX;
+        std::vector<float>           scaleY;
+        std::vector<float>           rotation;
+        std::vector<float>           sinRotation;
+        std::vector<float>           cosRotation;
+        std::vector<uint32_t>        textures;
+        std::vector<Run>             runs;
+        std::vector<PlannedRun>      plannedRuns;
+        std::vector<SpriteDrawBatch> batches;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SPRITEBATCH_H
@@ -0,0 +1,302 @@
+#include "SpriteCapture.h"
+#include "Rt2DSceneWidget.h"
+#include <chrono>
+#include <cstring>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr char kMagic[4] = {'R', 'T', 'S', 'C'};
+
+        uint32_t floatBits(float value) {
+            uint32_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return bits;
+        }
+
+        float bitsFloat(uint32_t bits) {
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        uint64_t nowMicroseconds() {
+            return std::chrono::duration_cast<std::chrono::microseconds>(
+                       std::chrono::steady_clock::now().time_since_epoch())
+                .count();
+        }
+
+        float field(const SpriteBatcher::Transform &sprite, uint32_t index) {
+            const float fields[5] = {sprite.x, sprite.y, sprite.scaleX, sprite.scaleY,
+                                     sprite.rotation};
+            return fields[index];
+        }
+
+        float &field(SpriteBatcher::Transform &sprite, uint32_t index) {
+            float *fields[5] = {&sprite.x, &sprite.y, &sprite.scaleX, &sprite.scaleY,
+                                &sprite.rotation};
+            return *fields[index];
+        }
+
+        // What the next sprite is coded against; see SpriteCaptureWriter
+        SpriteBatcher::Transform predict(const std::vector<SpriteBatcher::Transform> &previous,
+                                         const std::vector<SpriteBatcher::Transform> &current) {
+            if (current.size() < previous.size())
+                return previous[current.size()];
+            if (!current.empty())
+                return current.back();
+            return SpriteBatcher::Transform{0.0f, 0.0f, 1.0f, 1.0f, 0.0f};
+        }
+    } // namespace
+
+    SpriteCaptureWriter::SpriteCaptureWriter(const std::string &path)
+        : file(path, std::ios::binary | std::ios::trunc), path(path) {
+        if (!file) {
+            throw std::runtime_error("Failed to open sprite capture: " + path);
+        }
+
+        buffer.insert(buffer.end(), kMagic, kMagic + sizeof(kMagic));
+        writeVarint(kVersion);
+        lastFrameTime = nowMicroseconds();
+    }
+
+    void SpriteCaptureWriter::loadTexture(uint32_t id, uint32_t width, uint32_t height) {
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::LoadTexture));
+        writeVarint(id);
+        writeVarint(width);
+        writeVarint(height);
+    }
+
+    void SpriteCaptureWriter::setTexture(uint32_t id) {
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::SetTexture));
+        writeVarint(id);
+    }
+
+    void SpriteCaptureWriter::setSortMode(SpriteSortMode mode) {
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::SetSortMode));
+        writeVarint(static_cast<uint32_t>(mode));
+    }
+
+    void SpriteCaptureWriter::sprite(const SpriteBatcher::Transform &sprite) {
+        SpriteBatcher::Transform predicted = predict(previousFrame, currentFrame);
+
+        uint8_t mask = 0;
+        for (uint32_t i = 0; i < 5; i++) {
+            if (floatBits(field(sprite, i)) != floatBits(field(predicted, i)))
+                mask |= 1u << i;
+        }
+
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::Sprite) | mask << 3);
+        for (uint32_t i = 0; i < 5; i++) {
+            if (mask & 1u << i)
+                writeFloat(field(sprite, i), field(predicted, i));
+        }
+        currentFrame.push_back(sprite);
+    }
+
+    void SpriteCaptureWriter::setCamera(float x, float y, float width, float height) {
+        const float values[4] = {x, y, width, height};
+
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::SetCamera));
+        for (uint32_t i = 0; i < 4; i++) {
+            writeFloat(values[i], camera[i]);
+            camera[i] = values[i];
+        }
+    }
+
+    void SpriteCaptureWriter::resetCamera() {
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::ResetCamera));
+    }
+
+    void SpriteCaptureWriter::endFrame() {
+        uint64_t now = nowMicroseconds();
+        buffer.push_back(static_cast<uint8_t>(SpriteCaptureOp::EndFrame));
+        writeVarint(now - lastFrameTime);
+        lastFrameTime = now;
+
+        file.write(reinterpret_cast<const char *>(buffer.data()),
+                   static_cast<std::streamsize>(buffer.size()));
+        if (!file) {
+            throw std::runtime_error("Failed to write sprite capture: " + path);
+        }
+        written += buffer.size();
+        buffer.clear();
+        frames++;
+
+        std::swap(previousFrame, currentFrame);
+        currentFrame.clear();
+    }
+
+    void SpriteCaptureWriter::writeVarint(uint64_t value) {
+        while (value >= 0x80) {
+            buffer.push_back(static_cast<uint8_t>(value | 0x80));
+            value >>= 7;
+        }
+        buffer.push_back(static_cast<uint8_t>(value));
+    }
+
+    void SpriteCaptureWriter::writeFloat(float value, float predicted) {
+        int32_t delta = static_cast<int32_t>(floatBits(value) - floatBits(predicted));
+        writeVarint((static_cast<uint32_t>(delta) << 1) ^ static_cast<uint32_t>(delta >> 31));
+    }
+
+    SpriteCaptureReader::SpriteCaptureReader(const std::string &path) {
+        std::ifstream file(path, std::ios::binary | std::ios::ate);
+        if (!file) {
+            throw std::runtime_error("Failed to open sprite capture: " + path);
+        }
+
+        std::streamsize size = file.tellg();
+        file.seekg(0);
+        data.resize(static_cast<size_t>(size));
+        if (!file.read(reinterpret_cast<char *>(data.data()), size)) {
+            throw std::runtime_error("Failed to read sprite capture: " + path);
+        }
+
+        if (data.size() < sizeof(kMagic) ||
+            std::memcmp(data.data(), kMagic, sizeof(kMagic)) != 0) {
+            throw std::runtime_error("Not a sprite capture: " + path);
+        }
+        position = sizeof(kMagic);
+        version = static_cast<uint32_t>(readVarint());
+        if (version != SpriteCaptureWriter::kVersion) {
+            throw std::runtime_error("Unsupported sprite capture version: " + path);
+        }
+        start = position;
+    }
+
+    bool SpriteCaptureReader::next(SpriteCaptureCommand &command) {
+        if (position == data.size())
+            return false;
+
+        uint8_t byte = data[position++];
+        command.op = static_cast<SpriteCaptureOp>(byte & 7u);
+
+        switch (command.op) {
+        case SpriteCaptureOp::Sprite: {
+            command.sprite = predict(previousFrame, currentFrame);
+            for (uint32_t i = 0; i < 5; i++) {
+                if (byte >> 3 & 1u << i)
+                    field(command.sprite, i) = readFloat(field(command.sprite, i));
+            }
+            currentFrame.push_back(command.sprite);
+            break;
+        }
+        case SpriteCaptureOp::LoadTexture:
+            command.texture = static_cast<uint32_t>(readVarint());
+            command.width = static_cast<uint32_t>(readVarint());
+            command.height = static_cast<uint32_t>(readVarint());
+            break;
+        case SpriteCaptureOp::SetTexture:
+            command.texture = static_cast<uint32_t>(readVarint());
+            break;
+        case SpriteCaptureOp::SetSortMode:
+            command.sortMode = static_cast<SpriteSortMode>(readVarint());
+            break;
+        case SpriteCaptureOp::SetCamera:
+            for (uint32_t i = 0; i < 4; i++) {
+                camera[i] = readFloat(camera[i]);
+                command.camera[i] = camera[i];
+            }
+            break;
+        case SpriteCaptureOp::ResetCamera:
+            break;
+        case SpriteCaptureOp::EndFrame:
+            command.microseconds = readVarint();
+            std::swap(previousFrame, currentFrame);
+            currentFrame.clear();
+            break;
+        default:
+            throw std::runtime_error("Corrupt sprite capture");
+        }
+        return true;
+    }
+
+    void SpriteCaptureReader::rewind() {
+        position = start;
+        previousFrame.clear();
+        currentFrame.clear();
+        std::memset(camera, 0, sizeof(camera));
+    }
+
+    uint64_t SpriteCaptureReader::readVarint() {
+        uint64_t value = 0;
+        for (uint32_t shift = 0; shift < 64; shift += 7) {
+            if (position == data.size()) {
+                throw std::runtime_error("Truncated sprite capture");
+            }
+            uint8_t byte = data[position++];
+            value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+            if (!(byte & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Corrupt sprite capture");
+    }
+
+    float SpriteCaptureReader::readFloat(float predicted) {
+        uint32_t zigzag = static_cast<uint32_t>(readVarint());
+        uint32_t delta = (zigzag >> 1) ^ (0u - (zigzag & 1u));
+        return bitsFloat(floatBits(predicted) + delta);
+    }
+
+    SpriteCaptureReplayer::SpriteCaptureReplayer(Rt2DSceneWidget &widget,
+                                                 SpriteCaptureReader &reader)
+        : widget(widget), reader(reader) {}
+
+    bool SpriteCaptureReplayer::replayFrame() {
+        SpriteCaptureCommand command;
+        while (reader.next(command)) {
+            switch (command.op) {
+            case SpriteCaptureOp::Sprite: {
+                const SpriteBatcher::Transform &sprite = command.sprite;
+                widget.renderSprite(sprite.x, sprite.y, sprite.scaleX, sprite.scaleY,
+                                    sprite.rotation);
+                break;
+            }
+            case SpriteCaptureOp::LoadTexture: {
+                if (command.width == 0 || command.height == 0)
+                    break;
+
+                // Checkerboard, so atlas pages and mips are not all one colour
+                texels.resize(static_cast<size_t>(command.width) * command.height * 4);
+                for (uint32_t y = 0; y < command.height; y++) {
+                    for (uint32_t x = 0; x < command.width; x++) {
+                        uint8_t value = ((x / 8 + y / 8) & 1) ? 0xFF : 0x80;
+                        std::memset(&texels[(static_cast<size_t>(y) * command.width + x) * 4],
+                                    value, 4);
+                    }
+                }
+                textures[command.texture] =
+                    widget.loadTexture(texels.data(), command.width, command.height);
+                break;
+            }
+            case SpriteCaptureOp::SetTexture:
+                widget.setTexture(mapTexture(command.texture));
+                break;
+            case SpriteCaptureOp::SetSortMode:
+                widget.setSortMode(command.sortMode);
+                break;
+            case SpriteCaptureOp::SetCamera:
+                widget.setCamera(command.camera[0], command.camera[1], command.camera[2],
+                                 command.camera[3]);
+                break;
+            case SpriteCaptureOp::ResetCamera:
+                widget.resetCamera();
+                break;
+            case SpriteCaptureOp::EndFrame:
+                frameMicroseconds = command.microseconds;
+                widget.drawFrame();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    uint32_t SpriteCaptureReplayer::mapTexture(uint32_t captured) const {
+        // Textures the capture never loaded draw white
+        auto found = textures.find(captured);
+        return found != textures.end() ? found->second : 0;
+    }
+
+} // namespace Retoccilus::Core
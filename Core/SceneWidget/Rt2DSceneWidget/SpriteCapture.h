@@ -0,0 +1,144 @@
+#ifndef SPRITECAPTURE_H
+#define SPRITECAPTURE_H
+
+#include "SpriteBatch.h"
+#include <cstddef>
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    class Rt2DSceneWidget;
+
+    // Binary record of the sprite calls made on an Rt2DSceneWidget, frame by
+    // frame, for replaying field captures as repeatable performance tests.
+    //
+    // A capture is the magic "RTSC" and a varint version, followed by
+    // commands. Each command is one byte whose low 3 bits are the opcode,
+    // then varint operands. Floats are stored as the zigzag varint of the
+    // difference between their bit pattern and a prediction, so values
+    // that repeat or drift slowly take a byte or two. Sprites are predicted
+    // from the sprite at the same index in the previous frame (or the
+    // previous sprite when there is none), and the opcode byte's top 5 bits
+    // flag which of the five fields differ; a sprite that did not move
+    // costs one byte.
+    //
+    // Texture contents are not captured, only their sizes, so a replay
+    // packs and uploads the same amount of texture data.
+    enum class SpriteCaptureOp : uint8_t {
+        Sprite = 0,      // changed-field mask, changed fields
+        LoadTexture = 1, // id, width, height
+        SetTexture = 2,  // id
+        SetSortMode = 3, // SpriteSortMode
+        SetCamera = 4,   // x, y, width, height, predicted from the last camera
+        ResetCamera = 5,
+        EndFrame = 6     // microseconds since the previous EndFrame
+    };
+
+    struct SpriteCaptureCommand {
+        SpriteCaptureOp          op = SpriteCaptureOp::EndFrame;
+        SpriteBatcher::Transform sprite{};
+        uint32_t                 texture = 0;
+        uint32_t                 width = 0;
+        uint32_t                 height = 0;
+        SpriteSortMode           sortMode = SpriteSortMode::Submission;
+        float                    camera[4]{}; // x, y, width, height
+        uint64_t                 microseconds = 0;
+    };
+
+    // Buffers a frame's commands and appends them to the file at its end;
+    // calls after the last endFrame() are dropped
+    class SpriteCaptureWriter {
+      public:
+        static constexpr uint32_t kVersion = 1;
+
+        // Throws if `path` cannot be written
+        explicit SpriteCaptureWriter(const std::string &path);
+
+        SpriteCaptureWriter(const SpriteCaptureWriter &) = delete;
+        SpriteCaptureWriter &operator=(const SpriteCaptureWriter &) = delete;
+
+        void loadTexture(uint32_t id, uint32_t width, uint32_t height);
+        void setTexture(uint32_t id);
+        void setSortMode(SpriteSortMode mode);
+        void sprite(const SpriteBatcher::Transform &sprite);
+        void setCamera(float x, float y, float width, float height);
+        void resetCamera();
+        void endFrame();
+
+        uint64_t getFrameCount() const { return frames; }
+        // Including the frame still being buffered
+        uint64_t getByteCount() const { return written + buffer.size(); }
+
+      private:
+        void writeVarint(uint64_t value);
+        void writeFloat(float value, float predicted);
+
+        std::ofstream file;
+        std::string   path;
+
+        std::vector<uint8_t>                  buffer;
+        std::vector<SpriteBatcher::Transform> previousFrame;
+        std::vector<SpriteBatcher::Transform> currentFrame;
+        float                                 camera[4]{};
+
+        uint64_t frames = 0;
+        uint64_t written = 0;
+        uint64_t lastFrameTime = 0; // microseconds, steady clock
+    };
+
+    // Decodes a capture held in memory
+    class SpriteCaptureReader {
+      public:
+        // Reads the whole file; throws if it is not a capture
+        explicit SpriteCaptureReader(const std::string &path);
+
+        // False at the end of the capture. Throws if it is truncated.
+        bool next(SpriteCaptureCommand &command);
+        // Back to the first command
+        void rewind();
+
+        uint32_t getVersion() const { return version; }
+
+      private:
+        uint64_t readVarint();
+        float    readFloat(float predicted);
+
+        std::vector<uint8_t> data;
+        size_t               start = 0;
+        size_t               position = 0;
+        uint32_t             version = 0;
+
+        std::vector<SpriteBatcher::Transform> previousFrame;
+        std::vector<SpriteBatcher::Transform> currentFrame;
+        float                                 camera[4]{};
+    };
+
+    // Feeds a capture back through a widget. Captured textures are stood in
+    // for by generated ones of the same size, loaded when the capture does.
+    class SpriteCaptureReplayer {
+      public:
+        SpriteCaptureReplayer(Rt2DSceneWidget &widget, SpriteCaptureReader &reader);
+
+        // Issues the next frame's calls and draws it; false once the capture
+        // is exhausted
+        bool replayFrame();
+        // Captured time of the frame last replayed, for paced playback
+        uint64_t getFrameMicroseconds() const { return frameMicroseconds; }
+
+      private:
+        uint32_t mapTexture(uint32_t captured) const;
+
+        Rt2DSceneWidget                        &widget;
+        SpriteCaptureReader                    &reader;
+        std::unordered_map<uint32_t, uint32_t> textures; // captured id -> replay id
+        std::vector<uint8_t>                   texels;   // scratch for stand-ins
+        uint64_t                               frameMicroseconds = 0;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SPRITECAPTURE_H
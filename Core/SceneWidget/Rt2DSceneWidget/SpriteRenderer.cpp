@@ -0,0 +1,471 @@
+#include "SpriteRenderer.h"
+#include "Core/VulkanWrapper/VulkanWrapper.h"
+#include <algorithm>
+#include <array>
+#include <cstring>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        const uint32_t kSpriteVertSpv[] =
+#include "Sprite.vert.inc"
+            ;
+
+        const uint32_t kSpriteFragSpv[] =
+#include "Sprite.frag.inc"
+            ;
+
+        const uint32_t kSpriteBindlessFragSpv[] =
+#include "SpriteBindless.frag.inc"
+            ;
+    } // namespace
+
+    SpriteRenderer::SpriteRenderer(VulkanWrapper &renderer) : renderer(renderer) {}
+
+    SpriteRenderer::~SpriteRenderer() {
+        cleanup();
+    }
+
+    void SpriteRenderer::initialize(const SpriteTextures::Config &textureConfig) {
+        textures = std::make_unique<SpriteTextures>(renderer, textureConfig);
+        createPipeline();
+    }
+
+    void SpriteRenderer::cleanup() {
+        VkDevice device = renderer.getDevice();
+
+        GpuMemoryAllocator &allocator = renderer.getAllocator();
+        for (SceneSlot &slot : sceneSlots) {
+            if (slot.buffer != VK_NULL_HANDLE)
+                allocator.destroyBuffer(slot.buffer, slot.memory);
+        }
+        sceneSlots.clear();
+        batchedScene = nullptr;
+        culler.reset();
+
+        textures.reset();
+
+        if (pipeline != VK_NULL_HANDLE) {
+            vkDestroyPipeline(device, pipeline, nullptr);
+            pipeline = VK_NULL_HANDLE;
+        }
+        if (pipelineLayout != VK_NULL_HANDLE) {
+            vkDestroyPipelineLayout(device, pipelineLayout, nullptr);
+            pipelineLayout = VK_NULL_HANDLE;
+        }
+    }
+
+    void SpriteRenderer::record(VkCommandBuffer cmd, SpriteBatcher &batcher) {
+        if (batcher.empty())
+            return;
+
+        FrameProfiler          &profiler = renderer.getProfiler();
+        FrameProfiler::CpuScope cpuScope(profiler, "SpriteRenderer::record");
+
+        PreparedFrame           frame = prepare(batcher);
+        FrameProfiler::GpuScope gpuScope(profiler, cmd, "Sprites");
+        recordRange(cmd, batcher, frame, 0, frame.instanceCount);
+
+        batcher.clear();
+    }
+
+    SpriteRenderer::PreparedFrame SpriteRenderer::prepare(SpriteBatcher &batcher) {
+        PreparedFrame frame;
+        frame.instanceCount = static_cast<uint32_t>(batcher.size());
+        frame.instances = renderer.getFrameArena().allocate(
+            batcher.size() * sizeof(SpriteInstance), alignof(SpriteInstance));
+        frame.batches = &batcher.plan();
+        frame.extent = renderer.getRenderExtent();
+        frame.view = getView();
+        frame.textureSet = beginTextures();
+        return frame;
+    }
+
+    WorldRect SpriteRenderer::getView() const {
+        if (view)
+            return *view;
+
+        VkExtent2D extent = renderer.getSwapChainExtent();
+        return WorldRect{0.0f, 0.0f, static_cast<float>(extent.width),
+                         static_cast<float>(extent.height)};
+    }
+
+    void SpriteRenderer::recordRange(VkCommandBuffer cmd, const SpriteBatcher &batcher,
+                                     const PreparedFrame &frame, uint32_t first,
+                                     uint32_t count) {
+        if (count == 0)
+            return;
+
+        FrameProfiler::CpuScope scope(renderer.getProfiler(), "SpriteRenderer::recordRange");
+        batcher.writeInstances(static_cast<SpriteInstance *>(frame.instances.data), first,
+                               count);
+
+        bindState(cmd, frame.instances.buffer, frame.instances.offset, frame.extent, frame.view,
+                  frame.textureSet);
+        drawBatches(cmd, *frame.batches, first, count);
+    }
+
+    SpriteRenderer::PreparedScene SpriteRenderer::prepareScene(const SceneGraph &scene) {
+        PreparedScene prepared;
+        prepared.instanceCount = static_cast<uint32_t>(scene.getInstances().size());
+        if (prepared.instanceCount == 0)
+            return prepared;
+
+        FrameProfiler::CpuScope scope(renderer.getProfiler(), "SpriteRenderer::prepareScene");
+
+        uint32_t current = renderer.getCurrentFrame();
+        if (sceneSlots.size() <= current)
+            sceneSlots.resize(current + 1);
+        SceneSlot &slot = sceneSlots[current];
+        syncSceneSlot(slot, scene);
+
+        updateSceneBatches(scene);
+
+        prepared.instances = slot.buffer;
+        prepared.batches = &sceneBatches;
+        prepared.extent = renderer.getRenderExtent();
+        prepared.view = getView();
+        prepared.textureSet = beginTextures();
+        return prepared;
+    }
+
+    SpriteRenderer::PreparedScene SpriteRenderer::prepareCulledScene(RenderGraph      &graph,
+                                                                     const SceneGraph &scene) {
+        PreparedScene prepared;
+        prepared.instanceCount = static_cast<uint32_t>(scene.getInstances().size());
+        if (prepared.instanceCount == 0)
+            return prepared;
+
+        FrameProfiler::CpuScope scope(renderer.getProfiler(),
+                                      "SpriteRenderer::prepareCulledScene");
+
+        if (!culler) {
+            culler = std::make_unique<SceneCuller>(renderer);
+            culler->initialize();
+        }
+
+        updateSceneBatches(scene);
+        // Commits pending textures first, which can move them between pages
+        prepared.textureSet = beginTextures();
+
+        // The draws drawBatches() would make, as ranges of the scene. Atlas
+        // pages can be repacked between frames, so the keys are looked up
+        // every frame; the culler only rewrites its tables if they change.
+        cullRanges.clear();
+        for (size_t i = 0; i < sceneBatches.size();) {
+            uint32_t key = textures->drawKey(sceneBatches[i].stateKey);
+            uint32_t first = sceneBatches[i].firstInstance;
+            uint32_t end = first + sceneBatches[i].instanceCount;
+            for (i++; i < sceneBatches.size() &&
+                      textures->drawKey(sceneBatches[i].stateKey) == key;
+                 i++) {
+                end = sceneBatches[i].firstInstance + sceneBatches[i].instanceCount;
+            }
+            cullRanges.push_back(SceneCuller::DrawRange{first, end - first});
+        }
+
+        prepared.view = getView();
+        SceneCuller::Outputs outputs =
+            culler->declarePasses(graph, scene, cullRanges, prepared.view);
+
+        prepared.instances = culler->getCulledInstances();
+        prepared.batches = &sceneBatches;
+        prepared.extent = renderer.getRenderExtent();
+        prepared.gpuCulled = true;
+        prepared.culledInstances = outputs.instances;
+        prepared.drawCommands = outputs.commands;
+        return prepared;
+    }
+
+    void SpriteRenderer::recordScene(VkCommandBuffer cmd, const PreparedScene &scene) {
+        if (scene.instanceCount == 0)
+            return;
+
+        FrameProfiler::CpuScope scope(renderer.getProfiler(), "SpriteRenderer::recordScene");
+        bindState(cmd, scene.instances, 0, scene.extent, scene.view, scene.textureSet);
+        if (scene.gpuCulled) {
+            culler->recordDraws(cmd);
+        } else {
+            drawBatches(cmd, *scene.batches, 0, scene.instanceCount);
+        }
+    }
+
+    void SpriteRenderer::updateSceneBatches(const SceneGraph &scene) {
+        // Batches only change with the instances' textures. With bindless
+        // textures everything is one draw; otherwise each run of equal
+        // textures is a batch, and drawBatches() merges runs whose
+        // textures share an image.
+        if (batchedScene == &scene && batchedTextureVersion == scene.getTextureVersion())
+            return;
+
+        const std::vector<SpriteInstance> &instances = scene.getInstances();
+        uint32_t                           count = static_cast<uint32_t>(instances.size());
+
+        sceneBatches.clear();
+        if (textures->isBindless()) {
+            sceneBatches.push_back(SpriteDrawBatch{SpriteTextures::kWhiteTexture, 0, count});
+        } else {
+            for (uint32_t i = 0; i < count; i++) {
+                uint32_t texture = instances[i].texture;
+                if (sceneBatches.empty() || sceneBatches.back().stateKey != texture)
+                    sceneBatches.push_back(SpriteDrawBatch{texture, i, 0});
+                sceneBatches.back().instanceCount++;
+            }
+        }
+
+        batchedScene = &scene;
+        batchedTextureVersion = scene.getTextureVersion();
+    }
+
+    void SpriteRenderer::syncSceneSlot(SceneSlot &slot, const SceneGraph &scene) {
+        if (slot.scene == &scene && slot.version == scene.getVersion())
+            return;
+
+        const std::vector<SpriteInstance> &instances = scene.getInstances();
+        bool                               full = slot.scene != &scene;
+
+        // The slot's frame has finished, so its buffer can be replaced
+        if (slot.capacity < instances.size()) {
+            GpuMemoryAllocator &allocator = renderer.getAllocator();
+            if (slot.buffer != VK_NULL_HANDLE)
+                allocator.destroyBuffer(slot.buffer, slot.memory);
+
+            size_t capacity = std::max<size_t>(instances.size() + instances.size() / 2, 1024);
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = capacity * sizeof(SpriteInstance);
+            bufferInfo.usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            GpuAllocationCreateInfo allocInfo{};
+            allocInfo.requiredFlags =
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            allocInfo.mapped = true;
+
+            allocator.createBuffer(bufferInfo, allocInfo, slot.buffer, slot.memory);
+            slot.capacity = capacity;
+            full = true;
+        }
+
+        // Patch just what changed, unless the scene no longer remembers or
+        // so much changed that one straight copy is cheaper
+        sceneChanges.clear();
+        if (!full)
+            full = !scene.getChangesSince(slot.version, sceneChanges) ||
+                   sceneChanges.size() > instances.size() / 2;
+
+        auto *mapped = static_cast<SpriteInstance *>(slot.memory.mapped);
+        if (full) {
+            std::memcpy(mapped, instances.data(), instances.size() * sizeof(SpriteInstance));
+        } else {
+            for (uint32_t index : sceneChanges)
+                mapped[index] = instances[index];
+        }
+
+        slot.scene = &scene;
+        slot.version = scene.getVersion();
+    }
+
+    VkDescriptorSet SpriteRenderer::beginTextures() {
+        // Textures loaded since the last frame are packed together here
+        if (textures->hasPending())
+            textures->commit();
+        return textures->beginFrame(renderer.getCurrentFrame());
+    }
+
+    void SpriteRenderer::bindState(VkCommandBuffer cmd, VkBuffer instances, VkDeviceSize offset,
+                                   VkExtent2D extent, const WorldRect &view,
+                                   VkDescriptorSet textureSet) {
+        PushConstants constants{};
+        constants.scale[0] = 2.0f / (view.maxX - view.minX);
+        constants.scale[1] = 2.0f / (view.maxY - view.minY);
+        constants.offset[0] = -1.0f - view.minX * constants.scale[0];
+        constants.offset[1] = -1.0f - view.minY * constants.scale[1];
+
+        VkViewport viewport{};
+        viewport.width = static_cast<float>(extent.width);
+        viewport.height = static_cast<float>(extent.height);
+        viewport.maxDepth = 1.0f;
+
+        VkRect2D scissor{};
+        scissor.extent = extent;
+
+        vkCmdBindPipeline(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipeline);
+        vkCmdBindDescriptorSets(cmd, VK_PIPELINE_BIND_POINT_GRAPHICS, pipelineLayout, 0, 1,
+                                &textureSet, 0, nullptr);
+        vkCmdSetViewport(cmd, 0, 1, &viewport);
+        vkCmdSetScissor(cmd, 0, 1, &scissor);
+        vkCmdPushConstants(cmd, pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0,
+                           sizeof(PushConstants), &constants);
+        vkCmdBindVertexBuffers(cmd, 0, 1, &instances, &offset);
+    }
+
+    void SpriteRenderer::drawBatches(VkCommandBuffer cmd, const std::vector<SpriteDrawBatch> &batches,
+                                     uint32_t first, uint32_t count) {
+        // Batches are contiguous, so consecutive ones whose textures share
+        // a draw key merge into one draw: with bindless textures that is
+        // the whole range. Draws are clipped to the range; one that
+        // straddles two ranges becomes two draws, which keeps the order
+        // intact.
+        uint32_t end = first + count;
+        for (size_t i = 0; i < batches.size();) {
+            uint32_t key = textures->drawKey(batches[i].stateKey);
+            uint32_t drawFirst = batches[i].firstInstance;
+            uint32_t drawEnd = drawFirst + batches[i].instanceCount;
+            for (i++; i < batches.size() && textures->drawKey(batches[i].stateKey) == key; i++) {
+                drawEnd = batches[i].firstInstance + batches[i].instanceCount;
+            }
+
+            uint32_t from = std::max(first, drawFirst);
+            uint32_t to = std::min(end, drawEnd);
+            if (from < to) {
+                vkCmdDraw(cmd, 4, to - from, 0, from);
+            }
+        }
+    }
+
+    void SpriteRenderer::createPipeline() {
+        VkDevice device = renderer.getDevice();
+
+        VkShaderModule vertModule =
+            createShaderModule(kSpriteVertSpv, sizeof(kSpriteVertSpv));
+        VkShaderModule fragModule =
+            textures->isBindless()
+                ? createShaderModule(kSpriteBindlessFragSpv, sizeof(kSpriteBindlessFragSpv))
+                : createShaderModule(kSpriteFragSpv, sizeof(kSpriteFragSpv));
+
+        VkPipelineShaderStageCreateInfo stages[2]{};
+        stages[0].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[0].stage = VK_SHADER_STAGE_VERTEX_BIT;
+        stages[0].module = vertModule;
+        stages[0].pName = "main";
+        stages[1].sType = VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+        stages[1].stage = VK_SHADER_STAGE_FRAGMENT_BIT;
+        stages[1].module = fragModule;
+        stages[1].pName = "main";
+
+        // One per-instance stream, no per-vertex data: the quad corners come
+        // from gl_VertexIndex.
+        VkVertexInputBindingDescription binding{};
+        binding.binding = 0;
+        binding.stride = sizeof(SpriteInstance);
+        binding.inputRate = VK_VERTEX_INPUT_RATE_INSTANCE;
+
+        std::array<VkVertexInputAttributeDescription, 4> attributes{};
+        attributes[0] = {0, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SpriteInstance, row0)};
+        attributes[1] = {1, 0, VK_FORMAT_R32_UINT, offsetof(SpriteInstance, texture)};
+        attributes[2] = {2, 0, VK_FORMAT_R32G32B32_SFLOAT, offsetof(SpriteInstance, row1)};
+        attributes[3] = {3, 0, VK_FORMAT_R32_UINT, offsetof(SpriteInstance, color)};
+
+        VkPipelineVertexInputStateCreateInfo vertexInput{};
+        vertexInput.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
+        vertexInput.vertexBindingDescriptionCount = 1;
+        vertexInput.pVertexBindingDescriptions = &binding;
+        vertexInput.vertexAttributeDescriptionCount =
+            static_cast<uint32_t>(attributes.size());
+        vertexInput.pVertexAttributeDescriptions = attributes.data();
+
+        VkPipelineInputAssemblyStateCreateInfo inputAssembly{};
+        inputAssembly.sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO;
+        inputAssembly.topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_STRIP;
+
+        VkPipelineViewportStateCreateInfo viewportState{};
+        viewportState.sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO;
+        viewportState.viewportCount = 1;
+        viewportState.scissorCount = 1;
+
+        VkPipelineRasterizationStateCreateInfo rasterizer{};
+        rasterizer.sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO;
+        rasterizer.polygonMode = VK_POLYGON_MODE_FILL;
+        rasterizer.cullMode = VK_CULL_MODE_NONE;
+        rasterizer.frontFace = VK_FRONT_FACE_COUNTER_CLOCKWISE;
+        rasterizer.lineWidth = 1.0f;
+
+        VkPipelineMultisampleStateCreateInfo multisampling{};
+        multisampling.sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO;
+        multisampling.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
+
+        VkPipelineColorBlendAttachmentState blendAttachment{};
+        blendAttachment.blendEnable = VK_TRUE;
+        blendAttachment.srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA;
+        blendAttachment.dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        blendAttachment.colorBlendOp = VK_BLEND_OP_ADD;
+        blendAttachment.srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE;
+        blendAttachment.dstAlphaBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA;
+        blendAttachment.alphaBlendOp = VK_BLEND_OP_ADD;
+        blendAttachment.colorWriteMask =
+            VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT |
+            VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT;
+
+        VkPipelineColorBlendStateCreateInfo colorBlending{};
+        colorBlending.sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO;
+        colorBlending.attachmentCount = 1;
+        colorBlending.pAttachments = &blendAttachment;
+
+        VkDynamicState dynamicStates[] = {VK_DYNAMIC_STATE_VIEWPORT,
+                                          VK_DYNAMIC_STATE_SCISSOR};
+
+        VkPipelineDynamicStateCreateInfo dynamicState{};
+        dynamicState.sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO;
+        dynamicState.dynamicStateCount = 2;
+        dynamicState.pDynamicStates = dynamicStates;
+
+        VkPushConstantRange pushConstantRange{};
+        pushConstantRange.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+        pushConstantRange.offset = 0;
+        pushConstantRange.size = sizeof(PushConstants);
+
+        VkDescriptorSetLayout setLayout = textures->getSetLayout();
+
+        VkPipelineLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+        layoutInfo.setLayoutCount = 1;
+        layoutInfo.pSetLayouts = &setLayout;
+        layoutInfo.pushConstantRangeCount = 1;
+        layoutInfo.pPushConstantRanges = &pushConstantRange;
+
+        VK_CHECK_RESULT(
+            vkCreatePipelineLayout(device, &layoutInfo, nullptr, &pipelineLayout));
+
+        VkGraphicsPipelineCreateInfo pipelineInfo{};
+        pipelineInfo.sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO;
+        pipelineInfo.stageCount = 2;
+        pipelineInfo.pStages = stages;
+        pipelineInfo.pVertexInputState = &vertexInput;
+        pipelineInfo.pInputAssemblyState = &inputAssembly;
+        pipelineInfo.pViewportState = &viewportState;
+        pipelineInfo.pRasterizationState = &rasterizer;
+        pipelineInfo.pMultisampleState = &multisampling;
+        pipelineInfo.pColorBlendState = &colorBlending;
+        pipelineInfo.pDynamicState = &dynamicState;
+        pipelineInfo.layout = pipelineLayout;
+        pipelineInfo.renderPass = renderer.getRenderPass();
+        pipelineInfo.subpass = 0;
+
+        try {
+            pipeline = renderer.getPipelineCache().createGraphicsPipeline(pipelineInfo);
+        } catch (...) {
+            vkDestroyShaderModule(device, fragModule, nullptr);
+            vkDestroyShaderModule(device, vertModule, nullptr);
+            throw;
+        }
+
+        vkDestroyShaderModule(device, fragModule, nullptr);
+        vkDestroyShaderModule(device, vertModule, nullptr);
+    }
+
+    VkShaderModule SpriteRenderer::createShaderModule(const uint32_t *code,
+                                                      size_t          size) {
+        VkShaderModuleCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+        createInfo.codeSize = size;
+        createInfo.pCode = code;
+
+        VkShaderModule shaderModule;
+        VK_CHECK_RESULT(vkCreateShaderModule(renderer.getDevice(), &createInfo,
+                                             nullptr, &shaderModule));
+        return shaderModule;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,140 @@
+#ifndef SPRITERENDERER_H
+#define SPRITERENDERER_H
+
+#include "Core/VulkanWrapper/GpuMemoryAllocator.h"
+#include "SceneCuller.h"
+#include "SceneGraph.h"
+#include "SpatialGrid.h"
+#include "SpriteBatch.h"
+#include "SpriteTextures.h"
+#include <memory>
+#include <optional>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    class VulkanWrapper;
+
+    // GPU half of the sprite path: owns the instanced sprite pipeline and the
+    // sprite textures. A frame's sprites are written straight into a slice
+    // of the wrapper's FrameArena and drawn with one vkCmdDraw per run of
+    // batches that SpriteTextures::drawKey() allows to share a draw.
+    class SpriteRenderer {
+      public:
+        explicit SpriteRenderer(VulkanWrapper &renderer);
+        ~SpriteRenderer();
+
+        SpriteRenderer(const SpriteRenderer &) = delete;
+        SpriteRenderer &operator=(const SpriteRenderer &) = delete;
+
+        void initialize(const SpriteTextures::Config &textureConfig = {});
+        void cleanup();
+
+        // Batcher state keys are SpriteTextures texture ids
+        SpriteTextures &getTextures() { return *textures; }
+
+        // World rectangle mapped onto the whole framebuffer. Without one,
+        // world units are framebuffer pixels with the origin top-left.
+        void setView(const WorldRect &view) { this->view = view; }
+        void resetView() { view.reset(); }
+        // The view the next frame will be drawn with
+        WorldRect getView() const;
+
+        // Must be called inside the wrapper's render pass, after the frame
+        // arena has been reset for the current frame. Consumes and clears
+        // `batcher`.
+        void record(VkCommandBuffer cmd, SpriteBatcher &batcher);
+
+        // record() split for parallel recording: prepare() reserves the
+        // instance buffer and plans the draws on the render thread, then
+        // recordRange() writes and draws instances [first, first + count)
+        // and may run on several threads for disjoint ranges. The batcher
+        // must stay untouched until all ranges are recorded.
+        struct PreparedFrame {
+            FrameArena::Slice                   instances;
+            const std::vector<SpriteDrawBatch> *batches = nullptr;
+            uint32_t                            instanceCount = 0;
+            VkExtent2D                          extent{};
+            WorldRect                           view;
+            VkDescriptorSet                     textureSet = VK_NULL_HANDLE;
+        };
+
+        PreparedFrame prepare(SpriteBatcher &batcher);
+        void          recordRange(VkCommandBuffer cmd, const SpriteBatcher &batcher,
+                                  const PreparedFrame &frame, uint32_t first, uint32_t count);
+
+        // Retained scenes keep their instances in a buffer per frame slot
+        // instead of the frame arena. prepareScene() runs on the render
+        // thread and patches the slot's buffer with only the instances
+        // changed since the slot was last drawn; recordScene() draws them
+        // and may run on a recording thread. The scene must not be updated
+        // in between.
+        struct PreparedScene {
+            VkBuffer                            instances = VK_NULL_HANDLE;
+            const std::vector<SpriteDrawBatch> *batches = nullptr;
+            uint32_t                            instanceCount = 0;
+            VkExtent2D                          extent{};
+            WorldRect                           view;
+            VkDescriptorSet                     textureSet = VK_NULL_HANDLE;
+
+            // Set by prepareCulledScene(); the pass that records the scene
+            // must read these as VertexBuffer and IndirectBuffer
+            bool                  gpuCulled = false;
+            RenderGraph::Resource culledInstances;
+            RenderGraph::Resource drawCommands;
+        };
+
+        PreparedScene prepareScene(const SceneGraph &scene);
+        // prepareScene() with the scene kept resident on the GPU and culled
+        // by compute passes declared into `graph`, see SceneCuller. Must be
+        // called before the pass that records the scene is declared.
+        PreparedScene prepareCulledScene(RenderGraph &graph, const SceneGraph &scene);
+        void          recordScene(VkCommandBuffer cmd, const PreparedScene &scene);
+
+      private:
+        struct PushConstants {
+            float scale[2];
+            float offset[2];
+        };
+
+        // Copy of a scene's instances used by one frame slot
+        struct SceneSlot {
+            const SceneGraph *scene = nullptr;
+            VkBuffer          buffer = VK_NULL_HANDLE;
+            GpuAllocation     memory;
+            size_t            capacity = 0;
+            uint64_t          version = 0;
+        };
+
+        VkDescriptorSet beginTextures();
+        void            updateSceneBatches(const SceneGraph &scene);
+        void            syncSceneSlot(SceneSlot &slot, const SceneGraph &scene);
+        void            bindState(VkCommandBuffer cmd, VkBuffer instances, VkDeviceSize offset,
+                                  VkExtent2D extent, const WorldRect &view,
+                                  VkDescriptorSet textureSet);
+        void            drawBatches(VkCommandBuffer cmd, const std::vector<SpriteDrawBatch> &batches,
+                                    uint32_t first, uint32_t count);
+        void            createPipeline();
+        VkShaderModule  createShaderModule(const uint32_t *code, size_t size);
+
+        VulkanWrapper   &renderer;
+        VkPipelineLayout pipelineLayout = VK_NULL_HANDLE;
+        VkPipeline       pipeline = VK_NULL_HANDLE;
+
+        std::unique_ptr<SpriteTextures> textures;
+        std::optional<WorldRect>        view;
+
+        std::vector<SceneSlot>       sceneSlots; // per frame slot
+        std::vector<uint32_t>        sceneChanges; // scratch for syncSceneSlot
+        std::vector<SpriteDrawBatch> sceneBatches;
+        const SceneGraph            *batchedScene = nullptr;
+        uint64_t                     batchedTextureVersion = 0;
+
+        std::unique_ptr<SceneCuller>       culler; // created on first use
+        std::vector<SceneCuller::DrawRange> cullRanges;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SPRITERENDERER_H
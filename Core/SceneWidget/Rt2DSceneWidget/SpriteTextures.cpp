@@ -0,0 +1,570 @@
+#include "SpriteTextures.h"
+#include "Core/VulkanWrapper/VulkanWrapper.h"
+#include <algorithm>
+#include <cstring>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        uint32_t floorLog2(uint32_t value) {
+            uint32_t log = 0;
+            while (value > 1) {
+                value >>= 1;
+                log++;
+            }
+            return log;
+        }
+
+        uint32_t alignUp(uint32_t value, uint32_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        // Copies `width` x `height` texels into a `blockWidth` x
+        // `blockHeight` block at `dst`, `stride` texels per row, `padding`
+        // texels in from its corner; the rest of the block repeats the edge
+        // texels
+        void copyPadded(uint8_t *dst, uint32_t stride, uint32_t blockWidth, uint32_t blockHeight,
+                        const uint8_t *src, uint32_t width, uint32_t height, uint32_t padding) {
+            for (uint32_t y = 0; y < blockHeight; y++) {
+                uint32_t srcY = std::min(y > padding ? y - padding : 0, height - 1);
+                for (uint32_t x = 0; x < blockWidth; x++) {
+                    uint32_t srcX = std::min(x > padding ? x - padding : 0, width - 1);
+                    std::memcpy(&dst[(static_cast<size_t>(y) * stride + x) * 4],
+                                &src[(static_cast<size_t>(srcY) * width + srcX) * 4], 4);
+                }
+            }
+        }
+
+        // 2x2 box filter; odd edges reuse the last row or column
+        std::vector<uint8_t> downsample(const std::vector<uint8_t> &src, uint32_t width,
+                                        uint32_t height) {
+            uint32_t             dstWidth = std::max(width / 2, 1u);
+            uint32_t             dstHeight = std::max(height / 2, 1u);
+            std::vector<uint8_t> dst(static_cast<size_t>(dstWidth) * dstHeight * 4);
+
+            for (uint32_t y = 0; y < dstHeight; y++) {
+                uint32_t y0 = std::min(y * 2, height - 1);
+                uint32_t y1 = std::min(y * 2 + 1, height - 1);
+                for (uint32_t x = 0; x < dstWidth; x++) {
+                    uint32_t x0 = std::min(x * 2, width - 1);
+                    uint32_t x1 = std::min(x * 2 + 1, width - 1);
+                    for (uint32_t c = 0; c < 4; c++) {
+                        uint32_t sum = src[(static_cast<size_t>(y0) * width + x0) * 4 + c] +
+                                       src[(static_cast<size_t>(y0) * width + x1) * 4 + c] +
+                                       src[(static_cast<size_t>(y1) * width + x0) * 4 + c] +
+                                       src[(static_cast<size_t>(y1) * width + x1) * 4 + c];
+                        dst[(static_cast<size_t>(y) * dstWidth + x) * 4 + c] =
+                            static_cast<uint8_t>((sum + 2) / 4);
+                    }
+                }
+            }
+            return dst;
+        }
+    } // namespace
+
+    SpriteTextures::SpriteTextures(VulkanWrapper &renderer, const Config &config)
+        : renderer(renderer), config(config) {
+        const DeviceCapabilities     &capabilities = renderer.getDeviceCapabilities();
+        const VkPhysicalDeviceLimits &limits = capabilities.properties.limits;
+
+        uint32_t deviceLimit = std::min({limits.maxPerStageDescriptorSamplers,
+                                         limits.maxPerStageDescriptorSampledImages,
+                                         limits.maxDescriptorSetSamplers,
+                                         limits.maxDescriptorSetSampledImages});
+
+        bindless = renderer.hasDescriptorIndexing();
+        if (bindless) {
+            arraySize = std::min(config.maxImages, deviceLimit);
+        } else {
+            if (!capabilities.features.shaderSampledImageArrayDynamicIndexing) {
+                throw std::runtime_error(
+                    "Sprite textures need descriptor indexing or dynamic sampler array indexing");
+            }
+            arraySize = std::min(kFallbackImageCount, deviceLimit);
+        }
+
+        // A level-n texel spans 2^n atlas texels; it must stay inside the
+        // padding of its own entry
+        atlasMipLevels = floorLog2(std::max(config.padding, 1u)) + 1;
+
+        createLayout();
+
+        // Texture 0: one white texel, needed before anything else can be
+        // bound, so its upload is waited for here
+        uint32_t white = createImage(1, 1, 1);
+        uploadMips(white, std::vector<uint8_t>(4, 0xFF), 1, 1, 1);
+        renderer.getUploader().wait(renderer.getUploader().flush());
+        images[white].ready = true;
+
+        regions.push_back(Region{{0.0f, 0.0f, 1.0f, 1.0f}, white, 0, {}});
+    }
+
+    SpriteTextures::~SpriteTextures() {
+        VkDevice            device = renderer.getDevice();
+        GpuMemoryAllocator &allocator = renderer.getAllocator();
+
+        for (FrameSlot &slot : slots) {
+            if (slot.regionBuffer != VK_NULL_HANDLE)
+                allocator.destroyBuffer(slot.regionBuffer, slot.regionMemory);
+        }
+        for (Image &image : images) {
+            vkDestroyImageView(device, image.view, nullptr);
+            allocator.destroyImage(image.image, image.allocation);
+        }
+
+        vkDestroySampler(device, sampler, nullptr);
+    }
+
+    void SpriteTextures::createLayout() {
+        VkDevice device = renderer.getDevice();
+
+        // The bindless array is only written up to the number of images
+        DescriptorLayoutKey key;
+        key.add(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_VERTEX_BIT);
+        key.add(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, arraySize,
+                VK_SHADER_STAGE_FRAGMENT_BIT,
+                bindless ? VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT_EXT : 0);
+        setLayout = renderer.getDescriptorLayouts().getLayout(std::move(key));
+
+        // One region table per frame in flight, rewritten only once its
+        // frame is done
+        slots.resize(renderer.getMaxFramesInFlight());
+
+        VkSamplerCreateInfo samplerInfo{};
+        samplerInfo.sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO;
+        samplerInfo.magFilter = VK_FILTER_LINEAR;
+        samplerInfo.minFilter = VK_FILTER_LINEAR;
+        samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+        samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+        samplerInfo.maxLod = VK_LOD_CLAMP_NONE;
+
+        VK_CHECK_RESULT(vkCreateSampler(device, &samplerInfo, nullptr, &sampler));
+    }
+
+    uint32_t SpriteTextures::createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
+                                         VkFormat format) {
+        if (images.size() >= arraySize) {
+            throw std::runtime_error("Too many sprite texture images (limit " +
+                                     std::to_string(arraySize) + ")");
+        }
+
+        VkImageCreateInfo imageInfo{};
+        imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+        imageInfo.imageType = VK_IMAGE_TYPE_2D;
+        imageInfo.format = format;
+        imageInfo.extent = {width, height, 1};
+        imageInfo.mipLevels = mipLevels;
+        imageInfo.arrayLayers = 1;
+        imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+        imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+        imageInfo.usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+        imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+        imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+        GpuAllocationCreateInfo allocInfo{};
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+
+        Image image;
+        image.width = width;
+        image.height = height;
+        renderer.getAllocator().createImage(imageInfo, allocInfo, image.image, image.allocation);
+
+        VkImageViewCreateInfo viewInfo{};
+        viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+        viewInfo.image = image.image;
+        viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+        viewInfo.format = imageInfo.format;
+        viewInfo.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1};
+
+        VkResult result = vkCreateImageView(renderer.getDevice(), &viewInfo, nullptr, &image.view);
+        if (result != VK_SUCCESS) {
+            renderer.getAllocator().destroyImage(image.image, image.allocation);
+            VK_CHECK_RESULT(result);
+        }
+
+        images.push_back(image);
+        return static_cast<uint32_t>(images.size() - 1);
+    }
+
+    void SpriteTextures::uploadMips(uint32_t image, std::vector<uint8_t> texels, uint32_t width,
+                                    uint32_t height, uint32_t mipLevels) {
+        StagingUploader &uploader = renderer.getUploader();
+
+        for (uint32_t level = 0; level < mipLevels; level++) {
+            ImageUpload upload;
+            upload.image = images[image].image;
+            upload.subresource.mipLevel = level;
+            upload.extent = {width, height, 1};
+            images[image].ticket = uploader.uploadImage(upload, texels.data(), texels.size());
+
+            if (level + 1 < mipLevels) {
+                texels = downsample(texels, width, height);
+                width = std::max(width / 2, 1u);
+                height = std::max(height / 2, 1u);
+            }
+        }
+    }
+
+    SpriteTextures::TextureId SpriteTextures::load(const void *rgba, uint32_t width,
+                                                   uint32_t height) {
+        if (width == 0 || height == 0) {
+            throw std::runtime_error("Sprite texture has no texels");
+        }
+
+        TextureId      id = reserve();
+        const uint8_t *bytes = static_cast<const uint8_t *>(rgba);
+        provide(id, std::vector<uint8_t>(bytes, bytes + static_cast<size_t>(width) * height * 4),
+                width, height);
+        return id;
+    }
+
+    SpriteTextures::TextureId SpriteTextures::reserve() {
+        TextureId id = static_cast<TextureId>(regions.size());
+        // Draws as texture 0 until committed and uploaded
+        regions.push_back(regions[kWhiteTexture]);
+        return id;
+    }
+
+    void SpriteTextures::provide(TextureId id, std::vector<uint8_t> texels, uint32_t width,
+                                 uint32_t height) {
+        if (id == kWhiteTexture || id >= regions.size()) {
+            throw std::runtime_error("Sprite texture id was not reserved");
+        }
+        if (width == 0 || height == 0) {
+            throw std::runtime_error("Sprite texture has no texels");
+        }
+        if (texels.size() != static_cast<size_t>(width) * height * 4) {
+            throw std::runtime_error("Sprite texture texels do not match its size");
+        }
+        pending.push_back(PendingTexture{id, width, height, std::move(texels)});
+    }
+
+    void SpriteTextures::commit() {
+        if (pending.empty())
+            return;
+
+        uint32_t alignment = 1u << (atlasMipLevels - 1);
+
+        std::vector<PendingTexture *> atlased;
+        for (PendingTexture &texture : pending) {
+            bool small = texture.width <= config.maxAtlasedSize &&
+                         texture.height <= config.maxAtlasedSize &&
+                         alignUp(texture.width + config.padding * 2, alignment) <= config.atlasSize &&
+                         alignUp(texture.height + config.padding * 2, alignment) <= config.atlasSize;
+            if (small) {
+                atlased.push_back(&texture);
+            } else {
+                commitStandalone(texture);
+            }
+        }
+        if (!atlased.empty())
+            commitAtlased(atlased);
+
+        pending.clear();
+        renderer.getUploader().flush();
+        version++;
+    }
+
+    void SpriteTextures::commitStandalone(PendingTexture &texture) {
+        uint32_t mipLevels = floorLog2(std::max(texture.width, texture.height)) + 1;
+        uint32_t image = createImage(texture.width, texture.height, mipLevels);
+        uploadMips(image, std::move(texture.texels), texture.width, texture.height, mipLevels);
+
+        regions[texture.id] = Region{{0.0f, 0.0f, 1.0f, 1.0f}, image, 0, {}};
+    }
+
+    void SpriteTextures::commitAtlased(std::vector<PendingTexture *> &textures) {
+        struct Placement {
+            PendingTexture *texture;
+            size_t          page;
+            uint32_t        x;
+            uint32_t        y;
+            uint32_t        width; // of the block, padding included
+            uint32_t        height;
+        };
+
+        // Tallest first keeps the skyline flat
+        std::stable_sort(textures.begin(), textures.end(),
+                         [](const PendingTexture *a, const PendingTexture *b) {
+                             return a->height != b->height ? a->height > b->height
+                                                           : a->width > b->width;
+                         });
+
+        // Entries are aligned to the coarsest atlas mip so no level mixes
+        // texels of two entries
+        uint32_t padding = config.padding;
+        uint32_t alignment = 1u << (atlasMipLevels - 1);
+        uint32_t size = config.atlasSize;
+
+        // Pages of earlier commits are filled up first; only the pages
+        // opened here are uploaded whole
+        size_t                 firstNewPage = atlas.size();
+        std::vector<Placement> placements;
+        placements.reserve(textures.size());
+
+        for (PendingTexture *texture : textures) {
+            Placement placement{texture, 0, 0, 0,
+                                alignUp(texture->width + padding * 2, alignment),
+                                alignUp(texture->height + padding * 2, alignment)};
+            for (; placement.page < atlas.size(); placement.page++) {
+                if (atlas[placement.page].packer.pack(placement.width, placement.height,
+                                                      placement.x, placement.y))
+                    break;
+            }
+            if (placement.page == atlas.size()) {
+                atlas.push_back(AtlasPage{SkylinePacker(size, size),
+                                          createImage(size, size, atlasMipLevels)});
+                atlas.back().packer.pack(placement.width, placement.height, placement.x,
+                                         placement.y);
+            }
+            placements.push_back(placement);
+        }
+
+        for (size_t page = firstNewPage; page < atlas.size(); page++) {
+            std::vector<uint8_t> texels(static_cast<size_t>(size) * size * 4, 0);
+
+            for (const Placement &placement : placements) {
+                if (placement.page != page)
+                    continue;
+
+                const PendingTexture &texture = *placement.texture;
+                copyPadded(&texels[(static_cast<size_t>(placement.y) * size + placement.x) * 4],
+                           size, placement.width, placement.height, texture.texels.data(),
+                           texture.width, texture.height, padding);
+                setAtlasRegion(texture.id, static_cast<uint32_t>(page), placement.x,
+                               placement.y, texture.width, texture.height);
+            }
+
+            uploadMips(atlas[page].image, std::move(texels), size, size, atlasMipLevels);
+        }
+
+        for (const Placement &placement : placements) {
+            if (placement.page >= firstNewPage)
+                continue;
+
+            const PendingTexture &texture = *placement.texture;
+            PageUpdate            update{texture.id, static_cast<uint32_t>(placement.page),
+                                         placement.x, placement.y, placement.width,
+                                         placement.height, texture.width, texture.height, {}};
+
+            // The block is aligned to the coarsest mip, so each of its
+            // levels is exactly the page's texels at that level
+            std::vector<uint8_t> block(static_cast<size_t>(placement.width) * placement.height * 4);
+            copyPadded(block.data(), placement.width, placement.width, placement.height,
+                       texture.texels.data(), texture.width, texture.height, padding);
+            uint32_t width = placement.width;
+            uint32_t height = placement.height;
+            for (uint32_t level = 0; level < atlasMipLevels; level++) {
+                update.texels.insert(update.texels.end(), block.begin(), block.end());
+                if (level + 1 < atlasMipLevels) {
+                    block = downsample(block, width, height);
+                    width /= 2;
+                    height /= 2;
+                }
+            }
+            pageUpdates.push_back(std::move(update));
+        }
+    }
+
+    void SpriteTextures::setAtlasRegion(TextureId id, uint32_t page, uint32_t x, uint32_t y,
+                                        uint32_t width, uint32_t height) {
+        float size = static_cast<float>(config.atlasSize);
+        float u0 = (x + config.padding) / size;
+        float v0 = (y + config.padding) / size;
+        float u1 = (x + config.padding + width) / size;
+        float v1 = (y + config.padding + height) / size;
+        regions[id] = Region{{u0, v0, u1, v1}, atlas[page].image, 0, {}};
+    }
+
+    void SpriteTextures::recordUpdates(VkCommandBuffer cmd) {
+        if (pageUpdates.empty())
+            return;
+
+        // A page whose first upload has not been acquired yet takes its
+        // updates in a later frame
+        StagingUploader &uploader = renderer.getUploader();
+        auto             deferred =
+            std::stable_partition(pageUpdates.begin(), pageUpdates.end(),
+                                  [&](const PageUpdate &update) {
+                                      return uploader.isReady(
+                                          images[atlas[update.page].image].ticket);
+                                  });
+        if (deferred == pageUpdates.begin())
+            return;
+
+        // One copy per page
+        std::stable_sort(pageUpdates.begin(), deferred,
+                         [](const PageUpdate &a, const PageUpdate &b) { return a.page < b.page; });
+
+        VkDeviceSize total = 0;
+        for (auto it = pageUpdates.begin(); it != deferred; ++it)
+            total += it->texels.size();
+        FrameArena::Slice staging = renderer.getFrameArena().allocate(total, 16);
+
+        // Earlier frames sample the pages until the copy starts
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, atlasMipLevels, 0, 1};
+
+        barriers.clear();
+        for (auto it = pageUpdates.begin(); it != deferred; ++it) {
+            if (it == pageUpdates.begin() || std::prev(it)->page != it->page) {
+                barrier.image = images[atlas[it->page].image].image;
+                barriers.push_back(barrier);
+            }
+        }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        uint8_t     *data = static_cast<uint8_t *>(staging.data);
+        VkDeviceSize offset = 0;
+        for (auto it = pageUpdates.begin(); it != deferred;) {
+            uint32_t page = it->page;
+            copies.clear();
+            for (; it != deferred && it->page == page; ++it) {
+                std::memcpy(data + offset, it->texels.data(), it->texels.size());
+
+                uint32_t width = it->blockWidth;
+                uint32_t height = it->blockHeight;
+                for (uint32_t level = 0; level < atlasMipLevels; level++) {
+                    VkBufferImageCopy copy{};
+                    copy.bufferOffset = staging.offset + offset;
+                    copy.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1};
+                    copy.imageOffset = {static_cast<int32_t>(it->x >> level),
+                                        static_cast<int32_t>(it->y >> level), 0};
+                    copy.imageExtent = {width, height, 1};
+                    copies.push_back(copy);
+
+                    offset += static_cast<VkDeviceSize>(width) * height * 4;
+                    width /= 2;
+                    height /= 2;
+                }
+            }
+            vkCmdCopyBufferToImage(cmd, staging.buffer, images[atlas[page].image].image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                                   static_cast<uint32_t>(copies.size()), copies.data());
+        }
+
+        for (VkImageMemoryBarrier &pageBarrier : barriers) {
+            pageBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            pageBarrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            pageBarrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            pageBarrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr,
+                             static_cast<uint32_t>(barriers.size()), barriers.data());
+
+        // The copies are recorded ahead of every draw of the frame
+        for (auto it = pageUpdates.begin(); it != deferred; ++it)
+            setAtlasRegion(it->id, it->page, it->x, it->y, it->width, it->height);
+        pageUpdates.erase(pageUpdates.begin(), deferred);
+        version++;
+    }
+
+    uint32_t SpriteTextures::createDistanceFieldImage(uint32_t width, uint32_t height) {
+        if (width == 0 || height == 0) {
+            throw std::runtime_error("Distance field image has no texels");
+        }
+
+        uint32_t image = createImage(width, height, 1, VK_FORMAT_R8_UNORM);
+        images[image].flags = kDistanceField;
+        return image;
+    }
+
+    void SpriteTextures::setImageReady(uint32_t image) {
+        if (!images[image].ready) {
+            images[image].ready = true;
+            version++;
+        }
+    }
+
+    void SpriteTextures::setRegion(TextureId id, uint32_t image, uint32_t x, uint32_t y,
+                                   uint32_t width, uint32_t height) {
+        if (id == kWhiteTexture || id >= regions.size()) {
+            throw std::runtime_error("Sprite texture id was not reserved");
+        }
+
+        const Image &target = images[image];
+        float        u0 = static_cast<float>(x) / target.width;
+        float        v0 = static_cast<float>(y) / target.height;
+        float        u1 = static_cast<float>(x + width) / target.width;
+        float        v1 = static_cast<float>(y + height) / target.height;
+        regions[id] = Region{{u0, v0, u1, v1}, image, target.flags, {}};
+        version++;
+    }
+
+    VkDescriptorSet SpriteTextures::beginFrame(uint32_t slotIndex) {
+        StagingUploader &uploader = renderer.getUploader();
+        for (Image &image : images) {
+            // Distance-field images are never uploaded through the
+            // uploader; their owner calls setImageReady()
+            bool uploaded = (image.flags & kDistanceField) == 0;
+            if (!image.ready && uploaded && uploader.isReady(image.ticket)) {
+                image.ready = true;
+                version++;
+            }
+        }
+
+        FrameSlot &slot = slots[slotIndex];
+        if (slot.version != version)
+            writeRegions(slot);
+
+        // Images still uploading, and unused fallback entries, show texture 0
+        uint32_t imageCount = bindless ? static_cast<uint32_t>(images.size()) : arraySize;
+        imageInfos.resize(imageCount);
+        for (uint32_t i = 0; i < imageCount; i++) {
+            bool usable = i < images.size() && images[i].ready;
+            imageInfos[i].sampler = sampler;
+            imageInfos[i].imageView = usable ? images[i].view : images[kWhiteTexture].view;
+            imageInfos[i].imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        }
+
+        writes.clear();
+        writes.buffer(0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, slot.regionBuffer, 0,
+                      regions.size() * sizeof(Region));
+        writes.images(1, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, imageInfos.data(), imageCount);
+        return renderer.getDescriptorAllocator().getSet(setLayout, writes);
+    }
+
+    void SpriteTextures::writeRegions(FrameSlot &slot) {
+        GpuMemoryAllocator &allocator = renderer.getAllocator();
+
+        // The slot's frame has finished, so its buffer can be replaced
+        if (slot.regionCapacity < regions.size()) {
+            if (slot.regionBuffer != VK_NULL_HANDLE)
+                allocator.destroyBuffer(slot.regionBuffer, slot.regionMemory);
+
+            size_t capacity = std::max<size_t>(regions.size() * 2, 64);
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = capacity * sizeof(Region);
+            bufferInfo.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            GpuAllocationCreateInfo allocInfo{};
+            allocInfo.requiredFlags =
+                VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            allocInfo.mapped = true;
+
+            allocator.createBuffer(bufferInfo, allocInfo, slot.regionBuffer, slot.regionMemory);
+            slot.regionCapacity = capacity;
+        }
+        std::memcpy(slot.regionMemory.mapped, regions.data(), regions.size() * sizeof(Region));
+        slot.version = version;
+    }
+
+} // namespace Retoccilus::Core
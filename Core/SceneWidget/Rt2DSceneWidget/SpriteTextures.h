@@ -0,0 +1,211 @@
+#ifndef SPRITETEXTURES_H
+#define SPRITETEXTURES_H
+
+#include "Core/VulkanWrapper/DescriptorAllocator.h"
+#include "Core/VulkanWrapper/GpuMemoryAllocator.h"
+#include "Core/VulkanWrapper/StagingUploader.h"
+#include "SkylinePacker.h"
+#include <cstdint>
+#include <memory>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    class VulkanWrapper;
+
+    // Sprite textures, addressed by the texture index every SpriteInstance
+    // carries. Small images are packed into shared atlas pages; large ones
+    // get an image of their own. Either way a texture is a region of one
+    // image, and the region table (binding 0, read by Sprite.vert) maps
+    // the instance's index to that image and its UV rectangle.
+    //
+    // With descriptor indexing every image sits in one runtime-sized
+    // sampler array (binding 1) indexed per fragment, so sprites with any
+    // mix of textures are drawn with one instanced draw. Without it the
+    // array has kFallbackImageCount entries and must be indexed uniformly,
+    // so draws are split wherever the image changes; drawKey() tells the
+    // renderer where.
+    //
+    // Images are uploaded through the wrapper's StagingUploader; until a
+    // texture's upload has landed, it samples the white texture 0. Atlas
+    // pages stay open across commits: textures packed into a page that
+    // frames already sample are copied in on the graphics queue by
+    // recordUpdates(), and sample white until then.
+    // Distance-field images are the exception: their owner fills them on
+    // the graphics queue, e.g. SdfGlyphCache, and reports when they are
+    // ready. Their regions carry kDistanceField, and the fragment shaders
+    // draw them as an alpha mask from the distance to the outline.
+    class SpriteTextures {
+      public:
+        using TextureId = uint32_t;
+
+        // Plain white, so untextured sprites draw in their colour
+        static constexpr TextureId kWhiteTexture = 0;
+        static constexpr uint32_t  kFallbackImageCount = 16;
+        // Region flag, matching Sprite.frag
+        static constexpr uint32_t kDistanceField = 1;
+
+        struct Config {
+            uint32_t atlasSize = 2048;
+            // Texels of edge-extended border around every atlas entry. Atlas
+            // pages get log2(padding) + 1 mip levels, so filtering never
+            // reads a neighbour.
+            uint32_t padding = 4;
+            // Larger images (either side) get an image of their own
+            uint32_t maxAtlasedSize = 256;
+            // Upper bound for the bindless array, clamped to device limits
+            uint32_t maxImages = 4096;
+        };
+
+        SpriteTextures(VulkanWrapper &renderer, const Config &config);
+        ~SpriteTextures();
+
+        SpriteTextures(const SpriteTextures &) = delete;
+        SpriteTextures &operator=(const SpriteTextures &) = delete;
+
+        // Copies tightly packed RGBA8 (sRGB) texels. The texture is packed
+        // and uploaded by the next commit(), so loading many textures
+        // before a frame packs them together.
+        TextureId load(const void *rgba, uint32_t width, uint32_t height);
+        // A texture that samples white until provide() gives it texels,
+        // for images that arrive later, e.g. from AssetStreamer
+        TextureId reserve();
+        // Takes over tightly packed RGBA8 texels for a reserved texture,
+        // packed and uploaded by the next commit() like load()
+        void provide(TextureId id, std::vector<uint8_t> texels, uint32_t width, uint32_t height);
+        // Packs the loaded textures, generates their mips and queues the
+        // uploads. Called by the renderer when it prepares a frame.
+        void commit();
+        bool hasPending() const { return !pending.empty(); }
+        // Copies the textures that commit() packed into pages in use, on
+        // the frame's command buffer outside any render pass, through the
+        // wrapper's FrameArena. Called by the owner once per frame via
+        // VulkanWrapper::setUploadCallback().
+        void recordUpdates(VkCommandBuffer cmd);
+
+        // A single-channel (R8) distance-field image with one mip level,
+        // left in UNDEFINED layout for its owner to fill. It samples white
+        // until setImageReady(), which must be called once the commands
+        // that leave it in SHADER_READ_ONLY_OPTIMAL are recorded ahead of
+        // the frame's draws.
+        uint32_t    createDistanceFieldImage(uint32_t width, uint32_t height);
+        void        setImageReady(uint32_t image);
+        VkImage     getImage(uint32_t image) const { return images[image].image; }
+        VkImageView getImageView(uint32_t image) const { return images[image].view; }
+        // Points a reserved texture at texels [x, x + width) x [y, y + height)
+        // of `image`, drawn as a distance field if the image is one
+        void setRegion(TextureId id, uint32_t image, uint32_t x, uint32_t y, uint32_t width,
+                       uint32_t height);
+
+        // Called after the frame slot's fence has signalled. Refreshes the
+        // slot's region table if textures changed since it was last used,
+        // and returns the frame's set from the wrapper's
+        // DescriptorAllocator, the same one for every call in a frame.
+        VkDescriptorSet beginFrame(uint32_t slot);
+
+        VkDescriptorSetLayout getSetLayout() const { return setLayout; }
+        bool                  isBindless() const { return bindless; }
+
+        // Sprites whose textures have equal keys can share a draw
+        uint32_t drawKey(TextureId texture) const {
+            if (bindless)
+                return 0;
+            return regions[texture < regions.size() ? texture : kWhiteTexture].image;
+        }
+
+        uint32_t getTextureCount() const { return static_cast<uint32_t>(regions.size()); }
+        uint32_t getImageCount() const { return static_cast<uint32_t>(images.size()); }
+        uint32_t getAtlasPageCount() const { return static_cast<uint32_t>(atlas.size()); }
+
+      private:
+        // Matches TextureRegion in Sprite.vert (std430)
+        struct Region {
+            float    uv[4]; // u0, v0, u1, v1
+            uint32_t image;
+            uint32_t flags;
+            uint32_t padding[2];
+        };
+
+        struct PendingTexture {
+            TextureId            id;
+            uint32_t             width;
+            uint32_t             height;
+            std::vector<uint8_t> texels;
+        };
+
+        struct Image {
+            VkImage                 image = VK_NULL_HANDLE;
+            GpuAllocation           allocation;
+            VkImageView             view = VK_NULL_HANDLE;
+            StagingUploader::Ticket ticket = 0;
+            bool                    ready = false;
+            uint32_t                width = 0;
+            uint32_t                height = 0;
+            uint32_t                flags = 0; // of its regions
+        };
+
+        struct AtlasPage {
+            SkylinePacker packer;
+            uint32_t      image;
+        };
+
+        // A texture packed into a page that is already in use: its block,
+        // padding included, with every mip level, level 0 first
+        struct PageUpdate {
+            TextureId            id;
+            uint32_t             page;
+            uint32_t             x;
+            uint32_t             y;
+            uint32_t             blockWidth;
+            uint32_t             blockHeight;
+            uint32_t             width;
+            uint32_t             height;
+            std::vector<uint8_t> texels;
+        };
+
+        struct FrameSlot {
+            VkBuffer      regionBuffer = VK_NULL_HANDLE;
+            GpuAllocation regionMemory;
+            size_t        regionCapacity = 0;
+            uint64_t      version = 0;
+        };
+
+        void     createLayout();
+        uint32_t createImage(uint32_t width, uint32_t height, uint32_t mipLevels,
+                             VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);
+        void     uploadMips(uint32_t image, std::vector<uint8_t> texels, uint32_t width,
+                            uint32_t height, uint32_t mipLevels);
+        void     commitAtlased(std::vector<PendingTexture *> &textures);
+        void     commitStandalone(PendingTexture &texture);
+        void     setAtlasRegion(TextureId id, uint32_t page, uint32_t x, uint32_t y,
+                                uint32_t width, uint32_t height);
+        void     writeRegions(FrameSlot &slot);
+
+        VulkanWrapper &renderer;
+        Config         config;
+        bool           bindless = false;
+        uint32_t       arraySize = 0;
+        uint32_t       atlasMipLevels = 1;
+
+        VkDescriptorSetLayout setLayout = VK_NULL_HANDLE; // owned by the layout cache
+        VkSampler             sampler = VK_NULL_HANDLE;
+
+        std::vector<Region>         regions; // indexed by TextureId
+        std::vector<Image>          images;  // [0] is the white texture
+        std::vector<PendingTexture> pending;
+        std::vector<AtlasPage>      atlas;
+        std::vector<PageUpdate>     pageUpdates;
+        std::vector<FrameSlot>      slots;
+        uint64_t                    version = 1;
+
+        // Scratch for beginFrame() and recordUpdates()
+        std::vector<VkDescriptorImageInfo> imageInfos;
+        DescriptorSetWrites                writes;
+        std::vector<VkBufferImageCopy>     copies;
+        std::vector<VkImageMemoryBarrier>  barriers;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // SPRITETEXTURES_H
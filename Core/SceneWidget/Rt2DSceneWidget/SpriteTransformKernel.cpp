@@ -0,0 +1,345 @@
+#include "SpriteTransformKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define RT_SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#endif
+#endif
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RT_TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define RT_TARGET_AVX2
+#endif
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Angles are reduced in degrees, where the quadrant step (90) is
+        // exact, before converting the remainder to radians.
+        constexpr float kInv90 = 1.0f / 90.0f;
+        constexpr float kDegreesToRadians = 3.14159265358979323846f / 180.0f;
+
+        // Cephes sinf/cosf minimax polynomials on [-pi/4, pi/4]
+        constexpr float kSin0 = -1.9515295891e-4f;
+        constexpr float kSin1 = 8.3321608736e-3f;
+        constexpr float kSin2 = -1.6666654611e-1f;
+        constexpr float kCos0 = 2.443315711809948e-5f;
+        constexpr float kCos1 = -1.388731625493765e-3f;
+        constexpr float kCos2 = 4.166664568298827e-2f;
+
+        inline float bitsToFloat(uint32_t bits) {
+            float value;
+            std::memcpy(&value, &bits, sizeof(value));
+            return value;
+        }
+
+        // ---- Scalar -------------------------------------------------------
+
+        inline void sinCosScalar(float degrees, float &s, float &c) {
+            int   quadrant = static_cast<int>(std::nearbyint(degrees * kInv90));
+            float r = (degrees - static_cast<float>(quadrant) * 90.0f) * kDegreesToRadians;
+            float z = r * r;
+
+            float sp = ((kSin0 * z + kSin1) * z + kSin2) * z * r + r;
+            float cp = ((kCos0 * z + kCos1) * z + kCos2) * z * z - 0.5f * z + 1.0f;
+
+            if (quadrant & 1) {
+                std::swap(sp, cp);
+            }
+            s = (quadrant & 2) ? -sp : sp;
+            c = ((quadrant + 1) & 2) ? -cp : cp;
+        }
+
+        inline void writeInstance(SpriteInstance &inst, float x, float y, float sx,
+                                  float sy, float s, float c, uint32_t texture,
+                                  uint32_t color) {
+            inst.row0[0] = c * sx;
+            inst.row0[1] = -(s * sy);
+            inst.row0[2] = x;
+            inst.texture = texture;
+            inst.row1[0] = s * sx;
+            inst.row1[1] = c * sy;
+            inst.row1[2] = y;
+            inst.color = color;
+        }
+
+        void transformScalar(const SpriteTransformStreams &in, size_t begin,
+                             size_t end, uint32_t texture, uint32_t color,
+                             SpriteInstance *out) {
+            for (size_t i = begin; i < end; i++) {
+                float s, c;
+                if (in.sinRotation) {
+                    s = in.sinRotation[i];
+                    c = in.cosRotation[i];
+                } else {
+                    sinCosScalar(in.rotation[i], s, c);
+                }
+                writeInstance(out[i], in.x[i], in.y[i], in.scaleX[i], in.scaleY[i],
+                              s, c, texture, color);
+            }
+        }
+
+        void sinCosRangeScalar(const float *degrees, size_t begin, size_t end,
+                               float *sinOut, float *cosOut) {
+            for (size_t i = begin; i < end; i++) {
+                sinCosScalar(degrees[i], sinOut[i], cosOut[i]);
+            }
+        }
+
+#ifdef RT_SIMD_X86
+        // ---- SSE2 (4 sprites per iteration) --------------------------------
+
+        inline void sinCosSse(__m128 degrees, __m128 &s, __m128 &c) {
+            const __m128i one = _mm_set1_epi32(1);
+            const __m128i two = _mm_set1_epi32(2);
+
+            __m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(degrees, _mm_set1_ps(kInv90)));
+            __m128  r = _mm_mul_ps(
+                _mm_sub_ps(degrees, _mm_mul_ps(_mm_cvtepi32_ps(quadrant), _mm_set1_ps(90.0f))),
+                _mm_set1_ps(kDegreesToRadians));
+            __m128 z = _mm_mul_ps(r, r);
+
+            __m128 sp = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(kSin0), z), _mm_set1_ps(kSin1)), z), _mm_set1_ps(kSin2)), z), r), r);
+            __m128 cp = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_mul_ps(_mm_set1_ps(kCos0), z), _mm_set1_ps(kCos1)), z), _mm_set1_ps(kCos2)), z), z), _mm_mul_ps(_mm_set1_ps(0.5f), z)), _mm_set1_ps(1.0f));
+
+            __m128 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+            __m128 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, two), 30));
+            __m128 cosSign = _mm_castsi128_ps(
+                _mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one), two), 30));
+
+            s = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, cp), _mm_andnot_ps(swap, sp)), sinSign);
+            c = _mm_xor_ps(_mm_or_ps(_mm_and_ps(swap, sp), _mm_andnot_ps(swap, cp)), cosSign);
+        }
+
+        size_t transformSse(const SpriteTransformStreams &in, size_t count,
+                            uint32_t texture, uint32_t color, SpriteInstance *out) {
+            const __m128 signMask = _mm_set1_ps(-0.0f);
+            const __m128 tex = _mm_set1_ps(bitsToFloat(texture));
+            const __m128 col = _mm_set1_ps(bitsToFloat(color));
+
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                __m128 s, c;
+                if (in.sinRotation) {
+                    s = _mm_loadu_ps(in.sinRotation + i);
+                    c = _mm_loadu_ps(in.cosRotation + i);
+                } else {
+                    sinCosSse(_mm_loadu_ps(in.rotation + i), s, c);
+                }
+
+                __m128 sx = _mm_loadu_ps(in.scaleX + i);
+                __m128 sy = _mm_loadu_ps(in.scaleY + i);
+
+                __m128 a = _mm_mul_ps(c, sx);
+                __m128 b = _mm_xor_ps(_mm_mul_ps(s, sy), signMask);
+                __m128 tx = _mm_loadu_ps(in.x + i);
+                __m128 t = tex;
+                __m128 cc = _mm_mul_ps(s, sx);
+                __m128 d = _mm_mul_ps(c, sy);
+                __m128 ty = _mm_loadu_ps(in.y + i);
+                __m128 k = col;
+
+                _MM_TRANSPOSE4_PS(a, b, tx, t);
+                _MM_TRANSPOSE4_PS(cc, d, ty, k);
+
+                float *dst = reinterpret_cast<float *>(out + i);
+                _mm_storeu_ps(dst + 0, a);
+                _mm_storeu_ps(dst + 4, cc);
+                _mm_storeu_ps(dst + 8, b);
+                _mm_storeu_ps(dst + 12, d);
+                _mm_storeu_ps(dst + 16, tx);
+                _mm_storeu_ps(dst + 20, ty);
+                _mm_storeu_ps(dst + 24, t);
+                _mm_storeu_ps(dst + 28, k);
+            }
+            return i;
+        }
+
+        size_t sinCosRangeSse(const float *degrees, size_t count, float *sinOut,
+                              float *cosOut) {
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                __m128 s, c;
+                sinCosSse(_mm_loadu_ps(degrees + i), s, c);
+                _mm_storeu_ps(sinOut + i, s);
+                _mm_storeu_ps(cosOut + i, c);
+            }
+            return i;
+        }
+
+        // ---- AVX2 (8 sprites per iteration) --------------------------------
+
+        RT_TARGET_AVX2 inline void sinCosAvx2(__m256 degrees, __m256 &s, __m256 &c) {
+            const __m256i one = _mm256_set1_epi32(1);
+            const __m256i two = _mm256_set1_epi32(2);
+
+            __m256i quadrant = _mm256_cvtps_epi32(_mm256_mul_ps(degrees, _mm256_set1_ps(kInv90)));
+            __m256  r = _mm256_mul_ps(
+                _mm256_sub_ps(degrees, _mm256_mul_ps(_mm256_cvtepi32_ps(quadrant), _mm256_set1_ps(90.0f))),
+                _mm256_set1_ps(kDegreesToRadians));
+            __m256 z = _mm256_mul_ps(r, r);
+
+            __m256 sp = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kSin0), z), _mm256_set1_ps(kSin1)), z), _mm256_set1_ps(kSin2)), z), r), r);
+            __m256 cp = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(_mm256_set1_ps(kCos0), z), _mm256_set1_ps(kCos1)), z), _mm256_set1_ps(kCos2)), z), z), _mm256_mul_ps(_mm256_set1_ps(0.5f), z)), _mm256_set1_ps(1.0f));
+
+            __m256 swap = _mm256_castsi256_ps(_mm256_cmpeq_epi32(_mm256_and_si256(quadrant, one), one));
+            __m256 sinSign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_and_si256(quadrant, two), 30));
+            __m256 cosSign = _mm256_castsi256_ps(
+                _mm256_slli_epi32(_mm256_and_si256(_mm256_add_epi32(quadrant, one), two), 30));
+
+            s = _mm256_xor_ps(_mm256_blendv_ps(sp, cp, swap), sinSign);
+            c = _mm256_xor_ps(_mm256_blendv_ps(cp, sp, swap), cosSign);
+        }
+
+        RT_TARGET_AVX2 size_t transformAvx2(const SpriteTransformStreams &in, size_t count,
+                                            uint32_t texture, uint32_t color,
+                                            SpriteInstance *out) {
+            const __m256 signMask = _mm256_set1_ps(-0.0f);
+            const __m256 tex = _mm256_set1_ps(bitsToFloat(texture));
+            const __m256 col = _mm256_set1_ps(bitsToFloat(color));
+
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256 s, c;
+                if (in.sinRotation) {
+                    s = _mm256_loadu_ps(in.sinRotation + i);
+                    c = _mm256_loadu_ps(in.cosRotation + i);
+                } else {
+                    sinCosAvx2(_mm256_loadu_ps(in.rotation + i), s, c);
+                }
+
+                __m256 sx = _mm256_loadu_ps(in.scaleX + i);
+                __m256 sy = _mm256_loadu_ps(in.scaleY + i);
+
+                // Eight component streams; sprite k is lane k of each
+                __m256 r0 = _mm256_mul_ps(c, sx);
+                __m256 r1 = _mm256_xor_ps(_mm256_mul_ps(s, sy), signMask);
+                __m256 r2 = _mm256_loadu_ps(in.x + i);
+                __m256 r3 = tex;
+                __m256 r4 = _mm256_mul_ps(s, sx);
+                __m256 r5 = _mm256_mul_ps(c, sy);
+                __m256 r6 = _mm256_loadu_ps(in.y + i);
+                __m256 r7 = col;
+
+                // 8x8 transpose: one 32-byte SpriteInstance per output row
+                __m256 t0 = _mm256_unpacklo_ps(r0, r1);
+                __m256 t1 = _mm256_unpackhi_ps(r0, r1);
+                __m256 t2 = _mm256_unpacklo_ps(r2, r3);
+                __m256 t3 = _mm256_unpackhi_ps(r2, r3);
+                __m256 t4 = _mm256_unpacklo_ps(r4, r5);
+                __m256 t5 = _mm256_unpackhi_ps(r4, r5);
+                __m256 t6 = _mm256_unpacklo_ps(r6, r7);
+                __m256 t7 = _mm256_unpackhi_ps(r6, r7);
+
+                __m256 u0 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 u1 = _mm256_shuffle_ps(t0, t2, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 u2 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 u3 = _mm256_shuffle_ps(t1, t3, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 u4 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 u5 = _mm256_shuffle_ps(t4, t6, _MM_SHUFFLE(3, 2, 3, 2));
+                __m256 u6 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(1, 0, 1, 0));
+                __m256 u7 = _mm256_shuffle_ps(t5, t7, _MM_SHUFFLE(3, 2, 3, 2));
+
+                float *dst = reinterpret_cast<float *>(out + i);
+                _mm256_storeu_ps(dst + 0, _mm256_permute2f128_ps(u0, u4, 0x20));
+                _mm256_storeu_ps(dst + 8, _mm256_permute2f128_ps(u1, u5, 0x20));
+                _mm256_storeu_ps(dst + 16, _mm256_permute2f128_ps(u2, u6, 0x20));
+                _mm256_storeu_ps(dst + 24, _mm256_permute2f128_ps(u3, u7, 0x20));
+                _mm256_storeu_ps(dst + 32, _mm256_permute2f128_ps(u0, u4, 0x31));
+                _mm256_storeu_ps(dst + 40, _mm256_permute2f128_ps(u1, u5, 0x31));
+                _mm256_storeu_ps(dst + 48, _mm256_permute2f128_ps(u2, u6, 0x31));
+                _mm256_storeu_ps(dst + 56, _mm256_permute2f128_ps(u3, u7, 0x31));
+            }
+            return i;
+        }
+
+        RT_TARGET_AVX2 size_t sinCosRangeAvx2(const float *degrees, size_t count,
+                                              float *sinOut, float *cosOut) {
+            size_t i = 0;
+            for (; i + 8 <= count; i += 8) {
+                __m256 s, c;
+                sinCosAvx2(_mm256_loadu_ps(degrees + i), s, c);
+                _mm256_storeu_ps(sinOut + i, s);
+                _mm256_storeu_ps(cosOut + i, c);
+            }
+            return i;
+        }
+
+        bool cpuSupportsAvx2() {
+#if defined(__GNUC__) || defined(__clang__)
+            __builtin_cpu_init();
+            return __builtin_cpu_supports("avx2");
+#elif defined(_MSC_VER)
+            int info[4];
+            __cpuid(info, 0);
+            if (info[0] < 7)
+                return false;
+            __cpuid(info, 1);
+            bool osxsave = (info[2] & (1 << 27)) != 0;
+            bool avx = (info[2] & (1 << 28)) != 0;
+            if (!osxsave || !avx || (_xgetbv(0) & 0x6) != 0x6)
+                return false;
+            __cpuidex(info, 7, 0);
+            return (info[1] & (1 << 5)) != 0;
+#else
+            return false;
+#endif
+        }
+#endif // RT_SIMD_X86
+
+        SimdLevel detectSimdLevel() {
+#ifdef RT_SIMD_X86
+            return cpuSupportsAvx2() ? SimdLevel::AVX2 : SimdLevel::SSE2;
+#else
+            return SimdLevel::Scalar;
+#endif
+        }
+
+        const SimdLevel kSupportedLevel = detectSimdLevel();
+        SimdLevel       currentLevel = kSupportedLevel;
+    } // namespace
+
+    SimdLevel supportedSimdLevel() {
+        return kSupportedLevel;
+    }
+
+    SimdLevel activeSimdLevel() {
+        return currentLevel;
+    }
+
+    void setSimdLevel(SimdLevel level) {
+        currentLevel = std::min(level, kSupportedLevel);
+    }
+
+    void transformSprites(const SpriteTransformStreams &in, size_t count,
+                          uint32_t texture, uint32_t color, SpriteInstance *out) {
+        size_t done = 0;
+#ifdef RT_SIMD_X86
+        if (currentLevel == SimdLevel::AVX2) {
+            done = transformAvx2(in, count, texture, color, out);
+        } else if (currentLevel == SimdLevel::SSE2) {
+            done = transformSse(in, count, texture, color, out);
+        }
+#endif
+        transformScalar(in, done, count, texture, color, out);
+    }
+
+    void computeSinCos(const float *degrees, size_t count, float *sinOut, float *cosOut) {
+        size_t done = 0;
+#ifdef RT_SIMD_X86
+        if (currentLevel == SimdLevel::AVX2) {
+            done = sinCosRangeAvx2(degrees, count, sinOut, cosOut);
+        } else if (currentLevel == SimdLevel::SSE2) {
+            done = sinCosRangeSse(degrees, count, sinOut, cosOut);
+        }
+#endif
+        sinCosRangeScalar(degrees, done, count, sinOut, cosOut);
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,48 @@
+#ifndef SPRITETRANSFORMKERNEL_H
+#define SPRITETRANSFORMKERNEL_H
+
+#include "SpriteBatch.h"
+#include <cstddef>
+#include <cstdint>
+
+namespace Retoccilus::Core {
+
+    // Structure-of-arrays view over a run of sprite transforms. When
+    // sinRotation/cosRotation are set they are used instead of `rotation`,
+    // which skips the trigonometry for sprites whose angle rarely changes.
+    struct SpriteTransformStreams {
+        const float *x = nullptr;
+        const float *y = nullptr;
+        const float *scaleX = nullptr;
+        const float *scaleY = nullptr;
+        const float *rotation = nullptr; // degrees
+        const float *sinRotation = nullptr;
+        const float *cosRotation = nullptr;
+    };
+
+    enum class SimdLevel {
+        Scalar,
+        SSE2,
+        AVX2
+    };
+
+    // Highest level supported by the running CPU, and the level currently
+    // used by the kernels. setSimdLevel() clamps to what the CPU supports and
+    // exists mainly so benchmarks can compare paths.
+    SimdLevel supportedSimdLevel();
+    SimdLevel activeSimdLevel();
+    void      setSimdLevel(SimdLevel level);
+
+    // Writes the 2x3 affine T * R * S of `count` sprites into out[0..count),
+    // stamping every instance with `texture` and `color`. All SIMD levels use
+    // the same polynomial and no FMA, so results are bit-identical across
+    // paths.
+    void transformSprites(const SpriteTransformStreams &in, size_t count,
+                          uint32_t texture, uint32_t color, SpriteInstance *out);
+
+    // Fills sinOut/cosOut for angles given in degrees.
+    void computeSinCos(const float *degrees, size_t count, float *sinOut, float *cosOut);
+
+} // namespace Retoccilus::Core
+
+#endif // SPRITETRANSFORMKERNEL_H
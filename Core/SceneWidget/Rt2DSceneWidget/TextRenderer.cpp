@@ -0,0 +1,281 @@
+#include "TextRenderer.h"
+#include "SpriteTransformKernel.h"
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr uint32_t kReplacementCharacter = 0xFFFD;
+        // Runs not drawn for kRunLifetime frames are dropped, checked every
+        // kSweepInterval frames
+        constexpr uint64_t kRunLifetime = 120;
+        constexpr uint64_t kSweepInterval = 60;
+
+        uint64_t fnv1a(const void *data, size_t size, uint64_t hash = 14695981039346656037ull) {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Decodes the code point starting at text[i] and moves i past it.
+        // A malformed sequence decodes as U+FFFD and skips its first byte
+        // only, so the decoder picks up again at the next character.
+        uint32_t decodeUtf8(std::string_view text, size_t &i) {
+            uint8_t lead = static_cast<uint8_t>(text[i++]);
+            if (lead < 0x80)
+                return lead;
+
+            uint32_t length;
+            uint32_t codepoint;
+            uint32_t smallest; // overlong encodings are malformed
+            if ((lead & 0xE0) == 0xC0) {
+                length = 1;
+                codepoint = lead & 0x1F;
+                smallest = 0x80;
+            } else if ((lead & 0xF0) == 0xE0) {
+                length = 2;
+                codepoint = lead & 0x0F;
+                smallest = 0x800;
+            } else if ((lead & 0xF8) == 0xF0) {
+                length = 3;
+                codepoint = lead & 0x07;
+                smallest = 0x10000;
+            } else {
+                return kReplacementCharacter;
+            }
+
+            if (text.size() - i < length)
+                return kReplacementCharacter;
+            for (uint32_t k = 0; k < length; k++) {
+                uint8_t byte = static_cast<uint8_t>(text[i + k]);
+                if ((byte & 0xC0) != 0x80)
+                    return kReplacementCharacter;
+                codepoint = codepoint << 6 | (byte & 0x3F);
+            }
+            if (codepoint < smallest || codepoint > 0x10FFFF ||
+                (codepoint >= 0xD800 && codepoint <= 0xDFFF))
+                return kReplacementCharacter;
+
+            i += length;
+            return codepoint;
+        }
+    } // namespace
+
+    TextRenderer::TextRenderer(VulkanWrapper &renderer, SpriteTextures &textures)
+        : cache(renderer, textures, SdfGlyphCache::Config{}) {}
+
+    TextRenderer::FontId TextRenderer::addFont(std::shared_ptr<const FontSource> font) {
+        return cache.addFont(std::move(font));
+    }
+
+    TextRenderer::Run &TextRenderer::findRun(FontId font, std::string_view text) {
+        uint64_t hash = fnv1a(text.data(), text.size(), fnv1a(&font, sizeof(font)));
+
+        std::vector<Run> &bucket = runs[hash];
+        for (Run &run : bucket) {
+            if (run.font == font && run.text == text) {
+                runHits++;
+                return run;
+            }
+        }
+
+        runMisses++;
+        runCount++;
+        Run &run = bucket.emplace_back();
+        run.font = font;
+        run.text = std::string(text);
+        shape(run);
+        return run;
+    }
+
+    void TextRenderer::shape(Run &run) const {
+        const FontSource &font = cache.getFont(run.font);
+        FontMetrics       metrics = font.getMetrics();
+        float             lineHeight = metrics.ascent + metrics.descent + metrics.lineGap;
+
+        // Glyphs the font lacks show its replacement character, or else
+        // its missing glyph
+        uint32_t fallback = font.getGlyph(kReplacementCharacter);
+        if (fallback == 0)
+            fallback = font.getGlyph('?');
+
+        float     penX = 0.0f;
+        float     baseline = metrics.ascent;
+        uint32_t  previous = 0;
+        WorldRect bounds{std::numeric_limits<float>::max(), std::numeric_limits<float>::max(),
+                         std::numeric_limits<float>::lowest(), std::numeric_limits<float>::lowest()};
+
+        std::string_view text = run.text;
+        for (size_t i = 0; i < text.size();) {
+            uint32_t codepoint = decodeUtf8(text, i);
+            if (codepoint == '\n') {
+                penX = 0.0f;
+                baseline += lineHeight;
+                previous = 0;
+                continue;
+            }
+            if (codepoint == '\r')
+                continue;
+
+            uint32_t glyph = font.getGlyph(codepoint);
+            if (glyph == 0)
+                glyph = fallback;
+            if (previous != 0)
+                penX += font.getKerning(previous, glyph);
+
+            GlyphMetrics glyphMetrics = font.getGlyphMetrics(glyph);
+            if (glyphMetrics.maxX > glyphMetrics.minX && glyphMetrics.maxY > glyphMetrics.minY) {
+                run.glyphs.push_back(ShapedGlyph{glyph, penX, baseline});
+                bounds.minX = std::min(bounds.minX, penX + glyphMetrics.minX);
+                bounds.minY = std::min(bounds.minY, baseline + glyphMetrics.minY);
+                bounds.maxX = std::max(bounds.maxX, penX + glyphMetrics.maxX);
+                bounds.maxY = std::max(bounds.maxY, baseline + glyphMetrics.maxY);
+            }
+            penX += glyphMetrics.advance;
+            previous = glyph;
+        }
+
+        run.bounds = run.glyphs.empty() ? WorldRect{} : bounds;
+    }
+
+    const TextRenderer::ResolvedGlyphs &TextRenderer::resolve(Run &run, uint32_t sizeClass) {
+        ResolvedGlyphs &resolved = run.resolved[sizeClass];
+        if (resolved.epoch == cache.getEpoch()) {
+            for (SdfGlyphCache::EntryId entry : resolved.entries)
+                cache.touch(entry);
+            return resolved;
+        }
+
+        // Entries acquired here are used this frame, so later evictions,
+        // which move the epoch on, leave them alone
+        bool complete = true;
+        resolved.entries.resize(run.glyphs.size());
+        for (size_t i = 0; i < run.glyphs.size(); i++) {
+            resolved.entries[i] = cache.acquire(run.font, run.glyphs[i].glyph, sizeClass);
+            complete = complete && resolved.entries[i] != SdfGlyphCache::kNoEntry;
+        }
+        // Dropped glyphs are retried next frame
+        resolved.epoch = complete ? cache.getEpoch() : 0;
+        return resolved;
+    }
+
+    void TextRenderer::add(SpriteBatcher &batcher, FontId font, std::string_view text, float x,
+                           float y, float size, float rotation, uint32_t rgba,
+                           float pixelsPerUnit, const WorldRect &view) {
+        if (font >= cache.getFontCount()) {
+            throw std::runtime_error("TextRenderer: unknown font");
+        }
+        if (text.empty() || !(size > 0.0f))
+            return;
+
+        Run &run = findRun(font, text);
+        run.lastUsed = frame;
+        if (run.glyphs.empty())
+            return;
+
+        float radians = rotation * 0.017453292519943295f;
+        float s = std::sin(radians);
+        float c = std::cos(radians);
+
+        // Cull with the circle around the ink, like WorldRect::fromTransform()
+        const WorldRect &bounds = run.bounds;
+        float            centerX = 0.5f * (bounds.minX + bounds.maxX) * size;
+        float            centerY = 0.5f * (bounds.minY + bounds.maxY) * size;
+        float            radius = 0.5f * size * std::hypot(bounds.maxX - bounds.minX,
+                                                           bounds.maxY - bounds.minY);
+        float            worldX = x + c * centerX - s * centerY;
+        float            worldY = y + s * centerX + c * centerY;
+        if (!WorldRect{worldX - radius, worldY - radius, worldX + radius, worldY + radius}.overlaps(
+                view))
+            return;
+
+        const ResolvedGlyphs &resolved =
+            resolve(run, SdfGlyphCache::sizeClassFor(size * pixelsPerUnit));
+
+        glyphX.clear();
+        glyphY.clear();
+        glyphScaleX.clear();
+        glyphScaleY.clear();
+        glyphTextures.clear();
+        for (size_t i = 0; i < run.glyphs.size(); i++) {
+            if (resolved.entries[i] == SdfGlyphCache::kNoEntry)
+                continue;
+
+            // Sprites are centred on their position
+            const ShapedGlyph          &shaped = run.glyphs[i];
+            const SdfGlyphCache::Glyph &glyph = cache.getGlyph(resolved.entries[i]);
+            float                       localX = (shaped.x + 0.5f * (glyph.minX + glyph.maxX)) * size;
+            float                       localY = (shaped.y + 0.5f * (glyph.minY + glyph.maxY)) * size;
+            glyphX.push_back(x + c * localX - s * localY);
+            glyphY.push_back(y + s * localX + c * localY);
+            glyphScaleX.push_back((glyph.maxX - glyph.minX) * size);
+            glyphScaleY.push_back((glyph.maxY - glyph.minY) * size);
+            glyphTextures.push_back(glyph.texture);
+        }
+        if (glyphTextures.empty())
+            return;
+
+        glyphSin.assign(glyphTextures.size(), s);
+        glyphCos.assign(glyphTextures.size(), c);
+
+        SpriteTransformStreams streams;
+        streams.x = glyphX.data();
+        streams.y = glyphY.data();
+        streams.scaleX = glyphScaleX.data();
+        streams.scaleY = glyphScaleY.data();
+        streams.sinRotation = glyphSin.data();
+        streams.cosRotation = glyphCos.data();
+
+        batcher.setState(cache.getStateKey());
+        batcher.setColor(rgba);
+        batcher.add(streams, glyphTextures.data(), glyphTextures.size());
+        glyphsDrawn += static_cast<uint32_t>(glyphTextures.size());
+    }
+
+    void TextRenderer::endFrame() {
+        cache.endFrame();
+        frame++;
+        runHits = 0;
+        runMisses = 0;
+        glyphsDrawn = 0;
+
+        if (frame % kSweepInterval == 0)
+            sweepRuns();
+    }
+
+    void TextRenderer::sweepRuns() {
+        for (auto it = runs.begin(); it != runs.end();) {
+            std::vector<Run> &bucket = it->second;
+            size_t            before = bucket.size();
+            bucket.erase(std::remove_if(bucket.begin(), bucket.end(),
+                                        [this](const Run &run) {
+                                            return run.lastUsed + kRunLifetime < frame;
+                                        }),
+                         bucket.end());
+            runCount -= before - bucket.size();
+
+            if (bucket.empty()) {
+                it = runs.erase(it);
+            } else {
+                ++it;
+            }
+        }
+    }
+
+    TextRenderer::Stats TextRenderer::getStats() const {
+        Stats stats;
+        stats.runs = static_cast<uint32_t>(runCount);
+        stats.runHits = runHits;
+        stats.runMisses = runMisses;
+        stats.glyphs = glyphsDrawn;
+        stats.cache = cache.getStats();
+        return stats;
+    }
+
+} // namespace Retoccilus::Core
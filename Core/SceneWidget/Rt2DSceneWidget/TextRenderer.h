@@ -0,0 +1,117 @@
+#ifndef TEXTRENDERER_H
+#define TEXTRENDERER_H
+
+#include "SdfGlyphCache.h"
+#include "SpatialGrid.h"
+#include "SpriteBatch.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    class VulkanWrapper;
+
+    // Text drawn through the sprite path: every glyph is a sprite instance
+    // on a cell of the SdfGlyphCache atlas, queued into the frame's
+    // SpriteBatcher under the atlas's state key, so strings of any size
+    // and rotation between other sprites share their draws.
+    //
+    // Strings are shaped (UTF-8 decoded, mapped to glyphs, advanced and
+    // kerned) once and cached as runs keyed by font and text, along with
+    // the atlas entries of their glyphs per size class, so a string drawn
+    // again in later frames only touches its glyphs in the cache. Runs not
+    // drawn for a while are dropped.
+    class TextRenderer {
+      public:
+        using FontId = SdfGlyphCache::FontId;
+
+        struct Stats {
+            uint32_t runs = 0;
+            // Of the current frame
+            uint32_t runHits = 0;
+            uint32_t runMisses = 0;
+            uint32_t glyphs = 0;
+
+            SdfGlyphCache::Stats cache;
+        };
+
+        TextRenderer(VulkanWrapper &renderer, SpriteTextures &textures);
+
+        TextRenderer(const TextRenderer &) = delete;
+        TextRenderer &operator=(const TextRenderer &) = delete;
+
+        FontId addFont(std::shared_ptr<const FontSource> font);
+
+        // Queues `text` with the top-left corner of its first line at
+        // (x, y), lines `size` world units high, rotated by `rotation`
+        // degrees around that corner. `pixelsPerUnit` is the on-screen
+        // scale, which picks the glyphs' size class; text outside `view`
+        // is culled. Leaves the batcher in the atlas's state and `rgba`.
+        void add(SpriteBatcher &batcher, FontId font, std::string_view text, float x, float y,
+                 float size, float rotation, uint32_t rgba, float pixelsPerUnit,
+                 const WorldRect &view);
+
+        // See SdfGlyphCache::declarePasses()
+        RenderGraph::Resource declarePasses(RenderGraph &graph) { return cache.declarePasses(graph); }
+        // Called once the frame's text has been drawn
+        void endFrame();
+
+        Stats getStats() const;
+
+      private:
+        // Inked glyph at its origin, in em units from the top-left corner
+        // of the run
+        struct ShapedGlyph {
+            uint32_t glyph;
+            float    x;
+            float    y;
+        };
+
+        // Atlas entries of a run's glyphs in one size class, valid while
+        // the cache's epoch is unchanged
+        struct ResolvedGlyphs {
+            uint64_t                            epoch = 0;
+            std::vector<SdfGlyphCache::EntryId> entries;
+        };
+
+        struct Run {
+            FontId                   font;
+            std::string              text;
+            std::vector<ShapedGlyph> glyphs;
+            WorldRect                bounds; // of the ink, in em units
+            ResolvedGlyphs           resolved[SdfGlyphCache::kSizeClassCount];
+            uint64_t                 lastUsed = 0;
+        };
+
+        Run                  &findRun(FontId font, std::string_view text);
+        void                  shape(Run &run) const;
+        const ResolvedGlyphs &resolve(Run &run, uint32_t sizeClass);
+        void                  sweepRuns();
+
+        SdfGlyphCache cache;
+
+        // By hash of font and text, which findRun() compares in full
+        std::unordered_map<uint64_t, std::vector<Run>> runs;
+        size_t                                         runCount = 0;
+        uint64_t                                       frame = 1;
+        uint32_t                                       runHits = 0;
+        uint32_t                                       runMisses = 0;
+        uint32_t                                       glyphsDrawn = 0;
+
+        // Scratch for add()
+        std::vector<float>    glyphX;
+        std::vector<float>    glyphY;
+        std::vector<float>    glyphScaleX;
+        std::vector<float>    glyphScaleY;
+        std::vector<float>    glyphSin;
+        std::vector<float>    glyphCos;
+        std::vector<uint32_t> glyphTextures;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // TEXTRENDERER_H
@@ -0,0 +1,321 @@
+#include "DescriptorAllocator.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Descriptors of each type a pool holds per set, besides room for
+        // a few sets of the layout that asked for the pool
+        constexpr VkDescriptorPoolSize kPoolRatios[] = {
+            {VK_DESCRIPTOR_TYPE_SAMPLER, 1},
+            {VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 4},
+            {VK_DESCRIPTOR_TYPE_SAMPLED_IMAGE, 2},
+            {VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER, 2},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 4},
+            {VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC, 1},
+            {VK_DESCRIPTOR_TYPE_STORAGE_BUFFER_DYNAMIC, 1},
+        };
+        constexpr uint32_t kSetsOfRequestingLayout = 4;
+        constexpr uint32_t kMaxSetsPerPool = 4096;
+
+        uint64_t fnv1a(const void *data, size_t size) {
+            const uint8_t *bytes = static_cast<const uint8_t *>(data);
+            uint64_t       hash = 14695981039346656037ull;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= bytes[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // Non-dispatchable handles are pointers or 64-bit integers
+        // depending on the platform
+        template <typename Handle>
+        uint64_t handleBits(Handle handle) {
+            uint64_t bits = 0;
+            std::memcpy(&bits, &handle, sizeof(handle));
+            return bits;
+        }
+
+        bool isPoolFull(VkResult result) {
+            return result == VK_ERROR_OUT_OF_POOL_MEMORY || result == VK_ERROR_FRAGMENTED_POOL;
+        }
+    } // namespace
+
+    DescriptorLayoutKey &DescriptorLayoutKey::add(uint32_t binding, VkDescriptorType type,
+                                                  uint32_t count, VkShaderStageFlags stages,
+                                                  VkDescriptorBindingFlagsEXT flags) {
+        bindings.push_back(Binding{binding, type, count, stages, flags});
+        return *this;
+    }
+
+    size_t DescriptorLayoutCache::KeyHash::operator()(const DescriptorLayoutKey &key) const {
+        uint64_t hash = 14695981039346656037ull;
+        for (const DescriptorLayoutKey::Binding &binding : key.bindings) {
+            uint32_t fields[] = {binding.binding, static_cast<uint32_t>(binding.type),
+                                 binding.count, binding.stages, binding.flags};
+            hash = (hash ^ fnv1a(fields, sizeof(fields))) * 1099511628211ull;
+        }
+        return static_cast<size_t>(hash);
+    }
+
+    DescriptorLayoutCache::DescriptorLayoutCache(VkDevice device) : device(device) {}
+
+    DescriptorLayoutCache::~DescriptorLayoutCache() {
+        for (const auto &entry : layouts)
+            vkDestroyDescriptorSetLayout(device, entry.second, nullptr);
+    }
+
+    VkDescriptorSetLayout DescriptorLayoutCache::getLayout(DescriptorLayoutKey key) {
+        std::sort(key.bindings.begin(), key.bindings.end(),
+                  [](const DescriptorLayoutKey::Binding &a, const DescriptorLayoutKey::Binding &b) {
+                      return a.binding < b.binding;
+                  });
+
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = layouts.find(key);
+        if (it != layouts.end())
+            return it->second;
+
+        std::vector<VkDescriptorSetLayoutBinding> bindings(key.bindings.size());
+        std::vector<VkDescriptorBindingFlagsEXT>  bindingFlags(key.bindings.size());
+        std::vector<VkDescriptorPoolSize>         descriptorCounts;
+        bool                                      flagged = false;
+        for (size_t i = 0; i < key.bindings.size(); i++) {
+            const DescriptorLayoutKey::Binding &binding = key.bindings[i];
+            bindings[i].binding = binding.binding;
+            bindings[i].descriptorType = binding.type;
+            bindings[i].descriptorCount = binding.count;
+            bindings[i].stageFlags = binding.stages;
+            bindingFlags[i] = binding.flags;
+            flagged |= binding.flags != 0;
+
+            auto count = std::find_if(descriptorCounts.begin(), descriptorCounts.end(),
+                                      [&](const VkDescriptorPoolSize &size) {
+                                          return size.type == binding.type;
+                                      });
+            if (count != descriptorCounts.end()) {
+                count->descriptorCount += binding.count;
+            } else {
+                descriptorCounts.push_back({binding.type, binding.count});
+            }
+        }
+
+        VkDescriptorSetLayoutCreateInfo layoutInfo{};
+        layoutInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+        layoutInfo.bindingCount = static_cast<uint32_t>(bindings.size());
+        layoutInfo.pBindings = bindings.data();
+
+        // Only chained when used, so devices without descriptor indexing
+        // never see the struct
+        VkDescriptorSetLayoutBindingFlagsCreateInfoEXT flagsInfo{};
+        if (flagged) {
+            flagsInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO_EXT;
+            flagsInfo.bindingCount = static_cast<uint32_t>(bindingFlags.size());
+            flagsInfo.pBindingFlags = bindingFlags.data();
+            layoutInfo.pNext = &flagsInfo;
+        }
+
+        VkDescriptorSetLayout layout;
+        VK_CHECK_RESULT(vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout));
+
+        layouts.emplace(std::move(key), layout);
+        counts.emplace(layout, std::move(descriptorCounts));
+        return layout;
+    }
+
+    const std::vector<VkDescriptorPoolSize> &
+    DescriptorLayoutCache::getDescriptorCounts(VkDescriptorSetLayout layout) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        auto                        it = counts.find(layout);
+        if (it == counts.end()) {
+            throw std::runtime_error("Descriptor set layout is not from the layout cache");
+        }
+        return it->second;
+    }
+
+    size_t DescriptorLayoutCache::size() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return layouts.size();
+    }
+
+    DescriptorSetWrites &DescriptorSetWrites::buffer(uint32_t binding, VkDescriptorType type,
+                                                     VkBuffer buffer, VkDeviceSize offset,
+                                                     VkDeviceSize range) {
+        writes.push_back(Write{binding, type, static_cast<uint32_t>(bufferInfos.size()), 1, false});
+        bufferInfos.push_back(VkDescriptorBufferInfo{buffer, offset, range});
+        return *this;
+    }
+
+    DescriptorSetWrites &DescriptorSetWrites::images(uint32_t binding, VkDescriptorType type,
+                                                     const VkDescriptorImageInfo *infos,
+                                                     uint32_t count) {
+        writes.push_back(Write{binding, type, static_cast<uint32_t>(imageInfos.size()), count, true});
+        imageInfos.insert(imageInfos.end(), infos, infos + count);
+        return *this;
+    }
+
+    void DescriptorSetWrites::clear() {
+        writes.clear();
+        bufferInfos.clear();
+        imageInfos.clear();
+    }
+
+    DescriptorAllocator::DescriptorAllocator(VkDevice device, DescriptorLayoutCache &layouts,
+                                             uint32_t frameCount, uint32_t initialSetsPerPool)
+        : device(device), layouts(layouts), frames(frameCount),
+          setsPerPool(std::max(initialSetsPerPool, 1u)) {}
+
+    DescriptorAllocator::~DescriptorAllocator() {
+        // Destroying a pool frees its sets
+        for (Frame &frame : frames) {
+            for (VkDescriptorPool pool : frame.pools)
+                vkDestroyDescriptorPool(device, pool, nullptr);
+        }
+    }
+
+    void DescriptorAllocator::reset(uint32_t frameIndex) {
+        currentFrame = frameIndex;
+        Frame &frame = frames[frameIndex];
+
+        for (size_t i = 0; i < frame.pools.size() && i <= frame.currentPool; i++) {
+            VK_CHECK_RESULT(vkResetDescriptorPool(device, frame.pools[i], 0));
+        }
+        frame.currentPool = 0;
+        frame.sets.clear();
+        frame.allocated = 0;
+        frame.reused = 0;
+    }
+
+    VkDescriptorPool DescriptorAllocator::createPool(VkDescriptorSetLayout layout) {
+        std::vector<VkDescriptorPoolSize> sizes;
+        for (const VkDescriptorPoolSize &ratio : kPoolRatios)
+            sizes.push_back({ratio.type, ratio.descriptorCount * setsPerPool});
+        for (const VkDescriptorPoolSize &count : layouts.getDescriptorCounts(layout)) {
+            auto size = std::find_if(sizes.begin(), sizes.end(),
+                                     [&](const VkDescriptorPoolSize &s) {
+                                         return s.type == count.type;
+                                     });
+            uint32_t needed = count.descriptorCount * kSetsOfRequestingLayout;
+            if (size == sizes.end()) {
+                sizes.push_back({count.type, needed});
+            } else {
+                size->descriptorCount = std::max(size->descriptorCount, needed);
+            }
+        }
+
+        VkDescriptorPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+        poolInfo.maxSets = setsPerPool;
+        poolInfo.poolSizeCount = static_cast<uint32_t>(sizes.size());
+        poolInfo.pPoolSizes = sizes.data();
+
+        VkDescriptorPool pool;
+        VK_CHECK_RESULT(vkCreateDescriptorPool(device, &poolInfo, nullptr, &pool));
+
+        setsPerPool = std::min(setsPerPool * 2, kMaxSetsPerPool);
+        poolCount++;
+        return pool;
+    }
+
+    VkDescriptorSet DescriptorAllocator::allocate(VkDescriptorSetLayout layout) {
+        Frame &frame = frames[currentFrame];
+
+        VkDescriptorSetAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+        allocInfo.descriptorSetCount = 1;
+        allocInfo.pSetLayouts = &layout;
+
+        // Pools of this frame that are already full are skipped for the
+        // rest of it; a fresh pool that cannot take the set is an error
+        for (;;) {
+            bool created = false;
+            if (frame.currentPool == frame.pools.size()) {
+                frame.pools.push_back(createPool(layout));
+                created = true;
+            }
+
+            VkDescriptorSet set;
+            allocInfo.descriptorPool = frame.pools[frame.currentPool];
+            VkResult result = vkAllocateDescriptorSets(device, &allocInfo, &set);
+            if (result == VK_SUCCESS) {
+                frame.allocated++;
+                return set;
+            }
+            if (created || !isPoolFull(result)) {
+                VK_CHECK_RESULT(result);
+            }
+            frame.currentPool++;
+        }
+    }
+
+    VkDescriptorSet DescriptorAllocator::getSet(VkDescriptorSetLayout      layout,
+                                                const DescriptorSetWrites &writes) {
+        Frame &frame = frames[currentFrame];
+
+        key.clear();
+        key.push_back(handleBits(layout));
+        for (const DescriptorSetWrites::Write &write : writes.writes) {
+            key.push_back(write.binding);
+            key.push_back(static_cast<uint64_t>(write.type) << 32 | write.count);
+            for (uint32_t i = 0; i < write.count; i++) {
+                if (write.image) {
+                    const VkDescriptorImageInfo &info = writes.imageInfos[write.first + i];
+                    key.push_back(handleBits(info.sampler));
+                    key.push_back(handleBits(info.imageView));
+                    key.push_back(info.imageLayout);
+                } else {
+                    const VkDescriptorBufferInfo &info = writes.bufferInfos[write.first + i];
+                    key.push_back(handleBits(info.buffer));
+                    key.push_back(info.offset);
+                    key.push_back(info.range);
+                }
+            }
+        }
+
+        uint64_t                hash = fnv1a(key.data(), key.size() * sizeof(uint64_t));
+        std::vector<CachedSet> &bucket = frame.sets[hash];
+        for (const CachedSet &cached : bucket) {
+            if (cached.key == key) {
+                frame.reused++;
+                return cached.set;
+            }
+        }
+
+        VkDescriptorSet set = allocate(layout);
+
+        vkWrites.assign(writes.writes.size(), VkWriteDescriptorSet{});
+        for (size_t i = 0; i < writes.writes.size(); i++) {
+            const DescriptorSetWrites::Write &write = writes.writes[i];
+            VkWriteDescriptorSet             &vkWrite = vkWrites[i];
+            vkWrite.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+            vkWrite.dstSet = set;
+            vkWrite.dstBinding = write.binding;
+            vkWrite.descriptorCount = write.count;
+            vkWrite.descriptorType = write.type;
+            if (write.image) {
+                vkWrite.pImageInfo = &writes.imageInfos[write.first];
+            } else {
+                vkWrite.pBufferInfo = &writes.bufferInfos[write.first];
+            }
+        }
+        vkUpdateDescriptorSets(device, static_cast<uint32_t>(vkWrites.size()), vkWrites.data(), 0,
+                               nullptr);
+
+        bucket.push_back(CachedSet{key, set});
+        return set;
+    }
+
+    DescriptorAllocator::Stats DescriptorAllocator::getStats() const {
+        Stats stats;
+        stats.pools = poolCount;
+        stats.setsAllocated = frames[currentFrame].allocated;
+        stats.setsReused = frames[currentFrame].reused;
+        return stats;
+    }
+
+} // namespace Retoccilus::Core
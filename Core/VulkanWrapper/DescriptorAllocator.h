@@ -0,0 +1,173 @@
+#ifndef DESCRIPTOR_ALLOCATOR_H
+#define DESCRIPTOR_ALLOCATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // Binding signature of a descriptor set layout. Immutable samplers are
+    // not supported.
+    struct DescriptorLayoutKey {
+        struct Binding {
+            uint32_t                    binding;
+            VkDescriptorType            type;
+            uint32_t                    count;
+            VkShaderStageFlags          stages;
+            VkDescriptorBindingFlagsEXT flags; // needs VK_EXT_descriptor_indexing
+
+            bool operator==(const Binding &other) const {
+                return binding == other.binding && type == other.type && count == other.count &&
+                       stages == other.stages && flags == other.flags;
+            }
+        };
+
+        std::vector<Binding> bindings;
+
+        DescriptorLayoutKey &add(uint32_t binding, VkDescriptorType type, uint32_t count,
+                                 VkShaderStageFlags stages, VkDescriptorBindingFlagsEXT flags = 0);
+
+        bool operator==(const DescriptorLayoutKey &other) const {
+            return bindings == other.bindings;
+        }
+    };
+
+    // Device-wide cache of descriptor set layouts, so that every user of a
+    // binding signature shares one layout, and with it pipeline layout
+    // compatibility. Layouts live until the cache is destroyed.
+    // Thread-safe.
+    class DescriptorLayoutCache {
+      public:
+        explicit DescriptorLayoutCache(VkDevice device);
+        ~DescriptorLayoutCache();
+
+        DescriptorLayoutCache(const DescriptorLayoutCache &) = delete;
+        DescriptorLayoutCache &operator=(const DescriptorLayoutCache &) = delete;
+
+        // The same layout for keys with the same bindings, in any order
+        VkDescriptorSetLayout getLayout(DescriptorLayoutKey key);
+        // Descriptors of each type in one set of `layout`; throws for
+        // layouts that did not come from this cache
+        const std::vector<VkDescriptorPoolSize> &getDescriptorCounts(
+            VkDescriptorSetLayout layout) const;
+
+        size_t size() const;
+
+      private:
+        struct KeyHash {
+            size_t operator()(const DescriptorLayoutKey &key) const;
+        };
+
+        VkDevice device;
+
+        std::unordered_map<DescriptorLayoutKey, VkDescriptorSetLayout, KeyHash> layouts;
+        std::unordered_map<VkDescriptorSetLayout, std::vector<VkDescriptorPoolSize>> counts;
+        mutable std::mutex mutex;
+    };
+
+    // Contents of a descriptor set, to be written by
+    // DescriptorAllocator::getSet(). Keep one around and clear() it between
+    // sets to reuse its storage.
+    class DescriptorSetWrites {
+      public:
+        DescriptorSetWrites &buffer(uint32_t binding, VkDescriptorType type, VkBuffer buffer,
+                                    VkDeviceSize offset, VkDeviceSize range);
+        // `count` consecutive array elements from element 0
+        DescriptorSetWrites &images(uint32_t binding, VkDescriptorType type,
+                                    const VkDescriptorImageInfo *infos, uint32_t count);
+
+        void clear();
+
+      private:
+        friend class DescriptorAllocator;
+
+        struct Write {
+            uint32_t         binding;
+            VkDescriptorType type;
+            uint32_t         first; // into bufferInfos or imageInfos
+            uint32_t         count;
+            bool             image;
+        };
+
+        std::vector<Write>                  writes;
+        std::vector<VkDescriptorBufferInfo> bufferInfos;
+        std::vector<VkDescriptorImageInfo>  imageInfos;
+    };
+
+    // Descriptor sets for one view's frames, the descriptor counterpart of
+    // FrameArena. Every frame in flight owns a list of descriptor pools;
+    // reset() resets them with one vkResetDescriptorPool each once the
+    // frame's fence has signalled, instead of freeing sets one by one.
+    // When the pools run out another is chained, twice the size of the
+    // last, and kept for later frames, so a steady workload stops creating
+    // pools after its first frames.
+    //
+    // getSet() hashes a set's layout and contents, so draws that bind the
+    // same resources within a frame share one set and the descriptors are
+    // only written once.
+    //
+    // Layouts must come from the DescriptorLayoutCache the allocator was
+    // created with; pools are sized from their descriptor counts. Not
+    // thread-safe; sets are handed out on the render thread.
+    class DescriptorAllocator {
+      public:
+        struct Stats {
+            uint32_t pools = 0;
+            // Of the current frame
+            uint32_t setsAllocated = 0;
+            uint32_t setsReused = 0;
+        };
+
+        DescriptorAllocator(VkDevice device, DescriptorLayoutCache &layouts, uint32_t frameCount,
+                            uint32_t initialSetsPerPool = 64);
+        ~DescriptorAllocator();
+
+        DescriptorAllocator(const DescriptorAllocator &) = delete;
+        DescriptorAllocator &operator=(const DescriptorAllocator &) = delete;
+
+        void reset(uint32_t frameIndex);
+
+        // A set of `layout` holding `writes`, valid until the current frame
+        // slot is reset. Equal layout and contents give the same set.
+        VkDescriptorSet getSet(VkDescriptorSetLayout layout, const DescriptorSetWrites &writes);
+        // An unwritten set with the same lifetime, never shared
+        VkDescriptorSet allocate(VkDescriptorSetLayout layout);
+
+        Stats getStats() const;
+
+      private:
+        struct CachedSet {
+            std::vector<uint64_t> key;
+            VkDescriptorSet       set;
+        };
+
+        struct Frame {
+            std::vector<VkDescriptorPool> pools;
+            size_t                        currentPool = 0;
+            // By hash of the key, which getSet() compares in full
+            std::unordered_map<uint64_t, std::vector<CachedSet>> sets;
+            uint32_t                                             allocated = 0;
+            uint32_t                                             reused = 0;
+        };
+
+        VkDescriptorPool createPool(VkDescriptorSetLayout layout);
+
+        VkDevice               device;
+        DescriptorLayoutCache &layouts;
+        std::vector<Frame>     frames;
+        uint32_t               currentFrame = 0;
+        uint32_t               setsPerPool;
+        uint32_t               poolCount = 0;
+
+        // Scratch for getSet()
+        std::vector<uint64_t>             key;
+        std::vector<VkWriteDescriptorSet> vkWrites;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // DESCRIPTOR_ALLOCATOR_H
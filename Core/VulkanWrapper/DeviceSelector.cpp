@@ -0,0 +1,329 @@
+#include "DeviceSelector.h"
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Type dominates the score; memory and limits only break ties
+        // between devices of the same type.
+        int64_t typeScore(VkPhysicalDeviceType type) {
+            switch (type) {
+            case VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU:
+                return 1000000;
+            case VK_PHYSICAL_DEVICE_TYPE_INTEGRATED_GPU:
+                return 100000;
+            case VK_PHYSICAL_DEVICE_TYPE_VIRTUAL_GPU:
+                return 10000;
+            case VK_PHYSICAL_DEVICE_TYPE_CPU:
+                return 1000;
+            default:
+                return 0;
+            }
+        }
+
+        // VkPhysicalDeviceFeatures is a plain sequence of VkBool32
+        bool hasFeatures(const VkPhysicalDeviceFeatures &available,
+                         const VkPhysicalDeviceFeatures &required) {
+            constexpr size_t count = sizeof(VkPhysicalDeviceFeatures) / sizeof(VkBool32);
+            VkBool32         availableFlags[count];
+            VkBool32         requiredFlags[count];
+            std::memcpy(availableFlags, &available, sizeof(available));
+            std::memcpy(requiredFlags, &required, sizeof(required));
+
+            for (size_t i = 0; i < count; i++) {
+                if (requiredFlags[i] && !availableFlags[i])
+                    return false;
+            }
+            return true;
+        }
+
+        std::string toLower(std::string text) {
+            std::transform(text.begin(), text.end(), text.begin(),
+                           [](unsigned char c) { return static_cast<char>(std::tolower(c)); });
+            return text;
+        }
+
+        bool supportsDescriptorIndexing(const DeviceCapabilities          &capabilities,
+                                        PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2) {
+            if (!getFeatures2 ||
+                !capabilities.hasExtension(VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME) ||
+                !capabilities.hasExtension(VK_KHR_MAINTENANCE3_EXTENSION_NAME))
+                return false;
+
+            VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexing{};
+            indexing.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+
+            VkPhysicalDeviceFeatures2KHR features{};
+            features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+            features.pNext = &indexing;
+            getFeatures2(capabilities.physicalDevice, &features);
+
+            return indexing.shaderSampledImageArrayNonUniformIndexing &&
+                   indexing.runtimeDescriptorArray && indexing.descriptorBindingPartiallyBound;
+        }
+
+        bool supportsPresentWait(const DeviceCapabilities          &capabilities,
+                                 PFN_vkGetPhysicalDeviceFeatures2KHR getFeatures2) {
+            if (!getFeatures2 ||
+                !capabilities.hasExtension(VK_KHR_PRESENT_ID_EXTENSION_NAME) ||
+                !capabilities.hasExtension(VK_KHR_PRESENT_WAIT_EXTENSION_NAME))
+                return false;
+
+            VkPhysicalDevicePresentIdFeaturesKHR presentId{};
+            presentId.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+
+            VkPhysicalDevicePresentWaitFeaturesKHR presentWait{};
+            presentWait.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+            presentWait.pNext = &presentId;
+
+            VkPhysicalDeviceFeatures2KHR features{};
+            features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2_KHR;
+            features.pNext = &presentWait;
+            getFeatures2(capabilities.physicalDevice, &features);
+
+            return presentId.presentId && presentWait.presentWait;
+        }
+
+        QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device, VkSurfaceKHR surface,
+                                             const std::vector<VkQueueFamilyProperties> &families) {
+            QueueFamilyIndices indices;
+
+            for (uint32_t i = 0; i < families.size(); i++) {
+                bool graphics = families[i].queueFlags & VK_QUEUE_GRAPHICS_BIT;
+
+                // Headless has nothing to present to; alias the graphics
+                // family so the rest of device setup stays unchanged.
+                VkBool32 presentSupport = surface == VK_NULL_HANDLE ? graphics : VK_FALSE;
+                if (surface != VK_NULL_HANDLE) {
+                    vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+                }
+
+                // One family doing both avoids concurrent swapchain sharing
+                if (graphics && presentSupport) {
+                    indices.graphicsFamily = i;
+                    indices.presentFamily = i;
+                    break;
+                }
+                if (graphics && !indices.graphicsFamily.has_value()) {
+                    indices.graphicsFamily = i;
+                }
+                if (presentSupport && !indices.presentFamily.has_value()) {
+                    indices.presentFamily = i;
+                }
+            }
+
+            // A family with transfer but neither graphics nor compute is the
+            // DMA engine on discrete GPUs; copies there run alongside
+            // rendering. Partial image copies need a 1x1x1 granularity.
+            for (uint32_t family = 0; family < families.size(); family++) {
+                const VkQueueFamilyProperties &properties = families[family];
+                const VkExtent3D &granularity = properties.minImageTransferGranularity;
+
+                bool transferOnly = (properties.queueFlags & VK_QUEUE_TRANSFER_BIT) &&
+                                    !(properties.queueFlags &
+                                      (VK_QUEUE_GRAPHICS_BIT | VK_QUEUE_COMPUTE_BIT));
+                bool fineGrained = granularity.width == 1 && granularity.height == 1 &&
+                                   granularity.depth == 1;
+                if (transferOnly && fineGrained) {
+                    indices.transferFamily = family;
+                    break;
+                }
+            }
+            if (!indices.transferFamily.has_value()) {
+                indices.transferFamily = indices.graphicsFamily;
+            }
+
+            return indices;
+        }
+    } // namespace
+
+    bool DeviceCapabilities::hasExtension(const char *name) const {
+        for (const auto &extension : extensions) {
+            if (strcmp(extension.extensionName, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    VkDeviceSize DeviceCapabilities::deviceLocalBytes() const {
+        VkDeviceSize largest = 0;
+        for (uint32_t i = 0; i < memoryProperties.memoryHeapCount; i++) {
+            const VkMemoryHeap &heap = memoryProperties.memoryHeaps[i];
+            if (heap.flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT) {
+                largest = std::max(largest, heap.size);
+            }
+        }
+        return largest;
+    }
+
+    DeviceCapabilities DeviceSelector::query(VkPhysicalDevice device, VkSurfaceKHR surface) {
+        DeviceCapabilities capabilities;
+        capabilities.physicalDevice = device;
+
+        vkGetPhysicalDeviceProperties(device, &capabilities.properties);
+        vkGetPhysicalDeviceFeatures(device, &capabilities.features);
+        vkGetPhysicalDeviceMemoryProperties(device, &capabilities.memoryProperties);
+
+        uint32_t queueFamilyCount = 0;
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+        capabilities.queueFamilyProperties.resize(queueFamilyCount);
+        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
+                                                 capabilities.queueFamilyProperties.data());
+
+        uint32_t extensionCount = 0;
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+        capabilities.extensions.resize(extensionCount);
+        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
+                                             capabilities.extensions.data());
+
+        capabilities.queueFamilies =
+            findQueueFamilies(device, surface, capabilities.queueFamilyProperties);
+
+        if (surface != VK_NULL_HANDLE)
+            querySurface(device, surface, capabilities);
+
+        return capabilities;
+    }
+
+    void DeviceSelector::querySurface(VkPhysicalDevice device, VkSurfaceKHR surface,
+                                      DeviceCapabilities &capabilities) {
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
+                                                  &capabilities.surfaceCapabilities);
+
+        uint32_t formatCount = 0;
+        vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount, nullptr);
+        capabilities.surfaceFormats.resize(formatCount);
+        vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
+                                             capabilities.surfaceFormats.data());
+
+        uint32_t presentModeCount = 0;
+        vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
+                                                  nullptr);
+        capabilities.presentModes.resize(presentModeCount);
+        vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface, &presentModeCount,
+                                                  capabilities.presentModes.data());
+    }
+
+    bool DeviceSelector::isSuitable(const DeviceCapabilities &capabilities,
+                                    const DeviceRequirements &requirements) {
+        if (!capabilities.queueFamilies.isComplete())
+            return false;
+
+        for (const char *extension : requirements.extensions) {
+            if (!capabilities.hasExtension(extension))
+                return false;
+        }
+
+        if (!hasFeatures(capabilities.features, requirements.features))
+            return false;
+
+        if (requirements.presentation &&
+            (capabilities.surfaceFormats.empty() || capabilities.presentModes.empty()))
+            return false;
+
+        return true;
+    }
+
+    int64_t DeviceSelector::score(const DeviceCapabilities &capabilities,
+                                  const DeviceRequirements &requirements) {
+        if (!isSuitable(capabilities, requirements))
+            return -1;
+
+        const VkPhysicalDeviceLimits &limits = capabilities.properties.limits;
+
+        int64_t total = typeScore(capabilities.properties.deviceType);
+        // 1 point per 64 MiB of VRAM: an 8 GiB card scores 128
+        total += static_cast<int64_t>(capabilities.deviceLocalBytes() / (64ull * 1024 * 1024));
+        total += limits.maxImageDimension2D / 1024;
+        // A separate DMA queue lets uploads overlap rendering
+        if (capabilities.queueFamilies.transferFamily != capabilities.queueFamilies.graphicsFamily)
+            total += 32;
+        return total;
+    }
+
+    DeviceSelector::DeviceSelector(VkInstance instance, VkSurfaceKHR surface,
+                                   const DeviceRequirements &requirements) {
+        uint32_t deviceCount = 0;
+        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+
+        if (deviceCount == 0) {
+            throw std::runtime_error("Failed to find GPUs with Vulkan support");
+        }
+
+        std::vector<VkPhysicalDevice> devices(deviceCount);
+        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+
+        // Null unless the instance enabled VK_KHR_get_physical_device_properties2
+        auto getFeatures2 = reinterpret_cast<PFN_vkGetPhysicalDeviceFeatures2KHR>(
+            vkGetInstanceProcAddr(instance, "vkGetPhysicalDeviceFeatures2KHR"));
+
+        candidates.reserve(deviceCount);
+        for (VkPhysicalDevice device : devices) {
+            Candidate candidate;
+            candidate.capabilities = query(device, surface);
+            candidate.capabilities.descriptorIndexing =
+                supportsDescriptorIndexing(candidate.capabilities, getFeatures2);
+            candidate.capabilities.presentWait =
+                supportsPresentWait(candidate.capabilities, getFeatures2);
+            candidate.score = score(candidate.capabilities, requirements);
+            candidates.push_back(std::move(candidate));
+        }
+    }
+
+    std::optional<size_t> DeviceSelector::match(const std::string &selector) const {
+        bool numeric = !selector.empty() &&
+                       std::all_of(selector.begin(), selector.end(),
+                                   [](unsigned char c) { return std::isdigit(c); });
+        if (numeric) {
+            size_t index = std::strtoul(selector.c_str(), nullptr, 10);
+            if (index < candidates.size())
+                return index;
+            return std::nullopt;
+        }
+
+        std::string needle = toLower(selector);
+        for (size_t i = 0; i < candidates.size(); i++) {
+            std::string name = toLower(candidates[i].capabilities.properties.deviceName);
+            if (name.find(needle) != std::string::npos)
+                return i;
+        }
+        return std::nullopt;
+    }
+
+    const DeviceCapabilities &DeviceSelector::select(const std::string &preferred) const {
+        const char *environment = std::getenv("RETOCCILUS_DEVICE");
+        std::string selector = environment && *environment ? environment : preferred;
+
+        if (!selector.empty()) {
+            std::optional<size_t> index = match(selector);
+            if (!index) {
+                std::cerr << "Device selection: no GPU matches \"" << selector
+                          << "\", falling back to scoring" << std::endl;
+            } else if (candidates[*index].score < 0) {
+                std::cerr << "Device selection: "
+                          << candidates[*index].capabilities.properties.deviceName
+                          << " is not suitable, falling back to scoring" << std::endl;
+            } else {
+                return candidates[*index].capabilities;
+            }
+        }
+
+        const Candidate *best = nullptr;
+        for (const auto &candidate : candidates) {
+            if (candidate.score >= 0 && (!best || candidate.score > best->score)) {
+                best = &candidate;
+            }
+        }
+
+        if (!best) {
+            throw std::runtime_error("Failed to find a suitable GPU");
+        }
+        return best->capabilities;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,96 @@
+#ifndef DEVICE_SELECTOR_H
+#define DEVICE_SELECTOR_H
+
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    struct QueueFamilyIndices {
+        std::optional<uint32_t> graphicsFamily;
+        std::optional<uint32_t> presentFamily;
+        // A transfer-only family if the device has one, else graphics
+        std::optional<uint32_t> transferFamily;
+
+        bool isComplete() const {
+            return graphicsFamily.has_value() && presentFamily.has_value();
+        }
+    };
+
+    // Everything init needs to know about one physical device, queried once.
+    // Surface fields are empty when there is no surface (headless).
+    struct DeviceCapabilities {
+        VkPhysicalDevice                     physicalDevice = VK_NULL_HANDLE;
+        VkPhysicalDeviceProperties           properties{};
+        VkPhysicalDeviceFeatures             features{};
+        VkPhysicalDeviceMemoryProperties     memoryProperties{};
+        std::vector<VkQueueFamilyProperties> queueFamilyProperties;
+        std::vector<VkExtensionProperties>   extensions;
+        QueueFamilyIndices                   queueFamilies;
+
+        VkSurfaceCapabilitiesKHR        surfaceCapabilities{};
+        std::vector<VkSurfaceFormatKHR> surfaceFormats;
+        std::vector<VkPresentModeKHR>   presentModes;
+
+        // VK_EXT_descriptor_indexing with what bindless texture arrays need:
+        // non-uniform sampled image indexing, runtime-sized arrays and
+        // partially bound bindings. Only detected when the instance enabled
+        // VK_KHR_get_physical_device_properties2.
+        bool descriptorIndexing = false;
+        // VK_KHR_present_id and VK_KHR_present_wait, to time when a frame
+        // reaches the display. Detected like descriptorIndexing.
+        bool presentWait = false;
+
+        bool         hasExtension(const char *name) const;
+        VkDeviceSize deviceLocalBytes() const;
+    };
+
+    struct DeviceRequirements {
+        std::vector<const char *> extensions;
+        VkPhysicalDeviceFeatures  features{};
+        bool                      presentation = true;
+    };
+
+    // Ranks every physical device and picks the best suitable one. Discrete
+    // GPUs beat integrated ones, which beat virtual and CPU devices; within a
+    // type, more device-local memory and larger limits win.
+    //
+    // The choice can be forced with the RETOCCILUS_DEVICE environment
+    // variable or select()'s `preferred` argument (environment wins). Both
+    // take a device index or a case-insensitive substring of its name.
+    class DeviceSelector {
+      public:
+        struct Candidate {
+            DeviceCapabilities capabilities;
+            int64_t            score; // negative when unsuitable
+        };
+
+        DeviceSelector(VkInstance instance, VkSurfaceKHR surface,
+                       const DeviceRequirements &requirements);
+
+        const std::vector<Candidate> &getCandidates() const { return candidates; }
+
+        // Throws when no device is suitable
+        const DeviceCapabilities &select(const std::string &preferred = "") const;
+
+        static DeviceCapabilities query(VkPhysicalDevice device, VkSurfaceKHR surface);
+        // Fills only the surface fields, e.g. for another window on a picked device
+        static void               querySurface(VkPhysicalDevice device, VkSurfaceKHR surface,
+                                               DeviceCapabilities &capabilities);
+        static bool               isSuitable(const DeviceCapabilities &capabilities,
+                                             const DeviceRequirements &requirements);
+        static int64_t            score(const DeviceCapabilities &capabilities,
+                                        const DeviceRequirements &requirements);
+
+      private:
+        std::optional<size_t> match(const std::string &selector) const;
+
+        std::vector<Candidate> candidates;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // DEVICE_SELECTOR_H
@@ -0,0 +1,156 @@
+#include "FramePacer.h"
+#include <algorithm>
+#include <thread>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Share of the blocked time moved in front of the next frame. Below
+        // one, so that a single slow frame does not swing the delay.
+        constexpr double kGain = 0.5;
+        // The delay never exceeds this without a measured present interval
+        constexpr double kMaxDelayMs = 50.0;
+        // A present this much later than the shortest recent interval
+        // skipped a refresh
+        constexpr double kMissFactor = 1.5;
+
+        double milliseconds(FramePacer::Clock::duration duration) {
+            return std::chrono::duration<double, std::milli>(duration).count();
+        }
+    } // namespace
+
+    FramePacer::FramePacer(size_t historySize) : historySize(std::max<size_t>(historySize, 2)) {}
+
+    std::vector<VkPresentModeKHR> FramePacer::getPresentModes(PresentPolicy policy) {
+        switch (policy) {
+        case PresentPolicy::LowestLatency:
+            return {VK_PRESENT_MODE_IMMEDIATE_KHR, VK_PRESENT_MODE_MAILBOX_KHR,
+                    VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR};
+        case PresentPolicy::LowLatency:
+            return {VK_PRESENT_MODE_MAILBOX_KHR, VK_PRESENT_MODE_FIFO_KHR};
+        case PresentPolicy::AdaptiveVSync:
+            return {VK_PRESENT_MODE_FIFO_RELAXED_KHR, VK_PRESENT_MODE_FIFO_KHR};
+        case PresentPolicy::VSync:
+        case PresentPolicy::PowerSaving:
+            break;
+        }
+        return {VK_PRESENT_MODE_FIFO_KHR};
+    }
+
+    void FramePacer::setEnabled(bool enable) {
+        enabled = enable;
+        if (!enabled) {
+            std::lock_guard<std::mutex> lock(mutex);
+            delayMs = 0.0;
+            missed = false;
+        }
+    }
+
+    void FramePacer::beginFrame(bool sleep) {
+        if (enabled) {
+            double sleepMs;
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                if (missed) {
+                    delayMs *= 0.5;
+                    missed = false;
+                }
+                sleepMs = delayMs;
+            }
+            if (sleep && sleepMs > 0.0)
+                std::this_thread::sleep_for(std::chrono::duration<double, std::milli>(sleepMs));
+        }
+
+        frameStart = Clock::now();
+        blockedMs = 0.0;
+        inFrame = true;
+    }
+
+    uint64_t FramePacer::endFrame() {
+        uint64_t id = nextId++;
+        inFrame = false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        pending.push_back(Pending{id, frameStart});
+        if (pending.size() > historySize)
+            pending.pop_front();
+
+        updateDelay();
+        return id;
+    }
+
+    void FramePacer::abandonFrame() {
+        inFrame = false;
+
+        std::lock_guard<std::mutex> lock(mutex);
+        updateDelay();
+    }
+
+    void FramePacer::updateDelay() {
+        if (!enabled)
+            return;
+
+        // Never more than a refresh: sleeping longer cannot make up for
+        // blocking that happens once per refresh
+        double limit = kMaxDelayMs;
+        if (presentTimed && !intervals.empty())
+            limit = *std::min_element(intervals.begin(), intervals.end());
+        delayMs = std::clamp(delayMs + kGain * (blockedMs - margin), 0.0, limit);
+    }
+
+    void FramePacer::framePresented(uint64_t id, Clock::time_point time, bool timed) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        while (!pending.empty() && pending.front().id < id)
+            pending.pop_front();
+        if (pending.empty() || pending.front().id != id)
+            return;
+
+        latencies.push_back(milliseconds(time - pending.front().start));
+        if (latencies.size() > historySize)
+            latencies.pop_front();
+        pending.pop_front();
+
+        if (hasPresented) {
+            double interval = milliseconds(time - lastPresent);
+            // GPU completion is not tied to refreshes, so only real
+            // presents tell a missed one
+            if (timed && !intervals.empty() &&
+                interval > kMissFactor * *std::min_element(intervals.begin(), intervals.end()))
+                missed = true;
+
+            intervals.push_back(interval);
+            if (intervals.size() > historySize)
+                intervals.pop_front();
+        }
+        lastPresent = time;
+        hasPresented = true;
+        presentTimed = timed;
+    }
+
+    LatencyStats FramePacer::getStats() const {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        LatencyStats stats;
+        stats.frameDelayMs = delayMs;
+        stats.presentTimed = presentTimed;
+        stats.frames = static_cast<uint32_t>(latencies.size());
+        if (!latencies.empty()) {
+            double sum = 0.0;
+            for (double latency : latencies)
+                sum += latency;
+            stats.averageMs = sum / latencies.size();
+            stats.minMs = *std::min_element(latencies.begin(), latencies.end());
+            stats.maxMs = *std::max_element(latencies.begin(), latencies.end());
+            stats.lastMs = latencies.back();
+        }
+        if (!intervals.empty()) {
+            double sum = 0.0;
+            for (double interval : intervals)
+                sum += interval;
+            stats.presentIntervalMs = sum / intervals.size();
+        }
+        return stats;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,128 @@
+#ifndef FRAME_PACER_H
+#define FRAME_PACER_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // How a view's swapchain presents. Each policy takes the first present
+    // mode in its list that the surface supports; every surface supports
+    // FIFO.
+    enum class PresentPolicy {
+        LowestLatency, // IMMEDIATE, MAILBOX, FIFO_RELAXED, FIFO; may tear
+        LowLatency,    // MAILBOX, FIFO; never tears. The default.
+        VSync,         // FIFO: locked to the refresh rate
+        AdaptiveVSync, // FIFO_RELAXED, FIFO: a late frame tears instead of waiting a refresh
+        PowerSaving    // FIFO, paced like latency mode so the CPU sleeps between frames
+    };
+
+    // Input-to-present latency over the pacer's history
+    struct LatencyStats {
+        uint32_t frames = 0; // measured
+        double   averageMs = 0.0;
+        double   minMs = 0.0;
+        double   maxMs = 0.0;
+        double   lastMs = 0.0;
+        // Mean time between two presents
+        double presentIntervalMs = 0.0;
+        // How long the governor currently delays the start of a frame
+        double frameDelayMs = 0.0;
+        // Presents were timed with VK_KHR_present_wait. Otherwise the time
+        // the render thread saw the frame finish on the GPU stands in.
+        bool presentTimed = false;
+    };
+
+    // Frame pacing governor of one view. Each frame starts with
+    // beginFrame(), which is where the application should sample input,
+    // and is reported presented when the display has shown it; the time in
+    // between is the input-to-present latency.
+    //
+    // Left alone, a CPU that is faster than the GPU or the display records
+    // a frame and then blocks (on a frame slot's fence, or in
+    // vkAcquireNextImageKHR), so its input is already old by the time it
+    // is shown. While enabled, the governor moves that blocking in front
+    // of the input sample instead: it sleeps in beginFrame() for as long
+    // as frames recently spent blocked after it, minus a margin for
+    // jitter. A frame that misses its refresh halves the delay.
+    class FramePacer {
+      public:
+        using Clock = std::chrono::steady_clock;
+
+        explicit FramePacer(size_t historySize = 120);
+
+        FramePacer(const FramePacer &) = delete;
+        FramePacer &operator=(const FramePacer &) = delete;
+
+        // In order of preference
+        static std::vector<VkPresentModeKHR> getPresentModes(PresentPolicy policy);
+
+        // While disabled beginFrame() does not sleep; latency is measured
+        // either way
+        void setEnabled(bool enabled);
+        bool isEnabled() const { return enabled; }
+        // Blocking the governor leaves after beginFrame(), in milliseconds
+        void setMargin(double milliseconds) { margin = milliseconds; }
+
+        // Sleeps for the governor's delay, then marks the input sample.
+        // Without `sleep` only marks it, for a view whose frame goes out
+        // in a submission that another view's pacer already slept for.
+        void beginFrame(bool sleep = true);
+        bool isInFrame() const { return inFrame; }
+        // Time the frame blocked on the GPU or the display after beginFrame()
+        void addBlockedTime(double milliseconds) { blockedMs += milliseconds; }
+        // Closes the frame; returns its id for framePresented(). Ids start
+        // at 1 and increase by one per frame.
+        uint64_t endFrame();
+        // Closes a frame that was never submitted, e.g. because the
+        // swapchain was out of date. Its blocked time still counts towards
+        // the delay, but it takes no id and yields no latency sample.
+        void abandonFrame();
+
+        // Frame `id` reached the display at `time` (`timed`), or finished
+        // on the GPU then. Frames never reported are dropped once a later
+        // one is. Thread-safe.
+        void framePresented(uint64_t id, Clock::time_point time, bool timed);
+
+        LatencyStats getStats() const;
+
+      private:
+        struct Pending {
+            uint64_t          id;
+            Clock::time_point start;
+        };
+
+        // Moves the closing frame's blocked time into the delay; called
+        // with the mutex held
+        void updateDelay();
+
+        size_t historySize;
+        bool   enabled = false;
+        double margin = 1.0;
+
+        // Render thread
+        bool              inFrame = false;
+        Clock::time_point frameStart;
+        double            blockedMs = 0.0;
+        uint64_t          nextId = 1;
+
+        // Shared with framePresented()
+        mutable std::mutex  mutex;
+        double              delayMs = 0.0;
+        bool                missed = false; // halve the delay at the next frame
+        bool                presentTimed = false;
+        std::deque<Pending> pending;
+        std::deque<double>  latencies;
+        std::deque<double>  intervals;
+        Clock::time_point   lastPresent;
+        bool                hasPresented = false;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // FRAME_PACER_H
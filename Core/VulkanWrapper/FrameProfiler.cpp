@@ -0,0 +1,274 @@
+#include "FrameProfiler.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+#include <iomanip>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        std::atomic<uint32_t> nextThreadIndex{1};
+
+        thread_local uint32_t threadIndex = nextThreadIndex++;
+        thread_local uint32_t cpuDepth = 0;
+
+        void writeEscaped(std::ostream &out, const char *text) {
+            out << '"';
+            for (const char *c = text; *c; c++) {
+                switch (*c) {
+                case '"':
+                    out << "\\\"";
+                    break;
+                case '\\':
+                    out << "\\\\";
+                    break;
+                default:
+                    if (static_cast<unsigned char>(*c) >= 0x20)
+                        out << *c;
+                }
+            }
+            out << '"';
+        }
+
+        void writeEvent(std::ostream &out, const ProfileScope &scope, uint64_t frameNumber) {
+            out << "{\"name\":";
+            writeEscaped(out, scope.name);
+            out << ",\"cat\":\"" << (scope.thread == 0 ? "gpu" : "cpu") << "\""
+                << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << scope.thread
+                << ",\"ts\":" << scope.startMs * 1000.0
+                << ",\"dur\":" << scope.durationMs * 1000.0
+                << ",\"args\":{\"frame\":" << frameNumber << "}}";
+        }
+    } // namespace
+
+    FrameProfiler::FrameProfiler(VkDevice device, const DeviceCapabilities &capabilities,
+                                 uint32_t framesInFlight, uint32_t maxGpuScopes,
+                                 size_t historySize)
+        : device(device), maxGpuScopes(maxGpuScopes), historySize(historySize),
+          epoch(std::chrono::steady_clock::now()) {
+        slots.resize(framesInFlight);
+
+        // Timestamps are written on the graphics queue; zero valid bits means
+        // that family cannot write them at all.
+        uint32_t graphicsFamily = capabilities.queueFamilies.graphicsFamily.value();
+        uint32_t validBits =
+            capabilities.queueFamilyProperties[graphicsFamily].timestampValidBits;
+        if (validBits == 0 || capabilities.properties.limits.timestampPeriod <= 0.0f)
+            return;
+
+        timestampPeriod = capabilities.properties.limits.timestampPeriod;
+        timestampMask = validBits >= 64 ? UINT64_MAX : (1ull << validBits) - 1;
+
+        VkQueryPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+        poolInfo.queryType = VK_QUERY_TYPE_TIMESTAMP;
+        poolInfo.queryCount = maxGpuScopes * 2;
+
+        for (Slot &slot : slots) {
+            VK_CHECK_RESULT(vkCreateQueryPool(device, &poolInfo, nullptr, &slot.queryPool));
+        }
+    }
+
+    FrameProfiler::~FrameProfiler() {
+        for (Slot &slot : slots) {
+            if (slot.queryPool != VK_NULL_HANDLE)
+                vkDestroyQueryPool(device, slot.queryPool, nullptr);
+        }
+    }
+
+    double FrameProfiler::now() const {
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - epoch;
+        return elapsed.count();
+    }
+
+    void FrameProfiler::beginFrame(VkCommandBuffer cmd, uint32_t slotIndex,
+                                   uint64_t frameNumber) {
+        Slot &slot = slots[slotIndex];
+        collect(slot);
+
+        this->frameNumber = frameNumber;
+        recordingSlot = nullptr;
+        gpuDepth = 0;
+
+        if (!isEnabled())
+            return;
+
+        recordingSlot = &slot;
+        if (slot.queryPool != VK_NULL_HANDLE) {
+            vkCmdResetQueryPool(cmd, slot.queryPool, 0, maxGpuScopes * 2);
+        }
+    }
+
+    void FrameProfiler::endFrame() {
+        double endMs = now();
+
+        FrameProfile profile;
+        profile.frameNumber = frameNumber;
+        profile.cpuStartMs = frameStartMs;
+        profile.cpuEndMs = endMs;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            profile.cpuScopes.swap(cpuScopes);
+        }
+        frameStartMs = endMs;
+
+        if (recordingSlot) {
+            recordingSlot->pending = std::move(profile);
+            recordingSlot->submitMs = endMs;
+            recordingSlot = nullptr;
+        } else if (!profile.cpuScopes.empty()) {
+            // Enabled mid-frame: only the CPU half exists
+            std::lock_guard<std::mutex> lock(mutex);
+            history.push_back(std::move(profile));
+            if (history.size() > historySize)
+                history.pop_front();
+        }
+    }
+
+    void FrameProfiler::collect(Slot &slot) {
+        if (!slot.pending.has_value()) {
+            slot.scopes.clear();
+            return;
+        }
+
+        FrameProfile profile = std::move(*slot.pending);
+        slot.pending.reset();
+
+        uint32_t queryCount = static_cast<uint32_t>(slot.scopes.size()) * 2;
+        if (queryCount > 0) {
+            // The slot's fence has signalled, so the results are available
+            // and this does not wait.
+            std::vector<uint64_t> timestamps(queryCount);
+            VkResult              result = vkGetQueryPoolResults(
+                device, slot.queryPool, 0, queryCount, timestamps.size() * sizeof(uint64_t),
+                timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+
+            if (result == VK_SUCCESS) {
+                double   msPerTick = timestampPeriod / 1e6;
+                uint64_t base = timestamps[0];
+                double   last = 0.0;
+
+                profile.gpuScopes.reserve(slot.scopes.size());
+                for (size_t i = 0; i < slot.scopes.size(); i++) {
+                    const GpuScopeRecord &record = slot.scopes[i];
+                    if (!record.closed)
+                        continue;
+
+                    uint64_t begin = timestamps[i * 2];
+                    uint64_t end = timestamps[i * 2 + 1];
+                    double   offset = ((begin - base) & timestampMask) * msPerTick;
+                    double   duration = ((end - begin) & timestampMask) * msPerTick;
+
+                    profile.gpuScopes.push_back(ProfileScope{
+                        record.name, slot.submitMs + offset, duration, record.depth, 0});
+                    last = std::max(last, offset + duration);
+                }
+                profile.gpuMs = last;
+            }
+        }
+        slot.scopes.clear();
+
+        std::lock_guard<std::mutex> lock(mutex);
+        if (profile.gpuMs > 0.0)
+            latestGpuTime = FrameGpuTime{profile.frameNumber, profile.gpuMs};
+        history.push_back(std::move(profile));
+        if (history.size() > historySize)
+            history.pop_front();
+    }
+
+    uint32_t FrameProfiler::beginGpuScope(VkCommandBuffer cmd, const char *name) {
+        if (!recordingSlot || recordingSlot->queryPool == VK_NULL_HANDLE ||
+            recordingSlot->scopes.size() >= maxGpuScopes)
+            return kNoScope;
+
+        uint32_t index = static_cast<uint32_t>(recordingSlot->scopes.size());
+        recordingSlot->scopes.push_back(GpuScopeRecord{name, gpuDepth++, false});
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, recordingSlot->queryPool,
+                            index * 2);
+        return index;
+    }
+
+    void FrameProfiler::endGpuScope(VkCommandBuffer cmd, uint32_t index) {
+        if (!recordingSlot || index >= recordingSlot->scopes.size())
+            return;
+
+        vkCmdWriteTimestamp(cmd, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT,
+                            recordingSlot->queryPool, index * 2 + 1);
+        recordingSlot->scopes[index].closed = true;
+        gpuDepth--;
+    }
+
+    void FrameProfiler::addCpuScope(const ProfileScope &scope) {
+        std::lock_guard<std::mutex> lock(mutex);
+        cpuScopes.push_back(scope);
+    }
+
+    FrameProfiler::CpuScope::CpuScope(FrameProfiler &profiler, const char *name)
+        : profiler(profiler.isEnabled() ? &profiler : nullptr), name(name) {
+        if (this->profiler) {
+            startMs = profiler.now();
+            cpuDepth++;
+        }
+    }
+
+    FrameProfiler::CpuScope::~CpuScope() {
+        if (!profiler)
+            return;
+
+        cpuDepth--;
+        profiler->addCpuScope(
+            ProfileScope{name, startMs, profiler->now() - startMs, cpuDepth, threadIndex});
+    }
+
+    FrameProfiler::GpuScope::GpuScope(FrameProfiler &profiler, VkCommandBuffer cmd,
+                                      const char *name)
+        : profiler(&profiler), cmd(cmd), index(profiler.beginGpuScope(cmd, name)) {}
+
+    FrameProfiler::GpuScope::~GpuScope() {
+        if (index != kNoScope)
+            profiler->endGpuScope(cmd, index);
+    }
+
+    std::vector<FrameProfile> FrameProfiler::getHistory() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return std::vector<FrameProfile>(history.begin(), history.end());
+    }
+
+    std::optional<FrameProfile> FrameProfiler::getLatestFrame() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (history.empty())
+            return std::nullopt;
+        return history.back();
+    }
+
+    std::optional<FrameGpuTime> FrameProfiler::getLatestGpuTime() const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return latestGpuTime;
+    }
+
+    void FrameProfiler::writeChromeTrace(std::ostream &out) const {
+        std::vector<FrameProfile> frames = getHistory();
+
+        std::ios::fmtflags flags = out.flags();
+        out << std::fixed << std::setprecision(3);
+
+        out << "{\"traceEvents\":[";
+        out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":0,\"tid\":0,"
+               "\"args\":{\"name\":\"GPU\"}}";
+
+        for (const FrameProfile &frame : frames) {
+            for (const ProfileScope &scope : frame.cpuScopes) {
+                out << ",";
+                writeEvent(out, scope, frame.frameNumber);
+            }
+            for (const ProfileScope &scope : frame.gpuScopes) {
+                out << ",";
+                writeEvent(out, scope, frame.frameNumber);
+            }
+        }
+
+        out << "],\"displayTimeUnit\":\"ms\"}\n";
+        out.flags(flags);
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,163 @@
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include "DeviceSelector.h"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <optional>
+#include <ostream>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // One timed scope. Times are milliseconds since the profiler was
+    // created. Scope names must outlive the profiler (string literals).
+    struct ProfileScope {
+        const char *name;
+        double      startMs;
+        double      durationMs;
+        uint32_t    depth;
+        // Small per-thread index for CPU scopes, 0 for GPU scopes
+        uint32_t thread;
+    };
+
+    struct FrameProfile {
+        uint64_t frameNumber = 0;
+        // CPU time from the previous frame's submit to this one's
+        double cpuStartMs = 0.0;
+        double cpuEndMs = 0.0;
+        // First to last timestamp written by the frame's command buffer
+        double gpuMs = 0.0;
+
+        std::vector<ProfileScope> cpuScopes;
+        std::vector<ProfileScope> gpuScopes;
+    };
+
+    struct FrameGpuTime {
+        uint64_t frameNumber = 0;
+        double   gpuMs = 0.0;
+    };
+
+    // CPU and GPU frame profiler. GPU scopes are timestamp query pairs in a
+    // per-frame-slot VkQueryPool; they are read back when the slot comes
+    // around again and its fence has signalled, so the readback never
+    // waits. A frame's profile therefore reaches the history
+    // maxFramesInFlight frames after it was submitted.
+    //
+    // GPU and CPU clocks are not calibrated against each other (that needs
+    // VK_EXT_calibrated_timestamps); GPU scopes are placed on the CPU
+    // timeline by aligning the frame's first timestamp with its submit.
+    //
+    // Disabled by default. While disabled, scopes cost one relaxed atomic
+    // load and record nothing.
+    class FrameProfiler {
+      public:
+        FrameProfiler(VkDevice device, const DeviceCapabilities &capabilities,
+                      uint32_t framesInFlight, uint32_t maxGpuScopes = 128,
+                      size_t historySize = 240);
+        ~FrameProfiler();
+
+        FrameProfiler(const FrameProfiler &) = delete;
+        FrameProfiler &operator=(const FrameProfiler &) = delete;
+
+        // Takes effect at the next beginFrame() for GPU scopes
+        void setEnabled(bool enabled) { enabledFlag.store(enabled, std::memory_order_relaxed); }
+        bool isEnabled() const { return enabledFlag.load(std::memory_order_relaxed); }
+        bool hasGpuTimestamps() const { return timestampPeriod > 0.0; }
+
+        // Called by the wrapper once the slot's fence has signalled, right
+        // after vkBeginCommandBuffer; collects the slot's previous frame.
+        void beginFrame(VkCommandBuffer cmd, uint32_t slot, uint64_t frameNumber);
+        // Called after the frame was submitted
+        void endFrame();
+
+        class CpuScope {
+          public:
+            CpuScope(FrameProfiler &profiler, const char *name);
+            ~CpuScope();
+
+            CpuScope(const CpuScope &) = delete;
+            CpuScope &operator=(const CpuScope &) = delete;
+
+          private:
+            FrameProfiler *profiler;
+            const char    *name;
+            double         startMs = 0.0;
+        };
+
+        class GpuScope {
+          public:
+            GpuScope(FrameProfiler &profiler, VkCommandBuffer cmd, const char *name);
+            ~GpuScope();
+
+            GpuScope(const GpuScope &) = delete;
+            GpuScope &operator=(const GpuScope &) = delete;
+
+          private:
+            FrameProfiler  *profiler;
+            VkCommandBuffer cmd;
+            uint32_t        index;
+        };
+
+        // Completed frames, oldest first
+        std::vector<FrameProfile>   getHistory() const;
+        std::optional<FrameProfile> getLatestFrame() const;
+        // GPU time of the latest frame that has timestamps, without copying
+        // its scopes; read every frame by dynamic resolution
+        std::optional<FrameGpuTime> getLatestGpuTime() const;
+
+        // Writes the history in the Chrome trace event format, loadable in
+        // chrome://tracing or Perfetto
+        void writeChromeTrace(std::ostream &out) const;
+
+      private:
+        static constexpr uint32_t kNoScope = UINT32_MAX;
+
+        struct GpuScopeRecord {
+            const char *name;
+            uint32_t    depth;
+            bool        closed;
+        };
+
+        struct Slot {
+            VkQueryPool                 queryPool = VK_NULL_HANDLE;
+            std::vector<GpuScopeRecord> scopes;
+            // Waiting for the GPU half
+            std::optional<FrameProfile> pending;
+            double                      submitMs = 0.0;
+        };
+
+        double   now() const;
+        void     collect(Slot &slot);
+        uint32_t beginGpuScope(VkCommandBuffer cmd, const char *name);
+        void     endGpuScope(VkCommandBuffer cmd, uint32_t index);
+        void     addCpuScope(const ProfileScope &scope);
+
+        VkDevice device;
+        double   timestampPeriod = 0.0; // ns per tick, 0 without support
+        uint64_t timestampMask = 0;
+        uint32_t maxGpuScopes;
+        size_t   historySize;
+
+        std::atomic<bool>                     enabledFlag{false};
+        std::chrono::steady_clock::time_point epoch;
+
+        std::vector<Slot> slots;
+        Slot             *recordingSlot = nullptr;
+        uint32_t          gpuDepth = 0;
+        uint64_t          frameNumber = 0;
+        double            frameStartMs = 0.0;
+
+        std::vector<ProfileScope>   cpuScopes;
+        std::deque<FrameProfile>    history;
+        std::optional<FrameGpuTime> latestGpuTime;
+        mutable std::mutex          mutex;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // FRAME_PROFILER_H
@@ -0,0 +1,640 @@
+#include "GpuMemoryAllocator.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr VkDeviceSize kLargeHeapThreshold = 1024ull * 1024 * 1024;
+        constexpr VkDeviceSize kDefaultBlockSize = 64ull * 1024 * 1024;
+
+        uint32_t mostSignificantBit(uint64_t value) {
+            uint32_t bit = 0;
+            while (value >>= 1) {
+                bit++;
+            }
+            return bit;
+        }
+
+        uint32_t leastSignificantBit(uint64_t value) {
+#if defined(__GNUC__) || defined(__clang__)
+            return static_cast<uint32_t>(__builtin_ctzll(value));
+#else
+            uint32_t bit = 0;
+            while ((value & 1) == 0) {
+                value >>= 1;
+                bit++;
+            }
+            return bit;
+#endif
+        }
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment) {
+            return (value + alignment - 1) & ~(alignment - 1);
+        }
+    } // namespace
+
+    // ---- TlsfBlockMetadata -----------------------------------------------
+
+    TlsfBlockMetadata::TlsfBlockMetadata(uint64_t size) : blockSize(size) {
+        for (auto &heads : freeHeads) {
+            std::fill(std::begin(heads), std::end(heads), kInvalidHandle);
+        }
+
+        uint32_t index = newRegion();
+        regions[index] = Region{0, size, kInvalidHandle, kInvalidHandle,
+                                kInvalidHandle, kInvalidHandle, true};
+        insertFree(index);
+    }
+
+    void TlsfBlockMetadata::mapping(uint64_t size, uint32_t &fl, uint32_t &sl) {
+        if (size < kSecondLevelCount) {
+            // Small sizes get one linear class each in the first row
+            fl = 0;
+            sl = static_cast<uint32_t>(size);
+        } else {
+            uint32_t msb = mostSignificantBit(size);
+            fl = msb - kSecondLevelBits + 1;
+            sl = static_cast<uint32_t>(size >> (msb - kSecondLevelBits)) ^ kSecondLevelCount;
+        }
+    }
+
+    uint32_t TlsfBlockMetadata::findFree(uint64_t size) const {
+        // Round up to the next class boundary so that any range in the
+        // returned list is large enough ("good fit" rather than best fit).
+        if (size >= kSecondLevelCount) {
+            size += (1ull << (mostSignificantBit(size) - kSecondLevelBits)) - 1;
+        }
+
+        uint32_t fl, sl;
+        mapping(size, fl, sl);
+        if (fl >= kFirstLevelCount)
+            return kInvalidHandle;
+
+        uint32_t slMap = secondLevelMap[fl] & (~0u << sl);
+        if (slMap == 0) {
+            if (fl + 1 >= kFirstLevelCount)
+                return kInvalidHandle;
+            uint64_t flMap = firstLevelMap & (~0ull << (fl + 1));
+            if (flMap == 0)
+                return kInvalidHandle;
+            fl = leastSignificantBit(flMap);
+            slMap = secondLevelMap[fl];
+        }
+        sl = leastSignificantBit(slMap);
+        return freeHeads[fl][sl];
+    }
+
+    void TlsfBlockMetadata::insertFree(uint32_t index) {
+        Region  &region = regions[index];
+        uint32_t fl, sl;
+        mapping(region.size, fl, sl);
+
+        region.isFree = true;
+        region.prevFree = kInvalidHandle;
+        region.nextFree = freeHeads[fl][sl];
+        if (region.nextFree != kInvalidHandle) {
+            regions[region.nextFree].prevFree = index;
+        }
+        freeHeads[fl][sl] = index;
+
+        firstLevelMap |= 1ull << fl;
+        secondLevelMap[fl] |= 1u << sl;
+        freeRanges++;
+    }
+
+    void TlsfBlockMetadata::removeFree(uint32_t index) {
+        Region  &region = regions[index];
+        uint32_t fl, sl;
+        mapping(region.size, fl, sl);
+
+        if (region.prevFree != kInvalidHandle) {
+            regions[region.prevFree].nextFree = region.nextFree;
+        } else {
+            freeHeads[fl][sl] = region.nextFree;
+        }
+        if (region.nextFree != kInvalidHandle) {
+            regions[region.nextFree].prevFree = region.prevFree;
+        }
+
+        if (freeHeads[fl][sl] == kInvalidHandle) {
+            secondLevelMap[fl] &= ~(1u << sl);
+            if (secondLevelMap[fl] == 0) {
+                firstLevelMap &= ~(1ull << fl);
+            }
+        }
+
+        region.isFree = false;
+        freeRanges--;
+    }
+
+    uint32_t TlsfBlockMetadata::newRegion() {
+        if (!spareRegions.empty()) {
+            uint32_t index = spareRegions.back();
+            spareRegions.pop_back();
+            return index;
+        }
+        regions.push_back(Region{});
+        return static_cast<uint32_t>(regions.size() - 1);
+    }
+
+    void TlsfBlockMetadata::releaseRegion(uint32_t index) {
+        spareRegions.push_back(index);
+    }
+
+    bool TlsfBlockMetadata::allocate(uint64_t size, uint64_t alignment,
+                                     uint64_t &offset, uint32_t &handle) {
+        if (size == 0)
+            size = 1;
+        alignment = std::max<uint64_t>(alignment, 1);
+
+        uint32_t index = findFree(size + alignment - 1);
+        if (index == kInvalidHandle)
+            return false;
+
+        removeFree(index);
+
+        uint64_t aligned = alignUp(regions[index].offset, alignment);
+        uint64_t padding = aligned - regions[index].offset;
+
+        // Leading padding becomes its own free range. Its physical neighbour
+        // is in use (free neighbours are always merged), so no merge needed.
+        if (padding > 0) {
+            uint32_t front = newRegion();
+            Region  &region = regions[index];
+            regions[front] = Region{region.offset, padding, region.prevPhysical, index,
+                                    kInvalidHandle, kInvalidHandle, true};
+            if (region.prevPhysical != kInvalidHandle) {
+                regions[region.prevPhysical].nextPhysical = front;
+            }
+            region.prevPhysical = front;
+            region.offset = aligned;
+            region.size -= padding;
+            insertFree(front);
+        }
+
+        if (regions[index].size > size) {
+            uint32_t back = newRegion();
+            Region  &region = regions[index];
+            regions[back] = Region{region.offset + size, region.size - size, index,
+                                   region.nextPhysical, kInvalidHandle, kInvalidHandle, true};
+            if (region.nextPhysical != kInvalidHandle) {
+                regions[region.nextPhysical].prevPhysical = back;
+            }
+            region.nextPhysical = back;
+            region.size = size;
+            insertFree(back);
+        }
+
+        used += size;
+        allocations++;
+
+        offset = regions[index].offset;
+        handle = index;
+        return true;
+    }
+
+    void TlsfBlockMetadata::free(uint32_t handle) {
+        uint32_t index = handle;
+        used -= regions[index].size;
+        allocations--;
+
+        uint32_t prev = regions[index].prevPhysical;
+        if (prev != kInvalidHandle && regions[prev].isFree) {
+            removeFree(prev);
+            regions[prev].size += regions[index].size;
+            regions[prev].nextPhysical = regions[index].nextPhysical;
+            if (regions[index].nextPhysical != kInvalidHandle) {
+                regions[regions[index].nextPhysical].prevPhysical = prev;
+            }
+            releaseRegion(index);
+            index = prev;
+        }
+
+        uint32_t next = regions[index].nextPhysical;
+        if (next != kInvalidHandle && regions[next].isFree) {
+            removeFree(next);
+            regions[index].size += regions[next].size;
+            regions[index].nextPhysical = regions[next].nextPhysical;
+            if (regions[next].nextPhysical != kInvalidHandle) {
+                regions[regions[next].nextPhysical].prevPhysical = index;
+            }
+            releaseRegion(next);
+        }
+
+        insertFree(index);
+    }
+
+    uint64_t TlsfBlockMetadata::largestFreeRange() const {
+        if (firstLevelMap == 0)
+            return 0;
+
+        // The largest range lives in the highest non-empty list
+        uint32_t fl = mostSignificantBit(firstLevelMap);
+        uint32_t sl = mostSignificantBit(secondLevelMap[fl]);
+
+        uint64_t largest = 0;
+        for (uint32_t i = freeHeads[fl][sl]; i != kInvalidHandle; i = regions[i].nextFree) {
+            largest = std::max(largest, regions[i].size);
+        }
+        return largest;
+    }
+
+    // ---- GpuMemoryStats --------------------------------------------------
+
+    float GpuMemoryStats::fragmentation() const {
+        VkDeviceSize freeBytes = total.blockBytes - total.usedBytes;
+        if (freeBytes == 0)
+            return 0.0f;
+        return 1.0f - static_cast<float>(total.largestFreeRange) /
+                          static_cast<float>(freeBytes);
+    }
+
+    // ---- GpuMemoryAllocator ----------------------------------------------
+
+    GpuMemoryAllocator::GpuMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device)
+        : physicalDevice(physicalDevice), device(device) {
+        vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memoryProperties);
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+        maxAllocationCount = properties.limits.maxMemoryAllocationCount;
+
+        pools.resize(memoryProperties.memoryTypeCount * 2);
+        dedicatedCount.resize(memoryProperties.memoryTypeCount);
+        dedicatedBytes.resize(memoryProperties.memoryTypeCount);
+    }
+
+    GpuMemoryAllocator::~GpuMemoryAllocator() {
+        for (auto &pool : pools) {
+            for (auto &block : pool.blocks) {
+                freeDeviceMemory(block->memory, block->mapped != nullptr);
+            }
+        }
+    }
+
+    VkDeviceSize GpuMemoryAllocator::preferredBlockSize(uint32_t memoryType) const {
+        uint32_t     heapIndex = memoryProperties.memoryTypes[memoryType].heapIndex;
+        VkDeviceSize heapSize = memoryProperties.memoryHeaps[heapIndex].size;
+
+        // Small heaps (e.g. 256 MiB BAR memory) get proportionally smaller
+        // blocks so one block does not swallow the heap.
+        return heapSize <= kLargeHeapThreshold ? heapSize / 8 : kDefaultBlockSize;
+    }
+
+    GpuAllocation GpuMemoryAllocator::allocate(const VkMemoryRequirements &requirements,
+                                               const GpuAllocationCreateInfo &info,
+                                               GpuResourceKind kind) {
+        VkMemoryPropertyFlags required = info.requiredFlags;
+        if (info.mapped) {
+            required |= VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        }
+
+        // Candidate types ordered by how many preferred flags they carry
+        std::vector<uint32_t> candidates;
+        for (uint32_t i = 0; i < memoryProperties.memoryTypeCount; i++) {
+            VkMemoryPropertyFlags flags = memoryProperties.memoryTypes[i].propertyFlags;
+            if ((requirements.memoryTypeBits & (1u << i)) && (flags & required) == required) {
+                candidates.push_back(i);
+            }
+        }
+
+        auto preferredBits = [&](uint32_t type) {
+            VkMemoryPropertyFlags hits =
+                memoryProperties.memoryTypes[type].propertyFlags & info.preferredFlags;
+            uint32_t count = 0;
+            for (; hits; hits &= hits - 1) {
+                count++;
+            }
+            return count;
+        };
+        std::stable_sort(candidates.begin(), candidates.end(),
+                         [&](uint32_t a, uint32_t b) { return preferredBits(a) > preferredBits(b); });
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        GpuAllocation allocation;
+        for (uint32_t type : candidates) {
+            if (tryAllocate(type, requirements, info, kind, allocation)) {
+                return allocation;
+            }
+        }
+
+        throw std::runtime_error("Failed to allocate " + std::to_string(requirements.size) +
+                                 " bytes of device memory");
+    }
+
+    bool GpuMemoryAllocator::tryAllocate(uint32_t memoryType,
+                                         const VkMemoryRequirements &requirements,
+                                         const GpuAllocationCreateInfo &info,
+                                         GpuResourceKind kind, GpuAllocation &allocation) {
+        VkDeviceSize blockSize = preferredBlockSize(memoryType);
+
+        if (info.dedicated || requirements.size > blockSize / 2) {
+            return allocateDedicated(memoryType, requirements.size, info, allocation);
+        }
+
+        Pool &pool = pools[memoryType * 2 + static_cast<uint32_t>(kind)];
+
+        auto fill = [&](Block &block, uint64_t offset, uint32_t handle) {
+            allocation.memory = block.memory;
+            allocation.offset = offset;
+            allocation.size = requirements.size;
+            allocation.mapped = block.mapped ? static_cast<char *>(block.mapped) + offset : nullptr;
+            allocation.memoryType = memoryType;
+            allocation.block = &block;
+            allocation.handle = handle;
+        };
+
+        uint64_t offset;
+        uint32_t handle;
+        for (auto &block : pool.blocks) {
+            if (block->metadata.allocate(requirements.size, requirements.alignment,
+                                         offset, handle)) {
+                fill(*block, offset, handle);
+                return true;
+            }
+        }
+
+        // Host-visible blocks are mapped once for their whole lifetime
+        bool  hostVisible = memoryProperties.memoryTypes[memoryType].propertyFlags &
+                           VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT;
+        void *mapped = nullptr;
+
+        VkDeviceMemory memory =
+            allocateDeviceMemory(memoryType, blockSize, hostVisible ? &mapped : nullptr);
+        if (memory == VK_NULL_HANDLE)
+            return false;
+
+        auto block = std::make_unique<Block>(blockSize);
+        block->memory = memory;
+        block->mapped = mapped;
+        block->metadata.allocate(requirements.size, requirements.alignment, offset, handle);
+        fill(*block, offset, handle);
+        pool.blocks.push_back(std::move(block));
+        return true;
+    }
+
+    bool GpuMemoryAllocator::allocateDedicated(uint32_t memoryType, VkDeviceSize size,
+                                               const GpuAllocationCreateInfo &info,
+                                               GpuAllocation &allocation) {
+        void          *mapped = nullptr;
+        VkDeviceMemory memory =
+            allocateDeviceMemory(memoryType, size, info.mapped ? &mapped : nullptr);
+        if (memory == VK_NULL_HANDLE)
+            return false;
+
+        allocation.memory = memory;
+        allocation.offset = 0;
+        allocation.size = size;
+        allocation.mapped = mapped;
+        allocation.memoryType = memoryType;
+        allocation.block = nullptr;
+        allocation.handle = TlsfBlockMetadata::kInvalidHandle;
+
+        dedicatedCount[memoryType]++;
+        dedicatedBytes[memoryType] += size;
+        return true;
+    }
+
+    VkDeviceMemory GpuMemoryAllocator::allocateDeviceMemory(uint32_t memoryType,
+                                                            VkDeviceSize size,
+                                                            void       **mapped) {
+        if (deviceMemoryObjects >= maxAllocationCount) {
+            throw std::runtime_error("maxMemoryAllocationCount exceeded");
+        }
+
+        VkMemoryAllocateInfo allocInfo{};
+        allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+        allocInfo.allocationSize = size;
+        allocInfo.memoryTypeIndex = memoryType;
+
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkResult       result = vkAllocateMemory(device, &allocInfo, nullptr, &memory);
+        if (result == VK_ERROR_OUT_OF_DEVICE_MEMORY || result == VK_ERROR_OUT_OF_HOST_MEMORY) {
+            // Let the caller fall back to the next memory type
+            return VK_NULL_HANDLE;
+        }
+        VK_CHECK_RESULT(result);
+
+        if (mapped) {
+            VK_CHECK_RESULT(vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, mapped));
+        }
+
+        deviceMemoryObjects++;
+        return memory;
+    }
+
+    void GpuMemoryAllocator::freeDeviceMemory(VkDeviceMemory memory, bool mapped) {
+        if (mapped) {
+            vkUnmapMemory(device, memory);
+        }
+        vkFreeMemory(device, memory, nullptr);
+        deviceMemoryObjects--;
+    }
+
+    void GpuMemoryAllocator::free(GpuAllocation &allocation) {
+        if (allocation.memory == VK_NULL_HANDLE)
+            return;
+
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (allocation.block == nullptr) {
+            freeDeviceMemory(allocation.memory, allocation.mapped != nullptr);
+            dedicatedCount[allocation.memoryType]--;
+            dedicatedBytes[allocation.memoryType] -= allocation.size;
+        } else {
+            // Blocks are kept once created; an empty block is cheap to reuse
+            // and avoids vkAllocateMemory churn on level transitions.
+            static_cast<Block *>(allocation.block)->metadata.free(allocation.handle);
+        }
+
+        allocation = GpuAllocation{};
+    }
+
+    void GpuMemoryAllocator::createBuffer(const VkBufferCreateInfo &bufferInfo,
+                                          const GpuAllocationCreateInfo &info,
+                                          VkBuffer &buffer, GpuAllocation &allocation) {
+        VK_CHECK_RESULT(vkCreateBuffer(device, &bufferInfo, nullptr, &buffer));
+
+        VkMemoryRequirements requirements;
+        vkGetBufferMemoryRequirements(device, buffer, &requirements);
+
+        try {
+            allocation = allocate(requirements, info, GpuResourceKind::Linear);
+        } catch (...) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+            throw;
+        }
+        VK_CHECK_RESULT(
+            vkBindBufferMemory(device, buffer, allocation.memory, allocation.offset));
+    }
+
+    void GpuMemoryAllocator::createImage(const VkImageCreateInfo &imageInfo,
+                                         const GpuAllocationCreateInfo &info,
+                                         VkImage &image, GpuAllocation &allocation) {
+        VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &image));
+
+        VkMemoryRequirements requirements;
+        vkGetImageMemoryRequirements(device, image, &requirements);
+
+        GpuResourceKind kind = imageInfo.tiling == VK_IMAGE_TILING_OPTIMAL
+                                   ? GpuResourceKind::Optimal
+                                   : GpuResourceKind::Linear;
+        try {
+            allocation = allocate(requirements, info, kind);
+        } catch (...) {
+            vkDestroyImage(device, image, nullptr);
+            image = VK_NULL_HANDLE;
+            throw;
+        }
+        VK_CHECK_RESULT(
+            vkBindImageMemory(device, image, allocation.memory, allocation.offset));
+    }
+
+    void GpuMemoryAllocator::destroyBuffer(VkBuffer &buffer, GpuAllocation &allocation) {
+        if (buffer != VK_NULL_HANDLE) {
+            vkDestroyBuffer(device, buffer, nullptr);
+            buffer = VK_NULL_HANDLE;
+        }
+        free(allocation);
+    }
+
+    void GpuMemoryAllocator::destroyImage(VkImage &image, GpuAllocation &allocation) {
+        if (image != VK_NULL_HANDLE) {
+            vkDestroyImage(device, image, nullptr);
+            image = VK_NULL_HANDLE;
+        }
+        free(allocation);
+    }
+
+    GpuMemoryStats GpuMemoryAllocator::getStats() {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        GpuMemoryStats stats;
+        stats.memoryTypes.resize(memoryProperties.memoryTypeCount);
+        stats.deviceMemoryObjects = deviceMemoryObjects;
+        stats.maxDeviceMemoryObjects = maxAllocationCount;
+
+        for (uint32_t type = 0; type < memoryProperties.memoryTypeCount; type++) {
+            GpuMemoryStats::MemoryType &entry = stats.memoryTypes[type];
+            entry.dedicatedCount = dedicatedCount[type];
+            entry.dedicatedBytes = dedicatedBytes[type];
+            entry.allocationCount = dedicatedCount[type];
+
+            for (uint32_t kind = 0; kind < 2; kind++) {
+                for (const auto &block : pools[type * 2 + kind].blocks) {
+                    const TlsfBlockMetadata &metadata = block->metadata;
+                    entry.blockCount++;
+                    entry.blockBytes += metadata.size();
+                    entry.usedBytes += metadata.usedBytes();
+                    entry.allocationCount += metadata.allocationCount();
+                    entry.freeRangeCount += metadata.freeRangeCount();
+                    entry.largestFreeRange =
+                        std::max<VkDeviceSize>(entry.largestFreeRange, metadata.largestFreeRange());
+                }
+            }
+
+            stats.total.blockCount += entry.blockCount;
+            stats.total.dedicatedCount += entry.dedicatedCount;
+            stats.total.allocationCount += entry.allocationCount;
+            stats.total.blockBytes += entry.blockBytes;
+            stats.total.usedBytes += entry.usedBytes;
+            stats.total.dedicatedBytes += entry.dedicatedBytes;
+            stats.total.freeRangeCount += entry.freeRangeCount;
+            stats.total.largestFreeRange =
+                std::max(stats.total.largestFreeRange, entry.largestFreeRange);
+        }
+
+        return stats;
+    }
+
+    // ---- FrameArena ------------------------------------------------------
+
+    FrameArena::FrameArena(GpuMemoryAllocator &allocator, uint32_t frameCount,
+                           VkDeviceSize initialCapacity, VkBufferUsageFlags usage)
+        : allocator(allocator), usage(usage), frames(frameCount) {
+        for (auto &chunks : frames) {
+            chunks.push_back(createChunk(initialCapacity));
+        }
+    }
+
+    FrameArena::~FrameArena() {
+        for (auto &chunks : frames) {
+            for (auto &chunk : chunks) {
+                destroyChunk(chunk);
+            }
+        }
+    }
+
+    FrameArena::Chunk FrameArena::createChunk(VkDeviceSize capacity) {
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = capacity;
+        bufferInfo.usage = usage;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        GpuAllocationCreateInfo allocInfo{};
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        // Prefer write-combined BAR memory so the GPU reads it directly
+        allocInfo.preferredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        allocInfo.mapped = true;
+
+        Chunk chunk;
+        chunk.capacity = capacity;
+        allocator.createBuffer(bufferInfo, allocInfo, chunk.buffer, chunk.allocation);
+        return chunk;
+    }
+
+    void FrameArena::destroyChunk(Chunk &chunk) {
+        allocator.destroyBuffer(chunk.buffer, chunk.allocation);
+    }
+
+    void FrameArena::reset(uint32_t frameIndex) {
+        currentFrame = frameIndex;
+        auto &chunks = frames[frameIndex];
+
+        if (chunks.size() > 1) {
+            VkDeviceSize total = 0;
+            for (auto &chunk : chunks) {
+                total += chunk.capacity;
+                destroyChunk(chunk);
+            }
+            chunks.clear();
+            chunks.push_back(createChunk(total));
+        }
+
+        chunks.front().head = 0;
+    }
+
+    FrameArena::Slice FrameArena::allocate(VkDeviceSize size, VkDeviceSize alignment) {
+        auto  &chunks = frames[currentFrame];
+        Chunk *chunk = &chunks.back();
+
+        VkDeviceSize offset = alignUp(chunk->head, std::max<VkDeviceSize>(alignment, 1));
+        if (offset + size > chunk->capacity) {
+            chunks.push_back(createChunk(std::max(chunk->capacity * 2, size)));
+            chunk = &chunks.back();
+            offset = 0;
+        }
+
+        chunk->head = offset + size;
+
+        Slice slice;
+        slice.buffer = chunk->buffer;
+        slice.offset = offset;
+        slice.data = static_cast<char *>(chunk->allocation.mapped) + offset;
+        return slice;
+    }
+
+    VkDeviceSize FrameArena::bytesUsed() const {
+        VkDeviceSize total = 0;
+        for (const auto &chunk : frames[currentFrame]) {
+            total += chunk.head;
+        }
+        return total;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,229 @@
+#ifndef GPU_MEMORY_ALLOCATOR_H
+#define GPU_MEMORY_ALLOCATOR_H
+
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // Two-level segregated fit bookkeeping for one memory block. Works purely
+    // on offsets so it knows nothing about Vulkan; allocation and free are
+    // O(1) and neighbouring free ranges are merged immediately.
+    class TlsfBlockMetadata {
+      public:
+        static constexpr uint32_t kInvalidHandle = UINT32_MAX;
+
+        explicit TlsfBlockMetadata(uint64_t size);
+
+        // Returns false if no free range can hold `size` bytes at `alignment`
+        // (a power of two).
+        bool allocate(uint64_t size, uint64_t alignment, uint64_t &offset,
+                      uint32_t &handle);
+        void free(uint32_t handle);
+
+        uint64_t size() const { return blockSize; }
+        uint64_t usedBytes() const { return used; }
+        uint32_t allocationCount() const { return allocations; }
+        uint32_t freeRangeCount() const { return freeRanges; }
+        uint64_t largestFreeRange() const;
+        bool     empty() const { return allocations == 0; }
+
+      private:
+        static constexpr uint32_t kSecondLevelBits = 5;
+        static constexpr uint32_t kSecondLevelCount = 1u << kSecondLevelBits;
+        static constexpr uint32_t kFirstLevelCount = 64;
+
+        struct Region {
+            uint64_t offset;
+            uint64_t size;
+            uint32_t prevPhysical;
+            uint32_t nextPhysical;
+            uint32_t prevFree;
+            uint32_t nextFree;
+            bool     isFree;
+        };
+
+        static void mapping(uint64_t size, uint32_t &fl, uint32_t &sl);
+        uint32_t    findFree(uint64_t size) const;
+        void        insertFree(uint32_t index);
+        void        removeFree(uint32_t index);
+        uint32_t    newRegion();
+        void        releaseRegion(uint32_t index);
+
+        uint64_t              blockSize;
+        uint64_t              used = 0;
+        uint32_t              allocations = 0;
+        uint32_t              freeRanges = 0;
+        std::vector<Region>   regions;
+        std::vector<uint32_t> spareRegions;
+        uint64_t              firstLevelMap = 0;
+        uint32_t              secondLevelMap[kFirstLevelCount] = {};
+        uint32_t              freeHeads[kFirstLevelCount][kSecondLevelCount];
+    };
+
+    enum class GpuResourceKind {
+        // Buffers and linear images
+        Linear,
+        // Optimal-tiling images. Kept in separate blocks so that
+        // bufferImageGranularity never has to be honoured between neighbours.
+        Optimal
+    };
+
+    struct GpuAllocationCreateInfo {
+        VkMemoryPropertyFlags requiredFlags = 0;
+        VkMemoryPropertyFlags preferredFlags = 0;
+        // Persistently map the allocation; requires HOST_VISIBLE.
+        bool mapped = false;
+        // Give the resource its own VkDeviceMemory, e.g. large render targets.
+        bool dedicated = false;
+    };
+
+    struct GpuAllocation {
+        VkDeviceMemory memory = VK_NULL_HANDLE;
+        VkDeviceSize   offset = 0;
+        VkDeviceSize   size = 0;
+        void          *mapped = nullptr;
+        uint32_t       memoryType = UINT32_MAX;
+
+        // Internal: owning block (nullptr for dedicated) and its region handle
+        void    *block = nullptr;
+        uint32_t handle = TlsfBlockMetadata::kInvalidHandle;
+    };
+
+    struct GpuMemoryStats {
+        struct MemoryType {
+            uint32_t     blockCount = 0;
+            uint32_t     dedicatedCount = 0;
+            uint32_t     allocationCount = 0;
+            VkDeviceSize blockBytes = 0;
+            VkDeviceSize usedBytes = 0;
+            VkDeviceSize dedicatedBytes = 0;
+            VkDeviceSize largestFreeRange = 0;
+            uint32_t     freeRangeCount = 0;
+        };
+
+        std::vector<MemoryType> memoryTypes;
+        MemoryType              total;
+        uint32_t                deviceMemoryObjects = 0;
+        uint32_t                maxDeviceMemoryObjects = 0;
+
+        // 0 when all free space inside blocks is one contiguous range, towards
+        // 1 as it splinters into many small ranges.
+        float fragmentation() const;
+    };
+
+    // Hands out sub-ranges of large VkDeviceMemory blocks, one list of blocks
+    // per memory type and resource kind, so the number of vkAllocateMemory
+    // calls stays far below maxMemoryAllocationCount. Thread-safe.
+    class GpuMemoryAllocator {
+      public:
+        GpuMemoryAllocator(VkPhysicalDevice physicalDevice, VkDevice device);
+        ~GpuMemoryAllocator();
+
+        GpuMemoryAllocator(const GpuMemoryAllocator &) = delete;
+        GpuMemoryAllocator &operator=(const GpuMemoryAllocator &) = delete;
+
+        GpuAllocation allocate(const VkMemoryRequirements &requirements,
+                               const GpuAllocationCreateInfo &info,
+                               GpuResourceKind kind);
+        void          free(GpuAllocation &allocation);
+
+        // Create a resource, allocate and bind its memory in one go
+        void createBuffer(const VkBufferCreateInfo &bufferInfo,
+                          const GpuAllocationCreateInfo &info, VkBuffer &buffer,
+                          GpuAllocation &allocation);
+        void createImage(const VkImageCreateInfo &imageInfo,
+                         const GpuAllocationCreateInfo &info, VkImage &image,
+                         GpuAllocation &allocation);
+        void destroyBuffer(VkBuffer &buffer, GpuAllocation &allocation);
+        void destroyImage(VkImage &image, GpuAllocation &allocation);
+
+        GpuMemoryStats getStats();
+
+        const VkPhysicalDeviceMemoryProperties &getMemoryProperties() const {
+            return memoryProperties;
+        }
+
+      private:
+        struct Block {
+            VkDeviceMemory    memory = VK_NULL_HANDLE;
+            void             *mapped = nullptr;
+            TlsfBlockMetadata metadata;
+
+            explicit Block(VkDeviceSize size) : metadata(size) {}
+        };
+
+        struct Pool {
+            std::vector<std::unique_ptr<Block>> blocks;
+        };
+
+        VkDeviceSize   preferredBlockSize(uint32_t memoryType) const;
+        bool           tryAllocate(uint32_t memoryType, const VkMemoryRequirements &requirements,
+                                   const GpuAllocationCreateInfo &info, GpuResourceKind kind,
+                                   GpuAllocation &allocation);
+        bool           allocateDedicated(uint32_t memoryType, VkDeviceSize size,
+                                         const GpuAllocationCreateInfo &info,
+                                         GpuAllocation &allocation);
+        VkDeviceMemory allocateDeviceMemory(uint32_t memoryType, VkDeviceSize size,
+                                            void **mapped);
+        void           freeDeviceMemory(VkDeviceMemory memory, bool mapped);
+
+        VkPhysicalDevice                 physicalDevice;
+        VkDevice                         device;
+        VkPhysicalDeviceMemoryProperties memoryProperties;
+        uint32_t                         maxAllocationCount;
+        uint32_t                         deviceMemoryObjects = 0;
+        std::vector<Pool>                pools; // [memoryType * 2 + kind]
+        std::vector<uint32_t>            dedicatedCount;
+        std::vector<VkDeviceSize>        dedicatedBytes;
+        std::mutex                       mutex;
+    };
+
+    // Linear allocator for transient per-frame data (instances, uniforms,
+    // dynamic vertices). One host-visible buffer per frame in flight; a frame
+    // bumps a pointer through its buffer and reset() rewinds it once the
+    // frame's fence has signalled. Overflow chains an extra chunk and the
+    // next reset() replaces the chain with one buffer of the combined size.
+    class FrameArena {
+      public:
+        struct Slice {
+            VkBuffer     buffer = VK_NULL_HANDLE;
+            VkDeviceSize offset = 0;
+            void        *data = nullptr;
+        };
+
+        FrameArena(GpuMemoryAllocator &allocator, uint32_t frameCount,
+                   VkDeviceSize initialCapacity, VkBufferUsageFlags usage);
+        ~FrameArena();
+
+        FrameArena(const FrameArena &) = delete;
+        FrameArena &operator=(const FrameArena &) = delete;
+
+        void  reset(uint32_t frameIndex);
+        Slice allocate(VkDeviceSize size, VkDeviceSize alignment);
+
+        VkDeviceSize bytesUsed() const;
+
+      private:
+        struct Chunk {
+            VkBuffer      buffer = VK_NULL_HANDLE;
+            GpuAllocation allocation;
+            VkDeviceSize  capacity = 0;
+            VkDeviceSize  head = 0;
+        };
+
+        Chunk createChunk(VkDeviceSize capacity);
+        void  destroyChunk(Chunk &chunk);
+
+        GpuMemoryAllocator              &allocator;
+        VkBufferUsageFlags               usage;
+        std::vector<std::vector<Chunk>> frames;
+        uint32_t                         currentFrame = 0;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // GPU_MEMORY_ALLOCATOR_H
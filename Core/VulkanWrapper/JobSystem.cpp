@@ -0,0 +1,338 @@
+#include "JobSystem.h"
+#include <algorithm>
+#include <iostream>
+
+namespace Retoccilus::Core {
+
+    struct JobCounter::Job {
+        JobSystem::Job function;
+        JobCounter    *counter;
+    };
+
+    namespace {
+        // Which system's worker the current thread is, if any
+        thread_local const JobSystem *currentSystem = nullptr;
+        thread_local uint32_t         currentThread = 0;
+    } // namespace
+
+    JobSystem::WorkDeque::WorkDeque()
+        : slots(std::make_unique<std::atomic<QueuedJob *>[]>(kCapacity)) {}
+
+    bool JobSystem::WorkDeque::push(QueuedJob *job) {
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        if (b - t >= kCapacity)
+            return false;
+
+        slots[b & (kCapacity - 1)].store(job, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return true;
+    }
+
+    JobSystem::QueuedJob *JobSystem::WorkDeque::pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+
+        if (t > b) {
+            // Empty
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        QueuedJob *job = slots[b & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) {
+            // The last job; a thief may be after it too
+            if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                job = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return job;
+    }
+
+    JobSystem::QueuedJob *JobSystem::WorkDeque::steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b)
+            return nullptr;
+
+        QueuedJob *job = slots[t & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return nullptr; // lost to the owner or another thief
+        return job;
+    }
+
+    JobSystem::JobSystem(uint32_t workerCount) {
+        if (workerCount == 0)
+            workerCount = std::max(std::thread::hardware_concurrency(), 2u) - 1;
+
+        deques.resize(workerCount + 1);
+        for (uint32_t i = 1; i <= workerCount; i++)
+            deques[i] = std::make_unique<WorkDeque>();
+
+        workers.reserve(workerCount);
+        for (uint32_t i = 1; i <= workerCount; i++)
+            workers.emplace_back([this, i]() { workerLoop(i); });
+    }
+
+    JobSystem::~JobSystem() {
+        {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            stopping = true;
+        }
+        wake.notify_all();
+        for (std::thread &worker : workers)
+            worker.join();
+
+        // Whatever outside threads queued after the workers left
+        for (;;) {
+            QueuedJob *job = findJob(0);
+            if (!job)
+                job = findBackgroundJob();
+            if (!job)
+                break;
+            execute(job);
+        }
+    }
+
+    uint32_t JobSystem::getThreadIndex() const {
+        return currentSystem == this ? currentThread : 0;
+    }
+
+    void JobSystem::run(Job job, JobCounter *counter) {
+        if (counter)
+            counter->pending.fetch_add(1);
+        submit(new QueuedJob{std::move(job), counter});
+    }
+
+    void JobSystem::runAfter(JobCounter &dependency, Job job, JobCounter *counter) {
+        if (counter)
+            counter->pending.fetch_add(1);
+        auto *queuedJob = new QueuedJob{std::move(job), counter};
+
+        {
+            std::lock_guard<std::mutex> lock(dependency.mutex);
+            if (dependency.pending.load() != 0) {
+                dependency.continuations.push_back(queuedJob);
+                return;
+            }
+        }
+        submit(queuedJob);
+    }
+
+    void JobSystem::runBackground(Job job, JobCounter *counter) {
+        if (counter)
+            counter->pending.fetch_add(1);
+        auto *queuedJob = new QueuedJob{std::move(job), counter};
+
+        backgroundQueued.fetch_add(1);
+        {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            background.push_back(queuedJob);
+        }
+
+        // All of them: a thread sleeping in wait() would swallow a single
+        // notification without taking the job
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_all();
+        }
+    }
+
+    void JobSystem::submit(QueuedJob *job) {
+        // Counted first, so a thief never takes it before it is counted
+        queued.fetch_add(1);
+
+        uint32_t thread = getThreadIndex();
+        if (thread == 0 || !deques[thread]->push(job)) {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            shared.push_back(job);
+        }
+
+        if (sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_one();
+        }
+    }
+
+    JobSystem::QueuedJob *JobSystem::findJob(uint32_t thread) {
+        if (queued.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        QueuedJob *job = nullptr;
+        if (thread > 0)
+            job = deques[thread]->pop();
+
+        if (!job) {
+            std::lock_guard<std::mutex> lock(sharedMutex);
+            if (!shared.empty()) {
+                job = shared.front();
+                shared.pop_front();
+            }
+        }
+
+        // Steal from the next worker on, so thieves spread out
+        size_t count = deques.size();
+        for (size_t i = 1; !job && i < count; i++) {
+            size_t victim = (thread + i) % count;
+            if (victim != 0)
+                job = deques[victim]->steal();
+        }
+
+        if (job)
+            queued.fetch_sub(1);
+        return job;
+    }
+
+    JobSystem::QueuedJob *JobSystem::findBackgroundJob() {
+        if (backgroundQueued.load(std::memory_order_relaxed) == 0)
+            return nullptr;
+
+        std::lock_guard<std::mutex> lock(sharedMutex);
+        if (background.empty())
+            return nullptr;
+
+        QueuedJob *job = background.front();
+        background.pop_front();
+        backgroundQueued.fetch_sub(1);
+        return job;
+    }
+
+    void JobSystem::execute(QueuedJob *job) {
+        std::exception_ptr failure;
+        try {
+            job->function();
+        } catch (...) {
+            failure = std::current_exception();
+        }
+
+        // Captures go before the counter says the job is done
+        JobCounter *counter = job->counter;
+        delete job;
+
+        if (counter) {
+            finish(*counter, failure);
+        } else if (failure) {
+            try {
+                std::rethrow_exception(failure);
+            } catch (const std::exception &e) {
+                std::cerr << "Job failed: " << e.what() << std::endl;
+            } catch (...) {
+                std::cerr << "Job failed" << std::endl;
+            }
+        }
+    }
+
+    void JobSystem::finish(JobCounter &counter, std::exception_ptr failure) {
+        std::vector<QueuedJob *> ready;
+        bool                     done;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (failure && !counter.failure)
+                counter.failure = failure;
+            done = counter.pending.fetch_sub(1) == 1;
+            if (done)
+                ready.swap(counter.continuations);
+        }
+
+        // `counter` may be gone from here on
+        for (QueuedJob *job : ready)
+            submit(job);
+        if (done && sleepers.load() > 0) {
+            std::lock_guard<std::mutex> lock(sleepMutex);
+            wake.notify_all();
+        }
+    }
+
+    void JobSystem::wait(JobCounter &counter) {
+        uint32_t thread = getThreadIndex();
+        while (!counter.isDone()) {
+            if (QueuedJob *job = findJob(thread)) {
+                execute(job);
+                continue;
+            }
+
+            // Whatever is left runs elsewhere; sleep until it finishes or
+            // more is queued
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            sleepers.fetch_add(1);
+            wake.wait(lock, [&]() { return counter.pending.load() == 0 || queued.load() > 0; });
+            sleepers.fetch_sub(1);
+        }
+
+        // The finishing job may still hold the lock
+        std::exception_ptr failure;
+        {
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            failure = counter.failure;
+            counter.failure = nullptr;
+        }
+        if (failure)
+            std::rethrow_exception(failure);
+    }
+
+    void JobSystem::parallelFor(uint32_t count, uint32_t batchSize, const RangeJob &job) {
+        batchSize = std::max(batchSize, 1u);
+        if (count <= batchSize) {
+            if (count > 0)
+                job(0, count);
+            return;
+        }
+
+        JobCounter counter;
+        try {
+            split(0, count, batchSize, job, counter);
+        } catch (...) {
+            // The halves already forked still reference `job`
+            std::lock_guard<std::mutex> lock(counter.mutex);
+            if (!counter.failure)
+                counter.failure = std::current_exception();
+        }
+        wait(counter);
+    }
+
+    void JobSystem::split(uint32_t begin, uint32_t end, uint32_t batchSize, const RangeJob &job,
+                          JobCounter &counter) {
+        // Fork the upper half and keep going with the lower; slices stay
+        // aligned to batchSize
+        while (end - begin > batchSize) {
+            uint32_t batches = (end - begin + batchSize - 1) / batchSize;
+            uint32_t middle = begin + batches / 2 * batchSize;
+            run([this, middle, end, batchSize, &job, &counter]() {
+                split(middle, end, batchSize, job, counter);
+            }, &counter);
+            end = middle;
+        }
+        job(begin, end);
+    }
+
+    void JobSystem::workerLoop(uint32_t thread) {
+        currentSystem = this;
+        currentThread = thread;
+
+        for (;;) {
+            QueuedJob *job = findJob(thread);
+            if (!job)
+                job = findBackgroundJob();
+            if (job) {
+                execute(job);
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(sleepMutex);
+            if (stopping && queued.load() == 0 && backgroundQueued.load() == 0)
+                return;
+            sleepers.fetch_add(1);
+            wake.wait(lock, [this]() {
+                return stopping || queued.load() > 0 || backgroundQueued.load() > 0;
+            });
+            sleepers.fetch_sub(1);
+        }
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,157 @@
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace Retoccilus::Core {
+
+    class JobSystem;
+
+    // Counts the unfinished jobs submitted against it. JobSystem::wait()
+    // returns once it drops to zero; jobs queued with runAfter() start
+    // then. The first exception thrown by one of its jobs is kept for
+    // wait() to rethrow.
+    //
+    // A counter must outlive its jobs, so one on the stack has to be
+    // waited on before it goes out of scope. It can be reused once it has
+    // been waited on.
+    class JobCounter {
+      public:
+        JobCounter() = default;
+        ~JobCounter() = default;
+
+        JobCounter(const JobCounter &) = delete;
+        JobCounter &operator=(const JobCounter &) = delete;
+
+        bool isDone() const { return pending.load(std::memory_order_acquire) == 0; }
+
+      private:
+        friend class JobSystem;
+        struct Job;
+
+        std::atomic<uint32_t> pending{0};
+
+        // Taken by the job that brings `pending` to zero, so that once
+        // wait() has taken it too no job touches the counter any more
+        std::mutex         mutex;
+        std::exception_ptr failure;
+        std::vector<Job *> continuations; // queued by runAfter()
+    };
+
+    // A fixed pool of worker threads shared by the whole engine, so that
+    // subsystems fan work out over every core without starting threads of
+    // their own.
+    //
+    // Every worker owns a Chase-Lev deque: it pushes and pops its own jobs
+    // at the bottom without locking, and idle workers steal from the top
+    // of the others'. Jobs submitted from other threads go through a
+    // shared queue instead. Submitting from a job therefore keeps the work
+    // on that worker until somebody is idle enough to take it, which is
+    // what makes recursive fork/join (parallelFor()) cheap.
+    //
+    // wait() runs queued jobs while it waits, on workers and other threads
+    // alike, so jobs may wait on jobs of their own without deadlocking the
+    // pool. Idle workers sleep on a condition variable.
+    class JobSystem {
+      public:
+        using Job = std::function<void()>;
+        // Runs [begin, end) of a parallelFor() range
+        using RangeJob = std::function<void(uint32_t begin, uint32_t end)>;
+
+        // Zero workers picks one less than the hardware threads, leaving
+        // one for the thread that submits and waits
+        explicit JobSystem(uint32_t workerCount = 0);
+        // Runs whatever is still queued before the workers exit
+        ~JobSystem();
+
+        JobSystem(const JobSystem &) = delete;
+        JobSystem &operator=(const JobSystem &) = delete;
+
+        // Threads that run jobs, a waiting outside thread included
+        uint32_t getThreadCount() const { return static_cast<uint32_t>(workers.size()) + 1; }
+        // 1..workers on a worker of this system, 0 on any other thread. Two
+        // outside threads running jobs at once share index 0.
+        uint32_t getThreadIndex() const;
+
+        // Queues `job`. Exceptions reach wait() on `counter`; without one
+        // they are logged and dropped.
+        void run(Job job, JobCounter *counter = nullptr);
+        // Queues `job` once `dependency` has dropped to zero, straight away
+        // if it already has. `counter` counts it from now on.
+        void runAfter(JobCounter &dependency, Job job, JobCounter *counter = nullptr);
+        // For long jobs nobody is waiting on right away, such as pipeline
+        // compiles and asset decodes. Only idle workers take them, after
+        // all other jobs, and wait() never runs them, so they cannot hold
+        // up a render thread that is waiting on its own jobs.
+        void runBackground(Job job, JobCounter *counter = nullptr);
+
+        // Runs queued jobs until `counter` drops to zero, then rethrows the
+        // first exception of its jobs
+        void wait(JobCounter &counter);
+
+        // Calls `job` on consecutive slices of [0, count) no longer than
+        // `batchSize`, across the pool and the caller, and returns once all
+        // have run. The range is split in halves recursively, so idle
+        // workers steal large pieces first.
+        void parallelFor(uint32_t count, uint32_t batchSize, const RangeJob &job);
+
+      private:
+        using QueuedJob = JobCounter::Job;
+
+        // Fixed-size Chase-Lev work-stealing deque (Lê et al., "Correct and
+        // Efficient Work-Stealing for Weak Memory Models"). Only the owning
+        // worker pushes and pops; anybody may steal.
+        class WorkDeque {
+          public:
+            static constexpr int64_t kCapacity = 4096; // power of two
+
+            WorkDeque();
+
+            // False when full
+            bool       push(QueuedJob *job);
+            QueuedJob *pop();
+            QueuedJob *steal();
+
+          private:
+            alignas(64) std::atomic<int64_t> top{0};
+            alignas(64) std::atomic<int64_t> bottom{0};
+            std::unique_ptr<std::atomic<QueuedJob *>[]> slots;
+        };
+
+        void       submit(QueuedJob *job);
+        QueuedJob *findJob(uint32_t thread);
+        QueuedJob *findBackgroundJob();
+        void       execute(QueuedJob *job);
+        void       finish(JobCounter &counter, std::exception_ptr failure);
+        void       split(uint32_t begin, uint32_t end, uint32_t batchSize, const RangeJob &job,
+                         JobCounter &counter);
+        void       workerLoop(uint32_t thread);
+
+        std::vector<std::unique_ptr<WorkDeque>> deques; // [0] is unused
+        std::vector<std::thread>                workers;
+
+        std::mutex              sharedMutex;
+        std::deque<QueuedJob *> shared;     // from outside threads and full deques
+        std::deque<QueuedJob *> background; // runBackground()
+
+        // Jobs queued and not yet taken, for idle threads to sleep on
+        std::atomic<uint32_t>   queued{0};
+        std::atomic<uint32_t>   backgroundQueued{0};
+        std::atomic<uint32_t>   sleepers{0};
+        std::mutex              sleepMutex;
+        std::condition_variable wake;
+        bool                    stopping = false;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // JOB_SYSTEM_H
@@ -0,0 +1,154 @@
+#include "ParallelRecorder.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+
+namespace Retoccilus::Core {
+
+    ParallelRecorder::ParallelRecorder(VkDevice device, uint32_t queueFamily,
+                                       uint32_t framesInFlight, JobSystem &jobs,
+                                       uint32_t maxThreads)
+        : device(device), queueFamily(queueFamily), framesInFlight(framesInFlight),
+          jobs(jobs), threadCount(1), threads(jobs.getThreadCount() - 1) {
+        setThreadCount(maxThreads);
+        for (ThreadState &state : threads) {
+            createPools(state);
+        }
+
+        inheritance.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+    }
+
+    ParallelRecorder::~ParallelRecorder() {
+        // Destroying a pool frees its command buffers
+        auto destroy = [this](ThreadState &state) {
+            for (VkCommandPool pool : state.pools) {
+                vkDestroyCommandPool(device, pool, nullptr);
+            }
+        };
+        for (ThreadState &state : threads) {
+            destroy(state);
+        }
+        for (auto &[id, state] : outsideThreads) {
+            destroy(state);
+        }
+    }
+
+    void ParallelRecorder::setThreadCount(uint32_t count) {
+        threadCount = std::max(std::min(count, jobs.getThreadCount()), 1u);
+    }
+
+    void ParallelRecorder::createPools(ThreadState &state) {
+        state.pools.resize(framesInFlight);
+        state.buffers.resize(framesInFlight);
+        state.used.assign(framesInFlight, 0);
+
+        for (VkCommandPool &pool : state.pools) {
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = queueFamily;
+
+            VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &pool));
+        }
+    }
+
+    void ParallelRecorder::beginFrame(uint32_t frameSlot) {
+        slot = frameSlot;
+        auto reset = [this](ThreadState &state) {
+            VK_CHECK_RESULT(vkResetCommandPool(device, state.pools[slot], 0));
+            state.used[slot] = 0;
+        };
+        for (ThreadState &state : threads) {
+            reset(state);
+        }
+        for (auto &[id, state] : outsideThreads) {
+            reset(state);
+        }
+    }
+
+    ParallelRecorder::ThreadState &ParallelRecorder::currentThreadState() {
+        uint32_t index = jobs.getThreadIndex();
+        if (index != 0)
+            return threads[index - 1];
+
+        // The caller of record(), or another outside thread that picked up
+        // one of its tasks while waiting on jobs of its own. Map nodes stay
+        // put, so the reference outlives the lock.
+        std::lock_guard<std::mutex> lock(outsideMutex);
+        auto [it, inserted] = outsideThreads.try_emplace(std::this_thread::get_id());
+        if (inserted) {
+            try {
+                createPools(it->second);
+            } catch (...) {
+                for (VkCommandPool pool : it->second.pools) {
+                    vkDestroyCommandPool(device, pool, nullptr);
+                }
+                outsideThreads.erase(it);
+                throw;
+            }
+        }
+        return it->second;
+    }
+
+    void ParallelRecorder::beginRenderPass(VkCommandBuffer primaryBuffer,
+                                           VkRenderPass renderPass,
+                                           VkFramebuffer framebuffer) {
+        primary = primaryBuffer;
+        inheritance.renderPass = renderPass;
+        inheritance.subpass = 0;
+        inheritance.framebuffer = framebuffer;
+    }
+
+    VkCommandBuffer ParallelRecorder::acquireBuffer(ThreadState &state) {
+        std::vector<VkCommandBuffer> &buffers = state.buffers[slot];
+        size_t                       &used = state.used[slot];
+
+        // Buffers survive the pool reset and are reused frame after frame
+        if (used == buffers.size()) {
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = state.pools[slot];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+            allocInfo.commandBufferCount = 1;
+
+            VkCommandBuffer buffer;
+            VK_CHECK_RESULT(vkAllocateCommandBuffers(device, &allocInfo, &buffer));
+            buffers.push_back(buffer);
+        }
+        return buffers[used++];
+    }
+
+    void ParallelRecorder::recordTask(const Task &task, uint32_t index) {
+        // Whichever thread runs this owns its pools until it returns
+        VkCommandBuffer cmd = acquireBuffer(currentThreadState());
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT |
+                          VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;
+        beginInfo.pInheritanceInfo = &inheritance;
+
+        VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+        task(cmd, index);
+        VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+
+        recorded[index] = cmd;
+    }
+
+    void ParallelRecorder::record(uint32_t count, const Task &task) {
+        if (count == 0)
+            return;
+
+        recorded.assign(count, VK_NULL_HANDLE);
+
+        // At most threadCount slices of consecutive tasks; with one thread
+        // everything is recorded on the caller
+        uint32_t batchSize = (count + threadCount - 1) / threadCount;
+        jobs.parallelFor(count, batchSize, [&](uint32_t begin, uint32_t end) {
+            for (uint32_t index = begin; index < end; index++)
+                recordTask(task, index);
+        });
+
+        vkCmdExecuteCommands(primary, count, recorded.data());
+    }
+
+} // namespace Retoccilus::Core
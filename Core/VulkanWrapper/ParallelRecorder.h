@@ -0,0 +1,89 @@
+#ifndef PARALLEL_RECORDER_H
+#define PARALLEL_RECORDER_H
+
+#include "JobSystem.h"
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // Records the body of a render pass as secondary command buffers on
+    // the job system. Every thread that records (each worker, and each
+    // outside thread that runs a task while waiting) has its own transient
+    // VkCommandPool per frame in flight, so recording never contends on a
+    // pool; the pools of a frame slot are reset wholesale once its fence
+    // has signalled.
+    //
+    // record() splits the work into tasks, records each into its own
+    // secondary buffer and executes them into the primary in task order,
+    // so the result is the same as recording the tasks one after another.
+    class ParallelRecorder {
+      public:
+        // Records task `task` into `cmd`. Secondary buffers inherit no
+        // dynamic state: set viewport, scissor etc. in every task.
+        using Task = std::function<void(VkCommandBuffer cmd, uint32_t task)>;
+
+        // At most `maxThreads` threads of `jobs`, the caller included, are
+        // asked to record at once
+        ParallelRecorder(VkDevice device, uint32_t queueFamily, uint32_t framesInFlight,
+                         JobSystem &jobs, uint32_t maxThreads);
+        ~ParallelRecorder();
+
+        ParallelRecorder(const ParallelRecorder &) = delete;
+        ParallelRecorder &operator=(const ParallelRecorder &) = delete;
+
+        // Threads that record tasks, the caller included; split the work
+        // into about this many tasks
+        uint32_t getThreadCount() const { return threadCount; }
+        // Clamped to 1..the job system's threads
+        void setThreadCount(uint32_t count);
+
+        // Called by the wrapper after the slot's fence has signalled
+        void beginFrame(uint32_t slot);
+        // Called by the wrapper after beginning a render pass with
+        // VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+        void beginRenderPass(VkCommandBuffer primary, VkRenderPass renderPass,
+                             VkFramebuffer framebuffer);
+
+        // Records `taskCount` tasks and executes them into the primary.
+        // Blocks until all are recorded; rethrows the first exception.
+        void record(uint32_t taskCount, const Task &task);
+
+      private:
+        struct ThreadState {
+            std::vector<VkCommandPool>                pools;   // per frame slot
+            std::vector<std::vector<VkCommandBuffer>> buffers; // per frame slot
+            std::vector<size_t>                       used;    // per frame slot
+        };
+
+        void            createPools(ThreadState &state);
+        ThreadState    &currentThreadState();
+        void            recordTask(const Task &task, uint32_t index);
+        VkCommandBuffer acquireBuffer(ThreadState &state);
+
+        VkDevice                 device;
+        uint32_t                 queueFamily;
+        uint32_t                 framesInFlight;
+        JobSystem               &jobs;
+        uint32_t                 threadCount;
+        std::vector<ThreadState> threads; // workers, by JobSystem::getThreadIndex() - 1
+
+        // Threads outside the job system share thread index 0, so they are
+        // told apart by id; created the first time they record
+        std::unordered_map<std::thread::id, ThreadState> outsideThreads;
+        std::mutex                                       outsideMutex;
+
+        uint32_t                       slot = 0;
+        VkCommandBuffer                primary = VK_NULL_HANDLE;
+        VkCommandBufferInheritanceInfo inheritance{};
+        std::vector<VkCommandBuffer>   recorded;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // PARALLEL_RECORDER_H
@@ -0,0 +1,263 @@
+#include "PipelineCache.h"
+#include "VulkanWrapper.h"
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Our own envelope around the driver blob. Some drivers do not
+        // survive a truncated or corrupted blob, so it is checked before the
+        // data ever reaches vkCreatePipelineCache.
+        constexpr uint32_t kFileMagic = 0x43505452; // "RTPC"
+        constexpr uint32_t kFileVersion = 1;
+
+        struct FileHeader {
+            uint32_t magic;
+            uint32_t version;
+            uint64_t payloadSize;
+            uint64_t payloadHash;
+        };
+
+        // Size of VkPipelineCacheHeaderVersionOne as laid out in the blob
+        constexpr size_t kDriverHeaderSize = 16 + VK_UUID_SIZE;
+
+        uint64_t fnv1a(const uint8_t *data, size_t size) {
+            uint64_t hash = 14695981039346656037ull;
+            for (size_t i = 0; i < size; i++) {
+                hash ^= data[i];
+                hash *= 1099511628211ull;
+            }
+            return hash;
+        }
+
+        // The driver header is a little-endian byte stream regardless of
+        // host layout.
+        uint32_t readU32(const uint8_t *data) {
+            return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8 |
+                   static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+        }
+    } // namespace
+
+    PipelineCache::PipelineCache(VkPhysicalDevice physicalDevice, VkDevice device,
+                                 std::string path, bool creationFeedback, JobSystem &jobSystem)
+        : physicalDevice(physicalDevice), device(device), path(std::move(path)),
+          creationFeedback(creationFeedback), jobSystem(jobSystem) {
+        std::vector<uint8_t> blob = loadBlob();
+
+        VkPipelineCacheCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+        createInfo.initialDataSize = blob.size();
+        createInfo.pInitialData = blob.empty() ? nullptr : blob.data();
+
+        VkResult result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+        if (result != VK_SUCCESS && !blob.empty()) {
+            // The driver still refused it; start over empty
+            createInfo.initialDataSize = 0;
+            createInfo.pInitialData = nullptr;
+            result = vkCreatePipelineCache(device, &createInfo, nullptr, &cache);
+            blob.clear();
+        }
+        VK_CHECK_RESULT(result);
+
+        stats.loadedFromDisk = !blob.empty();
+        stats.loadedBytes = blob.size();
+    }
+
+    PipelineCache::~PipelineCache() {
+        prewarmCancelled = true;
+        waitForPrewarm();
+
+        if (cache != VK_NULL_HANDLE) {
+            vkDestroyPipelineCache(device, cache, nullptr);
+        }
+    }
+
+    std::vector<uint8_t> PipelineCache::loadBlob() {
+        std::vector<uint8_t> blob;
+        if (path.empty())
+            return blob;
+
+        std::ifstream file(path, std::ios::binary);
+        if (!file)
+            return blob;
+
+        FileHeader header{};
+        if (!file.read(reinterpret_cast<char *>(&header), sizeof(header)) ||
+            header.magic != kFileMagic || header.version != kFileVersion ||
+            header.payloadSize < kDriverHeaderSize || header.payloadSize > (1ull << 31)) {
+            std::cerr << "Pipeline cache: ignoring unreadable " << path << std::endl;
+            return blob;
+        }
+
+        blob.resize(static_cast<size_t>(header.payloadSize));
+        if (!file.read(reinterpret_cast<char *>(blob.data()),
+                       static_cast<std::streamsize>(blob.size())) ||
+            fnv1a(blob.data(), blob.size()) != header.payloadHash) {
+            std::cerr << "Pipeline cache: ignoring damaged " << path << std::endl;
+            blob.clear();
+            return blob;
+        }
+
+        VkPhysicalDeviceProperties properties;
+        vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+        uint32_t headerSize = readU32(blob.data());
+        uint32_t headerVersion = readU32(blob.data() + 4);
+        uint32_t vendorID = readU32(blob.data() + 8);
+        uint32_t deviceID = readU32(blob.data() + 12);
+
+        bool matches = headerSize >= kDriverHeaderSize && headerSize <= blob.size() &&
+                       headerVersion == VK_PIPELINE_CACHE_HEADER_VERSION_ONE &&
+                       vendorID == properties.vendorID &&
+                       deviceID == properties.deviceID &&
+                       std::memcmp(blob.data() + 16, properties.pipelineCacheUUID,
+                                   VK_UUID_SIZE) == 0;
+        if (!matches) {
+            // Different GPU or driver build; the blob would only be rejected
+            std::cerr << "Pipeline cache: discarding stale " << path << std::endl;
+            blob.clear();
+        }
+        return blob;
+    }
+
+    void PipelineCache::save() {
+        if (path.empty() || cache == VK_NULL_HANDLE)
+            return;
+
+        waitForPrewarm();
+
+        size_t size = 0;
+        VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, nullptr));
+        std::vector<uint8_t> blob(size);
+        VK_CHECK_RESULT(vkGetPipelineCacheData(device, cache, &size, blob.data()));
+        blob.resize(size);
+
+        FileHeader header{};
+        header.magic = kFileMagic;
+        header.version = kFileVersion;
+        header.payloadSize = blob.size();
+        header.payloadHash = fnv1a(blob.data(), blob.size());
+
+        // Write next to the target and rename, so a crash mid-write never
+        // leaves a half-written cache behind.
+        std::string tempPath = path + ".tmp";
+        {
+            std::ofstream file(tempPath, std::ios::binary | std::ios::trunc);
+            if (!file) {
+                std::cerr << "Pipeline cache: cannot write " << tempPath << std::endl;
+                return;
+            }
+            file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+            file.write(reinterpret_cast<const char *>(blob.data()),
+                       static_cast<std::streamsize>(blob.size()));
+            if (!file) {
+                std::cerr << "Pipeline cache: cannot write " << tempPath << std::endl;
+                return;
+            }
+        }
+
+        std::error_code error;
+        std::filesystem::rename(tempPath, path, error);
+        if (error) {
+            std::cerr << "Pipeline cache: cannot replace " << path << ": "
+                      << error.message() << std::endl;
+            return;
+        }
+
+        std::lock_guard<std::mutex> lock(statsMutex);
+        stats.savedBytes = blob.size();
+    }
+
+    VkPipeline PipelineCache::createGraphicsPipeline(
+        const VkGraphicsPipelineCreateInfo &createInfo) {
+        VkGraphicsPipelineCreateInfo info = createInfo;
+
+        VkPipelineCreationFeedbackEXT           feedback{};
+        VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo{};
+        if (creationFeedback) {
+            feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+            feedbackInfo.pNext = info.pNext;
+            feedbackInfo.pPipelineCreationFeedback = &feedback;
+            info.pNext = &feedbackInfo;
+        }
+
+        auto       start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VK_CHECK_RESULT(vkCreateGraphicsPipelines(device, cache, 1, &info, nullptr, &pipeline));
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        record(feedback, elapsed.count());
+        return pipeline;
+    }
+
+    VkPipeline PipelineCache::createComputePipeline(
+        const VkComputePipelineCreateInfo &createInfo) {
+        VkComputePipelineCreateInfo info = createInfo;
+
+        VkPipelineCreationFeedbackEXT           feedback{};
+        VkPipelineCreationFeedbackCreateInfoEXT feedbackInfo{};
+        if (creationFeedback) {
+            feedbackInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_CREATION_FEEDBACK_CREATE_INFO_EXT;
+            feedbackInfo.pNext = info.pNext;
+            feedbackInfo.pPipelineCreationFeedback = &feedback;
+            info.pNext = &feedbackInfo;
+        }
+
+        auto       start = std::chrono::steady_clock::now();
+        VkPipeline pipeline = VK_NULL_HANDLE;
+        VK_CHECK_RESULT(vkCreateComputePipelines(device, cache, 1, &info, nullptr, &pipeline));
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+
+        record(feedback, elapsed.count());
+        return pipeline;
+    }
+
+    void PipelineCache::record(const VkPipelineCreationFeedbackEXT &feedback,
+                               double milliseconds) {
+        std::lock_guard<std::mutex> lock(statsMutex);
+
+        stats.creationMilliseconds += milliseconds;
+        if (!(feedback.flags & VK_PIPELINE_CREATION_FEEDBACK_VALID_BIT_EXT)) {
+            stats.unreported++;
+        } else if (feedback.flags &
+                   VK_PIPELINE_CREATION_FEEDBACK_APPLICATION_PIPELINE_CACHE_HIT_BIT_EXT) {
+            stats.hits++;
+        } else {
+            stats.misses++;
+        }
+    }
+
+    void PipelineCache::prewarm(std::vector<PrewarmJob> jobs) {
+        waitForPrewarm();
+
+        prewarmCancelled = false;
+        for (PrewarmJob &job : jobs) {
+            jobSystem.runBackground([this, job = std::move(job)]() {
+                if (prewarmCancelled)
+                    return;
+                try {
+                    job(*this);
+                } catch (const std::exception &e) {
+                    // A failed prewarm only costs a cache miss later
+                    std::cerr << "Pipeline cache: prewarm failed: " << e.what() << std::endl;
+                }
+            }, &prewarmJobs);
+        }
+    }
+
+    void PipelineCache::waitForPrewarm() {
+        jobSystem.wait(prewarmJobs);
+    }
+
+    PipelineCacheStats PipelineCache::getStats() {
+        std::lock_guard<std::mutex> lock(statsMutex);
+        return stats;
+    }
+
+} // namespace Retoccilus::Core
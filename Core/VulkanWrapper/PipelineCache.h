@@ -0,0 +1,85 @@
+#ifndef PIPELINE_CACHE_H
+#define PIPELINE_CACHE_H
+
+#include "JobSystem.h"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    struct PipelineCacheStats {
+        // Pipelines the driver reported as served from the cache, or as
+        // compiled from scratch. Only counted when VK_EXT_pipeline_creation_
+        // feedback is enabled; otherwise creations land in `unreported`.
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+        uint32_t unreported = 0;
+        double   creationMilliseconds = 0.0;
+
+        bool   loadedFromDisk = false;
+        size_t loadedBytes = 0;
+        size_t savedBytes = 0;
+    };
+
+    // A VkPipelineCache persisted across runs. The blob is loaded in the
+    // constructor and written back by save(); blobs from another GPU or
+    // driver (vendor ID, device ID or cache UUID differ) and damaged files
+    // are discarded and the cache starts empty.
+    //
+    // All pipelines should be created through createGraphicsPipeline() /
+    // createComputePipeline() so that hits and misses are counted.
+    class PipelineCache {
+      public:
+        // Creates and destroys pipelines against the given cache
+        using PrewarmJob = std::function<void(PipelineCache &)>;
+
+        // An empty `path` keeps the cache in memory only. Prewarm jobs run
+        // on `jobSystem`.
+        PipelineCache(VkPhysicalDevice physicalDevice, VkDevice device,
+                      std::string path, bool creationFeedback, JobSystem &jobSystem);
+        ~PipelineCache();
+
+        PipelineCache(const PipelineCache &) = delete;
+        PipelineCache &operator=(const PipelineCache &) = delete;
+
+        VkPipelineCache get() const { return cache; }
+
+        VkPipeline createGraphicsPipeline(const VkGraphicsPipelineCreateInfo &createInfo);
+        VkPipeline createComputePipeline(const VkComputePipelineCreateInfo &createInfo);
+
+        // Compile the declared pipelines as background jobs so their later
+        // creation on the render thread is a cache hit. VkPipelineCache is
+        // internally synchronised, so they may all run at once.
+        void prewarm(std::vector<PrewarmJob> jobs);
+        void waitForPrewarm();
+
+        void               save();
+        PipelineCacheStats getStats();
+
+      private:
+        std::vector<uint8_t> loadBlob();
+        void                 record(const VkPipelineCreationFeedbackEXT &feedback,
+                                    double milliseconds);
+
+        VkPhysicalDevice physicalDevice;
+        VkDevice         device;
+        std::string      path;
+        bool             creationFeedback;
+        VkPipelineCache  cache = VK_NULL_HANDLE;
+
+        JobSystem        &jobSystem;
+        JobCounter        prewarmJobs;
+        std::atomic<bool> prewarmCancelled{false};
+
+        PipelineCacheStats stats;
+        std::mutex         statsMutex;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // PIPELINE_CACHE_H
@@ -0,0 +1,574 @@
+#include "RenderContext.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include <set>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        VkDebugUtilsMessengerCreateInfoEXT
+        debugMessengerInfo(PFN_vkDebugUtilsMessengerCallbackEXT callback) {
+            VkDebugUtilsMessengerCreateInfoEXT createInfo{};
+            createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
+            createInfo.messageSeverity = VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
+                                         VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
+                                         VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
+            createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
+                                     VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
+                                     VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
+            createInfo.pfnUserCallback = callback;
+            return createInfo;
+        }
+    } // namespace
+
+    RenderContext::RenderContext(WindowMode mode) : windowMode(mode) {
+        validationLayers = {"VK_LAYER_KHRONOS_validation"};
+        // Enabled when present; lets the pipeline cache count hits
+        optionalDeviceExtensions = {VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME};
+
+        if (isHeadless()) {
+            // No presentation, so neither GLFW nor VK_KHR_swapchain is needed
+            return;
+        }
+
+        // Once for all windows; glfwTerminate() would destroy every one
+        if (!glfwInit()) {
+            throw std::runtime_error("Failed to initialize GLFW");
+        }
+        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+
+        deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
+    }
+
+    RenderContext::~RenderContext() {
+        cleanup();
+        if (!isHeadless())
+            glfwTerminate();
+    }
+
+    void RenderContext::setDeviceExtensions(const std::vector<const char *> &extensions) {
+        deviceExtensions = extensions;
+    }
+
+    void RenderContext::setValidationLayers(const std::vector<const char *> &layers) {
+        validationLayers = layers;
+    }
+
+    void RenderContext::setRequiredDeviceFeatures(const VkPhysicalDeviceFeatures &features) {
+        requiredDeviceFeatures = features;
+    }
+
+    void RenderContext::setPreferredDevice(const std::string &selector) {
+        preferredDevice = selector;
+    }
+
+    void RenderContext::setStagingBufferSize(VkDeviceSize size) {
+        stagingBufferSize = size;
+    }
+
+    void RenderContext::setPipelineCachePath(const std::string &path) {
+        pipelineCachePath = path;
+    }
+
+    void RenderContext::setJobThreads(uint32_t count) {
+        jobThreads = count;
+    }
+
+    JobSystem &RenderContext::getJobSystem() {
+        if (!jobSystem)
+            jobSystem = std::make_unique<JobSystem>(jobThreads);
+        return *jobSystem;
+    }
+
+    void RenderContext::createInstance() {
+        if (instance != VK_NULL_HANDLE)
+            return;
+
+        auto start = std::chrono::steady_clock::now();
+
+        if (validationLayers.size() > 0 && !checkValidationLayerSupport()) {
+            throw std::runtime_error(
+                "Validation layers requested but not available");
+        }
+
+        VkApplicationInfo appInfo{};
+        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
+        appInfo.pApplicationName = "Vulkan App";
+        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.pEngineName = "No Engine";
+        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
+        appInfo.apiVersion = VK_API_VERSION_1_0;
+
+        VkInstanceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
+        createInfo.pApplicationInfo = &appInfo;
+
+        auto extensions = getRequiredExtensions();
+        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
+        createInfo.ppEnabledExtensionNames = extensions.data();
+
+        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo = debugMessengerInfo(debugCallback);
+        if (validationLayers.size() > 0) {
+            createInfo.enabledLayerCount =
+                static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+            createInfo.pNext = &debugCreateInfo;
+        } else {
+            createInfo.enabledLayerCount = 0;
+            createInfo.pNext = nullptr;
+        }
+
+        VK_CHECK_RESULT(vkCreateInstance(&createInfo, nullptr, &instance));
+
+        std::chrono::duration<double, std::milli> elapsed =
+            std::chrono::steady_clock::now() - start;
+        initTimings.push_back(InitStageTiming{"createInstance", elapsed.count()});
+
+        start = std::chrono::steady_clock::now();
+        setupDebugMessenger();
+        elapsed = std::chrono::steady_clock::now() - start;
+        initTimings.push_back(InitStageTiming{"setupDebugMessenger", elapsed.count()});
+    }
+
+    void RenderContext::setupDebugMessenger() {
+        if (validationLayers.size() == 0)
+            return;
+
+        VkDebugUtilsMessengerCreateInfoEXT createInfo = debugMessengerInfo(debugCallback);
+
+        auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
+            instance, "vkCreateDebugUtilsMessengerEXT");
+        if (func) {
+            VK_CHECK_RESULT(func(instance, &createInfo, nullptr, &debugMessenger));
+        }
+    }
+
+    void RenderContext::createDevice(VkSurfaceKHR surface) {
+        if (device != VK_NULL_HANDLE)
+            return;
+
+        createInstance();
+
+        auto timed = [](auto step) {
+            auto start = std::chrono::steady_clock::now();
+            step();
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            return elapsed.count();
+        };
+        auto stage = [&](const char *name, auto step) {
+            initTimings.push_back(InitStageTiming{name, timed(step)});
+        };
+
+        stage("pickPhysicalDevice", [&] { pickPhysicalDevice(surface); });
+        stage("createLogicalDevice", [&] { createLogicalDevice(); });
+
+        // Both only need the device, and a large cache blob takes a while
+        // to check and hand to the driver, so the allocator and staging
+        // uploader are set up alongside it
+        JobSystem         &jobs = getJobSystem();
+        JobCounter         allocatorCreated;
+        double             allocatorMilliseconds = 0.0;
+        double             cacheMilliseconds = 0.0;
+        std::exception_ptr failure;
+        jobs.run([&] { allocatorMilliseconds = timed([&] { createAllocator(); }); },
+                 &allocatorCreated);
+        try {
+            cacheMilliseconds = timed([&] { createPipelineCache(); });
+        } catch (...) {
+            failure = std::current_exception();
+        }
+        jobs.wait(allocatorCreated);
+        if (failure) {
+            std::rethrow_exception(failure);
+        }
+
+        initTimings.push_back(InitStageTiming{"createAllocator", allocatorMilliseconds});
+        initTimings.push_back(InitStageTiming{"createPipelineCache", cacheMilliseconds});
+    }
+
+    void RenderContext::pickPhysicalDevice(VkSurfaceKHR surface) {
+        DeviceRequirements requirements;
+        requirements.extensions = deviceExtensions;
+        requirements.features = requiredDeviceFeatures;
+        requirements.presentation = !isHeadless();
+
+        DeviceSelector selector(instance, surface, requirements);
+        deviceCapabilities = selector.select(preferredDevice);
+        physicalDevice = deviceCapabilities.physicalDevice;
+    }
+
+    void RenderContext::createLogicalDevice() {
+        const QueueFamilyIndices &indices = deviceCapabilities.queueFamilies;
+
+        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
+        std::set<uint32_t>                   uniqueQueueFamilies = {indices.graphicsFamily.value(),
+                                                                    indices.presentFamily.value(),
+                                                                    indices.transferFamily.value()};
+
+        float queuePriority = 1.0f;
+        for (uint32_t queueFamily : uniqueQueueFamilies) {
+            VkDeviceQueueCreateInfo queueCreateInfo{};
+            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
+            queueCreateInfo.queueFamilyIndex = queueFamily;
+            queueCreateInfo.queueCount = 1;
+            queueCreateInfo.pQueuePriorities = &queuePriority;
+            queueCreateInfos.push_back(queueCreateInfo);
+        }
+
+        VkPhysicalDeviceFeatures deviceFeatures = requiredDeviceFeatures;
+        // Sprite texture arrays are indexed by a per-draw value when bindless
+        // sampling is not available
+        deviceFeatures.shaderSampledImageArrayDynamicIndexing |=
+            deviceCapabilities.features.shaderSampledImageArrayDynamicIndexing;
+
+        VkDeviceCreateInfo createInfo{};
+        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+        createInfo.queueCreateInfoCount =
+            static_cast<uint32_t>(queueCreateInfos.size());
+        createInfo.pQueueCreateInfos = queueCreateInfos.data();
+        createInfo.pEnabledFeatures = &deviceFeatures;
+        enabledDeviceExtensions = deviceExtensions;
+        for (const char *extension : optionalDeviceExtensions) {
+            if (deviceCapabilities.hasExtension(extension)) {
+                enabledDeviceExtensions.push_back(extension);
+            }
+        }
+
+        VkPhysicalDeviceDescriptorIndexingFeaturesEXT indexingFeatures{};
+        if (deviceCapabilities.descriptorIndexing) {
+            for (const char *extension : {VK_KHR_MAINTENANCE3_EXTENSION_NAME,
+                                          VK_EXT_DESCRIPTOR_INDEXING_EXTENSION_NAME}) {
+                if (!isDeviceExtensionEnabled(extension))
+                    enabledDeviceExtensions.push_back(extension);
+            }
+
+            indexingFeatures.sType =
+                VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES_EXT;
+            indexingFeatures.shaderSampledImageArrayNonUniformIndexing = VK_TRUE;
+            indexingFeatures.runtimeDescriptorArray = VK_TRUE;
+            indexingFeatures.descriptorBindingPartiallyBound = VK_TRUE;
+            createInfo.pNext = &indexingFeatures;
+        }
+
+        // Lets views time their presents; pointless without a swapchain
+        VkPhysicalDevicePresentIdFeaturesKHR   presentIdFeatures{};
+        VkPhysicalDevicePresentWaitFeaturesKHR presentWaitFeatures{};
+        bool                                   presentWait =
+            deviceCapabilities.presentWait && !isHeadless();
+        if (presentWait) {
+            for (const char *extension : {VK_KHR_PRESENT_ID_EXTENSION_NAME,
+                                          VK_KHR_PRESENT_WAIT_EXTENSION_NAME}) {
+                if (!isDeviceExtensionEnabled(extension))
+                    enabledDeviceExtensions.push_back(extension);
+            }
+
+            presentIdFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR;
+            presentIdFeatures.presentId = VK_TRUE;
+            presentIdFeatures.pNext = const_cast<void *>(createInfo.pNext);
+            presentWaitFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR;
+            presentWaitFeatures.presentWait = VK_TRUE;
+            presentWaitFeatures.pNext = &presentIdFeatures;
+            createInfo.pNext = &presentWaitFeatures;
+        }
+        createInfo.enabledExtensionCount =
+            static_cast<uint32_t>(enabledDeviceExtensions.size());
+        createInfo.ppEnabledExtensionNames = enabledDeviceExtensions.data();
+
+        if (validationLayers.size() > 0) {
+            createInfo.enabledLayerCount =
+                static_cast<uint32_t>(validationLayers.size());
+            createInfo.ppEnabledLayerNames = validationLayers.data();
+        } else {
+            createInfo.enabledLayerCount = 0;
+        }
+
+        VK_CHECK_RESULT(
+            vkCreateDevice(physicalDevice, &createInfo, nullptr, &device));
+
+        if (presentWait) {
+            waitForPresentKHR = reinterpret_cast<PFN_vkWaitForPresentKHR>(
+                vkGetDeviceProcAddr(device, "vkWaitForPresentKHR"));
+        }
+
+        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
+        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+        vkGetDeviceQueue(device, indices.transferFamily.value(), 0, &transferQueue);
+    }
+
+    void RenderContext::createAllocator() {
+        allocator = std::make_unique<GpuMemoryAllocator>(physicalDevice, device);
+
+        const QueueFamilyIndices &indices = deviceCapabilities.queueFamilies;
+        uploader = std::make_unique<StagingUploader>(
+            device, *allocator, transferQueue, indices.transferFamily.value(),
+            indices.graphicsFamily.value(), stagingBufferSize);
+        descriptorLayouts = std::make_unique<DescriptorLayoutCache>(device);
+    }
+
+    void RenderContext::createPipelineCache() {
+        pipelineCache = std::make_unique<PipelineCache>(
+            physicalDevice, device, pipelineCachePath,
+            isDeviceExtensionEnabled(VK_EXT_PIPELINE_CREATION_FEEDBACK_EXTENSION_NAME),
+            getJobSystem());
+    }
+
+    bool RenderContext::isDeviceExtensionEnabled(const char *name) const {
+        for (const char *extension : enabledDeviceExtensions) {
+            if (strcmp(extension, name) == 0)
+                return true;
+        }
+        return false;
+    }
+
+    void RenderContext::checkPresentSupport(VkSurfaceKHR surface) const {
+        VkBool32 supported = VK_FALSE;
+        VK_CHECK_RESULT(vkGetPhysicalDeviceSurfaceSupportKHR(
+            physicalDevice, deviceCapabilities.queueFamilies.presentFamily.value(), surface,
+            &supported));
+        if (!supported) {
+            throw std::runtime_error("The shared device cannot present to this window");
+        }
+    }
+
+    VkResult RenderContext::waitForPresent(VkSwapchainKHR swapChain, uint64_t presentId,
+                                           uint64_t timeout) const {
+        if (!waitForPresentKHR) {
+            throw std::runtime_error("VK_KHR_present_wait is not enabled");
+        }
+        return waitForPresentKHR(device, swapChain, presentId, timeout);
+    }
+
+    VkFence RenderContext::acquireFence() {
+        // Fences signal in submission order, so only the oldest can be done
+        while (!submissions.empty() &&
+               vkGetFenceStatus(device, submissions.front().fence) == VK_SUCCESS) {
+            retireSubmissions(submissions.front().id);
+        }
+
+        VkFence fence;
+        if (!freeFences.empty()) {
+            fence = freeFences.back();
+            freeFences.pop_back();
+            VK_CHECK_RESULT(vkResetFences(device, 1, &fence));
+        } else {
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            VK_CHECK_RESULT(vkCreateFence(device, &fenceInfo, nullptr, &fence));
+        }
+        return fence;
+    }
+
+    RenderContext::SubmissionId
+    RenderContext::submitFrames(const std::vector<FrameSubmission> &frames,
+                                std::vector<VkResult>             &presentResults) {
+        submitInfos.assign(frames.size(), VkSubmitInfo{});
+        presentSwapChains.clear();
+        presentImageIndices.clear();
+        presentSemaphores.clear();
+        presentIds.clear();
+        bool timed = false;
+
+        for (size_t i = 0; i < frames.size(); i++) {
+            const FrameSubmission &frame = frames[i];
+            VkSubmitInfo          &submitInfo = submitInfos[i];
+            submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+            if (frame.waitSemaphore != VK_NULL_HANDLE) {
+                submitInfo.waitSemaphoreCount = 1;
+                submitInfo.pWaitSemaphores = &frame.waitSemaphore;
+                submitInfo.pWaitDstStageMask = &frame.waitStage;
+            }
+            submitInfo.commandBufferCount = 1;
+            submitInfo.pCommandBuffers = &frame.cmd;
+            if (frame.signalSemaphore != VK_NULL_HANDLE) {
+                submitInfo.signalSemaphoreCount = 1;
+                submitInfo.pSignalSemaphores = &frame.signalSemaphore;
+            }
+
+            if (frame.swapChain != VK_NULL_HANDLE) {
+                presentSwapChains.push_back(frame.swapChain);
+                presentImageIndices.push_back(frame.imageIndex);
+                presentSemaphores.push_back(frame.signalSemaphore);
+                presentIds.push_back(frame.presentId);
+                timed |= frame.presentId != 0;
+            }
+        }
+
+        // Only reset once we are sure to submit, or a wait on it deadlocks
+        VkFence fence = acquireFence();
+        VkResult result = vkQueueSubmit(graphicsQueue, static_cast<uint32_t>(submitInfos.size()),
+                                        submitInfos.data(), fence);
+        if (result != VK_SUCCESS) {
+            freeFences.push_back(fence);
+            throw std::runtime_error("Vulkan error: " + std::to_string(result));
+        }
+        submissions.push_back(Submission{++lastSubmission, fence});
+
+        presentResults.assign(frames.size(), VK_SUCCESS);
+        if (presentSwapChains.empty())
+            return lastSubmission;
+
+        presentFrameResults.assign(presentSwapChains.size(), VK_SUCCESS);
+
+        VkPresentInfoKHR presentInfo{};
+        presentInfo.sType = VK_STRUCTURE_TYPE_PRESENT_INFO_KHR;
+        presentInfo.waitSemaphoreCount = static_cast<uint32_t>(presentSemaphores.size());
+        presentInfo.pWaitSemaphores = presentSemaphores.data();
+        presentInfo.swapchainCount = static_cast<uint32_t>(presentSwapChains.size());
+        presentInfo.pSwapchains = presentSwapChains.data();
+        presentInfo.pImageIndices = presentImageIndices.data();
+        presentInfo.pResults = presentFrameResults.data();
+
+        VkPresentIdKHR presentIdInfo{};
+        if (timed && waitForPresentKHR) {
+            presentIdInfo.sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR;
+            presentIdInfo.swapchainCount = presentInfo.swapchainCount;
+            presentIdInfo.pPresentIds = presentIds.data();
+            presentInfo.pNext = &presentIdInfo;
+        }
+        vkQueuePresentKHR(presentQueue, &presentInfo);
+
+        size_t presented = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            if (frames[i].swapChain != VK_NULL_HANDLE)
+                presentResults[i] = presentFrameResults[presented++];
+        }
+        return lastSubmission;
+    }
+
+    void RenderContext::wait(SubmissionId submission) {
+        if (isComplete(submission))
+            return;
+        if (submission > lastSubmission) {
+            throw std::runtime_error("Waiting for a submission that was never made");
+        }
+
+        // Ids are consecutive, so the entry's position follows from its id
+        const Submission &entry = submissions[submission - submissions.front().id];
+        VK_CHECK_RESULT(vkWaitForFences(device, 1, &entry.fence, VK_TRUE, UINT64_MAX));
+        retireSubmissions(submission);
+    }
+
+    void RenderContext::retireSubmissions(SubmissionId submission) {
+        while (!submissions.empty() && submissions.front().id <= submission) {
+            freeFences.push_back(submissions.front().fence);
+            submissions.pop_front();
+        }
+        completedSubmission = std::max(completedSubmission, submission);
+    }
+
+    bool RenderContext::checkValidationLayerSupport() {
+        uint32_t layerCount;
+        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+
+        std::vector<VkLayerProperties> availableLayers(layerCount);
+        vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+
+        for (const char *layerName : validationLayers) {
+            bool layerFound = false;
+
+            for (const auto &layerProperties : availableLayers) {
+                if (strcmp(layerName, layerProperties.layerName) == 0) {
+                    layerFound = true;
+                    break;
+                }
+            }
+
+            if (!layerFound) {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::vector<const char *> RenderContext::getRequiredExtensions() {
+        std::vector<const char *> extensions;
+
+        if (!isHeadless()) {
+            uint32_t     glfwExtensionCount = 0;
+            const char **glfwExtensions;
+            glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+
+            extensions.assign(glfwExtensions, glfwExtensions + glfwExtensionCount);
+        }
+
+        if (validationLayers.size() > 0) {
+            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+        }
+
+        // Needed to query descriptor indexing support; enabled when present
+        uint32_t extensionCount = 0;
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, nullptr);
+        std::vector<VkExtensionProperties> available(extensionCount);
+        vkEnumerateInstanceExtensionProperties(nullptr, &extensionCount, available.data());
+        for (const auto &extension : available) {
+            if (strcmp(extension.extensionName,
+                       VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME) == 0) {
+                extensions.push_back(VK_KHR_GET_PHYSICAL_DEVICE_PROPERTIES_2_EXTENSION_NAME);
+                break;
+            }
+        }
+
+        return extensions;
+    }
+
+    VKAPI_ATTR VkBool32 VKAPI_CALL RenderContext::debugCallback(
+        VkDebugUtilsMessageSeverityFlagBitsEXT      messageSeverity,
+        VkDebugUtilsMessageTypeFlagsEXT             messageType,
+        const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
+        void                                       *pUserData) {
+
+        std::cerr << "Validation layer: " << pCallbackData->pMessage << std::endl;
+        return VK_FALSE;
+    }
+
+    void RenderContext::cleanup() {
+        // Runs from the destructor too, so handles are reset once destroyed
+        if (device != VK_NULL_HANDLE) {
+            vkDeviceWaitIdle(device);
+
+            for (const Submission &submission : submissions)
+                vkDestroyFence(device, submission.fence, nullptr);
+            for (VkFence fence : freeFences)
+                vkDestroyFence(device, fence, nullptr);
+            completedSubmission = lastSubmission;
+        }
+        submissions.clear();
+        freeFences.clear();
+
+        if (pipelineCache) {
+            pipelineCache->save();
+            pipelineCache.reset();
+        }
+
+        // Everything allocated from these must be gone by now
+        descriptorLayouts.reset();
+        uploader.reset();
+        allocator.reset();
+
+        if (device != VK_NULL_HANDLE) {
+            vkDestroyDevice(device, nullptr);
+            device = VK_NULL_HANDLE;
+        }
+        waitForPresentKHR = nullptr;
+
+        if (debugMessenger != VK_NULL_HANDLE) {
+            auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
+                instance, "vkDestroyDebugUtilsMessengerEXT");
+            if (func) {
+                func(instance, debugMessenger, nullptr);
+            }
+            debugMessenger = VK_NULL_HANDLE;
+        }
+
+        if (instance != VK_NULL_HANDLE) {
+            vkDestroyInstance(instance, nullptr);
+            instance = VK_NULL_HANDLE;
+        }
+    }
+
+} // namespace Retoccilus::Core
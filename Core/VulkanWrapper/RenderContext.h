@@ -0,0 +1,213 @@
+#ifndef RENDER_CONTEXT_H
+#define RENDER_CONTEXT_H
+
+#include "DescriptorAllocator.h"
+#include "DeviceSelector.h"
+#include "GpuMemoryAllocator.h"
+#include "JobSystem.h"
+#include "PipelineCache.h"
+#include "StagingUploader.h"
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    enum class WindowMode {
+        Windowed,
+        // No GLFW window, surface or swapchain. Frames render into offscreen
+        // images and can be read back into host memory.
+        Headless
+    };
+
+    // Wall time of one init step
+    struct InitStageTiming {
+        const char *stage;
+        double      milliseconds;
+    };
+
+    // What every view of one device shares: the instance, the picked
+    // device and its queues, device memory, the staging uploader, the
+    // pipeline cache, descriptor set layouts and the job system. Views
+    // (VulkanWrapper) attach to it with their own window surface and
+    // swapchain, or offscreen targets, and their frames are submitted
+    // together through submitFrames().
+    //
+    // A windowed context initialises GLFW and terminates it when destroyed,
+    // so it must outlive its views; they hold it by shared_ptr. Headless
+    // contexts only accept headless views.
+    //
+    // Not thread-safe; frames are submitted from the render thread.
+    class RenderContext {
+      public:
+        // One view's frame in a batched submission
+        struct FrameSubmission {
+            VkCommandBuffer cmd = VK_NULL_HANDLE;
+            // Acquire semaphore; null for offscreen frames
+            VkSemaphore          waitSemaphore = VK_NULL_HANDLE;
+            VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+            // Null when the frame is not presented
+            VkSemaphore    signalSemaphore = VK_NULL_HANDLE;
+            VkSwapchainKHR swapChain = VK_NULL_HANDLE;
+            uint32_t       imageIndex = 0;
+            // Non-zero ids are attached with VK_KHR_present_id for
+            // waitForPresent(); they must increase per swapchain
+            uint64_t presentId = 0;
+        };
+
+        // Increases by one per submitFrames(); 0 is never submitted
+        using SubmissionId = uint64_t;
+
+        explicit RenderContext(WindowMode mode = WindowMode::Windowed);
+        ~RenderContext();
+
+        RenderContext(const RenderContext &) = delete;
+        RenderContext &operator=(const RenderContext &) = delete;
+
+        // Configuration, read when the instance or device is created
+        void setDeviceExtensions(const std::vector<const char *> &extensions);
+        void setValidationLayers(const std::vector<const char *> &layers);
+        // Features a device must support to be picked; enabled on creation
+        void setRequiredDeviceFeatures(const VkPhysicalDeviceFeatures &features);
+        // Device index or name substring; RETOCCILUS_DEVICE overrides it
+        void setPreferredDevice(const std::string &selector);
+        void setStagingBufferSize(VkDeviceSize size);
+        // Where the pipeline cache persists between runs; empty disables it
+        void setPipelineCachePath(const std::string &path);
+        // Worker threads of the job system, read when it is first used;
+        // zero picks one less than the hardware threads
+        void setJobThreads(uint32_t count);
+
+        // Both do nothing once done, so every view can call them. The device
+        // is picked to present to `surface`, the first window's surface
+        // (null when headless); later windows are checked with
+        // checkPresentSupport().
+        void createInstance();
+        void createDevice(VkSurfaceKHR surface);
+        // Views must have been cleaned up first
+        void cleanup();
+
+        // Throws if the present queue cannot present to `surface`
+        void checkPresentSupport(VkSurfaceKHR surface) const;
+
+        // Submits the frames in order with one vkQueueSubmit, then presents
+        // those with a swapchain with one vkQueuePresentKHR. presentResults
+        // gets the present result per frame, VK_SUCCESS if not presented.
+        SubmissionId submitFrames(const std::vector<FrameSubmission> &frames,
+                                  std::vector<VkResult>             &presentResults);
+        bool         isComplete(SubmissionId submission) const {
+            return submission <= completedSubmission;
+        }
+        // Blocks until `submission` and everything before it has executed
+        void wait(SubmissionId submission);
+
+        // VK_KHR_present_wait is enabled; see DeviceCapabilities::presentWait
+        bool     isPresentWaitEnabled() const { return waitForPresentKHR != nullptr; }
+        // Blocks until the present with `presentId` on `swapChain`, or a later
+        // one, has reached the display; VK_TIMEOUT after `timeout`
+        // nanoseconds. Thread-safe for a swapchain that is not being
+        // destroyed. Throws if present wait is not enabled.
+        VkResult waitForPresent(VkSwapchainKHR swapChain, uint64_t presentId,
+                                uint64_t timeout) const;
+
+        bool             isHeadless() const { return windowMode == WindowMode::Headless; }
+        bool             hasDevice() const { return device != VK_NULL_HANDLE; }
+        VkInstance       getInstance() const { return instance; }
+        VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
+        VkDevice         getDevice() const { return device; }
+        VkQueue          getGraphicsQueue() const { return graphicsQueue; }
+        VkQueue          getPresentQueue() const { return presentQueue; }
+        // Surface fields describe the surface the device was picked with
+        const DeviceCapabilities &getDeviceCapabilities() const { return deviceCapabilities; }
+
+        GpuMemoryAllocator    &getAllocator() { return *allocator; }
+        StagingUploader       &getUploader() { return *uploader; }
+        PipelineCache         &getPipelineCache() { return *pipelineCache; }
+        DescriptorLayoutCache &getDescriptorLayouts() { return *descriptorLayouts; }
+        // Started on first use
+        JobSystem             &getJobSystem();
+
+        const std::vector<InitStageTiming> &getInitTimings() const { return initTimings; }
+
+        // True for required extensions and for optional ones the device has
+        bool isDeviceExtensionEnabled(const char *name) const;
+
+      private:
+        struct Submission {
+            SubmissionId id;
+            VkFence      fence;
+        };
+
+        void setupDebugMessenger();
+        void pickPhysicalDevice(VkSurfaceKHR surface);
+        void createLogicalDevice();
+        void createAllocator();
+        void createPipelineCache();
+
+        VkFence acquireFence();
+        // Recycles the fences of every submission up to `submission`
+        void retireSubmissions(SubmissionId submission);
+
+        bool                      checkValidationLayerSupport();
+        std::vector<const char *> getRequiredExtensions();
+
+        WindowMode windowMode;
+
+        VkInstance               instance = VK_NULL_HANDLE;
+        VkDebugUtilsMessengerEXT debugMessenger = VK_NULL_HANDLE;
+        VkPhysicalDevice         physicalDevice = VK_NULL_HANDLE;
+        DeviceCapabilities       deviceCapabilities;
+        VkDevice                 device = VK_NULL_HANDLE;
+        VkQueue                  graphicsQueue = VK_NULL_HANDLE;
+        VkQueue                  presentQueue = VK_NULL_HANDLE;
+        VkQueue                  transferQueue = VK_NULL_HANDLE;
+        PFN_vkWaitForPresentKHR  waitForPresentKHR = nullptr;
+
+        // Outlives everything below, which may have jobs queued
+        std::unique_ptr<JobSystem> jobSystem;
+
+        std::unique_ptr<GpuMemoryAllocator>    allocator;
+        std::unique_ptr<StagingUploader>       uploader;
+        std::unique_ptr<PipelineCache>         pipelineCache;
+        std::unique_ptr<DescriptorLayoutCache> descriptorLayouts;
+
+        // One fence per batched submission, recycled once it has signalled
+        std::deque<Submission> submissions;
+        std::vector<VkFence>   freeFences;
+        SubmissionId           lastSubmission = 0;
+        SubmissionId           completedSubmission = 0;
+
+        // Scratch for submitFrames
+        std::vector<VkSubmitInfo>   submitInfos;
+        std::vector<VkSwapchainKHR> presentSwapChains;
+        std::vector<uint32_t>       presentImageIndices;
+        std::vector<VkSemaphore>    presentSemaphores;
+        std::vector<VkResult>       presentFrameResults;
+        std::vector<uint64_t>       presentIds;
+
+        // Configuration
+        std::vector<const char *> deviceExtensions;
+        std::vector<const char *> optionalDeviceExtensions;
+        std::vector<const char *> enabledDeviceExtensions;
+        std::vector<const char *> validationLayers;
+        VkPhysicalDeviceFeatures  requiredDeviceFeatures{};
+        std::string               preferredDevice;
+        VkDeviceSize              stagingBufferSize = 32 * 1024 * 1024;
+        std::string               pipelineCachePath = "pipeline_cache.bin";
+        uint32_t                  jobThreads = 0;
+
+        std::vector<InitStageTiming> initTimings;
+
+        static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
+            VkDebugUtilsMessageSeverityFlagBitsEXT      messageSeverity,
+            VkDebugUtilsMessageTypeFlagsEXT             messageType,
+            const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
+            void                                       *pUserData);
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // RENDER_CONTEXT_H
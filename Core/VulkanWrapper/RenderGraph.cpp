@@ -0,0 +1,847 @@
+#include "RenderGraph.h"
+#include "FrameProfiler.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+#include <optional>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr VkAccessFlags kWriteAccess =
+            VK_ACCESS_SHADER_WRITE_BIT | VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT |
+            VK_ACCESS_DEPTH_STENCIL_ATTACHMENT_WRITE_BIT | VK_ACCESS_TRANSFER_WRITE_BIT |
+            VK_ACCESS_HOST_WRITE_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+
+        VkDeviceSize alignUp(VkDeviceSize value, VkDeviceSize alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        bool isImageAccess(RenderGraphAccess access) {
+            return access <= RenderGraphAccess::TransferWrite;
+        }
+    } // namespace
+
+    RenderGraph::AccessInfo RenderGraph::accessInfo(RenderGraphAccess access) {
+        switch (access) {
+        case RenderGraphAccess::ColorAttachment:
+            return {VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT,
+                    VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT, VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL,
+                    VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT, true};
+        case RenderGraphAccess::FragmentSampled:
+            return {VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+        case RenderGraphAccess::ComputeSampled:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, VK_IMAGE_USAGE_SAMPLED_BIT, false};
+        case RenderGraphAccess::ComputeStorageRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, false};
+        case RenderGraphAccess::ComputeStorageWrite:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_GENERAL, VK_IMAGE_USAGE_STORAGE_BIT, true};
+        case RenderGraphAccess::TransferRead:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_SRC_BIT, false};
+        case RenderGraphAccess::TransferWrite:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_USAGE_TRANSFER_DST_BIT, true};
+        case RenderGraphAccess::VertexBuffer:
+            return {VK_PIPELINE_STAGE_VERTEX_INPUT_BIT, VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+        case RenderGraphAccess::IndirectBuffer:
+            return {VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT, VK_ACCESS_INDIRECT_COMMAND_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+        case RenderGraphAccess::VertexShaderRead:
+            return {VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+        case RenderGraphAccess::ComputeBufferRead:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+        case RenderGraphAccess::ComputeBufferWrite:
+            return {VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_ACCESS_SHADER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, true};
+        case RenderGraphAccess::TransferBufferRead:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_READ_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, false};
+        case RenderGraphAccess::TransferBufferWrite:
+            return {VK_PIPELINE_STAGE_TRANSFER_BIT, VK_ACCESS_TRANSFER_WRITE_BIT,
+                    VK_IMAGE_LAYOUT_UNDEFINED, 0, true};
+        }
+        throw std::runtime_error("RenderGraph: unknown access");
+    }
+
+    RenderGraph::RenderGraph(VkDevice device, GpuMemoryAllocator &allocator,
+                             uint32_t framesInFlight, FrameProfiler *profiler)
+        : device(device), allocator(allocator), profiler(profiler), slots(framesInFlight) {}
+
+    RenderGraph::~RenderGraph() {
+        for (FrameSlot &slot : slots) {
+            for (VkFramebuffer framebuffer : slot.framebuffers)
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            destroyTransientImages(slot);
+        }
+        for (auto &entry : renderPasses)
+            vkDestroyRenderPass(device, entry.second, nullptr);
+    }
+
+    void RenderGraph::beginFrame(uint32_t slot) {
+        currentSlot = slot;
+
+        // Framebuffers are made per frame: they are cheap, and the views
+        // of imported images (the swapchain's) come and go
+        for (VkFramebuffer framebuffer : slots[slot].framebuffers)
+            vkDestroyFramebuffer(device, framebuffer, nullptr);
+        slots[slot].framebuffers.clear();
+
+        resources.clear();
+        passes.clear();
+        compiled = false;
+    }
+
+    RenderGraph::Resource RenderGraph::createImage(const char *name, const ImageDesc &desc) {
+        if (desc.width == 0 || desc.height == 0)
+            throw std::runtime_error(std::string("RenderGraph: image '") + name + "' has no size");
+
+        ResourceNode node{};
+        node.name = name;
+        node.isImage = true;
+        node.imported = false;
+        node.desc = desc;
+        resources.push_back(node);
+        return Resource{static_cast<uint32_t>(resources.size() - 1)};
+    }
+
+    RenderGraph::Resource RenderGraph::importImage(const char *name, const ImportedImage &image) {
+        ResourceNode node{};
+        node.name = name;
+        node.isImage = true;
+        node.imported = true;
+        node.image = image;
+        resources.push_back(node);
+        return Resource{static_cast<uint32_t>(resources.size() - 1)};
+    }
+
+    RenderGraph::Resource RenderGraph::importBuffer(const char *name,
+                                                    const ImportedBuffer &buffer) {
+        ResourceNode node{};
+        node.name = name;
+        node.isImage = false;
+        node.imported = true;
+        node.buffer = buffer;
+        resources.push_back(node);
+        return Resource{static_cast<uint32_t>(resources.size() - 1)};
+    }
+
+    RenderGraph::PassBuilder RenderGraph::addPass(const char *name, ExecuteFn execute) {
+        PassNode pass;
+        pass.name = name;
+        pass.execute = std::move(execute);
+        passes.push_back(std::move(pass));
+        compiled = false;
+        return PassBuilder(*this, static_cast<uint32_t>(passes.size() - 1));
+    }
+
+    void RenderGraph::addUse(uint32_t passIndex, Resource resource, RenderGraphAccess access,
+                             bool read, bool discard) {
+        if (resource.index >= resources.size())
+            throw std::runtime_error("RenderGraph: invalid resource");
+
+        ResourceNode &node = resources[resource.index];
+        if (node.isImage != isImageAccess(access))
+            throw std::runtime_error(std::string("RenderGraph: access does not fit resource '") +
+                                     node.name + "'");
+
+        AccessInfo info = accessInfo(access);
+        PassNode  &pass = passes[passIndex];
+        for (Use &use : pass.uses) {
+            if (use.resource != resource.index)
+                continue;
+
+            if (node.isImage && use.info.layout != info.layout)
+                throw std::runtime_error(std::string("RenderGraph: pass '") + pass.name +
+                                         "' needs '" + node.name + "' in two layouts");
+            use.info.stage |= info.stage;
+            use.info.access |= info.access;
+            use.info.imageUsage |= info.imageUsage;
+            use.info.write = use.info.write || info.write;
+            use.read = use.read || read;
+            use.discard = use.discard && discard;
+            return;
+        }
+        pass.uses.push_back(Use{resource.index, info, read, discard});
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::read(Resource resource,
+                                                            RenderGraphAccess access) {
+        graph.addUse(pass, resource, access, true, false);
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::write(Resource resource,
+                                                             RenderGraphAccess access) {
+        graph.addUse(pass, resource, access, false, false);
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::writeColor(Resource image,
+                                                                  AttachmentLoad load,
+                                                                  VkClearColorValue clear) {
+        bool loads = load == AttachmentLoad::Load;
+        graph.addUse(pass, image, RenderGraphAccess::ColorAttachment, loads, !loads);
+        if (loads) {
+            // Loading reads the attachment as well
+            for (Use &use : graph.passes[pass].uses) {
+                if (use.resource == image.index)
+                    use.info.access |= VK_ACCESS_COLOR_ATTACHMENT_READ_BIT;
+            }
+        }
+        graph.passes[pass].colors.push_back(Attachment{image.index, load, clear});
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::sideEffects() {
+        graph.passes[pass].sideEffects = true;
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::secondaryCommandBuffers() {
+        graph.passes[pass].secondary = true;
+        return *this;
+    }
+
+    RenderGraph::PassBuilder &RenderGraph::PassBuilder::renderArea(VkExtent2D extent) {
+        graph.passes[pass].area = extent;
+        return *this;
+    }
+
+    void RenderGraph::compile() {
+        if (compiled)
+            return;
+
+        stats = Stats{};
+        stats.passes = static_cast<uint32_t>(passes.size());
+
+        cull();
+        computeLifetimes();
+        buildTransientImages();
+
+        for (PassNode &pass : passes) {
+            if (pass.live && !pass.colors.empty())
+                pass.renderPass = getRenderPass(pass);
+        }
+        compiled = true;
+    }
+
+    void RenderGraph::cull() {
+        // Reference counting as in Frostbite's frame graph: a resource is
+        // needed while a live pass reads it or it is imported, and a pass is
+        // live while something it writes is needed
+        std::vector<std::vector<uint32_t>> writersOf(resources.size());
+        for (ResourceNode &resource : resources)
+            resource.readers = 0;
+
+        for (uint32_t p = 0; p < passes.size(); p++) {
+            PassNode &pass = passes[p];
+            pass.live = true;
+            pass.writers = 0;
+            for (const Use &use : pass.uses) {
+                if (use.read)
+                    resources[use.resource].readers++;
+                if (use.info.write) {
+                    pass.writers++;
+                    writersOf[use.resource].push_back(p);
+                }
+            }
+        }
+
+        std::vector<uint32_t> unused;
+        auto cullPass = [&](PassNode &pass) {
+            pass.live = false;
+            stats.culledPasses++;
+            for (const Use &use : pass.uses) {
+                ResourceNode &resource = resources[use.resource];
+                if (use.read && --resource.readers == 0 && !resource.imported)
+                    unused.push_back(use.resource);
+            }
+        };
+
+        for (PassNode &pass : passes) {
+            if (pass.writers == 0 && !pass.sideEffects)
+                cullPass(pass);
+        }
+        for (uint32_t r = 0; r < resources.size(); r++) {
+            if (resources[r].readers == 0 && !resources[r].imported)
+                unused.push_back(r);
+        }
+
+        while (!unused.empty()) {
+            uint32_t resource = unused.back();
+            unused.pop_back();
+
+            for (uint32_t p : writersOf[resource]) {
+                PassNode &pass = passes[p];
+                if (pass.live && --pass.writers == 0 && !pass.sideEffects)
+                    cullPass(pass);
+            }
+        }
+    }
+
+    void RenderGraph::computeLifetimes() {
+        for (ResourceNode &resource : resources) {
+            resource.firstPass = UINT32_MAX;
+            resource.lastPass = 0;
+            resource.usage = resource.desc.extraUsage;
+        }
+
+        for (uint32_t p = 0; p < passes.size(); p++) {
+            if (!passes[p].live)
+                continue;
+            for (const Use &use : passes[p].uses) {
+                ResourceNode &resource = resources[use.resource];
+                resource.firstPass = std::min(resource.firstPass, p);
+                resource.lastPass = std::max(resource.lastPass, p);
+                resource.usage |= use.info.imageUsage;
+            }
+        }
+
+        // Attachments nobody uses afterwards need not be written to memory
+        for (uint32_t p = 0; p < passes.size(); p++) {
+            for (Attachment &attachment : passes[p].colors) {
+                const ResourceNode &resource = resources[attachment.resource];
+                attachment.store = resource.imported || resource.lastPass > p;
+            }
+        }
+    }
+
+    void RenderGraph::buildTransientImages() {
+        FrameSlot &slot = slots[currentSlot];
+
+        std::vector<uint32_t> transient;
+        std::vector<uint64_t> signature;
+        for (uint32_t r = 0; r < resources.size(); r++) {
+            const ResourceNode &resource = resources[r];
+            if (!resource.isImage || resource.imported || resource.firstPass == UINT32_MAX)
+                continue;
+
+            transient.push_back(r);
+            signature.push_back(static_cast<uint64_t>(resource.desc.width) << 32 |
+                                resource.desc.height);
+            signature.push_back(static_cast<uint64_t>(resource.desc.format) << 32 |
+                                resource.usage);
+            signature.push_back(static_cast<uint64_t>(resource.firstPass) << 32 |
+                                resource.lastPass);
+        }
+
+        stats.transientImages = static_cast<uint32_t>(transient.size());
+        if (signature == slot.signature) {
+            for (uint32_t i = 0; i < transient.size(); i++)
+                resources[transient[i]].physical = i;
+            stats.transientBytes = slot.requestedBytes;
+            stats.allocatedBytes = slot.allocatedBytes;
+            return;
+        }
+
+        // The slot's previous frame has finished, so its images can go
+        destroyTransientImages(slot);
+        slot.signature = std::move(signature);
+        slot.images.resize(transient.size());
+
+        std::vector<VkMemoryRequirements> requirements(transient.size());
+        for (uint32_t i = 0; i < transient.size(); i++) {
+            ResourceNode &resource = resources[transient[i]];
+            resource.physical = i;
+
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = resource.desc.format;
+            imageInfo.extent = {resource.desc.width, resource.desc.height, 1};
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = resource.usage;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            VK_CHECK_RESULT(vkCreateImage(device, &imageInfo, nullptr, &slot.images[i].image));
+            vkGetImageMemoryRequirements(device, slot.images[i].image, &requirements[i]);
+            slot.requestedBytes += requirements[i].size;
+        }
+
+        // Largest first, each at the lowest offset that does not overlap an
+        // image alive at the same time. Images whose memory types do not
+        // intersect go to separate heaps.
+        struct Placement {
+            uint32_t     heap;
+            VkDeviceSize offset;
+            VkDeviceSize size;
+            uint32_t     first;
+            uint32_t     last;
+        };
+        struct Heap {
+            uint32_t     memoryTypeBits;
+            VkDeviceSize size = 0;
+            VkDeviceSize alignment = 1;
+        };
+
+        std::vector<uint32_t> order(transient.size());
+        for (uint32_t i = 0; i < order.size(); i++)
+            order[i] = i;
+        std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+            return requirements[a].size > requirements[b].size;
+        });
+
+        std::vector<Heap>      heaps;
+        std::vector<Placement> placements(transient.size());
+        std::vector<uint32_t>  placed;
+        std::vector<uint32_t>  conflicts;
+        for (uint32_t i : order) {
+            const VkMemoryRequirements &req = requirements[i];
+            const ResourceNode         &resource = resources[transient[i]];
+
+            uint32_t heap = 0;
+            while (heap < heaps.size() && !(heaps[heap].memoryTypeBits & req.memoryTypeBits))
+                heap++;
+            if (heap == heaps.size())
+                heaps.push_back(Heap{req.memoryTypeBits});
+
+            conflicts.clear();
+            for (uint32_t other : placed) {
+                const Placement &p = placements[other];
+                if (p.heap == heap && p.first <= resource.lastPass && resource.firstPass <= p.last)
+                    conflicts.push_back(other);
+            }
+            std::sort(conflicts.begin(), conflicts.end(), [&](uint32_t a, uint32_t b) {
+                return placements[a].offset < placements[b].offset;
+            });
+
+            VkDeviceSize offset = 0;
+            for (uint32_t other : conflicts) {
+                const Placement &p = placements[other];
+                offset = alignUp(offset, req.alignment);
+                if (offset + req.size <= p.offset)
+                    break;
+                offset = std::max(offset, p.offset + p.size);
+            }
+            offset = alignUp(offset, req.alignment);
+
+            placements[i] = Placement{heap, offset, req.size, resource.firstPass,
+                                      resource.lastPass};
+            heaps[heap].memoryTypeBits &= req.memoryTypeBits;
+            heaps[heap].size = std::max(heaps[heap].size, offset + req.size);
+            heaps[heap].alignment = std::max(heaps[heap].alignment, req.alignment);
+
+            // Whoever shares memory with this image at another time must be
+            // finished with it before the later one starts
+            for (uint32_t other : placed) {
+                const Placement &p = placements[other];
+                if (p.heap != heap || p.offset >= offset + req.size || offset >= p.offset + p.size)
+                    continue;
+                if (p.last < resource.firstPass)
+                    slot.images[i].previousOccupants.push_back(transient[other]);
+                else
+                    slot.images[other].previousOccupants.push_back(transient[i]);
+            }
+            placed.push_back(i);
+        }
+
+        GpuAllocationCreateInfo allocInfo{};
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+        allocInfo.dedicated = true;
+
+        slot.memory.resize(heaps.size());
+        for (uint32_t h = 0; h < heaps.size(); h++) {
+            VkMemoryRequirements req{};
+            req.size = heaps[h].size;
+            req.alignment = heaps[h].alignment;
+            req.memoryTypeBits = heaps[h].memoryTypeBits;
+            slot.memory[h] = allocator.allocate(req, allocInfo, GpuResourceKind::Optimal);
+            slot.allocatedBytes += heaps[h].size;
+        }
+
+        for (uint32_t i = 0; i < transient.size(); i++) {
+            const Placement &p = placements[i];
+            PhysicalImage   &image = slot.images[i];
+            VK_CHECK_RESULT(vkBindImageMemory(device, image.image, slot.memory[p.heap].memory,
+                                              slot.memory[p.heap].offset + p.offset));
+
+            VkImageViewCreateInfo viewInfo{};
+            viewInfo.sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+            viewInfo.image = image.image;
+            viewInfo.viewType = VK_IMAGE_VIEW_TYPE_2D;
+            viewInfo.format = resources[transient[i]].desc.format;
+            viewInfo.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            viewInfo.subresourceRange.levelCount = 1;
+            viewInfo.subresourceRange.layerCount = 1;
+            VK_CHECK_RESULT(vkCreateImageView(device, &viewInfo, nullptr, &image.view));
+        }
+
+        stats.transientBytes = slot.requestedBytes;
+        stats.allocatedBytes = slot.allocatedBytes;
+    }
+
+    void RenderGraph::destroyTransientImages(FrameSlot &slot) {
+        for (PhysicalImage &image : slot.images) {
+            if (image.view != VK_NULL_HANDLE)
+                vkDestroyImageView(device, image.view, nullptr);
+            if (image.image != VK_NULL_HANDLE)
+                vkDestroyImage(device, image.image, nullptr);
+        }
+        for (GpuAllocation &memory : slot.memory)
+            allocator.free(memory);
+
+        slot.signature.clear();
+        slot.images.clear();
+        slot.memory.clear();
+        slot.requestedBytes = 0;
+        slot.allocatedBytes = 0;
+    }
+
+    VkRenderPass RenderGraph::getRenderPass(const PassNode &pass) {
+        std::vector<uint32_t> key;
+        for (const Attachment &attachment : pass.colors) {
+            key.push_back(static_cast<uint32_t>(getFormat(Resource{attachment.resource})));
+            key.push_back(static_cast<uint32_t>(attachment.load));
+            key.push_back(attachment.store ? 1u : 0u);
+        }
+
+        auto it = renderPasses.find(key);
+        if (it != renderPasses.end())
+            return it->second;
+
+        // Layouts are handled by the graph's barriers, so attachments stay
+        // in COLOR_ATTACHMENT_OPTIMAL and no subpass dependencies are needed
+        std::vector<VkAttachmentDescription> attachments(pass.colors.size());
+        std::vector<VkAttachmentReference>   references(pass.colors.size());
+        for (size_t i = 0; i < pass.colors.size(); i++) {
+            const Attachment &attachment = pass.colors[i];
+
+            attachments[i].format = static_cast<VkFormat>(key[i * 3]);
+            attachments[i].samples = VK_SAMPLE_COUNT_1_BIT;
+            switch (attachment.load) {
+            case AttachmentLoad::Clear:
+                attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+                break;
+            case AttachmentLoad::Load:
+                attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_LOAD;
+                break;
+            case AttachmentLoad::DontCare:
+                attachments[i].loadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+                break;
+            }
+            attachments[i].storeOp =
+                attachment.store ? VK_ATTACHMENT_STORE_OP_STORE : VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+            attachments[i].stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+            attachments[i].initialLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+            attachments[i].finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+            references[i].attachment = static_cast<uint32_t>(i);
+            references[i].layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+        }
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = static_cast<uint32_t>(references.size());
+        subpass.pColorAttachments = references.data();
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = static_cast<uint32_t>(attachments.size());
+        renderPassInfo.pAttachments = attachments.data();
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+
+        VkRenderPass renderPass;
+        VK_CHECK_RESULT(vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
+        renderPasses.emplace(std::move(key), renderPass);
+        return renderPass;
+    }
+
+    void RenderGraph::execute(VkCommandBuffer cmd) {
+        compile();
+
+        FrameSlot &slot = slots[currentSlot];
+        for (ResourceNode &resource : resources) {
+            resource.state = State{};
+            if (resource.imported && resource.isImage) {
+                resource.state.layout = resource.image.initialLayout;
+                resource.state.writeStage = resource.image.initialStage;
+                resource.state.touched = true;
+            }
+        }
+
+        for (PassNode &pass : passes) {
+            if (!pass.live)
+                continue;
+
+            recordBarriers(cmd, pass);
+
+            std::optional<FrameProfiler::GpuScope> scope;
+            if (profiler)
+                scope.emplace(*profiler, cmd, pass.name);
+
+            PassContext context(*this);
+            context.cmd = cmd;
+            context.renderPass = pass.renderPass;
+            context.framebuffer = VK_NULL_HANDLE;
+            context.extent = {};
+
+            if (pass.colors.empty()) {
+                pass.execute(context);
+                continue;
+            }
+
+            std::vector<VkImageView>  views;
+            std::vector<VkClearValue> clears;
+            for (const Attachment &attachment : pass.colors) {
+                views.push_back(resolveView(attachment.resource));
+                VkClearValue clear{};
+                clear.color = attachment.clear;
+                clears.push_back(clear);
+            }
+            VkExtent2D framebufferExtent = getExtent(Resource{pass.colors.front().resource});
+            context.extent = framebufferExtent;
+            if (pass.area.width > 0 && pass.area.height > 0) {
+                context.extent.width = std::min(pass.area.width, framebufferExtent.width);
+                context.extent.height = std::min(pass.area.height, framebufferExtent.height);
+            }
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = pass.renderPass;
+            framebufferInfo.attachmentCount = static_cast<uint32_t>(views.size());
+            framebufferInfo.pAttachments = views.data();
+            framebufferInfo.width = framebufferExtent.width;
+            framebufferInfo.height = framebufferExtent.height;
+            framebufferInfo.layers = 1;
+
+            VK_CHECK_RESULT(
+                vkCreateFramebuffer(device, &framebufferInfo, nullptr, &context.framebuffer));
+            slot.framebuffers.push_back(context.framebuffer);
+
+            VkRenderPassBeginInfo beginInfo{};
+            beginInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+            beginInfo.renderPass = pass.renderPass;
+            beginInfo.framebuffer = context.framebuffer;
+            beginInfo.renderArea.extent = context.extent;
+            beginInfo.clearValueCount = static_cast<uint32_t>(clears.size());
+            beginInfo.pClearValues = clears.data();
+
+            vkCmdBeginRenderPass(cmd, &beginInfo,
+                                 pass.secondary ? VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS
+                                                : VK_SUBPASS_CONTENTS_INLINE);
+            pass.execute(context);
+            vkCmdEndRenderPass(cmd);
+        }
+
+        recordFinalBarriers(cmd);
+    }
+
+    void RenderGraph::recordBarriers(VkCommandBuffer cmd, const PassNode &pass) {
+        const FrameSlot     &slot = slots[currentSlot];
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        imageBarriers.clear();
+        bufferBarriers.clear();
+
+        for (const Use &use : pass.uses) {
+            ResourceNode     &resource = resources[use.resource];
+            State            &state = resource.state;
+            const AccessInfo &info = use.info;
+
+            VkPipelineStageFlags src = 0;
+            VkAccessFlags        srcAccess = 0;
+            VkImageLayout        oldLayout = state.layout;
+
+            if (!state.touched) {
+                // First use of a transient image: its memory may still be in
+                // use by the images that had it earlier in the frame
+                if (resource.isImage && !resource.imported) {
+                    for (uint32_t other : slot.images[resource.physical].previousOccupants) {
+                        const State &previous = resources[other].state;
+                        src |= previous.writeStage | previous.readStages;
+                        srcAccess |= previous.writeAccess;
+                    }
+                }
+                oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            }
+
+            bool layoutChange = resource.isImage && oldLayout != info.layout;
+            bool memoryBarrier = layoutChange;
+            if (layoutChange || info.write) {
+                // Overwriting or moving the data waits for earlier reads
+                // too; only the writes need making available
+                src |= state.writeStage | state.readStages;
+                srcAccess |= state.writeAccess;
+                memoryBarrier = memoryBarrier || state.writeAccess != 0;
+            } else if (state.writeAccess &&
+                       ((info.stage & ~state.visibleStages) || (info.access & ~state.visibleAccess))) {
+                // Read after write, not yet visible to this stage
+                src |= state.writeStage;
+                srcAccess |= state.writeAccess;
+                memoryBarrier = true;
+            }
+            if (layoutChange && use.discard)
+                oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            if (src == 0 && memoryBarrier)
+                src = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            if (src != 0) {
+                srcStages |= src;
+                dstStages |= info.stage;
+            }
+
+            if (memoryBarrier && resource.isImage) {
+                VkImageMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcAccessMask = srcAccess & kWriteAccess;
+                barrier.dstAccessMask = info.access;
+                barrier.oldLayout = oldLayout;
+                barrier.newLayout = info.layout;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = resolveImage(use.resource);
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                barrier.subresourceRange.levelCount = 1;
+                barrier.subresourceRange.layerCount = 1;
+                imageBarriers.push_back(barrier);
+            } else if (memoryBarrier) {
+                VkBufferMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcAccessMask = srcAccess & kWriteAccess;
+                barrier.dstAccessMask = info.access;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.buffer = resource.buffer.buffer;
+                barrier.offset = 0;
+                barrier.size = resource.buffer.size;
+                bufferBarriers.push_back(barrier);
+            }
+
+            if (info.write) {
+                state.writeStage = info.stage;
+                state.writeAccess = info.access & kWriteAccess;
+                state.readStages = 0;
+                state.visibleStages = 0;
+                state.visibleAccess = 0;
+            } else {
+                state.readStages |= info.stage;
+                if (memoryBarrier) {
+                    state.visibleStages |= info.stage;
+                    state.visibleAccess |= info.access;
+                }
+            }
+            state.layout = resource.isImage ? info.layout : VK_IMAGE_LAYOUT_UNDEFINED;
+            state.touched = true;
+        }
+
+        if (srcStages == 0)
+            return;
+
+        vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, 0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        stats.barriers++;
+    }
+
+    void RenderGraph::recordFinalBarriers(VkCommandBuffer cmd) {
+        VkPipelineStageFlags srcStages = 0;
+        VkPipelineStageFlags dstStages = 0;
+        imageBarriers.clear();
+        bufferBarriers.clear();
+
+        for (ResourceNode &resource : resources) {
+            if (!resource.imported)
+                continue;
+
+            const State &state = resource.state;
+            if (resource.isImage) {
+                const ImportedImage &image = resource.image;
+                if (state.layout == image.finalLayout && image.finalAccess == 0)
+                    continue;
+
+                VkImageMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+                barrier.srcAccessMask = state.writeAccess;
+                barrier.dstAccessMask = image.finalAccess;
+                barrier.oldLayout = state.layout;
+                barrier.newLayout = image.finalLayout;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.image = image.image;
+                barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+                barrier.subresourceRange.levelCount = 1;
+                barrier.subresourceRange.layerCount = 1;
+                imageBarriers.push_back(barrier);
+
+                srcStages |= state.writeStage | state.readStages;
+                dstStages |= image.finalStage;
+            } else if (resource.buffer.finalStage != 0 && state.writeAccess != 0) {
+                VkBufferMemoryBarrier barrier{};
+                barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+                barrier.srcAccessMask = state.writeAccess;
+                barrier.dstAccessMask = resource.buffer.finalAccess;
+                barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+                barrier.buffer = resource.buffer.buffer;
+                barrier.offset = 0;
+                barrier.size = resource.buffer.size;
+                bufferBarriers.push_back(barrier);
+
+                srcStages |= state.writeStage;
+                dstStages |= resource.buffer.finalStage;
+            }
+        }
+
+        if (imageBarriers.empty() && bufferBarriers.empty())
+            return;
+
+        if (srcStages == 0)
+            srcStages = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+        vkCmdPipelineBarrier(cmd, srcStages, dstStages, 0, 0, nullptr,
+                             static_cast<uint32_t>(bufferBarriers.size()), bufferBarriers.data(),
+                             static_cast<uint32_t>(imageBarriers.size()), imageBarriers.data());
+        stats.barriers++;
+    }
+
+    VkExtent2D RenderGraph::getExtent(Resource image) const {
+        const ResourceNode &resource = resources.at(image.index);
+        if (resource.imported)
+            return resource.image.extent;
+        return VkExtent2D{resource.desc.width, resource.desc.height};
+    }
+
+    VkFormat RenderGraph::getFormat(Resource image) const {
+        const ResourceNode &resource = resources.at(image.index);
+        return resource.imported ? resource.image.format : resource.desc.format;
+    }
+
+    VkImage RenderGraph::resolveImage(uint32_t index) const {
+        const ResourceNode &resource = resources.at(index);
+        if (resource.imported)
+            return resource.image.image;
+        return slots[currentSlot].images.at(resource.physical).image;
+    }
+
+    VkImageView RenderGraph::resolveView(uint32_t index) const {
+        const ResourceNode &resource = resources.at(index);
+        if (resource.imported)
+            return resource.image.view;
+        return slots[currentSlot].images.at(resource.physical).view;
+    }
+
+    VkImage RenderGraph::PassContext::getImage(Resource image) const {
+        return graph.resolveImage(image.index);
+    }
+
+    VkImageView RenderGraph::PassContext::getView(Resource image) const {
+        return graph.resolveView(image.index);
+    }
+
+    VkBuffer RenderGraph::PassContext::getBuffer(Resource buffer) const {
+        return graph.resources.at(buffer.index).buffer.buffer;
+    }
+
+} // namespace Retoccilus::Core
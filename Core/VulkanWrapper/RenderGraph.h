@@ -0,0 +1,306 @@
+#ifndef RENDER_GRAPH_H
+#define RENDER_GRAPH_H
+
+#include "GpuMemoryAllocator.h"
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    class FrameProfiler;
+
+    // How a pass touches a resource. Each maps to the pipeline stage,
+    // access mask and (for images) layout the graph synchronizes against.
+    enum class RenderGraphAccess {
+        // Images only
+        ColorAttachment, // written through the pass's render pass
+        FragmentSampled,
+        ComputeSampled,
+        ComputeStorageRead,
+        ComputeStorageWrite,
+        TransferRead,
+        TransferWrite,
+        // Buffers only
+        VertexBuffer,
+        IndirectBuffer,
+        VertexShaderRead,
+        ComputeBufferRead,
+        ComputeBufferWrite,
+        TransferBufferRead,
+        TransferBufferWrite
+    };
+
+    enum class AttachmentLoad { Clear, Load, DontCare };
+
+    // A frame described as passes and the resources they use, rebuilt every
+    // frame:
+    //
+    //   graph.beginFrame(slot);
+    //   auto target = graph.importImage("Backbuffer", ...);
+    //   auto scene  = graph.createImage("Scene", desc);
+    //   graph.addPass("Scene", ...).writeColor(scene);
+    //   graph.addPass("Tonemap", ...).read(scene, FragmentSampled).writeColor(target);
+    //   graph.compile();
+    //   graph.execute(cmd);
+    //
+    // Passes run in declaration order. compile() culls passes whose results
+    // nobody reads (unless marked with sideEffects()), then execute()
+    // issues exactly the barriers the declared uses need: none between
+    // reads in the same layout, execution-only ones for write-after-read,
+    // and every pass's barriers batched into one vkCmdPipelineBarrier.
+    //
+    // Images from createImage() are transient: they only exist within the
+    // frame, and those whose lifetimes (first to last live pass) do not
+    // overlap share memory. They are kept per frame slot and reused as
+    // long as the frame's transient images and lifetimes stay the same.
+    //
+    // Passes that write colour attachments get a render pass with the
+    // attachments in COLOR_ATTACHMENT_OPTIMAL, compatible with any render
+    // pass of the same formats, and their execute callback runs inside it.
+    class RenderGraph {
+      public:
+        struct Resource {
+            uint32_t index = UINT32_MAX;
+
+            bool isNull() const { return index == UINT32_MAX; }
+        };
+
+        struct ImageDesc {
+            uint32_t width = 0;
+            uint32_t height = 0;
+            VkFormat format = VK_FORMAT_R8G8B8A8_UNORM;
+            // Usage beyond what the declared accesses imply
+            VkImageUsageFlags extraUsage = 0;
+        };
+
+        // An image owned outside the graph, e.g. the swapchain image
+        struct ImportedImage {
+            VkImage     image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            VkFormat    format = VK_FORMAT_UNDEFINED;
+            VkExtent2D  extent{};
+            // State on entry. For an acquired swapchain image the stage is
+            // the one the acquire semaphore is waited at.
+            VkImageLayout        initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags initialStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
+            // State the frame leaves it in
+            VkImageLayout        finalLayout = VK_IMAGE_LAYOUT_GENERAL;
+            VkPipelineStageFlags finalStage = VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT;
+            VkAccessFlags        finalAccess = 0;
+        };
+
+        struct ImportedBuffer {
+            VkBuffer     buffer = VK_NULL_HANDLE;
+            VkDeviceSize size = VK_WHOLE_SIZE;
+            // Consumer after the frame, e.g. HOST for a readback; none if 0
+            VkPipelineStageFlags finalStage = 0;
+            VkAccessFlags        finalAccess = 0;
+        };
+
+        class PassContext;
+        using ExecuteFn = std::function<void(const PassContext &)>;
+
+        // Declares what a pass uses; returned by addPass()
+        class PassBuilder {
+          public:
+            PassBuilder &read(Resource resource, RenderGraphAccess access);
+            PassBuilder &write(Resource resource, RenderGraphAccess access);
+            // Attachments are numbered in call order
+            PassBuilder &writeColor(Resource image, AttachmentLoad load = AttachmentLoad::Clear,
+                                    VkClearColorValue clear = {{0.0f, 0.0f, 0.0f, 1.0f}});
+            // Keeps the pass even if nothing reads what it writes
+            PassBuilder &sideEffects();
+            // The render pass is begun with secondary command buffer contents
+            PassBuilder &secondaryCommandBuffers();
+            // Renders to the top-left `extent` of the attachments only;
+            // clears stop there too, and PassContext::extent is the area
+            PassBuilder &renderArea(VkExtent2D extent);
+
+          private:
+            friend class RenderGraph;
+            PassBuilder(RenderGraph &graph, uint32_t pass) : graph(graph), pass(pass) {}
+
+            RenderGraph &graph;
+            uint32_t     pass;
+        };
+
+        class PassContext {
+          public:
+            VkCommandBuffer cmd;
+            // Null for passes without colour attachments
+            VkRenderPass  renderPass;
+            VkFramebuffer framebuffer;
+            // Render area, from the attachments' origin
+            VkExtent2D    extent;
+
+            VkImage     getImage(Resource image) const;
+            VkImageView getView(Resource image) const;
+            VkBuffer    getBuffer(Resource buffer) const;
+
+          private:
+            friend class RenderGraph;
+            PassContext(const RenderGraph &graph) : graph(graph) {}
+
+            const RenderGraph &graph;
+        };
+
+        struct Stats {
+            uint32_t     passes = 0;
+            uint32_t     culledPasses = 0;
+            uint32_t     barriers = 0; // vkCmdPipelineBarrier calls
+            uint32_t     transientImages = 0;
+            VkDeviceSize transientBytes = 0; // without aliasing
+            VkDeviceSize allocatedBytes = 0; // with aliasing
+        };
+
+        // Pass names go to the profiler and must be string literals
+        RenderGraph(VkDevice device, GpuMemoryAllocator &allocator, uint32_t framesInFlight,
+                    FrameProfiler *profiler = nullptr);
+        ~RenderGraph();
+
+        RenderGraph(const RenderGraph &) = delete;
+        RenderGraph &operator=(const RenderGraph &) = delete;
+
+        // Called after the slot's fence has signalled; drops the previous
+        // frame's declarations and the slot's framebuffers
+        void beginFrame(uint32_t slot);
+
+        Resource    createImage(const char *name, const ImageDesc &desc);
+        Resource    importImage(const char *name, const ImportedImage &image);
+        Resource    importBuffer(const char *name, const ImportedBuffer &buffer);
+        PassBuilder addPass(const char *name, ExecuteFn execute);
+
+        void compile();
+        void execute(VkCommandBuffer cmd);
+
+        VkExtent2D   getExtent(Resource image) const;
+        VkFormat     getFormat(Resource image) const;
+        const Stats &getStats() const { return stats; }
+
+      private:
+        struct AccessInfo {
+            VkPipelineStageFlags stage;
+            VkAccessFlags        access;
+            VkImageLayout        layout;
+            VkImageUsageFlags    imageUsage;
+            bool                 write;
+        };
+
+        // Synchronization state of a resource during execute()
+        struct State {
+            VkImageLayout        layout = VK_IMAGE_LAYOUT_UNDEFINED;
+            VkPipelineStageFlags writeStage = 0;
+            VkAccessFlags        writeAccess = 0;
+            // Stages and accesses the last write has been made visible to
+            VkPipelineStageFlags visibleStages = 0;
+            VkAccessFlags        visibleAccess = 0;
+            // Reads since the last write
+            VkPipelineStageFlags readStages = 0;
+            bool                 touched = false;
+        };
+
+        struct ResourceNode {
+            const char *name;
+            bool        isImage;
+            bool        imported;
+            ImageDesc   desc;
+            ImportedImage  image;
+            ImportedBuffer buffer;
+
+            // compile()
+            VkImageUsageFlags usage = 0;
+            uint32_t          readers = 0;
+            uint32_t          firstPass = UINT32_MAX;
+            uint32_t          lastPass = 0;
+            uint32_t          physical = UINT32_MAX; // transient images
+
+            State state;
+        };
+
+        // Everything a pass does with one resource, merged
+        struct Use {
+            uint32_t   resource;
+            AccessInfo info;
+            bool       read;
+            // Only written as an attachment that is cleared or not loaded,
+            // so the old contents need not survive a layout transition
+            bool discard;
+        };
+
+        struct Attachment {
+            uint32_t          resource;
+            AttachmentLoad    load;
+            VkClearColorValue clear;
+            bool              store = true;
+        };
+
+        struct PassNode {
+            const char             *name;
+            ExecuteFn               execute;
+            std::vector<Use>        uses;
+            std::vector<Attachment> colors;
+            bool                    sideEffects = false;
+            bool                    secondary = false;
+            VkExtent2D              area{}; // whole attachments if empty
+            bool                    live = true;
+            uint32_t                writers = 0; // refcount for culling
+            VkRenderPass            renderPass = VK_NULL_HANDLE;
+        };
+
+        // A transient image of a frame slot, bound into a shared allocation
+        struct PhysicalImage {
+            VkImage     image = VK_NULL_HANDLE;
+            VkImageView view = VK_NULL_HANDLE;
+            // Transient images that used the same memory earlier in the frame
+            std::vector<uint32_t> previousOccupants;
+        };
+
+        struct FrameSlot {
+            // Transient images and lifetimes the images were built for
+            std::vector<uint64_t>      signature;
+            std::vector<PhysicalImage> images;
+            std::vector<GpuAllocation> memory;
+            VkDeviceSize               requestedBytes = 0;
+            VkDeviceSize               allocatedBytes = 0;
+            std::vector<VkFramebuffer> framebuffers;
+        };
+
+        static AccessInfo accessInfo(RenderGraphAccess access);
+
+        void         addUse(uint32_t pass, Resource resource, RenderGraphAccess access, bool read,
+                            bool discard);
+        void         cull();
+        void         computeLifetimes();
+        void         buildTransientImages();
+        void         destroyTransientImages(FrameSlot &slot);
+        VkRenderPass getRenderPass(const PassNode &pass);
+        VkImage      resolveImage(uint32_t resource) const;
+        VkImageView  resolveView(uint32_t resource) const;
+        void         recordBarriers(VkCommandBuffer cmd, const PassNode &pass);
+        void         recordFinalBarriers(VkCommandBuffer cmd);
+
+        VkDevice            device;
+        GpuMemoryAllocator &allocator;
+        FrameProfiler      *profiler;
+
+        std::vector<ResourceNode> resources;
+        std::vector<PassNode>     passes;
+        std::vector<FrameSlot>    slots;
+        uint32_t                  currentSlot = 0;
+        bool                      compiled = false;
+        Stats                     stats;
+
+        // Keyed by format, load and store op of every attachment
+        std::map<std::vector<uint32_t>, VkRenderPass> renderPasses;
+
+        // Scratch for recordBarriers
+        std::vector<VkImageMemoryBarrier>  imageBarriers;
+        std::vector<VkBufferMemoryBarrier> bufferBarriers;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // RENDER_GRAPH_H
@@ -0,0 +1,101 @@
+#include "ResolutionScaler.h"
+#include <algorithm>
+#include <cmath>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        // Scales are multiples of this
+        constexpr float kScaleStep = 1.0f / 32.0f;
+        // Share of the budget a new scale aims for, so that the frames
+        // after a change are not over budget again right away
+        constexpr double kTargetShare = 0.9;
+        // The scale grows after this many frames in a row under this share
+        // of the budget, by at most kMaxGrowth at a time
+        constexpr double   kGrowShare = 0.75;
+        constexpr uint32_t kGrowFrames = 30;
+        constexpr float    kMaxGrowth = 0.125f;
+        // Weight of a new GPU time in the average
+        constexpr double kSmoothing = 0.25;
+
+        float quantiseDown(float scale) {
+            return std::floor(scale / kScaleStep) * kScaleStep;
+        }
+
+        // Pixels, and so roughly GPU time, go with the square of the scale
+        float scaleFor(float scale, double gpuMs, double targetMs) {
+            return scale * static_cast<float>(std::sqrt(targetMs / gpuMs));
+        }
+    } // namespace
+
+    void ResolutionScaler::setSettings(const Settings &newSettings) {
+        settings = newSettings;
+        settings.maxScale = std::clamp(settings.maxScale, kScaleStep, 1.0f);
+        settings.minScale = std::clamp(settings.minScale, kScaleStep, settings.maxScale);
+
+        if (setScale(scale)) {
+            measured = false;
+            scaleSince = frame + 1;
+        }
+        underBudgetFrames = 0;
+    }
+
+    void ResolutionScaler::reset() {
+        scale = settings.maxScale;
+        averageMs = 0.0;
+        measured = false;
+        scaleSince = frame + 1;
+        underBudgetFrames = 0;
+    }
+
+    bool ResolutionScaler::update(uint64_t measuredFrame, double gpuMs, uint64_t currentFrame) {
+        frame = currentFrame;
+        if (measuredFrame < scaleSince || (measured && measuredFrame <= lastMeasured) ||
+            gpuMs <= 0.0)
+            return false;
+
+        lastMeasured = measuredFrame;
+        averageMs = measured ? averageMs + kSmoothing * (gpuMs - averageMs) : gpuMs;
+        measured = true;
+
+        double targetMs = kTargetShare * settings.budgetMs;
+        if (averageMs > settings.budgetMs) {
+            underBudgetFrames = 0;
+            return setScale(quantiseDown(scaleFor(scale, averageMs, targetMs)));
+        }
+
+        if (averageMs >= kGrowShare * settings.budgetMs || scale >= settings.maxScale) {
+            underBudgetFrames = 0;
+            return false;
+        }
+        if (++underBudgetFrames < kGrowFrames)
+            return false;
+
+        underBudgetFrames = 0;
+        float grown = std::min(scaleFor(scale, averageMs, targetMs), scale + kMaxGrowth);
+        return setScale(quantiseDown(grown));
+    }
+
+    bool ResolutionScaler::setScale(float newScale) {
+        newScale = std::clamp(newScale, settings.minScale, settings.maxScale);
+        if (newScale == scale)
+            return false;
+
+        // Frames in flight were recorded at the old scale, so the first
+        // time at the new one is a while off; until then, predict it
+        averageMs *= static_cast<double>(newScale) * newScale / (static_cast<double>(scale) * scale);
+        scale = newScale;
+        scaleSince = frame;
+        underBudgetFrames = 0;
+        return true;
+    }
+
+    VkExtent2D ResolutionScaler::apply(VkExtent2D extent) const {
+        auto scaled = [this](uint32_t size) {
+            uint32_t result = static_cast<uint32_t>(std::lround(size * scale));
+            return std::clamp(result, 1u, std::max(size, 1u));
+        };
+        return VkExtent2D{scaled(extent.width), scaled(extent.height)};
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,66 @@
+#ifndef RESOLUTION_SCALER_H
+#define RESOLUTION_SCALER_H
+
+#include <cstdint>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // Dynamic resolution controller of one view. It picks the scale of the
+    // scene's render resolution from measured GPU frame times, assuming
+    // that the time grows with the number of pixels: a frame over budget
+    // shrinks the scale at once by as much as that model says, while the
+    // scale only grows back, a bounded step at a time, after several
+    // frames in a row with room to spare.
+    //
+    // GPU times arrive frames in flight after the frame was recorded, so
+    // times of frames recorded before the last change are ignored. Scales
+    // are quantised, which keeps small jitter from changing the extent.
+    class ResolutionScaler {
+      public:
+        struct Settings {
+            // GPU time per frame to stay under, in milliseconds
+            double budgetMs = 1000.0 / 60.0;
+            // Of the full resolution, per axis; the maximum is at most 1
+            float minScale = 0.5f;
+            float maxScale = 1.0f;
+        };
+
+        ResolutionScaler() = default;
+
+        // Clamps the current scale to the new range
+        void            setSettings(const Settings &settings);
+        const Settings &getSettings() const { return settings; }
+
+        // Back to the maximum scale, forgetting the measurements
+        void reset();
+
+        // Feeds the GPU time of frame `measuredFrame`, before frame
+        // `currentFrame` is recorded. Returns true if the scale changed.
+        bool update(uint64_t measuredFrame, double gpuMs, uint64_t currentFrame);
+
+        float getScale() const { return scale; }
+        // `extent` at the current scale, at least one pixel per axis
+        VkExtent2D apply(VkExtent2D extent) const;
+
+      private:
+        // Returns false if the clamped scale is the current one
+        bool setScale(float newScale);
+
+        Settings settings;
+        float    scale = 1.0f;
+        // Latest frame passed to update()
+        uint64_t frame = 0;
+
+        // Smoothed GPU time at the current scale; 0 until measured
+        double   averageMs = 0.0;
+        uint64_t lastMeasured = 0;
+        bool     measured = false;
+        // First frame recorded at the current scale
+        uint64_t scaleSince = 0;
+        uint32_t underBudgetFrames = 0;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // RESOLUTION_SCALER_H
@@ -0,0 +1,428 @@
+#include "StagingUploader.h"
+#include "VulkanWrapper.h"
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace Retoccilus::Core {
+
+    namespace {
+        constexpr VkDeviceSize kRingGranularity = 256;
+        constexpr VkDeviceSize kBufferAlignment = 4;
+        // Covers the largest texel block we upload (RGBA32F)
+        constexpr VkDeviceSize kImageAlignment = 16;
+
+        constexpr VkPipelineStageFlags kBufferConsumerStages =
+            VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_INPUT_BIT |
+            VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+            VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+        constexpr VkAccessFlags kBufferConsumerAccess =
+            VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_INDEX_READ_BIT |
+            VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT |
+            VK_ACCESS_SHADER_READ_BIT;
+
+        uint64_t alignUp(uint64_t value, uint64_t alignment) {
+            return (value + alignment - 1) / alignment * alignment;
+        }
+
+        // Who touches an image next, judged by the layout it is left in
+        void imageConsumer(VkImageLayout layout, VkPipelineStageFlags &stages,
+                           VkAccessFlags &access) {
+            switch (layout) {
+            case VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL:
+                stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+                access = VK_ACCESS_TRANSFER_READ_BIT;
+                break;
+            case VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL:
+                stages = VK_PIPELINE_STAGE_TRANSFER_BIT;
+                access = VK_ACCESS_TRANSFER_WRITE_BIT;
+                break;
+            case VK_IMAGE_LAYOUT_GENERAL:
+                stages = VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                access = VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+                break;
+            default:
+                stages = VK_PIPELINE_STAGE_VERTEX_SHADER_BIT |
+                         VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT |
+                         VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT;
+                access = VK_ACCESS_SHADER_READ_BIT;
+                break;
+            }
+        }
+    } // namespace
+
+    StagingUploader::StagingUploader(VkDevice device, GpuMemoryAllocator &allocator,
+                                     VkQueue transferQueue, uint32_t transferFamily,
+                                     uint32_t graphicsFamily, VkDeviceSize ringSize)
+        : device(device), allocator(allocator), queue(transferQueue),
+          transferFamily(transferFamily), graphicsFamily(graphicsFamily),
+          capacity(alignUp(std::max<VkDeviceSize>(ringSize, kRingGranularity),
+                           kRingGranularity)) {
+        VkCommandPoolCreateInfo poolInfo{};
+        poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+        poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT |
+                         VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;
+        poolInfo.queueFamilyIndex = transferFamily;
+        VK_CHECK_RESULT(vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool));
+
+        VkBufferCreateInfo bufferInfo{};
+        bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+        bufferInfo.size = capacity;
+        bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+        bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+        GpuAllocationCreateInfo allocInfo{};
+        allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                  VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+        allocInfo.mapped = true;
+        allocInfo.dedicated = true;
+        allocator.createBuffer(bufferInfo, allocInfo, ringBuffer, ringMemory);
+    }
+
+    StagingUploader::~StagingUploader() {
+        for (auto &batch : inFlight) {
+            vkWaitForFences(device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+            recycle(batch);
+            spareBatches.push_back(std::move(batch));
+        }
+        inFlight.clear();
+        if (recording) {
+            recycle(recordingBatch);
+            spareBatches.push_back(std::move(recordingBatch));
+            recording = false;
+        }
+
+        for (auto &batch : spareBatches) {
+            vkDestroyFence(device, batch.fence, nullptr);
+        }
+        spareBatches.clear();
+
+        // Frees every command buffer, including one left mid-recording
+        vkDestroyCommandPool(device, commandPool, nullptr);
+        allocator.destroyBuffer(ringBuffer, ringMemory);
+    }
+
+    StagingUploader::Batch &StagingUploader::currentBatch() {
+        if (recording)
+            return recordingBatch;
+
+        if (!spareBatches.empty()) {
+            recordingBatch = std::move(spareBatches.back());
+            spareBatches.pop_back();
+        } else {
+            recordingBatch = Batch{};
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPool;
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+            VK_CHECK_RESULT(
+                vkAllocateCommandBuffers(device, &allocInfo, &recordingBatch.cmd));
+
+            VkFenceCreateInfo fenceInfo{};
+            fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+            VK_CHECK_RESULT(
+                vkCreateFence(device, &fenceInfo, nullptr, &recordingBatch.fence));
+        }
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(recordingBatch.cmd, &beginInfo));
+
+        recordingBatch.ticket = nextTicket++;
+        recording = true;
+        return recordingBatch;
+    }
+
+    bool StagingUploader::tryReserve(VkDeviceSize size, VkDeviceSize alignment,
+                                     uint64_t &position) {
+        if (head == tail) {
+            // Nothing holds ring space: restart at a lap boundary so that
+            // any upload up to the capacity fits without wrapping
+            head = alignUp(head, capacity);
+            tail = head;
+        }
+
+        uint64_t start = alignUp(head, alignment);
+        if (start % capacity + size > capacity) {
+            // Does not fit before the end of the ring; wrap to the next lap
+            start = alignUp(start, capacity);
+        }
+        if (start + size - tail > capacity)
+            return false;
+
+        head = start + size;
+        position = start;
+        return true;
+    }
+
+    void *StagingUploader::stage(const void *data, VkDeviceSize size,
+                                 VkDeviceSize alignment, VkBuffer &buffer,
+                                 VkDeviceSize &offset) {
+        if (size > capacity) {
+            // Rare (whole levels, huge atlases): a one-off staging buffer that
+            // dies with the batch.
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = size;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            GpuAllocationCreateInfo allocInfo{};
+            allocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                      VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            allocInfo.mapped = true;
+
+            GpuAllocation allocation;
+            allocator.createBuffer(bufferInfo, allocInfo, buffer, allocation);
+            std::memcpy(allocation.mapped, data, static_cast<size_t>(size));
+            currentBatch().oversized.emplace_back(buffer, allocation);
+            offset = 0;
+            return allocation.mapped;
+        }
+
+        uint64_t position;
+        while (!tryReserve(size, alignment, position)) {
+            if (!inFlight.empty()) {
+                retire(true);
+            } else if (recording) {
+                // Only the batch being recorded holds ring space
+                submit();
+            } else {
+                // The ring is idle and still has no room; waiting cannot help
+                throw std::runtime_error("Staging ring cannot hold an upload of " +
+                                         std::to_string(size) + " bytes");
+            }
+        }
+
+        buffer = ringBuffer;
+        offset = position % capacity;
+        void *dst = static_cast<char *>(ringMemory.mapped) + offset;
+        std::memcpy(dst, data, static_cast<size_t>(size));
+        return dst;
+    }
+
+    StagingUploader::Ticket StagingUploader::uploadBuffer(VkBuffer dst,
+                                                          VkDeviceSize dstOffset,
+                                                          const void *data,
+                                                          VkDeviceSize size) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkBuffer     srcBuffer;
+        VkDeviceSize srcOffset;
+        stage(data, size, kBufferAlignment, srcBuffer, srcOffset);
+
+        Batch &batch = currentBatch();
+
+        VkBufferCopy region{};
+        region.srcOffset = srcOffset;
+        region.dstOffset = dstOffset;
+        region.size = size;
+        vkCmdCopyBuffer(batch.cmd, srcBuffer, dst, 1, &region);
+
+        VkBufferMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.buffer = dst;
+        barrier.offset = dstOffset;
+        barrier.size = size;
+
+        if (usesDedicatedQueue()) {
+            // Release here, acquire on the graphics queue in beginFrame()
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+            vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 1,
+                                 &barrier, 0, nullptr);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = kBufferConsumerAccess;
+            batch.bufferAcquires.push_back(barrier);
+        } else {
+            barrier.dstAccessMask = kBufferConsumerAccess;
+            barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+            vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 kBufferConsumerStages, 0, 0, nullptr, 1, &barrier, 0,
+                                 nullptr);
+        }
+
+        return batch.ticket;
+    }
+
+    StagingUploader::Ticket StagingUploader::uploadImage(const ImageUpload &upload,
+                                                         const void *data,
+                                                         VkDeviceSize size) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        VkBuffer     srcBuffer;
+        VkDeviceSize srcOffset;
+        stage(data, size, kImageAlignment, srcBuffer, srcOffset);
+
+        Batch &batch = currentBatch();
+
+        VkImageMemoryBarrier barrier{};
+        barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = upload.oldLayout;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = upload.image;
+        barrier.subresourceRange.aspectMask = upload.subresource.aspectMask;
+        barrier.subresourceRange.baseMipLevel = upload.subresource.mipLevel;
+        barrier.subresourceRange.levelCount = 1;
+        barrier.subresourceRange.baseArrayLayer = upload.subresource.baseArrayLayer;
+        barrier.subresourceRange.layerCount = upload.subresource.layerCount;
+
+        vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                             VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr,
+                             1, &barrier);
+
+        VkBufferImageCopy region{};
+        region.bufferOffset = srcOffset;
+        region.imageSubresource = upload.subresource;
+        region.imageOffset = upload.offset;
+        region.imageExtent = upload.extent;
+        vkCmdCopyBufferToImage(batch.cmd, srcBuffer, upload.image,
+                               VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+        VkPipelineStageFlags consumerStages;
+        VkAccessFlags        consumerAccess;
+        imageConsumer(upload.finalLayout, consumerStages, consumerAccess);
+
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = upload.finalLayout;
+
+        if (usesDedicatedQueue()) {
+            // The layout transition is part of the release/acquire pair and
+            // must be spelled identically on both queues.
+            barrier.dstAccessMask = 0;
+            barrier.srcQueueFamilyIndex = transferFamily;
+            barrier.dstQueueFamilyIndex = graphicsFamily;
+            vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                                 VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, 0, 0, nullptr, 0,
+                                 nullptr, 1, &barrier);
+
+            barrier.srcAccessMask = 0;
+            barrier.dstAccessMask = consumerAccess;
+            batch.imageAcquires.push_back(barrier);
+        } else {
+            barrier.dstAccessMask = consumerAccess;
+            vkCmdPipelineBarrier(batch.cmd, VK_PIPELINE_STAGE_TRANSFER_BIT, consumerStages,
+                                 0, 0, nullptr, 0, nullptr, 1, &barrier);
+        }
+
+        return batch.ticket;
+    }
+
+    void StagingUploader::submit() {
+        if (!recording)
+            return;
+
+        Batch &batch = recordingBatch;
+        VK_CHECK_RESULT(vkEndCommandBuffer(batch.cmd));
+
+        VkSubmitInfo submitInfo{};
+        submitInfo.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers = &batch.cmd;
+        VK_CHECK_RESULT(vkQueueSubmit(queue, 1, &submitInfo, batch.fence));
+
+        batch.ringEnd = head;
+        inFlight.push_back(std::move(batch));
+        recording = false;
+    }
+
+    StagingUploader::Ticket StagingUploader::flush() {
+        std::lock_guard<std::mutex> lock(mutex);
+        submit();
+        return nextTicket - 1;
+    }
+
+    void StagingUploader::retire(bool block) {
+        if (block && !inFlight.empty()) {
+            VK_CHECK_RESULT(vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE,
+                                            UINT64_MAX));
+        }
+
+        // Batches complete in submission order on a single queue
+        while (!inFlight.empty()) {
+            Batch   &batch = inFlight.front();
+            VkResult status = vkGetFenceStatus(device, batch.fence);
+            if (status == VK_NOT_READY)
+                break;
+            VK_CHECK_RESULT(status);
+
+            // A restart at a lap boundary may have moved the tail past
+            // batches that used no ring space
+            tail = std::max(tail, batch.ringEnd);
+            retiredTicket = batch.ticket;
+            pendingBufferAcquires.insert(pendingBufferAcquires.end(),
+                                         batch.bufferAcquires.begin(),
+                                         batch.bufferAcquires.end());
+            pendingImageAcquires.insert(pendingImageAcquires.end(),
+                                        batch.imageAcquires.begin(),
+                                        batch.imageAcquires.end());
+
+            recycle(batch);
+            spareBatches.push_back(std::move(batch));
+            inFlight.pop_front();
+        }
+    }
+
+    void StagingUploader::recycle(Batch &batch) {
+        for (auto &[buffer, allocation] : batch.oversized) {
+            allocator.destroyBuffer(buffer, allocation);
+        }
+        batch.oversized.clear();
+        batch.bufferAcquires.clear();
+        batch.imageAcquires.clear();
+        vkResetFences(device, 1, &batch.fence);
+    }
+
+    bool StagingUploader::isReady(Ticket ticket) const {
+        std::lock_guard<std::mutex> lock(mutex);
+        return ticket <= acquiredTicket;
+    }
+
+    void StagingUploader::wait(Ticket ticket) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        if (recording && ticket >= recordingBatch.ticket) {
+            submit();
+        }
+        while (retiredTicket < ticket && !inFlight.empty()) {
+            retire(true);
+        }
+    }
+
+    void StagingUploader::beginFrame(VkCommandBuffer cmd) {
+        std::lock_guard<std::mutex> lock(mutex);
+
+        submit();
+        retire(false);
+
+        if (!pendingBufferAcquires.empty() || !pendingImageAcquires.empty()) {
+            vkCmdPipelineBarrier(
+                cmd, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT,
+                kBufferConsumerStages | VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr,
+                static_cast<uint32_t>(pendingBufferAcquires.size()),
+                pendingBufferAcquires.data(),
+                static_cast<uint32_t>(pendingImageAcquires.size()),
+                pendingImageAcquires.data());
+            pendingBufferAcquires.clear();
+            pendingImageAcquires.clear();
+        }
+
+        acquiredTicket = retiredTicket;
+    }
+
+} // namespace Retoccilus::Core
@@ -0,0 +1,129 @@
+#ifndef STAGING_UPLOADER_H
+#define STAGING_UPLOADER_H
+
+#include "GpuMemoryAllocator.h"
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+namespace Retoccilus::Core {
+
+    // Destination of an image upload. The image is moved from `oldLayout`
+    // to `finalLayout` around the copy.
+    struct ImageUpload {
+        VkImage                  image = VK_NULL_HANDLE;
+        VkImageSubresourceLayers subresource{VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        VkOffset3D               offset{0, 0, 0};
+        VkExtent3D               extent{0, 0, 1};
+        VkImageLayout            oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        VkImageLayout            finalLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    };
+
+    // Streams buffer and image data to the GPU through a persistently mapped
+    // staging ring, on the transfer queue when the device has a dedicated
+    // one. Uploads are grouped into batches; each batch is one submit with
+    // its own fence, and its ring space is recycled once the fence signals.
+    //
+    // Rendering never waits for a transfer: a batch is handed over to the
+    // graphics queue (queue family ownership acquire, or a plain barrier on
+    // single-family devices) at the start of the first frame recorded after
+    // its fence signalled. Resources of a ticket may be used by draws once
+    // isReady(ticket) returns true.
+    //
+    // Not thread-safe with respect to the graphics queue when both families
+    // are the same; call from the render thread.
+    class StagingUploader {
+      public:
+        using Ticket = uint64_t;
+
+        StagingUploader(VkDevice device, GpuMemoryAllocator &allocator,
+                        VkQueue transferQueue, uint32_t transferFamily,
+                        uint32_t graphicsFamily, VkDeviceSize ringSize);
+        ~StagingUploader();
+
+        StagingUploader(const StagingUploader &) = delete;
+        StagingUploader &operator=(const StagingUploader &) = delete;
+
+        // Copy `size` bytes into `dst` at `dstOffset`. Returns the ticket of
+        // the batch carrying the copy.
+        Ticket uploadBuffer(VkBuffer dst, VkDeviceSize dstOffset, const void *data,
+                            VkDeviceSize size);
+        // `data` is tightly packed texels for upload.extent
+        Ticket uploadImage(const ImageUpload &upload, const void *data, VkDeviceSize size);
+
+        // Submit the batch being recorded. Returns its ticket, or the last
+        // submitted ticket if nothing was pending.
+        Ticket flush();
+
+        bool isReady(Ticket ticket) const;
+        // Block until the transfer of `ticket` finished. The resources still
+        // become usable only at the next beginFrame().
+        void wait(Ticket ticket);
+
+        // Called by the wrapper with the frame's command buffer before the
+        // render pass: submits pending uploads, retires finished batches and
+        // records their ownership acquire barriers.
+        void beginFrame(VkCommandBuffer cmd);
+
+        VkDeviceSize ringCapacity() const { return capacity; }
+        VkDeviceSize ringBytesInFlight() const { return head - tail; }
+        bool         usesDedicatedQueue() const { return transferFamily != graphicsFamily; }
+
+      private:
+        struct Batch {
+            VkCommandBuffer cmd = VK_NULL_HANDLE;
+            VkFence         fence = VK_NULL_HANDLE;
+            Ticket          ticket = 0;
+            uint64_t        ringEnd = 0;
+
+            // Uploads larger than the whole ring get their own staging buffer
+            std::vector<std::pair<VkBuffer, GpuAllocation>> oversized;
+
+            std::vector<VkBufferMemoryBarrier> bufferAcquires;
+            std::vector<VkImageMemoryBarrier>  imageAcquires;
+        };
+
+        Batch &currentBatch();
+        void  *stage(const void *data, VkDeviceSize size, VkDeviceSize alignment,
+                     VkBuffer &buffer, VkDeviceSize &offset);
+        bool   tryReserve(VkDeviceSize size, VkDeviceSize alignment, uint64_t &position);
+        void   submit();
+        void   retire(bool block);
+        void   recycle(Batch &batch);
+
+        VkDevice            device;
+        GpuMemoryAllocator &allocator;
+        VkQueue             queue;
+        uint32_t            transferFamily;
+        uint32_t            graphicsFamily;
+
+        VkCommandPool commandPool = VK_NULL_HANDLE;
+        VkBuffer      ringBuffer = VK_NULL_HANDLE;
+        GpuAllocation ringMemory;
+        VkDeviceSize  capacity;
+
+        // Monotonic byte positions; the physical offset is position % capacity
+        uint64_t head = 0;
+        uint64_t tail = 0;
+
+        bool               recording = false;
+        Batch              recordingBatch;
+        std::deque<Batch>  inFlight;
+        std::vector<Batch> spareBatches;
+
+        // Ownership acquires of retired batches, recorded by beginFrame()
+        std::vector<VkBufferMemoryBarrier> pendingBufferAcquires;
+        std::vector<VkImageMemoryBarrier>  pendingImageAcquires;
+
+        Ticket nextTicket = 1;
+        Ticket retiredTicket = 0;
+        Ticket acquiredTicket = 0;
+
+        mutable std::mutex mutex;
+    };
+
+} // namespace Retoccilus::Core
+
+#endif // STAGING_UPLOADER_H
@@ -1,36 +1,55 @@
 #include "VulkanWrapper.h"
+#include <algorithm>
+#include <chrono>
 #include <cstring>
 #include <iostream>
-#include <set>
-
-#define VK_CHECK_RESULT(f)                                                    \
-    {                                                                         \
-        VkResult res = (f);                                                   \
-        if (res != VK_SUCCESS) {                                              \
-            throw std::runtime_error("Vulkan error: " + std::to_string(res)); \
-        }                                                                     \
-    }
+#include <thread>
 
 namespace Retoccilus::Core {
+
+    namespace {
+        // A present wait gives up after this, in nanoseconds, so that
+        // destroying a swapchain never waits on it for long
+        constexpr uint64_t kPresentWaitTimeout = 100'000'000;
+
+        double millisecondsSince(FramePacer::Clock::time_point start) {
+            return std::chrono::duration<double, std::milli>(FramePacer::Clock::now() - start)
+                .count();
+        }
+    } // namespace
+
     VulkanWrapper::VulkanWrapper(uint32_t width, uint32_t height,
-                                 const std::string &title)
-        : windowWidth(width), windowHeight(height) {
-        // Initialize GLFW
-        if (!glfwInit()) {
-            throw std::runtime_error("Failed to initialize GLFW");
+                                 const std::string &title, WindowMode mode)
+        : VulkanWrapper(std::make_shared<RenderContext>(mode), width, height, title, mode) {
+        ownsContext = true;
+    }
+
+    VulkanWrapper::VulkanWrapper(std::shared_ptr<RenderContext> context, uint32_t width,
+                                 uint32_t height, const std::string &title, WindowMode mode)
+        : windowWidth(width), windowHeight(height), windowMode(mode),
+          context(std::move(context)) {
+        recordingThreads = std::max(std::thread::hardware_concurrency(), 1u) - 1;
+
+        if (isHeadless()) {
+            return;
+        }
+        if (this->context->isHeadless()) {
+            throw std::runtime_error("A headless context cannot present to a window");
         }
 
-        // Create GLFW window
-        glfwWindowHint(GLFW_CLIENT_API, GLFW_NO_API);
+        // GLFW is initialised by the context
         window = glfwCreateWindow(width, height, title.c_str(), nullptr, nullptr);
         if (!window) {
-            glfwTerminate();
             throw std::runtime_error("Failed to create GLFW window");
         }
 
-        // Default extensions and validation layers
-        deviceExtensions = {VK_KHR_SWAPCHAIN_EXTENSION_NAME};
-        validationLayers = {"VK_LAYER_KHRONOS_validation"};
+        glfwSetWindowUserPointer(window, this);
+        glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);
+    }
+
+    void VulkanWrapper::framebufferResizeCallback(GLFWwindow *window, int, int) {
+        auto *wrapper = static_cast<VulkanWrapper *>(glfwGetWindowUserPointer(window));
+        wrapper->framebufferResized = true;
     }
 
     VulkanWrapper::~VulkanWrapper() {
@@ -38,214 +57,467 @@ namespace Retoccilus::Core {
         if (window) {
             glfwDestroyWindow(window);
         }
-        glfwTerminate();
     }
 
     void VulkanWrapper::initVulkan() {
+        initTimings.clear();
+        auto stage = [this](const char *name, void (VulkanWrapper::*step)()) {
+            auto start = std::chrono::steady_clock::now();
+            (this->*step)();
+            std::chrono::duration<double, std::milli> elapsed =
+                std::chrono::steady_clock::now() - start;
+            initTimings.push_back(InitStageTiming{name, elapsed.count()});
+        };
+
+        // Context steps are timed by the context; only the ones this view
+        // ran are reported
+        size_t contextStages = context->getInitTimings().size();
+        auto   adoptContextTimings = [&]() {
+            const auto &timings = context->getInitTimings();
+            initTimings.insert(initTimings.end(), timings.begin() + contextStages, timings.end());
+            contextStages = timings.size();
+        };
+
         createInstance();
-        setupDebugMessenger();
-        createSurface();
-        pickPhysicalDevice();
-        createLogicalDevice();
-        createSwapChain();
-        createImageViews();
-        createSyncObjects();
+        adoptContextTimings();
+        if (!isHeadless()) {
+            stage("createSurface", &VulkanWrapper::createSurface);
+        }
+        createDevice();
+        adoptContextTimings();
+        stage("createFrameArena", &VulkanWrapper::createFrameArena);
+        stage("createDescriptorAllocator", &VulkanWrapper::createDescriptorAllocator);
+        if (isHeadless()) {
+            stage("createOffscreenTargets", &VulkanWrapper::createOffscreenTargets);
+        } else {
+            stage("createSwapChain", &VulkanWrapper::createSwapChain);
+        }
+        stage("createImageViews", &VulkanWrapper::createImageViews);
+        stage("createRenderPass", &VulkanWrapper::createRenderPass);
+        stage("createFramebuffers", &VulkanWrapper::createFramebuffers);
+        stage("createCommandBuffers", &VulkanWrapper::createCommandBuffers);
+        stage("createSyncObjects", &VulkanWrapper::createSyncObjects);
+        stage("createProfiler", &VulkanWrapper::createProfiler);
+        stage("createParallelRecorder", &VulkanWrapper::createParallelRecorder);
+        stage("createRenderGraph", &VulkanWrapper::createRenderGraph);
     }
 
     void VulkanWrapper::mainLoop() {
+        if (isHeadless()) {
+            for (uint32_t i = 0; i < headlessFrameLimit; i++) {
+                drawFrame();
+            }
+            context->wait(frameSubmissions[(currentFrame + maxFramesInFlight - 1) %
+                                           maxFramesInFlight]);
+
+            // Hand out whatever is still waiting for readback, oldest first
+            for (size_t i = 0; i < offscreenTargets.size(); i++) {
+                deliverReadback((currentFrame + i) % offscreenTargets.size());
+            }
+            return;
+        }
+
         while (!glfwWindowShouldClose(window)) {
+            waitForFrameStart();
             glfwPollEvents();
-            // TODO: Add rendering logic
+            drawFrame();
         }
         vkDeviceWaitIdle(device);
     }
 
+    void VulkanWrapper::drawFrame() {
+        drawFrames({this});
+    }
+
+    void VulkanWrapper::drawFrames(const std::vector<VulkanWrapper *> &views) {
+        if (views.empty())
+            return;
+
+        RenderContext &context = *views.front()->context;
+        waitForFrameStart(views);
+
+        std::vector<RenderContext::FrameSubmission> submissions;
+        std::vector<VulkanWrapper *>                recorded;
+        submissions.reserve(views.size());
+        recorded.reserve(views.size());
+
+        for (VulkanWrapper *view : views) {
+            if (view->context.get() != &context) {
+                throw std::runtime_error("drawFrames() needs views of one context");
+            }
+
+            RenderContext::FrameSubmission submission;
+            bool                           record = view->isHeadless()
+                                                        ? view->recordOffscreenFrame(submission)
+                                                        : view->recordWindowFrame(submission);
+            if (record) {
+                submissions.push_back(submission);
+                recorded.push_back(view);
+            }
+        }
+
+        if (recorded.empty())
+            return;
+
+        // The batch is timed by the first view that has a frame in it
+        std::vector<VkResult>       presentResults;
+        RenderContext::SubmissionId submission;
+        {
+            FrameProfiler::CpuScope scope(*recorded.front()->profiler, "SubmitAndPresent");
+            submission = context.submitFrames(submissions, presentResults);
+        }
+
+        for (size_t i = 0; i < recorded.size(); i++) {
+            recorded[i]->finishFrame(submission, presentResults[i]);
+        }
+    }
+
+    void VulkanWrapper::waitForFrameStart() {
+        if (isHeadless() || pacer.isInFrame())
+            return;
+
+        FrameProfiler::CpuScope scope(*profiler, "FramePacing");
+        pacer.beginFrame();
+    }
+
+    void VulkanWrapper::waitForFrameStart(const std::vector<VulkanWrapper *> &views) {
+        // The views' frames go out in one submission, which blocks once, so
+        // one sleep paces them all
+        bool paced = false;
+        for (VulkanWrapper *view : views) {
+            if (view->isHeadless() || view->pacer.isInFrame())
+                continue;
+
+            if (paced) {
+                view->pacer.beginFrame(false);
+            } else {
+                view->waitForFrameStart();
+                paced = true;
+            }
+        }
+    }
+
+    void VulkanWrapper::reportCompletedFrames() {
+        if (context->isPresentWaitEnabled())
+            return;
+
+        // Slots from currentFrame on hold the oldest frames first
+        for (size_t i = 0; i < maxFramesInFlight; i++) {
+            size_t slot = (currentFrame + i) % maxFramesInFlight;
+            if (framePacingIds[slot] != 0 && context->isComplete(frameSubmissions[slot])) {
+                pacer.framePresented(framePacingIds[slot], FramePacer::Clock::now(), false);
+                framePacingIds[slot] = 0;
+            }
+        }
+    }
+
+    void VulkanWrapper::waitForPresentJobs() {
+        if (context->isPresentWaitEnabled())
+            context->getJobSystem().wait(presentWaitJobs);
+    }
+
+    void VulkanWrapper::waitForFrameSlot() {
+        FrameProfiler::CpuScope scope(*profiler, "WaitForFrame");
+        context->wait(frameSubmissions[currentFrame]);
+    }
+
+    void VulkanWrapper::beginCommandBuffer(VkCommandBuffer cmd) {
+        VK_CHECK_RESULT(vkResetCommandPool(device, commandPools[currentFrame], 0));
+        parallelRecorder->beginFrame(static_cast<uint32_t>(currentFrame));
+        frameArena->reset(static_cast<uint32_t>(currentFrame));
+        descriptorAllocator->reset(static_cast<uint32_t>(currentFrame));
+
+        VkCommandBufferBeginInfo beginInfo{};
+        beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+        beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+        VK_CHECK_RESULT(vkBeginCommandBuffer(cmd, &beginInfo));
+        profiler->beginFrame(cmd, static_cast<uint32_t>(currentFrame), frameNumber);
+        updateRenderExtent();
+    }
+
+    void VulkanWrapper::updateRenderExtent() {
+        renderExtent = swapChainExtent;
+        if (!isSceneScaled())
+            return;
+
+        // The profiler has just collected the slot's previous frame
+        if (std::optional<FrameGpuTime> time = profiler->getLatestGpuTime())
+            resolutionScaler.update(time->frameNumber, time->gpuMs, frameNumber);
+        renderExtent = resolutionScaler.apply(swapChainExtent);
+    }
+
+    bool VulkanWrapper::recordWindowFrame(RenderContext::FrameSubmission &submission) {
+        waitForFrameStart();
+
+        auto blockedSince = FramePacer::Clock::now();
+        if (pacer.isEnabled()) {
+            // One frame in flight: a frame queued behind another would only
+            // show input older by a frame
+            FrameProfiler::CpuScope scope(*profiler, "WaitForFrame");
+            context->wait(frameSubmissions[(currentFrame + maxFramesInFlight - 1) %
+                                           maxFramesInFlight]);
+        }
+        waitForFrameSlot();
+        pacer.addBlockedTime(millisecondsSince(blockedSince));
+        reportCompletedFrames();
+
+        // A submission's completion covers every earlier one on the queue
+        completedFrames = std::max(completedFrames, frameSerials[currentFrame]);
+        destroyRetiredSwapChains(false);
+
+        if (framebufferResized || presentModeChanged) {
+            recreateSwapChain();
+        }
+
+        uint32_t imageIndex;
+        VkResult result;
+        blockedSince = FramePacer::Clock::now();
+        {
+            FrameProfiler::CpuScope scope(*profiler, "Acquire");
+            result = vkAcquireNextImageKHR(device, swapChain, UINT64_MAX,
+                                           imageAvailableSemaphores[currentFrame],
+                                           VK_NULL_HANDLE, &imageIndex);
+        }
+
+        if (result == VK_ERROR_OUT_OF_DATE_KHR) {
+            // The next attempt starts a frame of its own
+            pacer.addBlockedTime(millisecondsSince(blockedSince));
+            pacer.abandonFrame();
+            recreateSwapChain();
+            return false;
+        } else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR) {
+            throw std::runtime_error("Failed to acquire swapchain image: " +
+                                     std::to_string(result));
+        }
+
+        // With more images than frames in flight, the acquired image can still
+        // belong to an older frame slot.
+        context->wait(imageSubmissions[imageIndex]);
+        acquiredImage = imageIndex;
+        pacer.addBlockedTime(millisecondsSince(blockedSince));
+
+        VkCommandBuffer cmd = commandBuffers[currentFrame];
+        beginCommandBuffer(cmd);
+
+        {
+            FrameProfiler::CpuScope cpuScope(*profiler, "Record");
+            FrameProfiler::GpuScope gpuScope(*profiler, cmd, "Frame");
+            context->getUploader().beginFrame(cmd);
+            if (uploadCallback)
+                uploadCallback(cmd);
+            recordRenderPass(cmd, imageIndex);
+        }
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+
+        submission.cmd = cmd;
+        submission.waitSemaphore = imageAvailableSemaphores[currentFrame];
+        submission.waitStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        submission.signalSemaphore = renderFinishedSemaphores[imageIndex];
+        submission.swapChain = swapChain;
+        submission.imageIndex = imageIndex;
+
+        pacingId = pacer.endFrame();
+        if (context->isPresentWaitEnabled())
+            submission.presentId = pacingId;
+        return true;
+    }
+
+    void VulkanWrapper::finishFrame(RenderContext::SubmissionId submission,
+                                    VkResult presentResult) {
+        frameSubmissions[currentFrame] = submission;
+        frameSerials[currentFrame] = frameNumber + 1;
+        profiler->endFrame();
+
+        if (isHeadless()) {
+            offscreenTargets[currentFrame].pendingFrame = frameNumber;
+        } else {
+            imageSubmissions[acquiredImage] = submission;
+            framePacingIds[currentFrame] = pacingId;
+        }
+
+        // One present wait at a time; frames presented meanwhile go
+        // unmeasured
+        if (!isHeadless() && context->isPresentWaitEnabled() && presentResult == VK_SUCCESS &&
+            presentWaitJobs.isDone()) {
+            RenderContext *presentContext = context.get();
+            FramePacer    *framePacer = &pacer;
+            VkSwapchainKHR presentSwapChain = swapChain;
+            uint64_t       id = pacingId;
+            context->getJobSystem().runBackground(
+                [presentContext, framePacer, presentSwapChain, id]() {
+                    VkResult result = presentContext->waitForPresent(presentSwapChain, id,
+                                                                     kPresentWaitTimeout);
+                    if (result == VK_SUCCESS)
+                        framePacer->framePresented(id, FramePacer::Clock::now(), true);
+                },
+                &presentWaitJobs);
+        }
+
+        frameNumber++;
+        currentFrame = (currentFrame + 1) % maxFramesInFlight;
+
+        if (presentResult == VK_ERROR_OUT_OF_DATE_KHR || presentResult == VK_SUBOPTIMAL_KHR) {
+            // Recreated at the start of the next frame, after its slot wait
+            framebufferResized = true;
+        } else if (presentResult != VK_SUCCESS) {
+            throw std::runtime_error("Failed to present swapchain image: " +
+                                     std::to_string(presentResult));
+        }
+    }
+
     // Configuration methods
     void VulkanWrapper::setDeviceExtensions(
         const std::vector<const char *> &extensions) {
-        deviceExtensions = extensions;
+        context->setDeviceExtensions(extensions);
     }
 
     void VulkanWrapper::setValidationLayers(
         const std::vector<const char *> &layers) {
-        validationLayers = layers;
+        context->setValidationLayers(layers);
+    }
+
+    void VulkanWrapper::setRequiredDeviceFeatures(const VkPhysicalDeviceFeatures &features) {
+        context->setRequiredDeviceFeatures(features);
+    }
+
+    void VulkanWrapper::setPreferredDevice(const std::string &selector) {
+        context->setPreferredDevice(selector);
     }
 
+    // Both counts are read when the swapchain and per-frame resources are
+    // created, so they must be set before initVulkan().
     void VulkanWrapper::setSwapchainImageCount(uint32_t count) {
         swapchainImageCount = count;
     }
 
     void VulkanWrapper::setMaxFramesInFlight(uint32_t count) {
-        maxFramesInFlight = count;
+        maxFramesInFlight = std::max(count, 1u);
     }
 
-    void VulkanWrapper::createInstance() {
-        if (validationLayers.size() > 0 && !checkValidationLayerSupport()) {
-            throw std::runtime_error(
-                "Validation layers requested but not available");
-        }
-
-        VkApplicationInfo appInfo{};
-        appInfo.sType = VK_STRUCTURE_TYPE_APPLICATION_INFO;
-        appInfo.pApplicationName = "Vulkan App";
-        appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.pEngineName = "No Engine";
-        appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-        appInfo.apiVersion = VK_API_VERSION_1_0;
-
-        VkInstanceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_INSTANCE_CREATE_INFO;
-        createInfo.pApplicationInfo = &appInfo;
-
-        auto extensions = getRequiredExtensions();
-        createInfo.enabledExtensionCount = static_cast<uint32_t>(extensions.size());
-        createInfo.ppEnabledExtensionNames = extensions.data();
-
-        VkDebugUtilsMessengerCreateInfoEXT debugCreateInfo{};
-        if (validationLayers.size() > 0) {
-            createInfo.enabledLayerCount =
-                static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames = validationLayers.data();
-
-            debugCreateInfo.sType =
-                VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-            debugCreateInfo.messageSeverity =
-                VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-                VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-                VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-            debugCreateInfo.messageType =
-                VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-                VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-                VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-            debugCreateInfo.pfnUserCallback = debugCallback;
-            createInfo.pNext =
-                (VkDebugUtilsMessengerCreateInfoEXT *)&debugCreateInfo;
-        } else {
-            createInfo.enabledLayerCount = 0;
-            createInfo.pNext = nullptr;
-        }
+    void VulkanWrapper::setHeadlessFrameLimit(uint32_t frames) {
+        headlessFrameLimit = frames;
+    }
 
-        VK_CHECK_RESULT(vkCreateInstance(&createInfo, nullptr, &instance));
+    void VulkanWrapper::setStagingBufferSize(VkDeviceSize size) {
+        context->setStagingBufferSize(size);
     }
 
-    void VulkanWrapper::setupDebugMessenger() {
-        if (validationLayers.size() == 0)
-            return;
+    void VulkanWrapper::setPipelineCachePath(const std::string &path) {
+        context->setPipelineCachePath(path);
+    }
 
-        VkDebugUtilsMessengerCreateInfoEXT createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEBUG_UTILS_MESSENGER_CREATE_INFO_EXT;
-        createInfo.messageSeverity =
-            VK_DEBUG_UTILS_MESSAGE_SEVERITY_VERBOSE_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_SEVERITY_WARNING_BIT_EXT |
-            VK_DEBUG_UTILS_MESSAGE_SEVERITY_ERROR_BIT_EXT;
-        createInfo.messageType = VK_DEBUG_UTILS_MESSAGE_TYPE_GENERAL_BIT_EXT |
-                                 VK_DEBUG_UTILS_MESSAGE_TYPE_VALIDATION_BIT_EXT |
-                                 VK_DEBUG_UTILS_MESSAGE_TYPE_PERFORMANCE_BIT_EXT;
-        createInfo.pfnUserCallback = debugCallback;
+    void VulkanWrapper::setProfilingEnabled(bool enabled) {
+        profilingEnabled = enabled;
+        if (profiler)
+            profiler->setEnabled(profilingEnabled || dynamicResolution);
+    }
 
-        auto func = (PFN_vkCreateDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
-            instance, "vkCreateDebugUtilsMessengerEXT");
-        if (func) {
-            VK_CHECK_RESULT(func(instance, &createInfo, nullptr, &debugMessenger));
-        }
+    void VulkanWrapper::setRecordingThreads(uint32_t count) {
+        recordingThreads = count;
+        if (parallelRecorder)
+            parallelRecorder->setThreadCount(recordingThreads + 1);
     }
 
-    void VulkanWrapper::createSurface() {
-        VK_CHECK_RESULT(
-            glfwCreateWindowSurface(instance, window, nullptr, &surface));
+    void VulkanWrapper::setPresentPolicy(PresentPolicy policy) {
+        presentPolicy = policy;
+        pacer.setEnabled(latencyMode || presentPolicy == PresentPolicy::PowerSaving);
+        if (swapChain != VK_NULL_HANDLE)
+            presentModeChanged = true;
     }
 
-    void VulkanWrapper::pickPhysicalDevice() {
-        uint32_t deviceCount = 0;
-        vkEnumeratePhysicalDevices(instance, &deviceCount, nullptr);
+    void VulkanWrapper::setLatencyMode(bool enabled) {
+        latencyMode = enabled;
+        pacer.setEnabled(latencyMode || presentPolicy == PresentPolicy::PowerSaving);
+    }
 
-        if (deviceCount == 0) {
-            throw std::runtime_error("Failed to find GPUs with Vulkan support");
-        }
+    void VulkanWrapper::setDynamicResolution(bool enabled) {
+        dynamicResolution = enabled;
+        if (!dynamicResolution)
+            resolutionScaler.reset();
+        if (profiler)
+            profiler->setEnabled(profilingEnabled || dynamicResolution);
+    }
 
-        std::vector<VkPhysicalDevice> devices(deviceCount);
-        vkEnumeratePhysicalDevices(instance, &deviceCount, devices.data());
+    void VulkanWrapper::setDynamicResolutionSettings(const ResolutionScaler::Settings &settings) {
+        resolutionScaler.setSettings(settings);
+    }
 
-        for (const auto &device : devices) {
-            if (isDeviceSuitable(device)) {
-                physicalDevice = device;
-                break;
-            }
-        }
+    void VulkanWrapper::setRecordCallback(RecordCallback callback) {
+        recordCallback = std::move(callback);
+    }
 
-        if (physicalDevice == VK_NULL_HANDLE) {
-            throw std::runtime_error("Failed to find a suitable GPU");
-        }
+    void VulkanWrapper::setParallelRecordCallback(ParallelRecordCallback callback) {
+        parallelRecordCallback = std::move(callback);
     }
 
-    void VulkanWrapper::createLogicalDevice() {
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
+    void VulkanWrapper::setOverlayCallback(RecordCallback callback) {
+        overlayCallback = std::move(callback);
+    }
 
-        std::vector<VkDeviceQueueCreateInfo> queueCreateInfos;
-        std::set<uint32_t>                   uniqueQueueFamilies = {indices.graphicsFamily.value(),
-                                                                    indices.presentFamily.value()};
+    void VulkanWrapper::setReadbackCallback(ReadbackCallback callback) {
+        readbackCallback = std::move(callback);
+    }
 
-        float queuePriority = 1.0f;
-        for (uint32_t queueFamily : uniqueQueueFamilies) {
-            VkDeviceQueueCreateInfo queueCreateInfo{};
-            queueCreateInfo.sType = VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO;
-            queueCreateInfo.queueFamilyIndex = queueFamily;
-            queueCreateInfo.queueCount = 1;
-            queueCreateInfo.pQueuePriorities = &queuePriority;
-            queueCreateInfos.push_back(queueCreateInfo);
-        }
+    void VulkanWrapper::setUploadCallback(RecordCallback callback) {
+        uploadCallback = std::move(callback);
+    }
 
-        VkPhysicalDeviceFeatures deviceFeatures{};
+    void VulkanWrapper::setRenderGraphCallback(RenderGraphCallback callback) {
+        renderGraphCallback = std::move(callback);
+    }
 
-        VkDeviceCreateInfo createInfo{};
-        createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
-        createInfo.queueCreateInfoCount =
-            static_cast<uint32_t>(queueCreateInfos.size());
-        createInfo.pQueueCreateInfos = queueCreateInfos.data();
-        createInfo.pEnabledFeatures = &deviceFeatures;
-        createInfo.enabledExtensionCount =
-            static_cast<uint32_t>(deviceExtensions.size());
-        createInfo.ppEnabledExtensionNames = deviceExtensions.data();
+    void VulkanWrapper::createInstance() {
+        context->createInstance();
+    }
 
-        if (validationLayers.size() > 0) {
-            createInfo.enabledLayerCount =
-                static_cast<uint32_t>(validationLayers.size());
-            createInfo.ppEnabledLayerNames = validationLayers.data();
-        } else {
-            createInfo.enabledLayerCount = 0;
+    void VulkanWrapper::createSurface() {
+        VK_CHECK_RESULT(
+            glfwCreateWindowSurface(context->getInstance(), window, nullptr, &surface));
+    }
+
+    void VulkanWrapper::createDevice() {
+        // The first view to get here picks the device for its own surface
+        bool created = !context->hasDevice();
+        context->createDevice(surface);
+
+        physicalDevice = context->getPhysicalDevice();
+        device = context->getDevice();
+        deviceCapabilities = context->getDeviceCapabilities();
+        if (!isHeadless() && !created) {
+            context->checkPresentSupport(surface);
+            DeviceSelector::querySurface(physicalDevice, surface, deviceCapabilities);
+            if (deviceCapabilities.surfaceFormats.empty() ||
+                deviceCapabilities.presentModes.empty()) {
+                throw std::runtime_error("The shared device cannot present to this window");
+            }
         }
+    }
 
-        VK_CHECK_RESULT(
-            vkCreateDevice(physicalDevice, &createInfo, nullptr, &device));
+    void VulkanWrapper::createFrameArena() {
+        // Sprite instances dominate per-frame traffic; 1 MiB holds ~32k of
+        // them before the arena has to chain a second chunk. Slices can also
+        // be copied from, e.g. into device-local buffers.
+        frameArena = std::make_unique<FrameArena>(
+            context->getAllocator(), maxFramesInFlight, 1024 * 1024,
+            VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT |
+                VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT |
+                VK_BUFFER_USAGE_TRANSFER_SRC_BIT);
+    }
 
-        vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
-        vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+    void VulkanWrapper::createDescriptorAllocator() {
+        descriptorAllocator = std::make_unique<DescriptorAllocator>(
+            device, context->getDescriptorLayouts(), maxFramesInFlight);
     }
 
     void VulkanWrapper::createSwapChain() {
-        VkSurfaceCapabilitiesKHR capabilities;
-        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface,
-                                                  &capabilities);
-
-        uint32_t formatCount;
-        vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount,
-                                             nullptr);
-        std::vector<VkSurfaceFormatKHR> formats(formatCount);
-        vkGetPhysicalDeviceSurfaceFormatsKHR(physicalDevice, surface, &formatCount,
-                                             formats.data());
-
-        uint32_t presentModeCount;
-        vkGetPhysicalDeviceSurfacePresentModesKHR(physicalDevice, surface,
-                                                  &presentModeCount, nullptr);
-        std::vector<VkPresentModeKHR> presentModes(presentModeCount);
-        vkGetPhysicalDeviceSurfacePresentModesKHR(
-            physicalDevice, surface, &presentModeCount, presentModes.data());
-
-        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(formats);
-        VkPresentModeKHR   presentMode = chooseSwapPresentMode(presentModes);
+        const VkSurfaceCapabilitiesKHR &capabilities = deviceCapabilities.surfaceCapabilities;
+
+        VkSurfaceFormatKHR surfaceFormat = chooseSwapSurfaceFormat(deviceCapabilities.surfaceFormats);
         VkExtent2D         extent = chooseSwapExtent(capabilities);
+        presentMode = chooseSwapPresentMode(deviceCapabilities.presentModes);
 
-        uint32_t imageCount = capabilities.minImageCount + 1;
+        uint32_t imageCount = std::max(swapchainImageCount, capabilities.minImageCount);
         if (capabilities.maxImageCount > 0 &&
             imageCount > capabilities.maxImageCount) {
             imageCount = capabilities.maxImageCount;
@@ -260,9 +532,15 @@ namespace Retoccilus::Core {
         createInfo.imageExtent = extent;
         createInfo.imageArrayLayers = 1;
         createInfo.imageUsage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-        QueueFamilyIndices indices = findQueueFamilies(physicalDevice);
-        uint32_t           queueFamilyIndices[] = {indices.graphicsFamily.value(),
+        // Blit destination for the upscale, whether or not dynamic
+        // resolution is on yet, so that turning it on needs no new swapchain
+        upscaleSupported = (capabilities.supportedUsageFlags & VK_IMAGE_USAGE_TRANSFER_DST_BIT) &&
+                           supportsUpscale(surfaceFormat.format);
+        if (upscaleSupported)
+            createInfo.imageUsage |= VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+
+        const QueueFamilyIndices &indices = deviceCapabilities.queueFamilies;
+        uint32_t                  queueFamilyIndices[] = {indices.graphicsFamily.value(),
                                                    indices.presentFamily.value()};
 
         if (indices.graphicsFamily != indices.presentFamily) {
@@ -279,10 +557,14 @@ namespace Retoccilus::Core {
         createInfo.compositeAlpha = VK_COMPOSITE_ALPHA_OPAQUE_BIT_KHR;
         createInfo.presentMode = presentMode;
         createInfo.clipped = VK_TRUE;
-        createInfo.oldSwapchain = VK_NULL_HANDLE;
+        // Handing over the old swapchain lets the presentation engine reuse
+        // its resources and keep showing it until the new one presents.
+        createInfo.oldSwapchain = swapChain;
 
+        VkSwapchainKHR newSwapChain;
         VK_CHECK_RESULT(
-            vkCreateSwapchainKHR(device, &createInfo, nullptr, &swapChain));
+            vkCreateSwapchainKHR(device, &createInfo, nullptr, &newSwapChain));
+        swapChain = newSwapChain;
 
         vkGetSwapchainImagesKHR(device, swapChain, &imageCount, nullptr);
         swapChainImages.resize(imageCount);
@@ -291,6 +573,76 @@ namespace Retoccilus::Core {
 
         swapChainImageFormat = surfaceFormat.format;
         swapChainExtent = extent;
+        renderExtent = extent;
+    }
+
+    void VulkanWrapper::recreateSwapChain() {
+        // A minimised window has a zero-sized framebuffer; wait until it is
+        // visible again.
+        int width = 0, height = 0;
+        glfwGetFramebufferSize(window, &width, &height);
+        while (width == 0 || height == 0) {
+            glfwWaitEvents();
+            glfwGetFramebufferSize(window, &width, &height);
+        }
+        windowWidth = static_cast<uint32_t>(width);
+        windowHeight = static_cast<uint32_t>(height);
+        framebufferResized = false;
+        presentModeChanged = false;
+
+        // Formats and present modes of a surface are fixed, but its current
+        // extent is not; only the capabilities in the snapshot are refreshed.
+        vkGetPhysicalDeviceSurfaceCapabilitiesKHR(physicalDevice, surface,
+                                                  &deviceCapabilities.surfaceCapabilities);
+
+        // No device idle: frames still in flight keep rendering to and
+        // presenting from the old swapchain while the new one is built.
+        VkSwapchainKHR oldSwapChain = swapChain;
+        createSwapChain();
+        retireSwapChain(oldSwapChain);
+
+        createImageViews();
+        createFramebuffers();
+        createPresentSemaphores();
+    }
+
+    void VulkanWrapper::retireSwapChain(VkSwapchainKHR oldSwapChain) {
+        RetiredSwapChain retired;
+        retired.swapChain = oldSwapChain;
+        retired.imageViews = std::move(swapChainImageViews);
+        retired.framebuffers = std::move(swapChainFramebuffers);
+        retired.renderFinishedSemaphores = std::move(renderFinishedSemaphores);
+        // Presents are not fenced, so also wait for one frame on the new
+        // swapchain: by then the engine has moved past the old one's last
+        // present and released its semaphores.
+        retired.retireAfterFrame = frameNumber + 1;
+        retiredSwapChains.push_back(std::move(retired));
+
+        swapChainImageViews.clear();
+        swapChainFramebuffers.clear();
+        renderFinishedSemaphores.clear();
+    }
+
+    void VulkanWrapper::destroyRetiredSwapChains(bool all) {
+        auto it = retiredSwapChains.begin();
+        while (it != retiredSwapChains.end()) {
+            if (!all && it->retireAfterFrame > completedFrames) {
+                ++it;
+                continue;
+            }
+            // A present wait may still be on it
+            waitForPresentJobs();
+
+            for (auto framebuffer : it->framebuffers)
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+            for (auto imageView : it->imageViews)
+                vkDestroyImageView(device, imageView, nullptr);
+            for (auto semaphore : it->renderFinishedSemaphores)
+                vkDestroySemaphore(device, semaphore, nullptr);
+            vkDestroySwapchainKHR(device, it->swapChain, nullptr);
+
+            it = retiredSwapChains.erase(it);
+        }
     }
 
     void VulkanWrapper::createImageViews() {
@@ -317,149 +669,446 @@ namespace Retoccilus::Core {
         }
     }
 
-    void VulkanWrapper::createSyncObjects() {
-        imageAvailableSemaphores.resize(maxFramesInFlight);
-        renderFinishedSemaphores.resize(maxFramesInFlight);
-        inFlightFences.resize(maxFramesInFlight);
+    void VulkanWrapper::createRenderPass() {
+        VkAttachmentDescription colorAttachment{};
+        colorAttachment.format = swapChainImageFormat;
+        colorAttachment.samples = VK_SAMPLE_COUNT_1_BIT;
+        colorAttachment.loadOp = VK_ATTACHMENT_LOAD_OP_CLEAR;
+        colorAttachment.storeOp = VK_ATTACHMENT_STORE_OP_STORE;
+        colorAttachment.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
+        colorAttachment.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
+        colorAttachment.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        colorAttachment.finalLayout = isHeadless()
+                                          ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL
+                                          : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+
+        VkAttachmentReference colorAttachmentRef{};
+        colorAttachmentRef.attachment = 0;
+        colorAttachmentRef.layout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;
+
+        VkSubpassDescription subpass{};
+        subpass.pipelineBindPoint = VK_PIPELINE_BIND_POINT_GRAPHICS;
+        subpass.colorAttachmentCount = 1;
+        subpass.pColorAttachments = &colorAttachmentRef;
+
+        VkSubpassDependency dependencies[2]{};
+        dependencies[0].srcSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[0].dstSubpass = 0;
+        dependencies[0].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].srcAccessMask = 0;
+        dependencies[0].dstStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[0].dstAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+
+        // Headless frames are copied out right after the pass
+        dependencies[1].srcSubpass = 0;
+        dependencies[1].dstSubpass = VK_SUBPASS_EXTERNAL;
+        dependencies[1].srcStageMask = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        dependencies[1].srcAccessMask = VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+        dependencies[1].dstStageMask = VK_PIPELINE_STAGE_TRANSFER_BIT;
+        dependencies[1].dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
+
+        VkRenderPassCreateInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_CREATE_INFO;
+        renderPassInfo.attachmentCount = 1;
+        renderPassInfo.pAttachments = &colorAttachment;
+        renderPassInfo.subpassCount = 1;
+        renderPassInfo.pSubpasses = &subpass;
+        renderPassInfo.dependencyCount = isHeadless() ? 2 : 1;
+        renderPassInfo.pDependencies = dependencies;
 
-        VkSemaphoreCreateInfo semaphoreInfo{};
-        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+        VK_CHECK_RESULT(
+            vkCreateRenderPass(device, &renderPassInfo, nullptr, &renderPass));
+    }
 
-        VkFenceCreateInfo fenceInfo{};
-        fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
-        fenceInfo.flags = VK_FENCE_CREATE_SIGNALED_BIT;
+    void VulkanWrapper::createFramebuffers() {
+        swapChainFramebuffers.resize(swapChainImageViews.size());
 
-        for (size_t i = 0; i < maxFramesInFlight; i++) {
-            VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                                              &imageAvailableSemaphores[i]));
-            VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
-                                              &renderFinishedSemaphores[i]));
-            VK_CHECK_RESULT(
-                vkCreateFence(device, &fenceInfo, nullptr, &inFlightFences[i]));
+        for (size_t i = 0; i < swapChainImageViews.size(); i++) {
+            VkImageView attachments[] = {swapChainImageViews[i]};
+
+            VkFramebufferCreateInfo framebufferInfo{};
+            framebufferInfo.sType = VK_STRUCTURE_TYPE_FRAMEBUFFER_CREATE_INFO;
+            framebufferInfo.renderPass = renderPass;
+            framebufferInfo.attachmentCount = 1;
+            framebufferInfo.pAttachments = attachments;
+            framebufferInfo.width = swapChainExtent.width;
+            framebufferInfo.height = swapChainExtent.height;
+            framebufferInfo.layers = 1;
+
+            VK_CHECK_RESULT(vkCreateFramebuffer(device, &framebufferInfo, nullptr,
+                                                &swapChainFramebuffers[i]));
         }
     }
 
-    // Helper functions implementation
-    bool VulkanWrapper::checkValidationLayerSupport() {
-        uint32_t layerCount;
-        vkEnumerateInstanceLayerProperties(&layerCount, nullptr);
+    void VulkanWrapper::createCommandBuffers() {
+        const QueueFamilyIndices &indices = deviceCapabilities.queueFamilies;
 
-        std::vector<VkLayerProperties> availableLayers(layerCount);
-        vkEnumerateInstanceLayerProperties(&layerCount, availableLayers.data());
+        commandPools.resize(maxFramesInFlight);
+        commandBuffers.resize(maxFramesInFlight);
 
-        for (const char *layerName : validationLayers) {
-            bool layerFound = false;
+        for (size_t i = 0; i < maxFramesInFlight; i++) {
+            // Transient pools are reset wholesale once the frame's fence signals
+            VkCommandPoolCreateInfo poolInfo{};
+            poolInfo.sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+            poolInfo.flags = VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;
+            poolInfo.queueFamilyIndex = indices.graphicsFamily.value();
 
-            for (const auto &layerProperties : availableLayers) {
-                if (strcmp(layerName, layerProperties.layerName) == 0) {
-                    layerFound = true;
-                    break;
-                }
-            }
+            VK_CHECK_RESULT(
+                vkCreateCommandPool(device, &poolInfo, nullptr, &commandPools[i]));
+
+            VkCommandBufferAllocateInfo allocInfo{};
+            allocInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+            allocInfo.commandPool = commandPools[i];
+            allocInfo.level = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+            allocInfo.commandBufferCount = 1;
+
+            VK_CHECK_RESULT(
+                vkAllocateCommandBuffers(device, &allocInfo, &commandBuffers[i]));
+        }
+    }
+
+    void VulkanWrapper::recordRenderPass(VkCommandBuffer cmd, uint32_t imageIndex) {
+        // A scaled scene needs a target of its own, which the graph provides
+        if (renderGraphCallback || isSceneScaled()) {
+            recordRenderGraph(cmd, imageIndex);
+            return;
+        }
 
-            if (!layerFound) {
-                return false;
+        VkClearValue clearColor = {{{0.0f, 0.0f, 0.0f, 1.0f}}};
+
+        VkRenderPassBeginInfo renderPassInfo{};
+        renderPassInfo.sType = VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+        renderPassInfo.renderPass = renderPass;
+        renderPassInfo.framebuffer = swapChainFramebuffers[imageIndex];
+        renderPassInfo.renderArea.offset = {0, 0};
+        renderPassInfo.renderArea.extent = swapChainExtent;
+        renderPassInfo.clearValueCount = 1;
+        renderPassInfo.pClearValues = &clearColor;
+
+        if (!parallelRecordCallback) {
+            vkCmdBeginRenderPass(cmd, &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);
+            if (recordCallback) {
+                recordCallback(cmd);
+            }
+            if (overlayCallback) {
+                overlayCallback(cmd);
             }
+            vkCmdEndRenderPass(cmd);
+            return;
         }
 
-        return true;
+        // A subpass holds either inline commands or secondary buffers, so
+        // the plain callback gets a secondary buffer of its own.
+        vkCmdBeginRenderPass(cmd, &renderPassInfo,
+                             VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+        parallelRecorder->beginRenderPass(cmd, renderPass, renderPassInfo.framebuffer);
+        if (recordCallback) {
+            parallelRecorder->record(
+                1, [this](VkCommandBuffer secondary, uint32_t) { recordCallback(secondary); });
+        }
+        parallelRecordCallback(*parallelRecorder);
+        if (overlayCallback) {
+            parallelRecorder->record(
+                1, [this](VkCommandBuffer secondary, uint32_t) { overlayCallback(secondary); });
+        }
+        vkCmdEndRenderPass(cmd);
     }
 
-    std::vector<const char *> VulkanWrapper::getRequiredExtensions() {
-        uint32_t     glfwExtensionCount = 0;
-        const char **glfwExtensions;
-        glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+    void VulkanWrapper::recordRenderGraph(VkCommandBuffer cmd, uint32_t imageIndex) {
+        renderGraph->beginFrame(static_cast<uint32_t>(currentFrame));
+
+        // The acquire semaphore is waited at colour output, and headless
+        // frames are copied out after the graph
+        RenderGraph::ImportedImage backbuffer;
+        backbuffer.image = swapChainImages[imageIndex];
+        backbuffer.view = swapChainImageViews[imageIndex];
+        backbuffer.format = swapChainImageFormat;
+        backbuffer.extent = swapChainExtent;
+        backbuffer.initialStage = VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT;
+        if (isHeadless()) {
+            backbuffer.finalLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+            backbuffer.finalStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+            backbuffer.finalAccess = VK_ACCESS_TRANSFER_READ_BIT;
+        } else {
+            backbuffer.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+        }
 
-        std::vector<const char *> extensions(glfwExtensions,
-                                             glfwExtensions + glfwExtensionCount);
+        RenderGraph::Resource target = renderGraph->importImage("Backbuffer", backbuffer);
+        if (renderGraphCallback) {
+            renderGraphCallback(*renderGraph, target);
+        } else {
+            declarePasses(*renderGraph, target);
+        }
+        renderGraph->compile();
+        renderGraph->execute(cmd);
+    }
 
-        if (validationLayers.size() > 0) {
-            extensions.push_back(VK_EXT_DEBUG_UTILS_EXTENSION_NAME);
+    void VulkanWrapper::declarePasses(RenderGraph &graph, RenderGraph::Resource target) {
+        declareScenePass(graph, target);
+    }
+
+    RenderGraph::PassBuilder VulkanWrapper::declareScenePass(RenderGraph          &graph,
+                                                             RenderGraph::Resource target) {
+        // The scaled scene goes into an image of the target's size, so the
+        // graph keeps reusing the same image whatever the scale; only the
+        // render area shrinks
+        RenderGraph::Resource sceneTarget = target;
+        VkExtent2D            targetExtent = graph.getExtent(target);
+        VkExtent2D            sceneExtent = targetExtent;
+        if (isSceneScaled()) {
+            RenderGraph::ImageDesc desc;
+            desc.width = targetExtent.width;
+            desc.height = targetExtent.height;
+            desc.format = graph.getFormat(target);
+            sceneTarget = graph.createImage("ScaledScene", desc);
+            sceneExtent.width = std::min(renderExtent.width, targetExtent.width);
+            sceneExtent.height = std::min(renderExtent.height, targetExtent.height);
         }
 
-        return extensions;
+        auto pass = graph.addPass("Scene", [this](const RenderGraph::PassContext &context) {
+            if (!parallelRecordCallback) {
+                if (recordCallback)
+                    recordCallback(context.cmd);
+                return;
+            }
+
+            parallelRecorder->beginRenderPass(context.cmd, context.renderPass,
+                                              context.framebuffer);
+            if (recordCallback) {
+                parallelRecorder->record(
+                    1, [this](VkCommandBuffer secondary, uint32_t) { recordCallback(secondary); });
+            }
+            parallelRecordCallback(*parallelRecorder);
+        });
+
+        pass.writeColor(sceneTarget);
+        if (parallelRecordCallback)
+            pass.secondaryCommandBuffers();
+
+        if (isSceneScaled()) {
+            pass.renderArea(sceneExtent);
+            declareUpscalePass(graph, sceneTarget, sceneExtent, target);
+        }
+        if (overlayCallback) {
+            auto overlay = graph.addPass("Overlay", [this](const RenderGraph::PassContext &context) {
+                overlayCallback(context.cmd);
+            });
+            overlay.writeColor(target, AttachmentLoad::Load);
+        }
+        return pass;
     }
 
-    bool VulkanWrapper::isDeviceSuitable(VkPhysicalDevice device) {
-        QueueFamilyIndices indices = findQueueFamilies(device);
+    void VulkanWrapper::declareUpscalePass(RenderGraph &graph, RenderGraph::Resource source,
+                                           VkExtent2D sourceExtent, RenderGraph::Resource target) {
+        VkImageBlit blit{};
+        blit.srcSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.srcOffsets[1] = {static_cast<int32_t>(sourceExtent.width),
+                              static_cast<int32_t>(sourceExtent.height), 1};
+        VkExtent2D targetExtent = graph.getExtent(target);
+        blit.dstSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        blit.dstOffsets[1] = {static_cast<int32_t>(targetExtent.width),
+                              static_cast<int32_t>(targetExtent.height), 1};
+
+        auto pass = graph.addPass("Upscale", [source, target, blit](
+                                                 const RenderGraph::PassContext &context) {
+            vkCmdBlitImage(context.cmd, context.getImage(source),
+                           VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, context.getImage(target),
+                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR);
+        });
+        pass.read(source, RenderGraphAccess::TransferRead)
+            .write(target, RenderGraphAccess::TransferWrite);
+    }
 
-        bool extensionsSupported = checkDeviceExtensionSupport(device);
+    bool VulkanWrapper::supportsUpscale(VkFormat format) const {
+        VkFormatProperties properties;
+        vkGetPhysicalDeviceFormatProperties(physicalDevice, format, &properties);
+        VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT |
+                                        VK_FORMAT_FEATURE_BLIT_DST_BIT |
+                                        VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+        return (properties.optimalTilingFeatures & required) == required;
+    }
 
-        bool swapChainAdequate = false;
-        if (extensionsSupported) {
-            VkSurfaceCapabilitiesKHR capabilities;
-            vkGetPhysicalDeviceSurfaceCapabilitiesKHR(device, surface,
-                                                      &capabilities);
+    void VulkanWrapper::createOffscreenTargets() {
+        // R8G8B8A8_UNORM is a required colour attachment format, so this
+        // works on any conformant driver including software ICDs (lavapipe).
+        swapChainImageFormat = VK_FORMAT_R8G8B8A8_UNORM;
+        swapChainExtent = {windowWidth, windowHeight};
+        renderExtent = swapChainExtent;
+        upscaleSupported = supportsUpscale(swapChainImageFormat);
 
-            uint32_t formatCount;
-            vkGetPhysicalDeviceSurfaceFormatsKHR(device, surface, &formatCount,
-                                                 nullptr);
+        VkDeviceSize readbackSize =
+            static_cast<VkDeviceSize>(windowWidth) * windowHeight * 4;
 
-            uint32_t presentModeCount;
-            vkGetPhysicalDeviceSurfacePresentModesKHR(device, surface,
-                                                      &presentModeCount, nullptr);
+        swapChainImages.resize(maxFramesInFlight);
+        offscreenTargets.resize(maxFramesInFlight);
 
-            swapChainAdequate = formatCount > 0 && presentModeCount > 0;
+        for (size_t i = 0; i < maxFramesInFlight; i++) {
+            OffscreenTarget &target = offscreenTargets[i];
+
+            VkImageCreateInfo imageInfo{};
+            imageInfo.sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+            imageInfo.imageType = VK_IMAGE_TYPE_2D;
+            imageInfo.format = swapChainImageFormat;
+            imageInfo.extent = {windowWidth, windowHeight, 1};
+            imageInfo.mipLevels = 1;
+            imageInfo.arrayLayers = 1;
+            imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
+            imageInfo.tiling = VK_IMAGE_TILING_OPTIMAL;
+            imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT |
+                              VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT;
+            imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+            imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+
+            // Render targets get their own VkDeviceMemory; they are large and
+            // live as long as the device.
+            GpuAllocationCreateInfo imageAllocInfo{};
+            imageAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
+            imageAllocInfo.dedicated = true;
+
+            context->getAllocator().createImage(imageInfo, imageAllocInfo, swapChainImages[i],
+                                   target.imageMemory);
+
+            VkBufferCreateInfo bufferInfo{};
+            bufferInfo.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+            bufferInfo.size = readbackSize;
+            bufferInfo.usage = VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+            bufferInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
+
+            // The host reads every byte back, so cached memory is much faster
+            GpuAllocationCreateInfo readbackAllocInfo{};
+            readbackAllocInfo.requiredFlags = VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT |
+                                              VK_MEMORY_PROPERTY_HOST_COHERENT_BIT;
+            readbackAllocInfo.preferredFlags = VK_MEMORY_PROPERTY_HOST_CACHED_BIT;
+            readbackAllocInfo.mapped = true;
+
+            context->getAllocator().createBuffer(bufferInfo, readbackAllocInfo, target.readbackBuffer,
+                                    target.readbackMemory);
         }
-
-        return indices.isComplete() && extensionsSupported && swapChainAdequate;
     }
 
-    VulkanWrapper::QueueFamilyIndices
-    VulkanWrapper::findQueueFamilies(VkPhysicalDevice device) {
-        QueueFamilyIndices indices;
+    bool VulkanWrapper::recordOffscreenFrame(RenderContext::FrameSubmission &submission) {
+        // The slot's previous frame is done once its submission completes,
+        // which is also when its readback becomes visible to the host.
+        waitForFrameSlot();
+        deliverReadback(currentFrame);
+
+        VkCommandBuffer  cmd = commandBuffers[currentFrame];
+        OffscreenTarget &target = offscreenTargets[currentFrame];
+        beginCommandBuffer(cmd);
+
+        {
+            FrameProfiler::CpuScope cpuScope(*profiler, "Record");
+            FrameProfiler::GpuScope gpuScope(*profiler, cmd, "Frame");
+            context->getUploader().beginFrame(cmd);
+            if (uploadCallback)
+                uploadCallback(cmd);
+            recordRenderPass(cmd, static_cast<uint32_t>(currentFrame));
+        }
 
-        uint32_t queueFamilyCount = 0;
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-                                                 nullptr);
+        VkBufferImageCopy region{};
+        region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        region.imageSubresource.mipLevel = 0;
+        region.imageSubresource.baseArrayLayer = 0;
+        region.imageSubresource.layerCount = 1;
+        region.imageExtent = {swapChainExtent.width, swapChainExtent.height, 1};
+
+        vkCmdCopyImageToBuffer(cmd, swapChainImages[currentFrame],
+                               VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                               target.readbackBuffer, 1, &region);
+
+        VkBufferMemoryBarrier hostBarrier{};
+        hostBarrier.sType = VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER;
+        hostBarrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        hostBarrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+        hostBarrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        hostBarrier.buffer = target.readbackBuffer;
+        hostBarrier.offset = 0;
+        hostBarrier.size = VK_WHOLE_SIZE;
+
+        vkCmdPipelineBarrier(cmd, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_HOST_BIT, 0, 0, nullptr, 1,
+                             &hostBarrier, 0, nullptr);
+
+        VK_CHECK_RESULT(vkEndCommandBuffer(cmd));
+
+        submission.cmd = cmd;
+        return true;
+    }
 
-        std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
-        vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount,
-                                                 queueFamilies.data());
+    void VulkanWrapper::deliverReadback(size_t frame) {
+        if (frame >= offscreenTargets.size())
+            return;
 
-        int i = 0;
-        for (const auto &queueFamily : queueFamilies) {
-            if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT) {
-                indices.graphicsFamily = i;
-            }
+        OffscreenTarget &target = offscreenTargets[frame];
+        if (!target.pendingFrame.has_value())
+            return;
 
-            VkBool32 presentSupport = false;
-            vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface,
-                                                 &presentSupport);
+        if (readbackCallback) {
+            ReadbackFrame readback{};
+            readback.frameNumber = target.pendingFrame.value();
+            readback.width = swapChainExtent.width;
+            readback.height = swapChainExtent.height;
+            readback.format = swapChainImageFormat;
+            readback.pixels = static_cast<const uint8_t *>(target.readbackMemory.mapped);
+            readback.size = static_cast<size_t>(swapChainExtent.width) *
+                            swapChainExtent.height * 4;
+            readbackCallback(readback);
+        }
+        target.pendingFrame.reset();
+    }
 
-            if (presentSupport) {
-                indices.presentFamily = i;
-            }
+    void VulkanWrapper::createSyncObjects() {
+        imageAvailableSemaphores.resize(maxFramesInFlight);
+        // Frames are fenced by the context's batched submissions
+        frameSubmissions.assign(maxFramesInFlight, 0);
+        frameSerials.assign(maxFramesInFlight, 0);
+        framePacingIds.assign(maxFramesInFlight, 0);
 
-            if (indices.isComplete()) {
-                break;
-            }
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-            i++;
+        for (size_t i = 0; i < maxFramesInFlight; i++) {
+            VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                              &imageAvailableSemaphores[i]));
         }
 
-        return indices;
+        createPresentSemaphores();
     }
 
-    bool VulkanWrapper::checkDeviceExtensionSupport(VkPhysicalDevice device) {
-        uint32_t extensionCount;
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                             nullptr);
+    void VulkanWrapper::createPresentSemaphores() {
+        if (isHeadless())
+            return;
 
-        std::vector<VkExtensionProperties> availableExtensions(extensionCount);
-        vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount,
-                                             availableExtensions.data());
+        renderFinishedSemaphores.resize(swapChainImages.size());
+        imageSubmissions.assign(swapChainImages.size(), 0);
 
-        std::set<std::string> requiredExtensions(deviceExtensions.begin(),
-                                                 deviceExtensions.end());
+        VkSemaphoreCreateInfo semaphoreInfo{};
+        semaphoreInfo.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
 
-        for (const auto &extension : availableExtensions) {
-            requiredExtensions.erase(extension.extensionName);
+        for (size_t i = 0; i < swapChainImages.size(); i++) {
+            VK_CHECK_RESULT(vkCreateSemaphore(device, &semaphoreInfo, nullptr,
+                                              &renderFinishedSemaphores[i]));
         }
+    }
+
+    void VulkanWrapper::createProfiler() {
+        profiler = std::make_unique<FrameProfiler>(device, deviceCapabilities, maxFramesInFlight);
+        profiler->setEnabled(profilingEnabled || dynamicResolution);
+    }
+
+    void VulkanWrapper::createParallelRecorder() {
+        parallelRecorder = std::make_unique<ParallelRecorder>(
+            device, deviceCapabilities.queueFamilies.graphicsFamily.value(),
+            maxFramesInFlight, context->getJobSystem(), recordingThreads + 1);
+    }
 
-        return requiredExtensions.empty();
+    void VulkanWrapper::createRenderGraph() {
+        renderGraph = std::make_unique<RenderGraph>(device, context->getAllocator(),
+                                                    maxFramesInFlight, profiler.get());
     }
 
+    // Helper functions implementation
     VkSurfaceFormatKHR VulkanWrapper::chooseSwapSurfaceFormat(
         const std::vector<VkSurfaceFormatKHR> &availableFormats) {
         for (const auto &availableFormat : availableFormats) {
@@ -474,9 +1123,10 @@ namespace Retoccilus::Core {
 
     VkPresentModeKHR VulkanWrapper::chooseSwapPresentMode(
         const std::vector<VkPresentModeKHR> &availablePresentModes) {
-        for (const auto &availablePresentMode : availablePresentModes) {
-            if (availablePresentMode == VK_PRESENT_MODE_MAILBOX_KHR) {
-                return availablePresentMode;
+        for (VkPresentModeKHR mode : FramePacer::getPresentModes(presentPolicy)) {
+            if (std::find(availablePresentModes.begin(), availablePresentModes.end(), mode) !=
+                availablePresentModes.end()) {
+                return mode;
             }
         }
 
@@ -488,7 +1138,12 @@ namespace Retoccilus::Core {
         if (capabilities.currentExtent.width != UINT32_MAX) {
             return capabilities.currentExtent;
         } else {
-            VkExtent2D actualExtent = {windowWidth, windowHeight};
+            // Framebuffer pixels, not screen coordinates; they differ on
+            // high-DPI displays
+            int width = 0, height = 0;
+            glfwGetFramebufferSize(window, &width, &height);
+            VkExtent2D actualExtent = {static_cast<uint32_t>(width),
+                                       static_cast<uint32_t>(height)};
 
             actualExtent.width = std::max(
                 capabilities.minImageExtent.width,
@@ -501,49 +1156,83 @@ namespace Retoccilus::Core {
         }
     }
 
-    VKAPI_ATTR VkBool32 VKAPI_CALL VulkanWrapper::debugCallback(
-        VkDebugUtilsMessageSeverityFlagBitsEXT      messageSeverity,
-        VkDebugUtilsMessageTypeFlagsEXT             messageType,
-        const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
-        void                                       *pUserData) {
-
-        std::cerr << "Validation layer: " << pCallbackData->pMessage << std::endl;
-        return VK_FALSE;
-    }
-
     void VulkanWrapper::cleanup() {
+        // cleanup() also runs from the destructor, so every handle is reset
+        // after it is destroyed.
+        if (device != VK_NULL_HANDLE) {
+            vkDeviceWaitIdle(device);
+            waitForPresentJobs();
+        }
+
         // 清理同步对象
-        for (size_t i = 0; i < maxFramesInFlight; i++) {
-            if (inFlightFences[i] != VK_NULL_HANDLE)
-                vkDestroyFence(device, inFlightFences[i], nullptr);
-            if (imageAvailableSemaphores[i] != VK_NULL_HANDLE)
-                vkDestroySemaphore(device, imageAvailableSemaphores[i], nullptr);
-            if (renderFinishedSemaphores[i] != VK_NULL_HANDLE)
-                vkDestroySemaphore(device, renderFinishedSemaphores[i], nullptr);
+        for (auto semaphore : imageAvailableSemaphores) {
+            if (semaphore != VK_NULL_HANDLE)
+                vkDestroySemaphore(device, semaphore, nullptr);
+        }
+        for (auto semaphore : renderFinishedSemaphores) {
+            if (semaphore != VK_NULL_HANDLE)
+                vkDestroySemaphore(device, semaphore, nullptr);
         }
+        imageAvailableSemaphores.clear();
+        renderFinishedSemaphores.clear();
+
+        for (auto pool : commandPools) {
+            if (pool != VK_NULL_HANDLE)
+                vkDestroyCommandPool(device, pool, nullptr);
+        }
+        commandPools.clear();
+        commandBuffers.clear();
+        parallelRecorder.reset();
+        renderGraph.reset();
 
         // 清理交换链相关资源
+        for (auto framebuffer : swapChainFramebuffers) {
+            if (framebuffer != VK_NULL_HANDLE)
+                vkDestroyFramebuffer(device, framebuffer, nullptr);
+        }
+        swapChainFramebuffers.clear();
+
+        if (renderPass != VK_NULL_HANDLE) {
+            vkDestroyRenderPass(device, renderPass, nullptr);
+            renderPass = VK_NULL_HANDLE;
+        }
+
         for (auto imageView : swapChainImageViews) {
             if (imageView != VK_NULL_HANDLE)
                 vkDestroyImageView(device, imageView, nullptr);
         }
+        swapChainImageViews.clear();
+
+        // Offscreen images are owned by us rather than by a swapchain
+        for (size_t i = 0; i < offscreenTargets.size(); i++) {
+            OffscreenTarget &target = offscreenTargets[i];
+            context->getAllocator().destroyBuffer(target.readbackBuffer, target.readbackMemory);
+            context->getAllocator().destroyImage(swapChainImages[i], target.imageMemory);
+        }
+        offscreenTargets.clear();
+        swapChainImages.clear();
+
+        profiler.reset();
+        frameArena.reset();
+        descriptorAllocator.reset();
 
-        if (swapChain != VK_NULL_HANDLE)
-            vkDestroySwapchainKHR(device, swapChain, nullptr);
         if (device != VK_NULL_HANDLE)
-            vkDestroyDevice(device, nullptr);
-        if (surface != VK_NULL_HANDLE)
-            vkDestroySurfaceKHR(instance, surface, nullptr);
-        
-        if (debugMessenger != VK_NULL_HANDLE) {
-            auto func = (PFN_vkDestroyDebugUtilsMessengerEXT)vkGetInstanceProcAddr(
-                instance, "vkDestroyDebugUtilsMessengerEXT");
-            if (func) {
-                func(instance, debugMessenger, nullptr);
-            }
+            destroyRetiredSwapChains(true);
+        if (swapChain != VK_NULL_HANDLE) {
+            vkDestroySwapchainKHR(device, swapChain, nullptr);
+            swapChain = VK_NULL_HANDLE;
+        }
+        if (surface != VK_NULL_HANDLE) {
+            vkDestroySurfaceKHR(context->getInstance(), surface, nullptr);
+            surface = VK_NULL_HANDLE;
         }
+        frameSubmissions.clear();
+        imageSubmissions.clear();
+        device = VK_NULL_HANDLE;
 
-        if (instance != VK_NULL_HANDLE)
-            vkDestroyInstance(instance, nullptr);
+        // A shared context lives on for the other views
+        if (ownsContext)
+            context->cleanup();
     }
 } // namespace Retoccilus::Core
+
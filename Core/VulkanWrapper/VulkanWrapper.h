@@ -1,13 +1,37 @@
 #ifndef VULKAN_WRAPPER_H
 #define VULKAN_WRAPPER_H
 
+#include "DescriptorAllocator.h"
+#include "DeviceSelector.h"
+#include "FramePacer.h"
+#include "FrameProfiler.h"
+#include "GpuMemoryAllocator.h"
+#include "JobSystem.h"
+#include "ParallelRecorder.h"
+#include "PipelineCache.h"
+#include "RenderContext.h"
+#include "RenderGraph.h"
+#include "ResolutionScaler.h"
+#include "StagingUploader.h"
+
 #define GLFW_INCLUDE_VULKAN
 #include <GLFW/glfw3.h>
+#include <functional>
+#include <memory>
 #include <optional>
+#include <stdexcept>
 #include <string>
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#define VK_CHECK_RESULT(f)                                                    \
+    {                                                                         \
+        VkResult res = (f);                                                   \
+        if (res != VK_SUCCESS) {                                              \
+            throw std::runtime_error("Vulkan error: " + std::to_string(res)); \
+        }                                                                     \
+    }
+
 namespace Retoccilus::Core {
 
     class AbstractRenderLayer {
@@ -16,92 +40,346 @@ namespace Retoccilus::Core {
         virtual void initialize() = 0;
         virtual void render() = 0;
         virtual void cleanup() = 0;
+
+        // Declares the layer's passes for the frame being recorded, drawing
+        // into `target`. Layers that do not override it add nothing.
+        virtual void declarePasses(RenderGraph & /*graph*/, RenderGraph::Resource /*target*/) {}
     };
 
+    // One view of a RenderContext: a window with its surface and swapchain,
+    // or offscreen targets when headless, plus everything per frame
+    // (command buffers, frame arena, profiler, render graph). Several views
+    // can share one context, and drawFrames() submits all their frames at
+    // once. A view constructed without a context creates its own.
     class VulkanWrapper : public AbstractRenderLayer {
       public:
-        struct QueueFamilyIndices {
-            std::optional<uint32_t> graphicsFamily;
-            std::optional<uint32_t> presentFamily;
-
-            bool isComplete() {
-                return graphicsFamily.has_value() && presentFamily.has_value();
-            }
+        // A finished headless frame. `pixels` is only valid during the callback.
+        struct ReadbackFrame {
+            uint64_t       frameNumber;
+            uint32_t       width;
+            uint32_t       height;
+            VkFormat       format;
+            const uint8_t *pixels;
+            size_t         size;
         };
 
-        VulkanWrapper(uint32_t width, uint32_t height, const std::string &title);
+        using InitStageTiming = Core::InitStageTiming;
+
+        using RecordCallback = std::function<void(VkCommandBuffer)>;
+        using ParallelRecordCallback = std::function<void(ParallelRecorder &)>;
+        using ReadbackCallback = std::function<void(const ReadbackFrame &)>;
+        using RenderGraphCallback =
+            std::function<void(RenderGraph &graph, RenderGraph::Resource backbuffer)>;
+
+        VulkanWrapper(uint32_t width, uint32_t height, const std::string &title,
+                      WindowMode mode = WindowMode::Windowed);
+        // Attaches to `context`, whose device is created by the first view
+        // to initialise. A headless context only takes headless views.
+        VulkanWrapper(std::shared_ptr<RenderContext> context, uint32_t width, uint32_t height,
+                      const std::string &title, WindowMode mode = WindowMode::Windowed);
         ~VulkanWrapper();
 
         void initialize() override { initVulkan(); }
         void render() override { mainLoop(); }
         void cleanup() override;
+        // Adds the pass that runs the record callbacks, clearing `target`
+        // first, and the overlay pass after it. The target must have the
+        // swapchain's format, so pipelines built against getRenderPass()
+        // stay compatible. Under dynamic resolution the scene pass draws
+        // into a transient image instead, which an upscale pass blits into
+        // `target`.
+        void declarePasses(RenderGraph &graph, RenderGraph::Resource target) override;
+        // declarePasses() returning the pass, for callers whose record
+        // callbacks read resources of earlier passes
+        RenderGraph::PassBuilder declareScenePass(RenderGraph &graph, RenderGraph::Resource target);
 
         void initVulkan();
         void mainLoop();
+        // Records and submits one frame. While the GPU executes it, the CPU
+        // is free to record the next one, up to maxFramesInFlight ahead.
+        void drawFrame();
+        // Draws one frame of every view, all attached to the same context,
+        // with a single queue submission and a single present
+        static void drawFrames(const std::vector<VulkanWrapper *> &views);
+        // Where a windowed view's frame starts: sleeps for the frame pacing
+        // delay, if any, and marks the input sample for latency stats. Call
+        // it right before polling input; frames that start without it
+        // start when they are drawn. Does nothing inside a frame or when
+        // headless.
+        void waitForFrameStart();
+        // waitForFrameStart() for views drawn together by drawFrames(),
+        // with a single pacing sleep for all of them
+        static void waitForFrameStart(const std::vector<VulkanWrapper *> &views);
 
-        // Configuration methods
+        // Configuration methods. The device-wide ones forward to the context
+        // and only take effect before its device is created.
         void setDeviceExtensions(const std::vector<const char *> &extensions);
         void setValidationLayers(const std::vector<const char *> &layers);
+        // Features a device must support to be picked; enabled on creation
+        void setRequiredDeviceFeatures(const VkPhysicalDeviceFeatures &features);
+        // Device index or name substring; RETOCCILUS_DEVICE overrides it
+        void setPreferredDevice(const std::string &selector);
         void setSwapchainImageCount(uint32_t count);
         void setMaxFramesInFlight(uint32_t count);
+        void setHeadlessFrameLimit(uint32_t frames);
+        void setStagingBufferSize(VkDeviceSize size);
+        // Where the pipeline cache persists between runs; empty disables it
+        void setPipelineCachePath(const std::string &path);
+        // Initial state of the profiler; getProfiler().setEnabled() toggles
+        // it at runtime
+        void setProfilingEnabled(bool enabled);
+        // Job system workers that record in parallel, besides the render
+        // thread; no more than the context's job system has. Defaults to
+        // one less than the hardware threads. Takes effect at the next
+        // frame when set after init.
+        void setRecordingThreads(uint32_t count);
+        // Picks the swapchain's present mode; recreates the swapchain at the
+        // next frame when it already exists
+        void setPresentPolicy(PresentPolicy policy);
+        // Trades throughput for input latency: one frame in flight, and
+        // the frame pacer delays the start of each frame by as long as
+        // frames would otherwise block waiting for the GPU or the display.
+        // PresentPolicy::PowerSaving paces frames the same way.
+        void setLatencyMode(bool enabled);
+        // Dynamic resolution: the scene is drawn at a resolution scaled
+        // each frame to keep the GPU frame time under the settings' budget,
+        // then upscaled into the swapchain image with a linear blit, and the
+        // overlay callback draws on top at full resolution. The scene's
+        // target has the swapchain's size and is kept across frames; a
+        // lower scale only draws into less of it. GPU times come from the
+        // profiler, which stays enabled meanwhile. Without blit support for
+        // the swapchain's format, the scene stays at full resolution.
+        void setDynamicResolution(bool enabled);
+        void setDynamicResolutionSettings(const ResolutionScaler::Settings &settings);
+
+        // Called inside the render pass of every frame
+        void setRecordCallback(RecordCallback callback);
+        // Called inside the render pass of every frame, after the record
+        // callback, to record the pass body as secondary command buffers on
+        // several threads. While set, the record callback is recorded into a
+        // secondary buffer as well.
+        void setParallelRecordCallback(ParallelRecordCallback callback);
+        // Called after the scene of every frame, inside a render pass at
+        // the swapchain's resolution, e.g. for UI that should stay sharp
+        // under dynamic resolution
+        void setOverlayCallback(RecordCallback callback);
+        // Called once per finished headless frame, after its fence signalled
+        void setReadbackCallback(ReadbackCallback callback);
+        // Called on every frame's command buffer ahead of its passes, once
+        // the uploads that landed were acquired, to copy into resources
+        // that earlier frames may still be reading, e.g. atlas pages
+        void setUploadCallback(RecordCallback callback);
+        // Builds each frame as a render graph instead of the single render
+        // pass. The callback declares the passes that end up in
+        // `backbuffer`, usually starting with declarePasses() into it or
+        // into an intermediate image that later passes post-process.
+        void setRenderGraphCallback(RenderGraphCallback callback);
+
+        // Accessors for layers that build their own GPU resources
+        bool             isHeadless() const { return windowMode == WindowMode::Headless; }
+        VkDevice         getDevice() const { return device; }
+        VkPhysicalDevice getPhysicalDevice() const { return physicalDevice; }
+        RenderContext   &getContext() { return *context; }
+        // Snapshot of the picked device, queried once during init, with the
+        // surface fields of this view's window
+        const DeviceCapabilities &getDeviceCapabilities() const { return deviceCapabilities; }
+        VkRenderPass     getRenderPass() const { return renderPass; }
+        VkExtent2D       getSwapChainExtent() const { return swapChainExtent; }
+        // Of the frame being recorded: the area of the scene's target the
+        // record callbacks draw into, from its origin. The swapchain extent
+        // unless dynamic resolution scaled it down.
+        VkExtent2D       getRenderExtent() const { return renderExtent; }
+        float            getResolutionScale() const { return resolutionScaler.getScale(); }
+        bool             isDynamicResolution() const { return dynamicResolution; }
+        uint32_t         getCurrentFrame() const { return static_cast<uint32_t>(currentFrame); }
+        uint32_t         getMaxFramesInFlight() const { return maxFramesInFlight; }
+        PresentPolicy    getPresentPolicy() const { return presentPolicy; }
+        // Of the current swapchain
+        VkPresentModeKHR getPresentMode() const { return presentMode; }
+        bool             isLatencyMode() const { return latencyMode; }
+        LatencyStats     getLatencyStats() const { return pacer.getStats(); }
+
+        // Device memory. The arena and the descriptor allocator are rewound
+        // for the current frame slot as soon as that slot's fence has
+        // signalled, before recording starts.
+        GpuMemoryAllocator    &getAllocator() { return context->getAllocator(); }
+        FrameArena            &getFrameArena() { return *frameArena; }
+        DescriptorAllocator   &getDescriptorAllocator() { return *descriptorAllocator; }
+        DescriptorLayoutCache &getDescriptorLayouts() { return context->getDescriptorLayouts(); }
+        StagingUploader       &getUploader() { return context->getUploader(); }
+        PipelineCache         &getPipelineCache() { return context->getPipelineCache(); }
+        FrameProfiler         &getProfiler() { return *profiler; }
+        RenderGraph           &getRenderGraph() { return *renderGraph; }
+
+        const std::vector<InitStageTiming> &getInitTimings() const { return initTimings; }
+
+        // True for required extensions and for optional ones the device has
+        bool isDeviceExtensionEnabled(const char *name) const {
+            return context->isDeviceExtensionEnabled(name);
+        }
+        // Bindless texture arrays, see DeviceCapabilities::descriptorIndexing
+        bool hasDescriptorIndexing() const { return deviceCapabilities.descriptorIndexing; }
 
       private:
         void createInstance();
-        void setupDebugMessenger();
         void createSurface();
-        void pickPhysicalDevice();
-        void createLogicalDevice();
+        void createDevice();
+        void createFrameArena();
+        void createDescriptorAllocator();
         void createSwapChain();
+        void recreateSwapChain();
+        void retireSwapChain(VkSwapchainKHR oldSwapChain);
+        void destroyRetiredSwapChains(bool all);
         void createImageViews();
+        void createRenderPass();
+        void createFramebuffers();
+        void createCommandBuffers();
         void createSyncObjects();
+        void createProfiler();
+        void createParallelRecorder();
+        void createRenderGraph();
+        void createPresentSemaphores();
+        void recordRenderPass(VkCommandBuffer cmd, uint32_t imageIndex);
+        void recordRenderGraph(VkCommandBuffer cmd, uint32_t imageIndex);
+        // Dynamic resolution
+        bool isSceneScaled() const { return dynamicResolution && upscaleSupported; }
+        void updateRenderExtent();
+        void declareUpscalePass(RenderGraph &graph, RenderGraph::Resource source,
+                                VkExtent2D sourceExtent, RenderGraph::Resource target);
+        bool supportsUpscale(VkFormat format) const;
+        void beginCommandBuffer(VkCommandBuffer cmd);
+        // Wait for the frame slot, then record the frame. Return false when
+        // there is nothing to submit this time.
+        bool recordWindowFrame(RenderContext::FrameSubmission &submission);
+        bool recordOffscreenFrame(RenderContext::FrameSubmission &submission);
+        void finishFrame(RenderContext::SubmissionId submission, VkResult presentResult);
+        void waitForFrameSlot();
+        // Frame pacing
+        void reportCompletedFrames();
+        void waitForPresentJobs();
+
+        // Headless
+        void createOffscreenTargets();
+        void deliverReadback(size_t frame);
 
         // Helper functions
-        bool                      checkValidationLayerSupport();
-        std::vector<const char *> getRequiredExtensions();
-        bool                      isDeviceSuitable(VkPhysicalDevice device);
-        QueueFamilyIndices        findQueueFamilies(VkPhysicalDevice device);
-        bool                      checkDeviceExtensionSupport(VkPhysicalDevice device);
         VkSurfaceFormatKHR        chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR> &availableFormats);
         VkPresentModeKHR          chooseSwapPresentMode(const std::vector<VkPresentModeKHR> &availablePresentModes);
         VkExtent2D                chooseSwapExtent(const VkSurfaceCapabilitiesKHR &capabilities);
 
         // Window related
-        GLFWwindow *window;
+        GLFWwindow *window = nullptr;
         uint32_t    windowWidth;
         uint32_t    windowHeight;
+        WindowMode  windowMode;
+
+        // Shared device; the handles below are copied from it on init
+        std::shared_ptr<RenderContext> context;
+        // Cleaned up with the view when the view created it
+        bool ownsContext = false;
 
         // Vulkan objects
-        VkInstance               instance;
-        VkDebugUtilsMessengerEXT debugMessenger;
-        VkSurfaceKHR             surface;
+        VkSurfaceKHR             surface = VK_NULL_HANDLE;
         VkPhysicalDevice         physicalDevice = VK_NULL_HANDLE;
-        VkDevice                 device;
-        VkQueue                  graphicsQueue;
-        VkQueue                  presentQueue;
-        VkSwapchainKHR           swapChain;
+        DeviceCapabilities       deviceCapabilities;
+        VkDevice                 device = VK_NULL_HANDLE;
+        VkSwapchainKHR           swapChain = VK_NULL_HANDLE;
         std::vector<VkImage>     swapChainImages;
         VkFormat                 swapChainImageFormat;
         VkExtent2D               swapChainExtent;
         std::vector<VkImageView> swapChainImageViews;
 
-        // Synchronization
-        std::vector<VkSemaphore> imageAvailableSemaphores;
-        std::vector<VkSemaphore> renderFinishedSemaphores;
-        std::vector<VkFence>     inFlightFences;
-        size_t                   currentFrame = 0;
+        // Render pass
+        VkRenderPass               renderPass = VK_NULL_HANDLE;
+        std::vector<VkFramebuffer> swapChainFramebuffers;
+
+        std::unique_ptr<FrameArena>          frameArena;
+        std::unique_ptr<DescriptorAllocator> descriptorAllocator;
+        std::unique_ptr<FrameProfiler>       profiler;
+
+        // Offscreen targets and readback, one per frame in flight (headless)
+        struct OffscreenTarget {
+            GpuAllocation           imageMemory;
+            VkBuffer                readbackBuffer = VK_NULL_HANDLE;
+            GpuAllocation           readbackMemory;
+            std::optional<uint64_t> pendingFrame;
+        };
+        std::vector<OffscreenTarget> offscreenTargets;
+        uint32_t                     headlessFrameLimit = 1;
+        ReadbackCallback             readbackCallback;
+
+        // Commands, one pool per frame in flight
+        std::vector<VkCommandPool>        commandPools;
+        std::vector<VkCommandBuffer>      commandBuffers;
+        RecordCallback                    recordCallback;
+        ParallelRecordCallback            parallelRecordCallback;
+        RecordCallback                    overlayCallback;
+        RecordCallback                    uploadCallback;
+        std::unique_ptr<ParallelRecorder> parallelRecorder;
+        std::unique_ptr<RenderGraph>      renderGraph;
+        RenderGraphCallback               renderGraphCallback;
+        uint64_t                          frameNumber = 0;
+
+        // Synchronization. renderFinishedSemaphores is per swapchain image:
+        // a present does not signal anything we could wait on before reuse.
+        // Frame slots and swapchain images are guarded by the context
+        // submission that last used them (0 if none).
+        std::vector<VkSemaphore>                 imageAvailableSemaphores;
+        std::vector<VkSemaphore>                 renderFinishedSemaphores;
+        std::vector<RenderContext::SubmissionId> frameSubmissions;
+        std::vector<RenderContext::SubmissionId> imageSubmissions;
+        size_t                                   currentFrame = 0;
+        uint32_t                                 acquiredImage = 0;
 
         // Configuration
-        std::vector<const char *> deviceExtensions;
-        std::vector<const char *> validationLayers;
-        uint32_t                  swapchainImageCount = 2;
-        uint32_t                  maxFramesInFlight = 2;
-
-        // Debug
-        static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(
-            VkDebugUtilsMessageSeverityFlagBitsEXT      messageSeverity,
-            VkDebugUtilsMessageTypeFlagsEXT             messageType,
-            const VkDebugUtilsMessengerCallbackDataEXT *pCallbackData,
-            void                                       *pUserData);
+        uint32_t      swapchainImageCount = 2;
+        uint32_t      maxFramesInFlight = 2;
+        bool          profilingEnabled = false;
+        uint32_t      recordingThreads;
+        PresentPolicy presentPolicy = PresentPolicy::LowLatency;
+        bool          latencyMode = false;
+
+        std::vector<InitStageTiming> initTimings;
+
+        // Window resizing. The callback only records that a resize happened;
+        // however many events arrive between two frames, the swapchain is
+        // recreated once, at the start of the next frame.
+        static void framebufferResizeCallback(GLFWwindow *window, int width, int height);
+        bool        framebufferResized = false;
+
+        // Swapchains replaced by a resize, with their views, framebuffers and
+        // present semaphores. They are destroyed once the frames that used
+        // them have completed, instead of waiting for the device to go idle.
+        struct RetiredSwapChain {
+            VkSwapchainKHR             swapChain;
+            std::vector<VkImageView>   imageViews;
+            std::vector<VkFramebuffer> framebuffers;
+            std::vector<VkSemaphore>   renderFinishedSemaphores;
+            uint64_t                   retireAfterFrame;
+        };
+        std::vector<RetiredSwapChain> retiredSwapChains;
+        // Number of submitted frames each slot's submission covers, and how
+        // many frames are known to have completed
+        std::vector<uint64_t> frameSerials;
+        uint64_t              completedFrames = 0;
+
+        // Frame pacing. Without VK_KHR_present_wait, a frame counts as
+        // presented when its slot's submission is seen complete; its pacer
+        // id is kept per slot until then (0 once reported). With it, a
+        // background job waits for one present at a time.
+        FramePacer            pacer;
+        uint64_t              pacingId = 0; // of the frame being submitted
+        std::vector<uint64_t> framePacingIds;
+        JobCounter            presentWaitJobs;
+        VkPresentModeKHR      presentMode = VK_PRESENT_MODE_FIFO_KHR;
+        bool                  presentModeChanged = false;
+
+        // Dynamic resolution. upscaleSupported is for the swapchain's
+        // format and usage.
+        ResolutionScaler resolutionScaler;
+        VkExtent2D       renderExtent{};
+        bool             dynamicResolution = false;
+        bool             upscaleSupported = false;
     };
 
 } // namespace Retoccilus::Core